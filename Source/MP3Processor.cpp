@@ -67,6 +67,11 @@ bool MP3Processor::init(const int sampleRate, const int maxSamplesPerBlock) {
     // Constant bitrate with no bit reservoir, to cut down on latency.
     lame_set_VBR((lame_global_flags *)lame_enc_handler, vbr_off);
     lame_set_disable_reservoir((lame_global_flags *)lame_enc_handler, 1);
+    // The frames are decoded straight away, not written to a file, so skip
+    // the LAME tag, ReplayGain and stats bookkeeping.
+    lame_set_fish_session((lame_global_flags *)lame_enc_handler, FISH_SESSION_STREAM);
+    // One block of memory for the encoder's state, per instance.
+    lame_set_fish_arena((lame_global_flags *)lame_enc_handler, 1);
     if (lame_init_params((lame_global_flags *)lame_enc_handler) != 0) {
         lame_close((lame_global_flags *)lame_enc_handler);
         std::cout << "Bad params\n";
@@ -128,17 +133,31 @@ void MP3Processor::addNextInput(float *left_input, float* right_input, const int
         std::cout << "Not initialized\n";
     }
 
-    int enc_result = lame_encode_buffer_ieee_float(
-                (lame_global_flags *)lame_enc_handler,
-                left_input,
-                right_input,
-                num_block_samples,
-                mp3Buffer.data(),
-                mp3Buffer.size());
-    
-    if (enc_result < 0) {
-        std::cout << "Encoding error: " << enc_result << "\n";
-        return;
+    // Write the block straight into LAME's frame window, a frame's worth at
+    // a time, instead of having lame_encode_buffer_ieee_float copy it twice.
+    int enc_result = 0;
+    for (int done = 0; done < num_block_samples;) {
+        float *window_l, *window_r;
+        const int room = lame_encode_acquire_ieee_float(
+                    (lame_global_flags *)lame_enc_handler, &window_l, &window_r);
+        if (room < 0) {
+            std::cout << "Encoding error: " << room << "\n";
+            return;
+        }
+        const int n = std::min(room, num_block_samples - done);
+        std::memcpy(window_l, left_input + done, n * sizeof(float));
+        std::memcpy(window_r, right_input + done, n * sizeof(float));
+        const int bytes = lame_encode_commit_ieee_float(
+                    (lame_global_flags *)lame_enc_handler,
+                    n,
+                    mp3Buffer.data() + enc_result,
+                    mp3Buffer.size() - enc_result);
+        if (bytes < 0) {
+            std::cout << "Encoding error: " << bytes << "\n";
+            return;
+        }
+        enc_result += bytes;
+        done += n;
     }
     
     int dec_result = hip_decode((hip_global_flags *)lame_dec_handler,
@@ -184,22 +203,9 @@ int MP3Processor::samples_in_output_queue()
     return outputBufferL->num_items();
 }
 
-void MP3Processor::changeBitrate(float fish)
+void MP3Processor::changeBitrate(float fish, int lowpass)
 {
-    // Values pulled from the the freq_map table in lame, lame.c line 214
-    int lowpass;
-    if (fish < 0.25) {
-        lowpass = 10000;
-    } else if (fish < 0.5) {
-        lowpass = 7000;
-    } else if (fish < 0.75) {
-        lowpass = 3900;
-    } else {
-        lowpass = 2000;
-    }
-    // Lowpass is currently unimplemented, because it didn't do anything.
-    // TODO: figure out how to change LAME lowpass on the fly.
-    
-    
+    // LAME folds the lowpass into its polyphase filterbank, which costs
+    // nothing extra, and fades it in over a few granules.
     lame_change_bitrate_midstream((lame_global_flags *)lame_enc_handler, lowpass, fish);
 }
@@ -36,7 +36,7 @@ public:
     void deInit();
     void addNextInput(float *left_input, float* right_input, const int num_block_samples);
     bool hasReadyOutput();
-    void changeBitrate(float fish);
+    void changeBitrate(float fish, int lowpass);
     bool copy_output(float* left, float* right, const int num_block_samples);
     int samples_in_output_queue();
     bool initialFlush();
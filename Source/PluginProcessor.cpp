@@ -151,6 +151,11 @@ void FishAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
     FilterCalc::calcCoeffsLPF(coeffs, 5000, 0.5, fs);
     filter_post_L.setCoefficients(coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]);
     filter_post_R.setCoefficients(coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]);
+    
+    // The top of the fish lowpass range, so nothing changes at fish = 0.
+    FilterCalc::calcCoeffsLPF(coeffs, 4000, Q, fs);
+    filter_lo_L.setCoefficients(coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]);
+    filter_lo_R.setCoefficients(coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]);
 #endif
 
 }
@@ -192,16 +197,15 @@ void FishAudioProcessor::updateParameters()
 #if DOWNSAMPLE
     // range from 4,000 to 1,000
     float cutoff_freq = std::pow(4.0, 1.0 - fishUserParameter) * 1000.0;
+    // LAME is set up at fs but fed the downsampled signal, so in its terms
+    // every frequency is DOWNSAMPLE_RATIO times higher.
+    cutoff_freq *= DOWNSAMPLE_RATIO;
 #else
     // range from 10,000 to 1,000
     float cutoff_freq = std::pow(10.0, 1.0 - fishUserParameter) * 1000.0;
 #endif
-    float coeffs[5];
-    FilterCalc::calcCoeffsLPF(coeffs, cutoff_freq, Q, fs);
-    filter_lo_L.setCoefficients(coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]);
-    filter_lo_R.setCoefficients(coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]);
     
-    mp3Processor.changeBitrate(fishUserParameter);
+    mp3Processor.changeBitrate(fishUserParameter, (int)cutoff_freq);
     params_need_updating = false;
 }
 
@@ -233,6 +237,7 @@ void FishAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::M
     if (totalNumInputChannels == 2) {
         channelData_l = buffer.getWritePointer(0);
         channelData_r = buffer.getWritePointer(1);
+#if DOWNSAMPLE
         for (int i = 0; i < num_block_samples; ++i) {
             channelData_l[i] = filter_lo_L.tick(channelData_l[i]);
         }
@@ -240,13 +245,16 @@ void FishAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::M
         for (int i = 0; i < num_block_samples; ++i) {
             channelData_r[i] = filter_lo_R.tick(channelData_r[i]);
         }
+#endif
         
     } else if (totalNumInputChannels == 1) {
         channelData_l = buffer.getWritePointer(0);
         channelData_r = nullptr;
+#if DOWNSAMPLE
         for (int i = 0; i < num_block_samples; ++i) {
             channelData_l[i] = filter_lo_L.tick(channelData_l[i]);
         }
+#endif
     } else {
         std::cout << "Only works in mono or stereo.\n";
         buffer.applyGain(2.0f);
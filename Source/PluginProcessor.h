@@ -104,6 +104,9 @@ private:
     std::vector<float> downsampled_r;
     
     stk::BiQuad filter_post_L, filter_post_R;
+    // Anti-aliasing ahead of the downsampler. The lowpass that moves with
+    // fish happens inside LAME.
+    stk::BiQuad filter_lo_L, filter_lo_R;
 #endif
     
     void updateParameters();
@@ -122,8 +125,6 @@ private:
     const int DEFAULT_MODE; // STEREO
     float lsamp, rsamp, prevlsamp, prevrsamp;
     
-    stk::BiQuad filter_lo_L, filter_lo_R;
-    
     float fs;
     const float Q = 0.71; // Decently flat passband, without a noticeable spike
     
@@ -0,0 +1,108 @@
+/*
+ * Entry points of the library for Fish's kernel tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* BEND: what Tests/LameKernels.cpp calls inside the library.  The library
+ * includes this too, next to its own declarations, so a signature that
+ * drifts from the one the tests call no longer builds.  FLOAT and sample_t
+ * are spelled float here, as machine.h has them.
+ *
+ * The hooks, which only the tests call, are built only with
+ * FISH_TEST_HOOKS (configure --enable-fish-test-hooks, or hooks=yes for
+ * Makefile.MSVC).  The library the plugin ships is built without them. */
+
+#ifndef FISH_TEST_HOOKS_H
+#define FISH_TEST_HOOKS_H
+
+#include "lame.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+    struct lame_internal_flags;
+
+/* the scalar kernels and tables */
+    void    quantize_lines_xrpow(unsigned int l, float istep, const float *xp, int *pi);
+    void    quantize_lines_xrpow_01(unsigned int l, float istep, const float *xr, int *ix);
+    int     choose_table_nonMMX(const int *ix, const int *const end, int *const s);
+    float   calc_xmin_core_c(const float *xr, int width, float rh1, float *rh2);
+    void    attack_hpf_core_c(const float *firbuf, const float *coef, float *hp, float *peak);
+    void    attack_ms_core_c(const float *l, const float *r, float *peak_m, float *peak_s);
+    float   trancate_threshold(float *band, int width, float allowedNoise);
+    extern const unsigned char t32l[];
+    extern const unsigned char t33l[];
+
+/* the SIMD kernels the tests call directly */
+#if defined(__x86_64__) || defined(_M_X64)
+    int     has_SSE2(void);
+    int     has_AVX2(void);
+    void    quantize_lines_xrpow_SSE2(unsigned int l, float istep, const float *xp, int *pi);
+    void    quantize_lines_xrpow_01_SSE2(unsigned int l, float istep, const float *xr, int *ix);
+    float   calc_xmin_core_SSE2(const float *xr, int width, float rh1, float *rh2);
+    void    attack_hpf_core_SSE2(const float *firbuf, const float *coef, float *hp, float *peak);
+    void    attack_ms_core_SSE2(const float *l, const float *r, float *peak_m, float *peak_s);
+    void    quantize_lines_xrpow_AVX2(unsigned int l, float istep, const float *xp, int *pi);
+    void    quantize_lines_xrpow_01_AVX2(unsigned int l, float istep, const float *xr, int *ix);
+    float   calc_xmin_core_AVX2(const float *xr, int width, float rh1, float *rh2);
+    void    attack_hpf_core_AVX2(const float *firbuf, const float *coef, float *hp, float *peak);
+    void    attack_ms_core_AVX2(const float *l, const float *r, float *peak_m, float *peak_s);
+    int     choose_table_AVX2(const int *ix, const int *const end, int *const s);
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    void    quantize_lines_xrpow_NEON(unsigned int l, float istep, const float *xp, int *pi);
+    void    quantize_lines_xrpow_01_NEON(unsigned int l, float istep, const float *xr, int *ix);
+    float   calc_xmin_core_NEON(const float *xr, int width, float rh1, float *rh2);
+    void    attack_hpf_core_NEON(const float *firbuf, const float *coef, float *hp, float *peak);
+    void    attack_ms_core_NEON(const float *l, const float *r, float *peak_m, float *peak_s);
+#endif
+
+/* these run on an encoder's own tables and kernel choice */
+    void    fft_long(struct lame_internal_flags const *const gfc, float x_real[1024],
+                     int chn, const float *const data[2]);
+    void    fft_short(struct lame_internal_flags const *const gfc, float x_real[3][256],
+                      int chn, const float *const data[2]);
+
+/* the hooks, FISH_TEST_HOOKS only */
+    struct lame_internal_flags *lame_get_internal_flags(lame_global_flags * gfp);
+    void    mdct_sub48_spectrum(struct lame_internal_flags *gfc, const float *w0,
+                                const float *w1, int block_type, float xr[2][2][576]);
+    float   calc_noise_lines(struct lame_internal_flags const *gfc, const float *xr,
+                             const int *ix, int big_values, int count1, int startline, int l,
+                             float step);
+    void    best_huffman_divide_lines(struct lame_internal_flags const *gfc, const int *ix,
+                                      int block_type, int counted[10], int divided[10]);
+    int     format_bitstream_lines(struct lame_internal_flags *gfc, const int *block_type,
+                                   const int *scalefac, const int *ix, int nframes,
+                                   unsigned char *buffer, int size);
+    void    psymodel_energy_lines(struct lame_internal_flags const *gfc, int which,
+                                  const float *fftenergy, float *eb, float *max, float *avg);
+    void    psymodel_p2s_lines(struct lame_internal_flags const *gfc, int which, const float *eb,
+                               const float *thr, float *enn, float *thm);
+    void    psymodel_pe_lines(struct lame_internal_flags const *gfc, const float *en,
+                              const float *thm, float masking_lower, int n, float *lg);
+    float   psymodel_loudness_lines(struct lame_internal_flags const *gfc, const float *energy);
+    int     psymodel_spread_lines(struct lame_internal_flags const *gfc, int which,
+                                  const float *eb, const unsigned char *mask_idx, float *ecb);
+    void    psymodel_mask_add_index_lines(struct lame_internal_flags const *gfc,
+                                          const float *ratio, int n, int *index, int *reached);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* FISH_TEST_HOOKS_H */
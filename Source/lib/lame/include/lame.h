@@ -148,6 +148,70 @@ typedef lame_global_flags *lame_t;
 
 void lame_change_bitrate_midstream(lame_global_flags*, int, float); // BEND
 
+/* BEND: retune the polyphase lowpass/highpass (Hz, 0 = off) while encoding.
+ * The new response is faded in over a few granules. */
+int lame_change_filter_midstream(lame_global_flags*, int lowpass, int highpass); // BEND
+
+/* BEND: zero-copy ingest.  lame_encode_acquire_ieee_float points pcm_l and
+ * pcm_r at the encoder's own frame window and returns how many samples it
+ * takes before the next frame is complete (0: commit it as it is).  pcm_r
+ * is NULL for mono input.  Write up to that many samples there, normalized
+ * to +/- 1.0 like lame_encode_buffer_ieee_float, and hand the count to
+ * lame_encode_commit_ieee_float, which encodes at most one frame and
+ * returns the bytes written to mp3buf (0 until the frame is complete).
+ * Both return -3 when the encoder has to resample. */
+int CDECL lame_encode_acquire_ieee_float(lame_global_flags *, float **pcm_l, float **pcm_r); // BEND
+int CDECL lame_encode_commit_ieee_float(lame_global_flags *, const int nsamples,
+                                        unsigned char *mp3buf, const int mp3buf_size); // BEND
+
+/* BEND: psychoacoustic model used by the encoder, chosen per session */
+typedef enum fish_psymodel_e {
+    FISH_PSY_VBR = 0,   /* LAME's full L3psycho_anal_vbr (default) */
+    FISH_PSY_CHEAP,     /* spectral tilt thresholds, no FFTs */
+    FISH_PSY_MDCT,      /* thresholds from the MDCT spectrum, no FFTs */
+    FISH_PSY_MAX_INDICATOR  /* Don't use this! It's used for sanity checks. */
+} fish_psymodel;
+
+int CDECL lame_set_fish_psymodel(lame_global_flags *, fish_psymodel); // BEND
+fish_psymodel CDECL lame_get_fish_psymodel(const lame_global_flags *); // BEND
+
+/* BEND: CBR quantizer, chosen per session */
+typedef enum fish_quantizer_e {
+    FISH_QUANT_ITERATIVE = 0,   /* LAME's outer_loop noise shaping search (default) */
+    FISH_QUANT_DIRECT,          /* gain predicted from the bit target, bounded refinement */
+    FISH_QUANT_VBR_NEW,         /* vbr-new scalefactor search under the CBR caps */
+    FISH_QUANT_MAX_INDICATOR    /* Don't use this! It's used for sanity checks. */
+} fish_quantizer;
+
+int CDECL lame_set_fish_quantizer(lame_global_flags *, fish_quantizer); // BEND
+fish_quantizer CDECL lame_get_fish_quantizer(const lame_global_flags *); // BEND
+
+/* BEND: what the encoder keeps the books for, chosen per session */
+typedef enum fish_session_e {
+    FISH_SESSION_FILE = 0,      /* an MP3 file: LAME tag, ID3 tags, ReplayGain,
+                                   music CRC and the bitrate histograms (default) */
+    FISH_SESSION_STREAM,        /* frames decoded in memory: none of those */
+    FISH_SESSION_MAX_INDICATOR  /* Don't use this! It's used for sanity checks. */
+} fish_session;
+
+int CDECL lame_set_fish_session(lame_global_flags *, fish_session); // BEND
+fish_session CDECL lame_get_fish_session(const lame_global_flags *); // BEND
+
+/* BEND: have lame_init_params move the encoder's state into one block of
+ * memory, laid out with what every frame reads first.  Buffers allocated
+ * later, like the resampler's, stay on the heap.  default = 0 (disabled) */
+int CDECL lame_set_fish_arena(lame_global_flags *, int); // BEND
+int CDECL lame_get_fish_arena(const lame_global_flags *); // BEND
+
+/* BEND: bytes of encoder state the session holds, arena or heap, or -1.
+ * Meant for after lame_init_params. */
+int CDECL lame_get_fish_session_bytes(const lame_global_flags *); // BEND
+
+/* BEND: a LAME configured with --enable-fish-minimal has no id3tag_*,
+ * lame_get_lametag_frame or lame_get_id3v1_tag/lame_get_id3v2_tag, and
+ * lame_set_bWriteVbrTag, lame_set_findReplayGain and lame_set_analysis
+ * refuse 1.  It only decodes Layer III. */
+
 
 /***********************************************************************
  *
@@ -138,7 +138,8 @@ putheader_bits(lame_internal_flags * gfc)
 #ifdef DEBUG
     hogege += cfg->sideinfo_len * 8;
 #endif
-    memcpy(&bs->buf[bs->buf_byte_idx], esv->header[esv->w_ptr].buf, cfg->sideinfo_len);
+    assert(bs->acc_bits == 0);
+    memcpy(&bs->buf[bs->buf_byte_idx + 1], esv->header[esv->w_ptr].buf, cfg->sideinfo_len);
     bs->buf_byte_idx += cfg->sideinfo_len;
     bs->totbit += cfg->sideinfo_len * 8;
     esv->w_ptr = (esv->w_ptr + 1) & (MAX_HEADER_BUF - 1);
@@ -147,71 +148,79 @@ putheader_bits(lame_internal_flags * gfc)
 
 
 
-/*write j bits into the bit stream */
+/* BEND: the bits go into a 64 bit accumulator, and on to buf 32 at a
+ * time.  Only a put that runs into the next frame header is split, so
+ * that the header can go in at its byte; the whole bytes still in the
+ * accumulator are flushed into buf at the end of every frame. */
+
+/*write j bits into the accumulator */
 inline static void
-putbits2(lame_internal_flags * gfc, int val, int j)
+putbits_acc(Bit_stream_struc * bs, unsigned int val, int j)
 {
-    EncStateVar_t const *const esv = &gfc->sv_enc;
-    Bit_stream_struc *bs;
-    bs = &gfc->bs;
-
     assert(j < MAX_LENGTH - 2);
+    assert(bs->acc_bits < 32);
+
+    bs->acc = (bs->acc << j) | (val & ((1u << j) - 1u));
+    bs->acc_bits += j;
+    bs->totbit += j;
+    if (bs->acc_bits >= 32) {
+        uint32_t const w = (uint32_t) (bs->acc >> (bs->acc_bits - 32));
+        unsigned char *const p = &bs->buf[bs->buf_byte_idx + 1];
+        assert(bs->buf_byte_idx + 4 < BUFFER_SIZE);
+        p[0] = (unsigned char) (w >> 24);
+        p[1] = (unsigned char) (w >> 16);
+        p[2] = (unsigned char) (w >> 8);
+        p[3] = (unsigned char) w;
+        bs->buf_byte_idx += 4;
+        bs->acc_bits -= 32;
+    }
+}
 
-    while (j > 0) {
-        int     k;
-        if (bs->buf_bit_idx == 0) {
-            bs->buf_bit_idx = 8;
-            bs->buf_byte_idx++;
-            assert(bs->buf_byte_idx < BUFFER_SIZE);
-            assert(esv->header[esv->w_ptr].write_timing >= bs->totbit);
-            if (esv->header[esv->w_ptr].write_timing == bs->totbit) {
-                putheader_bits(gfc);
-            }
-            bs->buf[bs->buf_byte_idx] = 0;
-        }
+/*move the whole bytes of the accumulator into buf */
+static void
+putbits_flush(Bit_stream_struc * bs)
+{
+    while (bs->acc_bits >= 8) {
+        bs->acc_bits -= 8;
+        bs->buf[++bs->buf_byte_idx] = (unsigned char) (bs->acc >> bs->acc_bits);
+        assert(bs->buf_byte_idx < BUFFER_SIZE);
+    }
+}
 
-        k = Min(j, bs->buf_bit_idx);
-        j -= k;
+/*write j bits with the frame header due in them */
+static void
+putbits_header(lame_internal_flags * gfc, int val, int j)
+{
+    EncStateVar_t const *const esv = &gfc->sv_enc;
+    Bit_stream_struc *const bs = &gfc->bs;
+    int const k = esv->header[esv->w_ptr].write_timing - bs->totbit;
 
-        bs->buf_bit_idx -= k;
+    assert(0 <= k && k < j);
+    putbits_acc(bs, (unsigned int) val >> (j - k), k);
+    putbits_flush(bs);
+    putheader_bits(gfc);
+    putbits_acc(bs, val, j - k);
+}
 
-        assert(j < MAX_LENGTH); /* 32 too large on 32 bit machines */
-        assert(bs->buf_bit_idx < MAX_LENGTH);
+/*write j bits into the bit stream */
+inline static void
+putbits2(lame_internal_flags * gfc, int val, int j)
+{
+    EncStateVar_t const *const esv = &gfc->sv_enc;
+    Bit_stream_struc *const bs = &gfc->bs;
 
-        bs->buf[bs->buf_byte_idx] |= ((val >> j) << bs->buf_bit_idx);
-        bs->totbit += k;
-    }
+    assert(esv->header[esv->w_ptr].write_timing >= bs->totbit);
+    if (bs->totbit + j > esv->header[esv->w_ptr].write_timing)
+        putbits_header(gfc, val, j);
+    else
+        putbits_acc(bs, val, j);
 }
 
 /*write j bits into the bit stream, ignoring frame headers */
 inline static void
 putbits_noheaders(lame_internal_flags * gfc, int val, int j)
 {
-    Bit_stream_struc *bs;
-    bs = &gfc->bs;
-
-    assert(j < MAX_LENGTH - 2);
-
-    while (j > 0) {
-        int     k;
-        if (bs->buf_bit_idx == 0) {
-            bs->buf_bit_idx = 8;
-            bs->buf_byte_idx++;
-            assert(bs->buf_byte_idx < BUFFER_SIZE);
-            bs->buf[bs->buf_byte_idx] = 0;
-        }
-
-        k = Min(j, bs->buf_bit_idx);
-        j -= k;
-
-        bs->buf_bit_idx -= k;
-
-        assert(j < MAX_LENGTH); /* 32 too large on 32 bit machines */
-        assert(bs->buf_bit_idx < MAX_LENGTH);
-
-        bs->buf[bs->buf_byte_idx] |= ((val >> j) << bs->buf_bit_idx);
-        bs->totbit += k;
-    }
+    putbits_acc(&gfc->bs, val, j);
 }
 
 
@@ -875,6 +884,7 @@ flush_bitstream(lame_internal_flags * gfc)
     if ((flushbits = compute_flushbits(gfc, &nbytes)) < 0)
         return;
     drain_into_ancillary(gfc, flushbits);
+    putbits_flush(&gfc->bs); /* BEND */
 
     /* check that the 100% of the last frame has been written to bitstream */
     assert(esv->header[last_ptr].write_timing + getframebits(gfc)
@@ -901,6 +911,7 @@ add_dummy_byte(lame_internal_flags * gfc, unsigned char val, unsigned int n)
         for (i = 0; i < MAX_HEADER_BUF; ++i)
             esv->header[i].write_timing += 8;
     }
+    putbits_flush(&gfc->bs); /* BEND */
 }
 
 
@@ -932,6 +943,7 @@ format_bitstream(lame_internal_flags * gfc)
     bits += writeMainData(gfc);
     drain_into_ancillary(gfc, l3_side->resvDrain_post);
     bits += l3_side->resvDrain_post;
+    putbits_flush(&gfc->bs); /* BEND */
 
     l3_side->main_data_begin += (bitsPerFrame - bits) / 8;
 
@@ -987,6 +999,7 @@ format_bitstream(lame_internal_flags * gfc)
 }
 
 
+#ifndef FISH_MINIMAL
 static int
 do_gain_analysis(lame_internal_flags * gfc, unsigned char* buffer, int minimum)
 {
@@ -1054,6 +1067,7 @@ do_gain_analysis(lame_internal_flags * gfc, unsigned char* buffer, int minimum)
 #endif
     return minimum;
 }
+#endif
 
 static int
 do_copy_buffer(lame_internal_flags * gfc, unsigned char *buffer, int size)
@@ -1066,7 +1080,6 @@ do_copy_buffer(lame_internal_flags * gfc, unsigned char *buffer, int size)
         return -1;      /* buffer is too small */
     memcpy(buffer, bs->buf, minimum);
     bs->buf_byte_idx = -1;
-    bs->buf_bit_idx = 0;
     return minimum;
 }
 
@@ -1082,7 +1095,8 @@ int
 copy_buffer(lame_internal_flags * gfc, unsigned char *buffer, int size, int mp3data)
 {
     int const minimum = do_copy_buffer(gfc, buffer, size);
-    if (minimum > 0 && mp3data) {
+#ifndef FISH_MINIMAL /* BEND: no tag or ReplayGain to keep up to date */
+    if (minimum > 0 && mp3data && gfc->cfg.fish_session != FISH_SESSION_STREAM) { /* BEND */
         UpdateMusicCRC(&gfc->nMusicCRC, buffer, minimum);
 
         /** sum number of bytes belonging to the mp3 stream
@@ -1092,6 +1106,9 @@ copy_buffer(lame_internal_flags * gfc, unsigned char *buffer, int size, int mp3d
 
         return do_gain_analysis(gfc, buffer, minimum);
     }                   /* if (mp3data) */
+#else
+    (void) mp3data;
+#endif
     return minimum;
 }
 
@@ -1107,7 +1124,8 @@ init_bit_stream_w(lame_internal_flags * gfc)
     gfc->bs.buf = lame_calloc(unsigned char, BUFFER_SIZE);
     gfc->bs.buf_size = BUFFER_SIZE;
     gfc->bs.buf_byte_idx = -1;
-    gfc->bs.buf_bit_idx = 0;
+    gfc->bs.acc = 0;
+    gfc->bs.acc_bits = 0;
     gfc->bs.totbit = 0;
 }
 
@@ -353,6 +353,11 @@ lame_encode_mp3_frame(       /* Output */
 
 
 
+    /* BEND: the bands the lowpass leaves anything in, over the steps
+     * mdct_sub48 takes this frame; the psymodel skips the others too */
+    calc_bandwidth_limits(gfc);
+
+
     /****************************************
     *   Stage 1: psychoacoustic model       *
     ****************************************/
@@ -371,13 +376,23 @@ lame_encode_mp3_frame(       /* Output */
             for (ch = 0; ch < cfg->channels_out; ch++) {
                 bufp[ch] = &inbuf[ch][576 + gr * 576 - FFTOFFSET];
             }
-            ret = L3psycho_anal_vbr(gfc, bufp, gr,
-                                    masking_LR, masking_MS,
-                                    pe[gr], pe_MS[gr], tot_ener[gr], blocktype);
+            if (cfg->fish_psymodel == FISH_PSY_CHEAP) { // BEND
+                ret = L3psycho_anal_fish(gfc, bufp, gr,
+                                         masking_LR, masking_MS,
+                                         pe[gr], pe_MS[gr], tot_ener[gr], blocktype);
+            }
+            else if (cfg->fish_psymodel == FISH_PSY_MDCT) { // BEND: maskings follow the MDCT
+                ret = L3psycho_anal_mdct_blocktype(gfc, bufp, gr, blocktype);
+            }
+            else {
+                ret = L3psycho_anal_vbr(gfc, bufp, gr,
+                                        masking_LR, masking_MS,
+                                        pe[gr], pe_MS[gr], tot_ener[gr], blocktype);
+            }
             if (ret != 0)
                 return -4;
 
-            if (cfg->mode == JOINT_STEREO) {
+            if (cfg->mode == JOINT_STEREO && cfg->fish_psymodel != FISH_PSY_MDCT) {
                 ms_ener_ratio[gr] = tot_ener[gr][2] + tot_ener[gr][3];
                 if (ms_ener_ratio[gr] > 0)
                     ms_ener_ratio[gr] = tot_ener[gr][3] / ms_ener_ratio[gr];
@@ -395,6 +410,9 @@ lame_encode_mp3_frame(       /* Output */
 
     /* auto-adjust of ATH, useful for low volume */
     adjust_ATH(gfc);
+    /* BEND: and calc_xmin's ATH with it */
+    if (gfc->ATH->xmin_adjust != gfc->ATH->adjust_factor)
+        calc_ath_xmin(gfc);
 
 
     /****************************************
@@ -404,6 +422,19 @@ lame_encode_mp3_frame(       /* Output */
     /* polyphase filtering / mdct */
     mdct_sub48(gfc, inbuf[0], inbuf[1]);
 
+    // BEND: the MDCT domain psymodel works on the spectrum computed above
+    if (cfg->fish_psymodel == FISH_PSY_MDCT) {
+        for (gr = 0; gr < cfg->mode_gr; gr++) {
+            (void) L3psycho_anal_mdct(gfc, gr, masking_LR, masking_MS,
+                                      pe[gr], pe_MS[gr], tot_ener[gr]);
+            if (cfg->mode == JOINT_STEREO) {
+                ms_ener_ratio[gr] = tot_ener[gr][2] + tot_ener[gr][3];
+                if (ms_ener_ratio[gr] > 0)
+                    ms_ener_ratio[gr] = tot_ener[gr][3] / ms_ener_ratio[gr];
+            }
+        }
+    }
+
 
     /****************************************
     *   Stage 3: MS/LR decision             *
@@ -461,6 +492,7 @@ lame_encode_mp3_frame(       /* Output */
     }
 
 
+#ifndef NOANALYSIS
     /* copy data for MP3 frame analyzer */
     if (cfg->analysis && gfc->pinfo != NULL) {
         for (gr = 0; gr < cfg->mode_gr; gr++) {
@@ -480,6 +512,7 @@ lame_encode_mp3_frame(       /* Output */
             }
         }
     }
+#endif
 
 
     /****************************************
@@ -547,10 +580,13 @@ lame_encode_mp3_frame(       /* Output */
     mp3count = copy_buffer(gfc, mp3buf, mp3buf_size, 1);
 
 
+#ifndef FISH_MINIMAL
     if (cfg->write_lame_tag) {
         AddVbrFrame(gfc);
     }
+#endif
 
+#ifndef NOANALYSIS
     if (cfg->analysis && gfc->pinfo != NULL) {
         int     framesize = 576 * cfg->mode_gr;
         for (ch = 0; ch < cfg->channels_out; ch++) {
@@ -565,10 +601,12 @@ lame_encode_mp3_frame(       /* Output */
 
         set_frame_pinfo(gfc, masking);
     }
+#endif
 
     ++gfc->ov_enc.frame_number;
 
-    updateStats(gfc);
+    if (cfg->fish_session != FISH_SESSION_STREAM) /* BEND */
+        updateStats(gfc);
 
     return mp3count;
 }
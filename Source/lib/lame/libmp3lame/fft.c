@@ -202,6 +202,11 @@ fft_short(lame_internal_flags const *const gfc,
     for (b = 0; b < 3; b++) {
         FLOAT  *x = &x_real[b][BLKSIZE_s / 2];
         short const k = (576 / 3) * (b + 1);
+        if (gfc->fft_window_fht) { /* BEND */
+            gfc->fft_window_fht(x_real[b], buffer[chn] + k, gfc->cd_psy->window_sf,
+                                gfc->cd_psy->fht_twiddle, BLKSIZE_s);
+            continue;
+        }
         j = BLKSIZE_s / 8 - 1;
         do {
             FLOAT   f0, f1, f2, f3, w;
@@ -252,6 +257,12 @@ fft_long(lame_internal_flags const *const gfc,
 {
     int     i;
     int     jj = BLKSIZE / 8 - 1;
+
+    if (gfc->fft_window_fht) { /* BEND */
+        gfc->fft_window_fht(x, buffer[chn], gfc->cd_psy->window,
+                            gfc->cd_psy->fht_twiddle, BLKSIZE);
+        return;
+    }
     x += BLKSIZE / 2;
 
 #define window_s gfc->cd_psy->window_s
@@ -303,6 +314,33 @@ extern void fht_3DN(FLOAT * fz, int n);
 extern void fht_SSE(FLOAT * fz, int n);
 #endif
 
+/* BEND: c1, s1, c2, s2 of every fht stage, as fht's recurrence makes them */
+static void
+init_fht_twiddle(FLOAT * tw)
+{
+    const FLOAT *tri = costab;
+    int     kx;
+
+    for (kx = 2; kx <= BLKSIZE / 8; kx <<= 2) {
+        int const len = kx + 8;
+        FLOAT   c1 = tri[0], s1 = tri[1];
+        int     i;
+        tw[0] = tw[len] = tw[2 * len] = tw[3 * len] = 0;
+        for (i = 1; i < len; i++) {
+            FLOAT   c2;
+            tw[i] = c1;
+            tw[len + i] = s1;
+            tw[2 * len + i] = 1 - (2 * s1) * s1;
+            tw[3 * len + i] = (2 * s1) * c1;
+            c2 = c1;
+            c1 = c2 * tri[0] - s1 * tri[1];
+            s1 = c2 * tri[1] + s1 * tri[0];
+        }
+        tw += 4 * len;
+        tri += 2;
+    }
+}
+
 void
 init_fft(lame_internal_flags * const gfc)
 {
@@ -318,6 +356,13 @@ init_fft(lame_internal_flags * const gfc)
     for (i = 0; i < BLKSIZE_s / 2; i++)
         gfc->cd_psy->window_s[i] = 0.5 * (1.0 - cos(2.0 * PI * (i + 0.5) / BLKSIZE_s));
 
+    /* BEND: the layout the SIMD FFTs read */
+    for (i = 0; i < BLKSIZE_s / 2; i++) {
+        gfc->cd_psy->window_sf[i] = gfc->cd_psy->window_s[i];
+        gfc->cd_psy->window_sf[BLKSIZE_s - 1 - i] = gfc->cd_psy->window_s[i];
+    }
+    init_fht_twiddle(gfc->cd_psy->fht_twiddle);
+
     gfc->fft_fht = fht;
 #ifdef HAVE_NASM
     if (gfc->CPU_features.AMD_3DNow) {
@@ -330,10 +375,22 @@ init_fft(lame_internal_flags * const gfc)
         gfc->fft_fht = fht;
     }
 #else
-#ifdef HAVE_XMMINTRIN_H
-#ifdef MIN_ARCH_SSE
-    gfc->fft_fht = fht_SSE2;
+#ifdef LAME_INTRIN_SSE
+    if (gfc->CPU_features.SSE2) {
+        gfc->fft_fht = fht_SSE2;
+    }
 #endif
 #endif
+
+    gfc->fft_window_fht = 0;
+#ifdef LAME_INTRIN_AVX
+    if (gfc->CPU_features.AVX2) {
+        gfc->fft_window_fht = fft_window_fht_AVX2;
+    }
+#endif
+#ifdef LAME_INTRIN_NEON
+    if (gfc->CPU_features.NEON) {
+        gfc->fft_window_fht = fft_window_fht_NEON;
+    }
 #endif
 }
@@ -0,0 +1,194 @@
+/*
+ * Entry points of the library for Fish's kernel tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* BEND: the hooks of fish_test_hooks.h that need nothing private to
+ * another file.  The library's headers are all included, so each of its
+ * declarations is checked against the one the tests call. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef FISH_TEST_HOOKS
+
+#include "lame.h"
+#include "machine.h"
+#include "encoder.h"
+#include "util.h"
+#include "lame_global_flags.h"
+#include "bitstream.h"
+#include "fft.h"
+#include "newmdct.h"
+#include "psymodel.h"
+#include "quantize.h"
+#include "quantize_pvt.h"
+#include "reservoir.h"
+#include "tables.h"
+#include "vector/lame_intrin.h"
+#include "fish_test_hooks.h"
+
+
+/* the encoder state behind gfp once lame_init_params has run */
+lame_internal_flags *
+lame_get_internal_flags(lame_global_flags * gfp)
+{
+    if (is_lame_global_flags_valid(gfp))
+        return gfp->internal_flags;
+    return 0;
+}
+
+/* one frame of mdct_sub48 with every granule of the given block type; the
+ * spectrum goes to xr[gr][ch] */
+void
+mdct_sub48_spectrum(lame_internal_flags * gfc, const sample_t * w0, const sample_t * w1,
+                    int block_type, FLOAT xr[2][2][576])
+{
+    int     gr, ch;
+
+    for (gr = 0; gr < 2; gr++) {
+        for (ch = 0; ch < 2; ch++) {
+            gfc->l3_side.tt[gr][ch].block_type = block_type;
+            gfc->l3_side.tt[gr][ch].mixed_block_flag = 0;
+        }
+    }
+    mdct_sub48(gfc, w0, w1);
+    for (gr = 0; gr < gfc->cfg.mode_gr; gr++) {
+        for (ch = 0; ch < gfc->cfg.channels_out; ch++)
+            memcpy(xr[gr][ch], gfc->l3_side.tt[gr][ch].xr, 576 * sizeof(FLOAT));
+    }
+}
+
+/* gfc->calc_noise_core over l pairs of lines from startline, of a granule
+ * with spectrum xr quantized to ix */
+FLOAT
+calc_noise_lines(lame_internal_flags const *gfc, const FLOAT * xr, const int *ix, int big_values,
+                 int count1, int startline, int l, FLOAT step)
+{
+    gr_info cod_info;
+
+    memcpy(cod_info.xr, xr, sizeof(cod_info.xr));
+    memcpy(cod_info.l3_enc, ix, sizeof(cod_info.l3_enc));
+    cod_info.big_values = big_values;
+    cod_info.count1 = count1;
+    return gfc->calc_noise_core(&cod_info, &startline, l, step);
+}
+
+static void
+huffman_divide_fields(gr_info const *gi, int fields[10])
+{
+    fields[0] = gi->part2_3_length;
+    fields[1] = gi->big_values;
+    fields[2] = gi->count1;
+    fields[3] = gi->count1bits;
+    fields[4] = gi->count1table_select;
+    fields[5] = gi->table_select[0];
+    fields[6] = gi->table_select[1];
+    fields[7] = gi->table_select[2];
+    fields[8] = gi->region0_count;
+    fields[9] = gi->region1_count;
+}
+
+/* noquant_count_bits and then best_huffman_divide on a granule quantized
+ * to ix.  counted[] and divided[] get part2_3_length, big_values, count1,
+ * count1bits, count1table_select, table_select[0..2], region0_count and
+ * region1_count. */
+void
+best_huffman_divide_lines(lame_internal_flags const *gfc, const int *ix, int block_type,
+                          int counted[10], int divided[10])
+{
+    gr_info gi;
+
+    assert(gfc->cfg.use_best_huffman != 2);
+    memset(&gi, 0, sizeof(gi));
+    memcpy(gi.l3_enc, ix, sizeof(gi.l3_enc));
+    gi.block_type = block_type;
+    gi.max_nonzero_coeff = 575;
+    gi.part2_3_length = noquant_count_bits(gfc, &gi, 0);
+    huffman_divide_fields(&gi, counted);
+    best_huffman_divide(gfc, &gi);
+    huffman_divide_fields(&gi, divided);
+}
+
+/* nframes frames of given granules through the reservoir, side info,
+ * Huffman coder and writer, into buffer; returns the bytes copied out.
+ * Each granule takes a block type, SFBMAX scalefactors and 576 lines, whose
+ * signs are the spectrum's; the top half of the lines is dropped until
+ * the granule fits its share of the frame.  No floating point on the way,
+ * so the tests can hash the bytes on any build. */
+int
+format_bitstream_lines(lame_internal_flags * gfc, const int *block_type, const int *scalefac,
+                       const int *ix, int nframes, unsigned char *buffer, int size)
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    EncStateVar_t *const esv = &gfc->sv_enc;
+    int     frame, gr, ch, i, n, bits, mean_bits, copied, total = 0;
+
+    for (frame = 0; frame < nframes; frame++) {
+        int     granules = cfg->mode_gr * cfg->channels_out;
+
+        /* as lame_encode_mp3_frame pads */
+        gfc->ov_enc.padding = FALSE;
+        if ((esv->slot_lag -= esv->frac_SpF) < 0) {
+            esv->slot_lag += cfg->samplerate_out;
+            gfc->ov_enc.padding = TRUE;
+        }
+
+        bits = ResvFrameBegin(gfc, &mean_bits);
+        for (gr = 0; gr < cfg->mode_gr; gr++) {
+            for (ch = 0; ch < cfg->channels_out; ch++) {
+                gr_info *const gi = &gfc->l3_side.tt[gr][ch];
+
+                memset(gi, 0, sizeof(*gi));
+                gi->block_type = *block_type++;
+                gi->global_gain = 140;
+                gi->sfbmax = gi->block_type == SHORT_TYPE ? 3 * SBPSY_s : SBPSY_l;
+                gi->sfbdivide = gi->block_type == SHORT_TYPE ? gi->sfbmax - 18 : 11;
+                memcpy(gi->scalefac, scalefac, gi->sfbmax * sizeof(int));
+                scalefac += SFBMAX;
+                for (i = 0; i < 576; i++) {
+                    gi->l3_enc[i] = abs(ix[i]);
+                    gi->xr[i] = ix[i] < 0 ? -1 : 1;
+                }
+                ix += 576;
+                (void) scale_bitcount(gfc, gi);
+
+                for (n = 576;; n = (n / 4) * 2) {
+                    gi->max_nonzero_coeff = n - 1;
+                    memset(&gi->l3_enc[n], 0, (576 - n) * sizeof(int));
+                    gi->part2_3_length = noquant_count_bits(gfc, gi, 0);
+                    if (n == 0 || gi->part2_3_length + gi->part2_length <= bits / granules)
+                        break;
+                }
+                bits -= gi->part2_3_length + gi->part2_length;
+                granules--;
+                ResvAdjust(gfc, gi);
+            }
+        }
+        ResvFrameEnd(gfc, mean_bits);
+
+        (void) format_bitstream(gfc);
+        copied = copy_buffer(gfc, buffer + total, size - total, 0);
+        if (copied < 0)
+            return copied;
+        total += copied;
+    }
+    return total;
+}
+
+#endif /* FISH_TEST_HOOKS */
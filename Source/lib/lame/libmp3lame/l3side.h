@@ -45,44 +45,53 @@ typedef struct {
 } III_psy_ratio;
 
 typedef struct {
-    FLOAT   xr[576];
-    int     l3_enc[576];
-    int     scalefac[SFBMAX];
-    FLOAT   xrpow_max;
-
+    /* BEND: the fields the quantization loops read on every step come
+     * first, then the tables per scalefactor band, then the rest of the
+     * side info.  The spectrum goes last: xr stays the same while a
+     * granule is quantized, so the loops copy only GR_INFO_STATE_SIZE,
+     * and only GR_INFO_SIDE_SIZE where l3_enc is not theirs to change. */
+    int     global_gain;
+    int     scalefac_scale;
+    int     preflag;
     int     part2_3_length;
     int     big_values;
     int     count1;
-    int     global_gain;
-    int     scalefac_compress;
+    int     count1bits;
+    int     max_nonzero_coeff;
     int     block_type;
-    int     mixed_block_flag;
+    int     sfbmax;
+    int     psymax;
+    int     psybw;       /* BEND: sfbs from here to psymax are silent */
+    FLOAT   xrpow_max;
     int     table_select[3];
-    int     subblock_gain[3 + 1];
     int     region0_count;
     int     region1_count;
-    int     preflag;
-    int     scalefac_scale;
-    int     count1table_select;
+    int     subblock_gain[3 + 1];
+
+    int     scalefac[SFBMAX];
+    int     width[SFBMAX];
+    int     window[SFBMAX];
+    char    energy_above_cutoff[SFBMAX];
 
     int     part2_length;
+    int     scalefac_compress;
+    int     mixed_block_flag;
+    int     count1table_select;
     int     sfb_lmax;
     int     sfb_smin;
     int     psy_lmax;
-    int     sfbmax;
-    int     psymax;
     int     sfbdivide;
-    int     width[SFBMAX];
-    int     window[SFBMAX];
-    int     count1bits;
     /* added for LSF */
     const int *sfb_partition_table;
     int     slen[4];
 
-    int     max_nonzero_coeff;
-    char    energy_above_cutoff[SFBMAX];
+    LAME_ALIGN(16) int l3_enc[576];
+    LAME_ALIGN(16) FLOAT xr[576];
 } gr_info;
 
+#define GR_INFO_SIDE_SIZE  offsetof(gr_info, l3_enc)
+#define GR_INFO_STATE_SIZE offsetof(gr_info, xr)
+
 typedef struct {
     gr_info tt[2][2];
     int     main_data_begin;
@@ -46,6 +46,8 @@
 #include "version.h"
 #include "VbrTag.h"
 #include "tables.h"
+#include "newmdct.h"
+#include "vector/lame_intrin.h"
 
 
 #if defined(__FreeBSD__) && !defined(__alpha__)
@@ -102,28 +104,23 @@ filter_coef(FLOAT x)
 }
 
 static void
-lame_init_params_ppflt(lame_internal_flags * gfc)
+lame_ppflt_amp_filter(lame_internal_flags const *gfc, FLOAT * lowpass1, FLOAT * lowpass2,
+                      FLOAT * highpass1, FLOAT * highpass2, FLOAT amp_filter[32])
 {
-    SessionConfig_t *const cfg = &gfc->cfg;
-    
-    /***************************************************************/
-    /* compute info needed for polyphase filter (filter type==0, default) */
-    /***************************************************************/
-
     int     band, maxband, minband;
     FLOAT   freq;
     int     lowpass_band = 32;
     int     highpass_band = -1;
 
-    if (cfg->lowpass1 > 0) {
+    if (*lowpass1 > 0) {
         minband = 999;
         for (band = 0; band <= 31; band++) {
             freq = band / 31.0;
             /* this band and above will be zeroed: */
-            if (freq >= cfg->lowpass2) {
+            if (freq >= *lowpass2) {
                 lowpass_band = Min(lowpass_band, band);
             }
-            if (cfg->lowpass1 < freq && freq < cfg->lowpass2) {
+            if (*lowpass1 < freq && freq < *lowpass2) {
                 minband = Min(minband, band);
             }
         }
@@ -131,63 +128,117 @@ lame_init_params_ppflt(lame_internal_flags * gfc)
         /* compute the *actual* transition band implemented by
          * the polyphase filter */
         if (minband == 999) {
-            cfg->lowpass1 = (lowpass_band - .75) / 31.0;
+            *lowpass1 = (lowpass_band - .75) / 31.0;
         }
         else {
-            cfg->lowpass1 = (minband - .75) / 31.0;
+            *lowpass1 = (minband - .75) / 31.0;
         }
-        cfg->lowpass2 = lowpass_band / 31.0;
+        *lowpass2 = lowpass_band / 31.0;
     }
 
     /* make sure highpass filter is within 90% of what the effective
      * highpass frequency will be */
-    if (cfg->highpass2 > 0) {
-        if (cfg->highpass2 < .9 * (.75 / 31.0)) {
-            cfg->highpass1 = 0;
-            cfg->highpass2 = 0;
+    if (*highpass2 > 0) {
+        if (*highpass2 < .9 * (.75 / 31.0)) {
+            *highpass1 = 0;
+            *highpass2 = 0;
             MSGF(gfc, "Warning: highpass filter disabled.  " "highpass frequency too small\n");
         }
     }
 
-    if (cfg->highpass2 > 0) {
+    if (*highpass2 > 0) {
         maxband = -1;
         for (band = 0; band <= 31; band++) {
             freq = band / 31.0;
             /* this band and below will be zereod */
-            if (freq <= cfg->highpass1) {
+            if (freq <= *highpass1) {
                 highpass_band = Max(highpass_band, band);
             }
-            if (cfg->highpass1 < freq && freq < cfg->highpass2) {
+            if (*highpass1 < freq && freq < *highpass2) {
                 maxband = Max(maxband, band);
             }
         }
         /* compute the *actual* transition band implemented by
          * the polyphase filter */
-        cfg->highpass1 = highpass_band / 31.0;
+        *highpass1 = highpass_band / 31.0;
         if (maxband == -1) {
-            cfg->highpass2 = (highpass_band + .75) / 31.0;
+            *highpass2 = (highpass_band + .75) / 31.0;
         }
         else {
-            cfg->highpass2 = (maxband + .75) / 31.0;
+            *highpass2 = (maxband + .75) / 31.0;
         }
     }
 
     for (band = 0; band < 32; band++) {
         FLOAT fc1, fc2;
         freq = band / 31.0f;
-        if (cfg->highpass2 > cfg->highpass1) {
-            fc1 = filter_coef((cfg->highpass2 - freq) / (cfg->highpass2 - cfg->highpass1 + 1e-20));
+        if (*highpass2 > *highpass1) {
+            fc1 = filter_coef((*highpass2 - freq) / (*highpass2 - *highpass1 + 1e-20));
         }
         else {
             fc1 = 1.0f;
         }
-        if (cfg->lowpass2 > cfg->lowpass1) {
-            fc2 = filter_coef((freq - cfg->lowpass1)  / (cfg->lowpass2 - cfg->lowpass1 + 1e-20));
+        if (*lowpass2 > *lowpass1) {
+            fc2 = filter_coef((freq - *lowpass1)  / (*lowpass2 - *lowpass1 + 1e-20));
         }
         else {
             fc2 = 1.0f;
         }
-        gfc->sv_enc.amp_filter[band] = fc1 * fc2;
+        amp_filter[band] = fc1 * fc2;
+    }
+}
+
+
+static void
+lame_init_params_ppflt(lame_internal_flags * gfc)
+{
+    SessionConfig_t *const cfg = &gfc->cfg;
+
+    /***************************************************************/
+    /* compute info needed for polyphase filter (filter type==0, default) */
+    /***************************************************************/
+
+    lame_ppflt_amp_filter(gfc, &cfg->lowpass1, &cfg->lowpass2, &cfg->highpass1, &cfg->highpass2,
+                          gfc->sv_enc.amp_filter);
+}
+
+
+static void
+lame_filter_bounds(lame_global_flags const *gfp, int samplerate_out, int lowpassfreq,
+                   int highpassfreq, FLOAT * lowpass1, FLOAT * lowpass2,
+                   FLOAT * highpass1, FLOAT * highpass2)
+{
+    /* apply user driven high pass filter */
+    if (highpassfreq > 0) {
+        *highpass1 = 2. * highpassfreq;
+
+        if (gfp->highpasswidth >= 0)
+            *highpass2 = 2. * (highpassfreq + gfp->highpasswidth);
+        else            /* 0% above on default */
+            *highpass2 = (1 + 0.00) * 2. * highpassfreq;
+
+        *highpass1 /= samplerate_out;
+        *highpass2 /= samplerate_out;
+    }
+    else {
+        *highpass1 = 0;
+        *highpass2 = 0;
+    }
+    /* apply user driven low pass filter */
+    *lowpass1 = 0;
+    *lowpass2 = 0;
+    if (lowpassfreq > 0 && lowpassfreq < (samplerate_out / 2) ) {
+        *lowpass2 = 2. * lowpassfreq;
+        if (gfp->lowpasswidth >= 0) {
+            *lowpass1 = 2. * (lowpassfreq - gfp->lowpasswidth);
+            if (*lowpass1 < 0) /* has to be >= 0 */
+                *lowpass1 = 0;
+        }
+        else {          /* 0% below on default */
+            *lowpass1 = (1 - 0.00) * 2. * lowpassfreq;
+        }
+        *lowpass1 /= samplerate_out;
+        *lowpass2 /= samplerate_out;
     }
 }
 
@@ -572,6 +623,7 @@ lame_init_params(lame_global_flags * gfp)
     cfg = &gfc->cfg;
 
     cfg->enforce_min_bitrate = gfp->VBR_hard_min;
+#ifndef NOANALYSIS
     cfg->analysis = gfp->analysis;
     if (cfg->analysis)
         gfp->write_lame_tag = 0;
@@ -579,6 +631,24 @@ lame_init_params(lame_global_flags * gfp)
     /* some file options not allowed if output is: not specified or stdout */
     if (gfc->pinfo != NULL)
         gfp->write_lame_tag = 0; /* disable Xing VBR tag */
+#else
+    cfg->analysis = 0;
+#endif
+
+    /* BEND: nothing is written to a file, so none of its bookkeeping */
+    cfg->fish_session = gfp->fish_session;
+    if (cfg->fish_session == FISH_SESSION_STREAM) {
+        gfp->write_lame_tag = 0;
+        gfp->write_id3tag_automatic = 0;
+        gfp->findReplayGain = 0;
+        gfp->decode_on_the_fly = 0;
+    }
+#ifdef FISH_MINIMAL
+    /* BEND: built without tags and ReplayGain */
+    gfp->write_lame_tag = 0;
+    gfp->write_id3tag_automatic = 0;
+    gfp->findReplayGain = 0;
+#endif
 
     /* report functions */
     gfc->report_msg = gfp->report.msgf;
@@ -598,11 +668,15 @@ lame_init_params(lame_global_flags * gfp)
     if (gfp->asm_optimizations.sse) {
         gfc->CPU_features.SSE = has_SSE();
         gfc->CPU_features.SSE2 = has_SSE2();
+        gfc->CPU_features.AVX2 = has_AVX2(); /* BEND */
     }
     else {
         gfc->CPU_features.SSE = 0;
         gfc->CPU_features.SSE2 = 0;
+        gfc->CPU_features.AVX2 = 0; /* BEND */
     }
+    gfc->CPU_features.NEON = has_NEON(); /* BEND */
+    limit_CPU_features(gfc); /* BEND */
 
 
     cfg->vbr = gfp->VBR;
@@ -868,38 +942,8 @@ lame_init_params(lame_global_flags * gfp)
     cfg->mode = gfp->mode;
 
 
-    /* apply user driven high pass filter */
-    if (cfg->highpassfreq > 0) {
-        cfg->highpass1 = 2. * cfg->highpassfreq;
-
-        if (gfp->highpasswidth >= 0)
-            cfg->highpass2 = 2. * (cfg->highpassfreq + gfp->highpasswidth);
-        else            /* 0% above on default */
-            cfg->highpass2 = (1 + 0.00) * 2. * cfg->highpassfreq;
-
-        cfg->highpass1 /= cfg->samplerate_out;
-        cfg->highpass2 /= cfg->samplerate_out;
-    }
-    else {
-        cfg->highpass1 = 0;
-        cfg->highpass2 = 0;
-    }
-    /* apply user driven low pass filter */
-    cfg->lowpass1 = 0;
-    cfg->lowpass2 = 0;
-    if (cfg->lowpassfreq > 0 && cfg->lowpassfreq < (cfg->samplerate_out / 2) ) {
-        cfg->lowpass2 = 2. * cfg->lowpassfreq;
-        if (gfp->lowpasswidth >= 0) {
-            cfg->lowpass1 = 2. * (cfg->lowpassfreq - gfp->lowpasswidth);
-            if (cfg->lowpass1 < 0) /* has to be >= 0 */
-                cfg->lowpass1 = 0;
-        }
-        else {          /* 0% below on default */
-            cfg->lowpass1 = (1 - 0.00) * 2. * cfg->lowpassfreq;
-        }
-        cfg->lowpass1 /= cfg->samplerate_out;
-        cfg->lowpass2 /= cfg->samplerate_out;
-    }
+    lame_filter_bounds(gfp, cfg->samplerate_out, cfg->lowpassfreq, cfg->highpassfreq,
+                       &cfg->lowpass1, &cfg->lowpass2, &cfg->highpass1, &cfg->highpass2);
 
 
 
@@ -1198,6 +1242,9 @@ lame_init_params(lame_global_flags * gfp)
     cfg->quant_comp = gfp->quant_comp;
     cfg->quant_comp_short = gfp->quant_comp_short;
 
+    cfg->fish_psymodel = gfp->fish_psymodel; // BEND
+    cfg->fish_quantizer = gfp->fish_quantizer; // BEND
+
     cfg->use_temporal_masking_effect = gfp->useTemporal;
     if (cfg->mode == JOINT_STEREO) {
         cfg->use_safe_joint_stereo = gfp->exp_nspsytune & 2;
@@ -1275,7 +1322,10 @@ lame_init_params(lame_global_flags * gfp)
 
     (void) lame_init_bitstream(gfp);
 
+    init_mdct(gfc);     /* BEND */
     iteration_init(gfc);
+    gfc->sv_qnt.bw_unlimited = gfp->bandwidth_unlimited; /* BEND */
+    calc_bandwidth_limits(gfc); /* BEND */
     (void) psymodel_init(gfp);
 
     cfg->buffer_constraint = get_max_frame_buffer_size_by_constraint(cfg, gfp->strict_ISO);
@@ -1287,6 +1337,7 @@ lame_init_params(lame_global_flags * gfp)
     if (cfg->decode_on_the_fly)
         cfg->findPeakSample = 1;
 
+#ifndef FISH_MINIMAL
     if (cfg->findReplayGain) {
         if (InitGainAnalysis(gfc->sv_rpg.rgdata, cfg->samplerate_out) == INIT_GAIN_ANALYSIS_ERROR) {
             /* Actually this never happens, our samplerates are the ones RG accepts!
@@ -1296,6 +1347,7 @@ lame_init_params(lame_global_flags * gfp)
             cfg->findReplayGain = 0;
         }
     }
+#endif
 
 #ifdef DECODE_ON_THE_FLY
     if (cfg->decode_on_the_fly && !gfp->decode_only) {
@@ -1311,6 +1363,8 @@ lame_init_params(lame_global_flags * gfp)
 #endif
     /* updating lame internal flags finished successful */
     gfc->lame_init_params_successful = 1;
+    if (gfp->fish_arena)
+        (void) lame_pack_session(gfp); /* BEND: moves gfc, no use of it after this */
     return 0;
 }
 
@@ -1344,7 +1398,8 @@ lame_print_config(const lame_global_flags * gfp)
     MSGF(gfc, "warning: alpha versions should be used for testing only\n");
 #endif
     if (gfc->CPU_features.MMX
-        || gfc->CPU_features.AMD_3DNow || gfc->CPU_features.SSE || gfc->CPU_features.SSE2) {
+        || gfc->CPU_features.AMD_3DNow || gfc->CPU_features.SSE || gfc->CPU_features.SSE2
+        || gfc->CPU_features.NEON) {
         char    text[256] = { 0 };
         int     fft_asm_used = 0;
 #ifdef HAVE_NASM
@@ -1355,8 +1410,8 @@ lame_print_config(const lame_global_flags * gfp)
             fft_asm_used = 2;
         }
 #else
-# if defined( HAVE_XMMINTRIN_H ) && defined( MIN_ARCH_SSE )
-        {
+# if defined( LAME_INTRIN_SSE )
+        if (gfc->CPU_features.SSE2) {
             fft_asm_used = 3;
         }
 # endif
@@ -1372,7 +1427,7 @@ lame_print_config(const lame_global_flags * gfp)
             concatSep(text, ", ", (fft_asm_used == 1) ? "3DNow! (ASM used)" : "3DNow!");
         }
         if (gfc->CPU_features.SSE) {
-#if defined(HAVE_XMMINTRIN_H)
+#if defined(LAME_INTRIN_SSE)
             concatSep(text, ", ", "SSE (ASM used)");
 #else
             concatSep(text, ", ", (fft_asm_used == 2) ? "SSE (ASM used)" : "SSE");
@@ -1381,6 +1436,20 @@ lame_print_config(const lame_global_flags * gfp)
         if (gfc->CPU_features.SSE2) {
             concatSep(text, ", ", (fft_asm_used == 3) ? "SSE2 (ASM used)" : "SSE2");
         }
+        if (gfc->CPU_features.AVX2) {
+#if defined(LAME_INTRIN_AVX)
+            concatSep(text, ", ", "AVX2 (ASM used)");
+#else
+            concatSep(text, ", ", "AVX2");
+#endif
+        }
+        if (gfc->CPU_features.NEON) {
+#if defined(LAME_INTRIN_NEON)
+            concatSep(text, ", ", "NEON (ASM used)");
+#else
+            concatSep(text, ", ", "NEON");
+#endif
+        }
         MSGF(gfc, "CPU features: %s\n", text);
     }
 
@@ -1598,8 +1667,9 @@ static void
 save_gain_values(lame_internal_flags * gfc)
 {
     SessionConfig_t const *const cfg = &gfc->cfg;
-    RpgStateVar_t const *const rsv = &gfc->sv_rpg;
     RpgResult_t *const rov = &gfc->ov_rpg;
+#ifndef FISH_MINIMAL
+    RpgStateVar_t const *const rsv = &gfc->sv_rpg;
     /* save the ReplayGain value */
     if (cfg->findReplayGain) {
         FLOAT const RadioGain = (FLOAT) GetTitleGain(rsv->rgdata);
@@ -1610,6 +1680,7 @@ save_gain_values(lame_internal_flags * gfc)
             rov->RadioGain = 0;
         }
     }
+#endif
 
     /* find the gain and scale change required for no clipping */
     if (cfg->findPeakSample) {
@@ -1631,10 +1702,10 @@ update_inbuffer_size(lame_internal_flags * gfc, const int nsamples)
     EncStateVar_t *const esv = &gfc->sv_enc;
     if (esv->in_buffer_0 == 0 || esv->in_buffer_nsamples < nsamples) {
         if (esv->in_buffer_0) {
-            free(esv->in_buffer_0);
+            lame_session_free(gfc, esv->in_buffer_0); /* BEND */
         }
         if (esv->in_buffer_1) {
-            free(esv->in_buffer_1);
+            lame_session_free(gfc, esv->in_buffer_1);
         }
         esv->in_buffer_0 = lame_calloc(sample_t, nsamples);
         esv->in_buffer_1 = lame_calloc(sample_t, nsamples);
@@ -1681,6 +1752,71 @@ calcNeeded(SessionConfig_t const * cfg)
 }
 
 
+/* BEND: the part of the encoding loop that follows n_out new samples
+ * landing in the mfbuf window: ReplayGain, the counters, and a frame once
+ * the window holds mf_needed samples.  Returns the bytes written to
+ * mp3buf, or < 0 on error. */
+static int
+lame_encode_window(lame_internal_flags * gfc, int n_out, int mf_needed,
+                   unsigned char *mp3buf, int buf_size)
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    EncStateVar_t *const esv = &gfc->sv_enc;
+    int     pcm_samples_per_frame = 576 * cfg->mode_gr;
+    int     ret = 0, ch;
+    sample_t *mfbuf[2];
+
+    mfbuf[0] = esv->mfbuf[0] + esv->mf_start;
+    mfbuf[1] = esv->mfbuf[1] + esv->mf_start;
+
+#ifndef FISH_MINIMAL
+    /* compute ReplayGain of resampled input if requested */
+    if (cfg->findReplayGain && !cfg->decode_on_the_fly)
+        if (AnalyzeSamples
+            (gfc->sv_rpg.rgdata, &mfbuf[0][esv->mf_size], &mfbuf[1][esv->mf_size], n_out,
+             cfg->channels_out) == GAIN_ANALYSIS_ERROR)
+            return -6;
+#endif
+
+    /* update mfbuf[] counters */
+    esv->mf_size += n_out;
+    assert(esv->mf_size <= MFSIZE);
+
+    /* lame_encode_flush may have set gfc->mf_sample_to_encode to 0
+     * so we have to reinitialize it here when that happened.
+     */
+    if (esv->mf_samples_to_encode < 1) {
+        esv->mf_samples_to_encode = ENCDELAY + POSTDELAY;
+    }
+    esv->mf_samples_to_encode += n_out;
+
+
+    if (esv->mf_size >= mf_needed) {
+        /* encode the frame.  */
+        /* mp3buf              = pointer to current location in buffer */
+        /* buf_size            = amount of space avalable  */
+        ret = lame_encode_mp3_frame(gfc, mfbuf[0], mfbuf[1], mp3buf, buf_size);
+
+        if (ret < 0)
+            return ret;
+
+        /* shift out old samples */
+        esv->mf_size -= pcm_samples_per_frame;
+        esv->mf_samples_to_encode -= pcm_samples_per_frame;
+        /* BEND: by moving the window, the samples only once it
+           has used up the slack */
+        esv->mf_start += pcm_samples_per_frame;
+        if (esv->mf_start >= MFSLACK) {
+            for (ch = 0; ch < cfg->channels_out; ch++)
+                memmove(esv->mfbuf[ch], esv->mfbuf[ch] + esv->mf_start,
+                        esv->mf_size * sizeof(esv->mfbuf[0][0]));
+            esv->mf_start = 0;
+        }
+    }
+    return ret;
+}
+
+
 /*
  * THE MAIN LAME ENCODING INTERFACE
  * mt 3/00
@@ -1707,8 +1843,7 @@ lame_encode_buffer_sample_t(lame_internal_flags * gfc,
 {
     SessionConfig_t const *const cfg = &gfc->cfg;
     EncStateVar_t *const esv = &gfc->sv_enc;
-    int     pcm_samples_per_frame = 576 * cfg->mode_gr;
-    int     mp3size = 0, ret, i, ch, mf_needed;
+    int     mp3size = 0, ret, mf_needed;
     int     mp3out;
     sample_t *mfbuf[2];
     sample_t *in_buffer[2];
@@ -1734,76 +1869,35 @@ lame_encode_buffer_sample_t(lame_internal_flags * gfc,
 
     mf_needed = calcNeeded(cfg);
 
-    mfbuf[0] = esv->mfbuf[0];
-    mfbuf[1] = esv->mfbuf[1];
-
     while (nsamples > 0) {
         sample_t const *in_buffer_ptr[2];
         int     n_in = 0;    /* number of input samples processed with fill_buffer */
         int     n_out = 0;   /* number of samples output with fill_buffer */
         /* n_in <> n_out if we are resampling */
-
+        /* mp3buf_size-mp3size = amount of space avalable,
+           mp3buf_size = 0 if we should not worry about the buffer size */
+        int     buf_size = mp3buf_size - mp3size;
+        if (mp3buf_size == 0)
+            buf_size = INT_MAX;
+
+        mfbuf[0] = esv->mfbuf[0] + esv->mf_start;
+        mfbuf[1] = esv->mfbuf[1] + esv->mf_start;
         in_buffer_ptr[0] = in_buffer[0];
         in_buffer_ptr[1] = in_buffer[1];
         /* copy in new samples into mfbuf, with resampling */
         fill_buffer(gfc, mfbuf, &in_buffer_ptr[0], nsamples, &n_in, &n_out);
 
-        /* compute ReplayGain of resampled input if requested */
-        if (cfg->findReplayGain && !cfg->decode_on_the_fly)
-            if (AnalyzeSamples
-                (gfc->sv_rpg.rgdata, &mfbuf[0][esv->mf_size], &mfbuf[1][esv->mf_size], n_out,
-                 cfg->channels_out) == GAIN_ANALYSIS_ERROR)
-                return -6;
-
-
-
         /* update in_buffer counters */
         nsamples -= n_in;
         in_buffer[0] += n_in;
         if (cfg->channels_out == 2)
             in_buffer[1] += n_in;
 
-        /* update mfbuf[] counters */
-        esv->mf_size += n_out;
-        assert(esv->mf_size <= MFSIZE);
-        
-        /* lame_encode_flush may have set gfc->mf_sample_to_encode to 0
-         * so we have to reinitialize it here when that happened.
-         */
-        if (esv->mf_samples_to_encode < 1) {
-            esv->mf_samples_to_encode = ENCDELAY + POSTDELAY;
-        }        
-        esv->mf_samples_to_encode += n_out;
-
-
-        if (esv->mf_size >= mf_needed) {
-            /* encode the frame.  */
-            /* mp3buf              = pointer to current location in buffer */
-            /* mp3buf_size         = size of original mp3 output buffer */
-            /*                     = 0 if we should not worry about the */
-            /*                       buffer size because calling program is  */
-            /*                       to lazy to compute it */
-            /* mp3size             = size of data written to buffer so far */
-            /* mp3buf_size-mp3size = amount of space avalable  */
-
-            int     buf_size = mp3buf_size - mp3size;
-            if (mp3buf_size == 0)
-                buf_size = INT_MAX;
-
-            ret = lame_encode_mp3_frame(gfc, mfbuf[0], mfbuf[1], mp3buf, buf_size);
-
-            if (ret < 0)
-                return ret;
-            mp3buf += ret;
-            mp3size += ret;
-
-            /* shift out old samples */
-            esv->mf_size -= pcm_samples_per_frame;
-            esv->mf_samples_to_encode -= pcm_samples_per_frame;
-            for (ch = 0; ch < cfg->channels_out; ch++)
-                for (i = 0; i < esv->mf_size; i++)
-                    mfbuf[ch][i] = mfbuf[ch][i + pcm_samples_per_frame];
-        }
+        ret = lame_encode_window(gfc, n_out, mf_needed, mp3buf, buf_size);
+        if (ret < 0)
+            return ret;
+        mp3buf += ret;
+        mp3size += ret;
     }
     assert(nsamples == 0);
 
@@ -1946,6 +2040,85 @@ lame_encode_buffer_interleaved_ieee_float(lame_t gfp,
 }
 
 
+/* BEND: zero-copy ingest, see lame.h */
+int
+lame_encode_acquire_ieee_float(lame_t gfp, float **pcm_l, float **pcm_r)
+{
+    lame_internal_flags *gfc;
+    SessionConfig_t const *cfg;
+    EncStateVar_t *esv;
+    int     room;
+
+    if (!is_lame_global_flags_valid(gfp))
+        return -3;
+    gfc = gfp->internal_flags;
+    if (!is_lame_internal_flags_valid(gfc))
+        return -3;
+    cfg = &gfc->cfg;
+    esv = &gfc->sv_enc;
+    if (isResamplingNecessary(cfg))
+        return -3;
+
+    room = calcNeeded(cfg) - esv->mf_size;
+    *pcm_l = esv->mfbuf[0] + esv->mf_start + esv->mf_size;
+    *pcm_r = cfg->channels_in > 1 ? esv->mfbuf[1] + esv->mf_start + esv->mf_size : NULL;
+    return Max(room, 0);
+}
+
+int
+lame_encode_commit_ieee_float(lame_t gfp, const int nsamples,
+                              unsigned char *mp3buf, const int mp3buf_size)
+{
+    lame_internal_flags *gfc;
+    SessionConfig_t const *cfg;
+    EncStateVar_t *esv;
+    int     mf_needed, mp3out, ret, i;
+    int     buf_size = mp3buf_size == 0 ? INT_MAX : mp3buf_size;
+
+    if (!is_lame_global_flags_valid(gfp))
+        return -3;
+    gfc = gfp->internal_flags;
+    if (!is_lame_internal_flags_valid(gfc))
+        return -3;
+    cfg = &gfc->cfg;
+    esv = &gfc->sv_enc;
+    mf_needed = calcNeeded(cfg);
+    if (isResamplingNecessary(cfg) || nsamples < 0
+        || nsamples > Max(mf_needed - esv->mf_size, 0))
+        return -3;
+
+    /* copy out any tags that may have been written into bitstream */
+    mp3out = copy_buffer(gfc, mp3buf, buf_size, 0);
+    if (mp3out < 0)
+        return mp3out;  /* not enough buffer space */
+    if (mp3buf_size != 0)
+        buf_size -= mp3out;
+
+    {   /* what lame_copy_inbuffer would have done, in place */
+        sample_t *const ib0 = esv->mfbuf[0] + esv->mf_start + esv->mf_size;
+        sample_t *const ib1 = esv->mfbuf[1] + esv->mf_start + esv->mf_size;
+        sample_t const *const br = cfg->channels_in > 1 ? ib1 : ib0;
+        FLOAT const s = 32767.0;
+        FLOAT const m00 = s * cfg->pcm_transform[0][0];
+        FLOAT const m01 = s * cfg->pcm_transform[0][1];
+        FLOAT const m10 = s * cfg->pcm_transform[1][0];
+        FLOAT const m11 = s * cfg->pcm_transform[1][1];
+
+        for (i = 0; i < nsamples; i++) {
+            sample_t const xl = ib0[i];
+            sample_t const xr = br[i];
+            ib0[i] = xl * m00 + xr * m01;
+            ib1[i] = xl * m10 + xr * m11;
+        }
+    }
+
+    ret = lame_encode_window(gfc, nsamples, mf_needed, mp3buf + mp3out, buf_size);
+    if (ret < 0)
+        return ret;
+    return mp3out + ret;
+}
+
+
 int
 lame_encode_buffer_ieee_double(lame_t gfp,
                          const double pcm_l[], const double pcm_r[], const int nsamples,
@@ -2060,9 +2233,11 @@ lame_init_bitstream(lame_global_flags * gfp)
         if (gfc != 0) {
             gfc->ov_enc.frame_number = 0;
 
+#ifndef FISH_MINIMAL
             if (gfp->write_id3tag_automatic) {
                 (void) id3tag_write_v2(gfp);
             }
+#endif
             /* initialize histogram data optionally used by frontend */
             memset(gfc->ov_enc.bitrate_channelmode_hist, 0,
                    sizeof(gfc->ov_enc.bitrate_channelmode_hist));
@@ -2071,9 +2246,11 @@ lame_init_bitstream(lame_global_flags * gfp)
 
             gfc->ov_rpg.PeakSample = 0.0;
 
+#ifndef FISH_MINIMAL
             /* Write initial VBR Header to bitstream and init VBR data */
             if (gfc->cfg.write_lame_tag)
                 (void) InitVbrTag(gfp);
+#endif
 
 
             return 0;
@@ -2201,6 +2378,7 @@ lame_encode_flush(lame_global_flags * gfp, unsigned char *mp3buffer, int mp3buff
     if (mp3buffer_size == 0)
         mp3buffer_size_remaining = INT_MAX;
 
+#ifndef FISH_MINIMAL
     if (gfp->write_id3tag_automatic) {
         /* write a id3 tag to the bitstream */
         (void) id3tag_write_v1(gfp);
@@ -2212,6 +2390,7 @@ lame_encode_flush(lame_global_flags * gfp, unsigned char *mp3buffer, int mp3buff
         }
         mp3count += imp3;
     }
+#endif
 #if 0
     {
         int const ed = gfc->ov_enc.encoder_delay;
@@ -2303,6 +2482,7 @@ lame_mp3_tags_fid(lame_global_flags * gfp, FILE * fpStream)
     if (!cfg->write_lame_tag) {
         return;
     }
+#ifndef FISH_MINIMAL
     /* Write Xing header again */
     if (fpStream && !fseek(fpStream, 0, SEEK_SET)) {
         int     rc = PutVbrTag(gfp, fpStream);
@@ -2324,6 +2504,9 @@ lame_mp3_tags_fid(lame_global_flags * gfp, FILE * fpStream)
             break;
         }
     }
+#else
+    (void) fpStream;
+#endif
 }
 
 
@@ -2357,6 +2540,7 @@ lame_init_internal_flags(lame_internal_flags* gfc)
      */
     gfc->sv_enc.mf_samples_to_encode = ENCDELAY + POSTDELAY;
     gfc->sv_enc.mf_size = ENCDELAY - MDCTDELAY; /* we pad input with this many 0's */
+    gfc->sv_enc.mf_start = 0; /* BEND */
     gfc->ov_enc.encoder_padding = 0;
     gfc->ov_enc.encoder_delay = ENCDELAY;
 
@@ -2368,10 +2552,12 @@ lame_init_internal_flags(lame_internal_flags* gfc)
     if (NULL == gfc->ATH)
         return -2;      /* maybe error codes should be enumerated in lame.h ?? */
 
+#ifndef FISH_MINIMAL
     gfc->sv_rpg.rgdata = lame_calloc(replaygain_t, 1);
     if (NULL == gfc->sv_rpg.rgdata) {
         return -2;
     }
+#endif
     return 0;
 }
 
@@ -2403,7 +2589,9 @@ lame_init_old(lame_global_flags * gfp)
     gfp->num_channels = 2;
     gfp->num_samples = MAX_U_32_NUM;
 
+#ifndef FISH_MINIMAL
     gfp->write_lame_tag = 1;
+#endif
     gfp->quality = -1;
     gfp->short_blocks = short_block_not_set;
     gfp->subblock_gain = -1;
@@ -2449,7 +2637,9 @@ lame_init_old(lame_global_flags * gfp)
 
     gfp->preset = 0;
 
+#ifndef FISH_MINIMAL
     gfp->write_id3tag_automatic = 1;
+#endif
 
     gfp->report.debugf = &lame_report_def;
     gfp->report.errorf = &lame_report_def;
@@ -2663,9 +2853,49 @@ lame_bitrate_block_type_hist(const lame_global_flags * gfp, int bitrate_btype_co
 }
 
 // BEND
+#define AMP_FILTER_GLIDE_GRANULES 8
+
+int lame_change_filter_midstream(lame_global_flags* gfp, int lowpass, int highpass)
+{
+    lame_internal_flags *gfc;
+    SessionConfig_t *cfg;
+    FLOAT   lowpass1, lowpass2, highpass1, highpass2;
+
+    if (!is_lame_global_flags_valid(gfp))
+        return -1;
+    gfc = gfp->internal_flags;
+    if (!is_lame_internal_flags_valid(gfc))
+        return -1;
+    cfg = &gfc->cfg;
+
+    /* the same bounds lame_init_params would have picked, minus the
+     * automatic choices: 0 or less switches a filter off */
+    lame_filter_bounds(gfp, cfg->samplerate_out, lowpass, highpass,
+                       &lowpass1, &lowpass2, &highpass1, &highpass2);
+    lame_ppflt_amp_filter(gfc, &lowpass1, &lowpass2, &highpass1, &highpass2,
+                          gfc->sv_enc.amp_filter_target);
+
+    /* mdct_sub48 walks amp_filter over to the target, so that a moving
+     * cutoff doesn't switch whole subbands on and off between granules */
+    gfc->sv_enc.amp_filter_steps = AMP_FILTER_GLIDE_GRANULES;
+    calc_bandwidth_limits(gfc);
+
+    gfp->lowpassfreq = lowpass;
+    gfp->highpassfreq = highpass;
+    cfg->lowpassfreq = lowpass;
+    cfg->highpassfreq = highpass;
+    cfg->lowpass1 = lowpass1;
+    cfg->lowpass2 = lowpass2;
+    cfg->highpass1 = highpass1;
+    cfg->highpass2 = highpass2;
+    return 0;
+}
+
 void lame_change_bitrate_midstream(lame_global_flags* gfp, int lowpass, float fish)
 {
-    // gfp->lowpassfreq = lowpass;
+    if (lowpass > 0 && lowpass != gfp->lowpassfreq) {
+        (void) lame_change_filter_midstream(gfp, lowpass, gfp->highpassfreq);
+    }
 
     // gfp->ch1br = (int) (pow(100.0, (1. - fish)) * 5.0);
     // gfp->ch2br = (int) (pow(100.0, (1. - fish)) * 3.0);
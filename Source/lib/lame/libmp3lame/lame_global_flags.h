@@ -27,6 +27,11 @@ typedef enum short_block_e {
 struct lame_global_struct {
     int ch1br; // BEND
     int ch2br; // BEND
+    int fish_psymodel; // BEND
+    int fish_quantizer; // BEND
+    int fish_session; // BEND
+    int fish_arena; // BEND
+    int bandwidth_unlimited; // BEND
 
     unsigned int class_id;
 
@@ -48,6 +48,7 @@ char   *strchr(), *strrchr();
 # include <math.h>
 #endif
 #include <limits.h>
+#include <stddef.h>        /* BEND: offsetof */
 
 #include <ctype.h>
 
@@ -152,6 +153,16 @@ typedef double FLOAT8;
 # endif
 #endif
 
+/* BEND: aligns a struct member for the SIMD kernels.  Keep it to 16,
+ * which is what malloc gives for the structs allocated with lame_calloc. */
+#if defined(_MSC_VER)
+# define LAME_ALIGN(n) __declspec(align(n))
+#elif defined(__GNUC__)
+# define LAME_ALIGN(n) __attribute__((aligned(n)))
+#else
+# define LAME_ALIGN(n)
+#endif
+
 /* sample_t must be floating point, at least 32 bits */
 typedef FLOAT sample_t;
 
@@ -442,12 +442,14 @@ hip_decode1_headersB(hip_t hip, unsigned char *buffer,
 }
 
 
+#ifndef NOANALYSIS
 void hip_set_pinfo(hip_t hip, plotting_data* pinfo)
 {
     if (hip) {
         hip->pinfo = pinfo;
     }
 }
+#endif
 
 
 
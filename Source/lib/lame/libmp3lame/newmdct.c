@@ -36,6 +36,8 @@
 #include "util.h"
 #include "newmdct.h"
 
+#include "vector/lame_intrin.h"
+
 
 
 #ifndef USE_GOGO_SUBBAND
@@ -814,6 +816,512 @@ window_subband(const sample_t * x1, FLOAT a[SBLIMIT])
 }
 
 
+#if defined(LAME_VECTOR_EXT) && defined(LAME_INTRIN_AVX)
+
+/* BEND: window_subband on 8 slots at once, one per lane.  Lanes 0..3 are
+ * the 4 slots from x0 on (32 samples apart) and go to a0 (32 FLOATs
+ * apart), lanes 4..7 likewise from x1 to a1.  x1 may be the other channel
+ * or the next 4 slots of the same one.  The arithmetic is window_subband's.
+ * The input is transposed into rows of 32 first, so the lanes of each
+ * load are 4 consecutive FLOATs per half.  AVX2 only: split into two
+ * 128 bit halves (SSE2, NEON) the shuffles cost more than they save. */
+
+typedef FLOAT v4f __attribute__ ((vector_size(4 * sizeof(FLOAT))));
+typedef FLOAT v8f __attribute__ ((vector_size(8 * sizeof(FLOAT))));
+
+#define VEC_INLINE inline static __attribute__ ((always_inline))
+
+#define WS_ROWS 20              /* 19 rows of 32 samples cover 4 slots */
+
+#define X(o) __extension__ ({                                          \
+        int const k_ = ((o) & 31) * WS_ROWS + ((o) >> 5);             \
+        v4f     lo_, hi_;                                             \
+        memcpy(&lo_, ta + k_, sizeof(lo_));                           \
+        memcpy(&hi_, tb + k_, sizeof(hi_));                           \
+        __builtin_shufflevector(lo_, hi_, 0, 1, 2, 3, 4, 5, 6, 7); })
+
+VEC_INLINE void
+transpose_8x8(v8f * v)
+{
+    v8f     t[8], u[8];
+    int     j;
+
+    for (j = 0; j < 8; j += 2) {
+        t[j] = __builtin_shufflevector(v[j], v[j + 1], 0, 8, 1, 9, 4, 12, 5, 13);
+        t[j + 1] = __builtin_shufflevector(v[j], v[j + 1], 2, 10, 3, 11, 6, 14, 7, 15);
+    }
+    for (j = 0; j < 8; j += 4) {
+        u[j] = __builtin_shufflevector(t[j], t[j + 2], 0, 1, 8, 9, 4, 5, 12, 13);
+        u[j + 1] = __builtin_shufflevector(t[j], t[j + 2], 2, 3, 10, 11, 6, 7, 14, 15);
+        u[j + 2] = __builtin_shufflevector(t[j + 1], t[j + 3], 0, 1, 8, 9, 4, 5, 12, 13);
+        u[j + 3] = __builtin_shufflevector(t[j + 1], t[j + 3], 2, 3, 10, 11, 6, 7, 14, 15);
+    }
+    for (j = 0; j < 4; j++) {
+        v[j] = __builtin_shufflevector(u[j], u[j + 4], 0, 1, 2, 3, 8, 9, 10, 11);
+        v[j + 4] = __builtin_shufflevector(u[j], u[j + 4], 4, 5, 6, 7, 12, 13, 14, 15);
+    }
+}
+
+/* t[c * WS_ROWS + r] = x[32 * r + c] */
+VEC_INLINE void
+window_subband_x8_load(FLOAT * t, const sample_t * x)
+{
+    int     r, c, j;
+
+    for (r = 0; r < 16; r += 8) {
+        for (c = 0; c < 32; c += 8) {
+            v8f     v[8];
+            for (j = 0; j < 8; j++)
+                memcpy(&v[j], x + 32 * (r + j) + c, sizeof(v[j]));
+            transpose_8x8(v);
+            for (j = 0; j < 8; j++)
+                memcpy(t + (c + j) * WS_ROWS + r, &v[j], sizeof(v[j]));
+        }
+    }
+    for (r = 16; r < 19; r++) {
+        for (c = 0; c < 32; c++)
+            t[c * WS_ROWS + r] = x[32 * r + c];
+    }
+}
+
+VEC_INLINE void
+window_subband_x8_body(const sample_t * x0, FLOAT * a0, const sample_t * x1, FLOAT * a1)
+{
+    FLOAT const sqrt2 = SQRT2;
+    FLOAT const *wp = enwindow + 10;
+    FLOAT   ta[32 * WS_ROWS], tb[32 * WS_ROWS];
+    v8f     a[SBLIMIT];
+    int     o1 = 286, o2 = 238 - 14; /* x1 and x2 of window_subband, from x - 286 */
+    int     i, l;
+
+    window_subband_x8_load(ta, x0 - 286);
+    window_subband_x8_load(tb, x1 - 286);
+
+    for (i = -15; i < 0; i++) {
+        FLOAT   w;
+        v8f     s, t, u;
+
+        w = wp[-10];
+        s = X(o2 - 224) * w;
+        t = X(o1 + 224) * w;
+        w = wp[-9];
+        s += X(o2 - 160) * w;
+        t += X(o1 + 160) * w;
+        w = wp[-8];
+        s += X(o2 - 96) * w;
+        t += X(o1 + 96) * w;
+        w = wp[-7];
+        s += X(o2 - 32) * w;
+        t += X(o1 + 32) * w;
+        w = wp[-6];
+        s += X(o2 + 32) * w;
+        t += X(o1 - 32) * w;
+        w = wp[-5];
+        s += X(o2 + 96) * w;
+        t += X(o1 - 96) * w;
+        w = wp[-4];
+        s += X(o2 + 160) * w;
+        t += X(o1 - 160) * w;
+        w = wp[-3];
+        s += X(o2 + 224) * w;
+        t += X(o1 - 224) * w;
+
+        w = wp[-2];
+        s += X(o1 - 256) * w;
+        t -= X(o2 + 256) * w;
+        w = wp[-1];
+        s += X(o1 - 192) * w;
+        t -= X(o2 + 192) * w;
+        w = wp[0];
+        s += X(o1 - 128) * w;
+        t -= X(o2 + 128) * w;
+        w = wp[1];
+        s += X(o1 - 64) * w;
+        t -= X(o2 + 64) * w;
+        w = wp[2];
+        s += X(o1) * w;
+        t -= X(o2) * w;
+        w = wp[3];
+        s += X(o1 + 64) * w;
+        t -= X(o2 - 64) * w;
+        w = wp[4];
+        s += X(o1 + 128) * w;
+        t -= X(o2 - 128) * w;
+        w = wp[5];
+        s += X(o1 + 192) * w;
+        t -= X(o2 - 192) * w;
+
+        s *= wp[6];
+        u = t - s;
+        a[30 + i * 2] = t + s;
+        a[31 + i * 2] = wp[7] * u;
+        wp += 18;
+        o1--;
+        o2++;
+    }
+    {
+        v8f     s, t, u, v;
+        t = X(o1 - 16) * wp[-10];
+        s = X(o1 - 32) * wp[-2];
+        t += (X(o1 - 48) - X(o1 + 16)) * wp[-9];
+        s += X(o1 - 96) * wp[-1];
+        t += (X(o1 - 80) + X(o1 + 48)) * wp[-8];
+        s += X(o1 - 160) * wp[0];
+        t += (X(o1 - 112) - X(o1 + 80)) * wp[-7];
+        s += X(o1 - 224) * wp[1];
+        t += (X(o1 - 144) + X(o1 + 112)) * wp[-6];
+        s -= X(o1 + 32) * wp[2];
+        t += (X(o1 - 176) - X(o1 + 144)) * wp[-5];
+        s -= X(o1 + 96) * wp[3];
+        t += (X(o1 - 208) + X(o1 + 176)) * wp[-4];
+        s -= X(o1 + 160) * wp[4];
+        t += (X(o1 - 240) - X(o1 + 208)) * wp[-3];
+        s -= X(o1 + 224);
+
+        u = s - t;
+        v = s + t;
+
+        t = a[14];
+        s = a[15] - t;
+
+        a[31] = v + t;  /* A0 */
+        a[30] = u + s;  /* A1 */
+        a[15] = u - s;  /* A2 */
+        a[14] = v - t;  /* A3 */
+    }
+    {
+        v8f     xr;
+        xr = a[28] - a[0];
+        a[0] += a[28];
+        a[28] = xr * wp[-2 * 18 + 7];
+        xr = a[29] - a[1];
+        a[1] += a[29];
+        a[29] = xr * wp[-2 * 18 + 7];
+
+        xr = a[26] - a[2];
+        a[2] += a[26];
+        a[26] = xr * wp[-4 * 18 + 7];
+        xr = a[27] - a[3];
+        a[3] += a[27];
+        a[27] = xr * wp[-4 * 18 + 7];
+
+        xr = a[24] - a[4];
+        a[4] += a[24];
+        a[24] = xr * wp[-6 * 18 + 7];
+        xr = a[25] - a[5];
+        a[5] += a[25];
+        a[25] = xr * wp[-6 * 18 + 7];
+
+        xr = a[22] - a[6];
+        a[6] += a[22];
+        a[22] = xr * sqrt2;
+        xr = a[23] - a[7];
+        a[7] += a[23];
+        a[23] = xr * sqrt2 - a[7];
+        a[7] -= a[6];
+        a[22] -= a[7];
+        a[23] -= a[22];
+
+        xr = a[6];
+        a[6] = a[31] - xr;
+        a[31] = a[31] + xr;
+        xr = a[7];
+        a[7] = a[30] - xr;
+        a[30] = a[30] + xr;
+        xr = a[22];
+        a[22] = a[15] - xr;
+        a[15] = a[15] + xr;
+        xr = a[23];
+        a[23] = a[14] - xr;
+        a[14] = a[14] + xr;
+
+        xr = a[20] - a[8];
+        a[8] += a[20];
+        a[20] = xr * wp[-10 * 18 + 7];
+        xr = a[21] - a[9];
+        a[9] += a[21];
+        a[21] = xr * wp[-10 * 18 + 7];
+
+        xr = a[18] - a[10];
+        a[10] += a[18];
+        a[18] = xr * wp[-12 * 18 + 7];
+        xr = a[19] - a[11];
+        a[11] += a[19];
+        a[19] = xr * wp[-12 * 18 + 7];
+
+        xr = a[16] - a[12];
+        a[12] += a[16];
+        a[16] = xr * wp[-14 * 18 + 7];
+        xr = a[17] - a[13];
+        a[13] += a[17];
+        a[17] = xr * wp[-14 * 18 + 7];
+
+        xr = -a[20] + a[24];
+        a[20] += a[24];
+        a[24] = xr * wp[-12 * 18 + 7];
+        xr = -a[21] + a[25];
+        a[21] += a[25];
+        a[25] = xr * wp[-12 * 18 + 7];
+
+        xr = a[4] - a[8];
+        a[4] += a[8];
+        a[8] = xr * wp[-12 * 18 + 7];
+        xr = a[5] - a[9];
+        a[5] += a[9];
+        a[9] = xr * wp[-12 * 18 + 7];
+
+        xr = a[0] - a[12];
+        a[0] += a[12];
+        a[12] = xr * wp[-4 * 18 + 7];
+        xr = a[1] - a[13];
+        a[1] += a[13];
+        a[13] = xr * wp[-4 * 18 + 7];
+        xr = a[16] - a[28];
+        a[16] += a[28];
+        a[28] = xr * wp[-4 * 18 + 7];
+        xr = -a[17] + a[29];
+        a[17] += a[29];
+        a[29] = xr * wp[-4 * 18 + 7];
+
+        xr = sqrt2 * (a[2] - a[10]);
+        a[2] += a[10];
+        a[10] = xr;
+        xr = sqrt2 * (a[3] - a[11]);
+        a[3] += a[11];
+        a[11] = xr;
+        xr = sqrt2 * (-a[18] + a[26]);
+        a[18] += a[26];
+        a[26] = xr - a[18];
+        xr = sqrt2 * (-a[19] + a[27]);
+        a[19] += a[27];
+        a[27] = xr - a[19];
+
+        xr = a[2];
+        a[19] -= a[3];
+        a[3] -= xr;
+        a[2] = a[31] - xr;
+        a[31] += xr;
+        xr = a[3];
+        a[11] -= a[19];
+        a[18] -= xr;
+        a[3] = a[30] - xr;
+        a[30] += xr;
+        xr = a[18];
+        a[27] -= a[11];
+        a[19] -= xr;
+        a[18] = a[15] - xr;
+        a[15] += xr;
+
+        xr = a[19];
+        a[10] -= xr;
+        a[19] = a[14] - xr;
+        a[14] += xr;
+        xr = a[10];
+        a[11] -= xr;
+        a[10] = a[23] - xr;
+        a[23] += xr;
+        xr = a[11];
+        a[26] -= xr;
+        a[11] = a[22] - xr;
+        a[22] += xr;
+        xr = a[26];
+        a[27] -= xr;
+        a[26] = a[7] - xr;
+        a[7] += xr;
+
+        xr = a[27];
+        a[27] = a[6] - xr;
+        a[6] += xr;
+
+        xr = sqrt2 * (a[0] - a[4]);
+        a[0] += a[4];
+        a[4] = xr;
+        xr = sqrt2 * (a[1] - a[5]);
+        a[1] += a[5];
+        a[5] = xr;
+        xr = sqrt2 * (a[16] - a[20]);
+        a[16] += a[20];
+        a[20] = xr;
+        xr = sqrt2 * (a[17] - a[21]);
+        a[17] += a[21];
+        a[21] = xr;
+
+        xr = -sqrt2 * (a[8] - a[12]);
+        a[8] += a[12];
+        a[12] = xr - a[8];
+        xr = -sqrt2 * (a[9] - a[13]);
+        a[9] += a[13];
+        a[13] = xr - a[9];
+        xr = -sqrt2 * (a[25] - a[29]);
+        a[25] += a[29];
+        a[29] = xr - a[25];
+        xr = -sqrt2 * (a[24] + a[28]);
+        a[24] -= a[28];
+        a[28] = xr - a[24];
+
+        xr = a[24] - a[16];
+        a[24] = xr;
+        xr = a[20] - xr;
+        a[20] = xr;
+        xr = a[28] - xr;
+        a[28] = xr;
+
+        xr = a[25] - a[17];
+        a[25] = xr;
+        xr = a[21] - xr;
+        a[21] = xr;
+        xr = a[29] - xr;
+        a[29] = xr;
+
+        xr = a[17] - a[1];
+        a[17] = xr;
+        xr = a[9] - xr;
+        a[9] = xr;
+        xr = a[25] - xr;
+        a[25] = xr;
+        xr = a[5] - xr;
+        a[5] = xr;
+        xr = a[21] - xr;
+        a[21] = xr;
+        xr = a[13] - xr;
+        a[13] = xr;
+        xr = a[29] - xr;
+        a[29] = xr;
+
+        xr = a[1] - a[0];
+        a[1] = xr;
+        xr = a[16] - xr;
+        a[16] = xr;
+        xr = a[17] - xr;
+        a[17] = xr;
+        xr = a[8] - xr;
+        a[8] = xr;
+        xr = a[9] - xr;
+        a[9] = xr;
+        xr = a[24] - xr;
+        a[24] = xr;
+        xr = a[25] - xr;
+        a[25] = xr;
+        xr = a[4] - xr;
+        a[4] = xr;
+        xr = a[5] - xr;
+        a[5] = xr;
+        xr = a[20] - xr;
+        a[20] = xr;
+        xr = a[21] - xr;
+        a[21] = xr;
+        xr = a[12] - xr;
+        a[12] = xr;
+        xr = a[13] - xr;
+        a[13] = xr;
+        xr = a[28] - xr;
+        a[28] = xr;
+        xr = a[29] - xr;
+        a[29] = xr;
+
+        xr = a[0];
+        a[0] += a[31];
+        a[31] -= xr;
+        xr = a[1];
+        a[1] += a[30];
+        a[30] -= xr;
+        xr = a[16];
+        a[16] += a[15];
+        a[15] -= xr;
+        xr = a[17];
+        a[17] += a[14];
+        a[14] -= xr;
+        xr = a[8];
+        a[8] += a[23];
+        a[23] -= xr;
+        xr = a[9];
+        a[9] += a[22];
+        a[22] -= xr;
+        xr = a[24];
+        a[24] += a[7];
+        a[7] -= xr;
+        xr = a[25];
+        a[25] += a[6];
+        a[6] -= xr;
+        xr = a[4];
+        a[4] += a[27];
+        a[27] -= xr;
+        xr = a[5];
+        a[5] += a[26];
+        a[26] -= xr;
+        xr = a[20];
+        a[20] += a[11];
+        a[11] -= xr;
+        xr = a[21];
+        a[21] += a[10];
+        a[10] -= xr;
+        xr = a[12];
+        a[12] += a[19];
+        a[19] -= xr;
+        xr = a[13];
+        a[13] += a[18];
+        a[18] -= xr;
+        xr = a[28];
+        a[28] += a[3];
+        a[3] -= xr;
+        xr = a[29];
+        a[29] += a[2];
+        a[2] -= xr;
+    }
+
+    /* stored in band order, so mdct_long_x8 reads 8 bands in one go */
+    for (i = 0; i < SBLIMIT; i += 8) {
+        v8f     v[8];
+        for (l = 0; l < 8; l++)
+            v[l] = a[order[i + l]];
+        transpose_8x8(v);
+        for (l = 0; l < 4; l++) {
+            memcpy(a0 + 32 * l + i, &v[l], sizeof(v[l]));
+            memcpy(a1 + 32 * l + i, &v[l + 4], sizeof(v[l + 4]));
+        }
+    }
+}
+
+#undef X
+
+/* the aliasing reduction butterflies of mdct_sub48, bands 1 .. bands-1 */
+VEC_INLINE void
+mdct_alias_x8_body(FLOAT * xr, int bands)
+{
+    v8f     vca, vcs;
+    int     band;
+
+    memcpy(&vca, ca, sizeof(vca));
+    memcpy(&vcs, cs, sizeof(vcs));
+    for (band = 1; band < bands; band++) {
+        FLOAT  *const p = xr + 18 * band;
+        v8f     x, y, bu, bd;
+        memcpy(&x, p, sizeof(x));
+        memcpy(&y, p - 8, sizeof(y));
+        y = __builtin_shufflevector(y, y, 7, 6, 5, 4, 3, 2, 1, 0);
+        bu = x * vca + y * vcs;
+        bd = x * vcs - y * vca;
+        bu = __builtin_shufflevector(bu, bu, 7, 6, 5, 4, 3, 2, 1, 0);
+        memcpy(p, &bd, sizeof(bd));
+        memcpy(p - 8, &bu, sizeof(bu));
+    }
+}
+
+LAME_TARGET("avx2") static void
+window_subband_x8_AVX2(const sample_t * x0, FLOAT * a0, const sample_t * x1, FLOAT * a1)
+{
+    window_subband_x8_body(x0, a0, x1, a1);
+}
+
+LAME_TARGET("avx2") static void
+mdct_alias_x8_AVX2(FLOAT * xr, int bands)
+{
+    mdct_alias_x8_body(xr, bands);
+}
+
+#endif /* LAME_VECTOR_EXT && LAME_INTRIN_AVX */
+
+
 /*-------------------------------------------------------------------*/
 /*                                                                   */
 /*   Function: Calculation of the MDCT                               */
@@ -941,33 +1449,252 @@ mdct_long(FLOAT * out, FLOAT const *in)
 }
 
 
+#if defined(LAME_VECTOR_EXT) && defined(LAME_INTRIN_AVX)
+
+/* BEND: mdct_long on 8 bands at once, one per lane */
+VEC_INLINE void
+mdct_long_x8v(v8f * out, v8f const *in)
+{
+    v8f     ct, st;
+    {
+        v8f     tc1, tc2, tc3, tc4, ts5, ts6, ts7, ts8;
+        /* 1,2, 5,6, 9,10, 13,14, 17 */
+        tc1 = in[17] - in[9];
+        tc3 = in[15] - in[11];
+        tc4 = in[14] - in[12];
+        ts5 = in[0] + in[8];
+        ts6 = in[1] + in[7];
+        ts7 = in[2] + in[6];
+        ts8 = in[3] + in[5];
+
+        out[17] = (ts5 + ts7 - ts8) - (ts6 - in[4]);
+        st = (ts5 + ts7 - ts8) * cx[7] + (ts6 - in[4]);
+        ct = (tc1 - tc3 - tc4) * cx[6];
+        out[5] = ct + st;
+        out[6] = ct - st;
+
+        tc2 = (in[16] - in[10]) * cx[6];
+        ts6 = ts6 * cx[7] + in[4];
+        ct = tc1 * cx[0] + tc2 + tc3 * cx[1] + tc4 * cx[2];
+        st = -ts5 * cx[4] + ts6 - ts7 * cx[5] + ts8 * cx[3];
+        out[1] = ct + st;
+        out[2] = ct - st;
+
+        ct = tc1 * cx[1] - tc2 - tc3 * cx[2] + tc4 * cx[0];
+        st = -ts5 * cx[5] + ts6 - ts7 * cx[3] + ts8 * cx[4];
+        out[9] = ct + st;
+        out[10] = ct - st;
+
+        ct = tc1 * cx[2] - tc2 + tc3 * cx[0] - tc4 * cx[1];
+        st = ts5 * cx[3] - ts6 + ts7 * cx[4] - ts8 * cx[5];
+        out[13] = ct + st;
+        out[14] = ct - st;
+    }
+    {
+        v8f     ts1, ts2, ts3, ts4, tc5, tc6, tc7, tc8;
+
+        ts1 = in[8] - in[0];
+        ts3 = in[6] - in[2];
+        ts4 = in[5] - in[3];
+        tc5 = in[17] + in[9];
+        tc6 = in[16] + in[10];
+        tc7 = in[15] + in[11];
+        tc8 = in[14] + in[12];
+
+        out[0] = (tc5 + tc7 + tc8) + (tc6 + in[13]);
+        ct = (tc5 + tc7 + tc8) * cx[7] - (tc6 + in[13]);
+        st = (ts1 - ts3 + ts4) * cx[6];
+        out[11] = ct + st;
+        out[12] = ct - st;
+
+        ts2 = (in[7] - in[1]) * cx[6];
+        tc6 = in[13] - tc6 * cx[7];
+        ct = tc5 * cx[3] - tc6 + tc7 * cx[4] + tc8 * cx[5];
+        st = ts1 * cx[2] + ts2 + ts3 * cx[0] + ts4 * cx[1];
+        out[3] = ct + st;
+        out[4] = ct - st;
+
+        ct = -tc5 * cx[5] + tc6 - tc7 * cx[3] - tc8 * cx[4];
+        st = ts1 * cx[1] + ts2 - ts3 * cx[2] - ts4 * cx[0];
+        out[7] = ct + st;
+        out[8] = ct - st;
+
+        ct = -tc5 * cx[4] + tc6 - tc7 * cx[5] - tc8 * cx[3];
+        st = ts1 * cx[0] - ts2 + ts3 * cx[1] - ts4 * cx[2];
+        out[15] = ct + st;
+        out[16] = ct - st;
+    }
+}
+
+
+/* mdct_sub48's long block path for bands band .. band+7: the polyphase
+ * lowpass amp, the window and mdct_long.  out is the first band's xr,
+ * sb0 and sb1 are in band order (window_subband_x8). */
+VEC_INLINE void
+mdct_long_x8_body(FLOAT * out, const FLOAT * sb0, FLOAT * sb1, int band, int type,
+                  const FLOAT * amp)
+{
+    v8f     b0[18], b1[18], work[18], gain, pass;
+    int     k, l, scaled = 0;
+
+    for (l = 0; l < 8; l++) {
+        FLOAT const g = amp[band + l];
+        gain[l] = g < 1e-12 ? 0 : g < 1.0 ? g : 1;
+        pass[l] = g < 1e-12 ? 0 : 1;
+        scaled |= g < 1.0;
+    }
+    for (k = 0; k < 18; k++) {
+        memcpy(&b0[k], sb0 + SBLIMIT * k + band, sizeof(b0[k]));
+        memcpy(&b1[k], sb1 + SBLIMIT * k + band, sizeof(b1[k]));
+        if (scaled) {
+            b1[k] *= gain;
+            memcpy(sb1 + SBLIMIT * k + band, &b1[k], sizeof(b1[k]));
+        }
+    }
+
+    for (k = -NL / 4; k < 0; k++) {
+        v8f     a, b;
+        a = win[type][k + 27] * b1[k + 9] + win[type][k + 36] * b1[8 - k];
+        b = win[type][k + 9] * b0[k + 9] - win[type][k + 18] * b0[8 - k];
+        work[k + 9] = a - b * tantab_l[k + 9];
+        work[k + 18] = a * tantab_l[k + 9] + b;
+    }
+    mdct_long_x8v(b0, work);
+
+    for (k = 0; k < 18; k++)
+        b0[k] *= pass;
+    for (k = 0; k < 16; k += 8) {
+        transpose_8x8(b0 + k);
+        for (l = 0; l < 8; l++)
+            memcpy(out + 18 * l + k, &b0[k + l], sizeof(b0[k + l]));
+    }
+    for (l = 0; l < 8; l++) {
+        out[18 * l + 16] = b0[16][l];
+        out[18 * l + 17] = b0[17][l];
+    }
+}
+
+LAME_TARGET("avx2") static void
+mdct_long_x8_AVX2(FLOAT * out, const FLOAT * sb0, FLOAT * sb1, int band, int type,
+                  const FLOAT * amp)
+{
+    mdct_long_x8_body(out, sb0, sb1, band, type, amp);
+}
+
+#endif /* LAME_VECTOR_EXT && LAME_INTRIN_AVX */
+
+/* BEND: the 18 polyphase slots of granule gr, for every channel */
+static void
+polyphase_granule(lame_internal_flags * gfc, const sample_t * w0, const sample_t * w1, int gr)
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    EncStateVar_t *const esv = &gfc->sv_enc;
+    const sample_t *wk[2];
+    FLOAT  *samp[2];
+    int     ch, k, band, slot = 0;
+
+    wk[0] = w0 + 286 + 576 * gr;
+    wk[1] = w1 + 286 + 576 * gr;
+    samp[0] = esv->sb_sample[0][1 - gr][0];
+    samp[1] = esv->sb_sample[1][1 - gr][0];
+
+    if (gfc->window_subband_x8) {
+        if (cfg->channels_out == 2) {
+            for (; slot + 4 <= 18; slot += 4) {
+                gfc->window_subband_x8(wk[0] + 32 * slot, samp[0] + 32 * slot,
+                                       wk[1] + 32 * slot, samp[1] + 32 * slot);
+            }
+        }
+        else {
+            for (; slot + 8 <= 18; slot += 8) {
+                gfc->window_subband_x8(wk[0] + 32 * slot, samp[0] + 32 * slot,
+                                       wk[0] + 32 * (slot + 4), samp[0] + 32 * (slot + 4));
+            }
+        }
+    }
+    for (ch = 0; ch < cfg->channels_out; ch++) {
+        for (k = slot; k < 18; k++) {
+            if (gfc->window_subband_x8) {
+                /* in band order, like window_subband_x8 */
+                FLOAT   a[SBLIMIT];
+                window_subband(wk[ch] + 32 * k, a);
+                for (band = 0; band < SBLIMIT; band++)
+                    samp[ch][32 * k + band] = a[order[band]];
+            }
+            else
+                window_subband(wk[ch] + 32 * k, samp[ch] + 32 * k);
+        }
+        /*
+         * Compensate for inversion in the analysis filter
+         */
+        for (k = 1; k < 18; k += 2) {
+            for (band = 1; band < 32; band += 2) {
+                samp[ch][32 * k + band] *= -1;
+            }
+        }
+    }
+}
+
+void
+init_mdct(lame_internal_flags * gfc)
+{
+    gfc->window_subband_x8 = 0;
+    gfc->mdct_alias_x8 = 0;
+    gfc->mdct_long_x8 = 0;
+#if defined(LAME_VECTOR_EXT) && defined(LAME_INTRIN_AVX)
+    if (gfc->CPU_features.AVX2) {
+        gfc->window_subband_x8 = window_subband_x8_AVX2;
+        gfc->mdct_alias_x8 = mdct_alias_x8_AVX2;
+        gfc->mdct_long_x8 = mdct_long_x8_AVX2;
+    }
+#endif
+}
+
 void
 mdct_sub48(lame_internal_flags * gfc, const sample_t * w0, const sample_t * w1)
 {
     SessionConfig_t const *const cfg = &gfc->cfg;
     EncStateVar_t *const esv = &gfc->sv_enc;
     int     gr, k, ch;
-    const sample_t *wk;
+    FLOAT   glide[2][32];
+    FLOAT const *amp_filter[2];
 
-    wk = w0 + 286;
-    /* thinking cache performance, ch->gr loop is better than gr->ch loop */
-    for (ch = 0; ch < cfg->channels_out; ch++) {
-        for (gr = 0; gr < cfg->mode_gr; gr++) {
+    /* BEND: a retuned filter takes over a step per granule */
+    for (gr = 0; gr < cfg->mode_gr; gr++) {
+        amp_filter[gr] = esv->amp_filter;
+        if (esv->amp_filter_steps > 0) {
+            int     band;
+            for (band = 0; band < 32; band++) {
+                esv->amp_filter[band] += (esv->amp_filter_target[band] - esv->amp_filter[band])
+                    / esv->amp_filter_steps;
+                glide[gr][band] = esv->amp_filter[band];
+            }
+            esv->amp_filter_steps--;
+            amp_filter[gr] = glide[gr];
+        }
+    }
+
+    /* BEND: granule by granule, so that the polyphase filterbank can run
+     * every channel of a granule in one go */
+    for (gr = 0; gr < cfg->mode_gr; gr++) {
+        polyphase_granule(gfc, w0, w1, gr);
+        for (ch = 0; ch < cfg->channels_out; ch++) {
             int     band;
             gr_info *const gi = &(gfc->l3_side.tt[gr][ch]);
             FLOAT  *mdct_enc = gi->xr;
-            FLOAT  *samp = esv->sb_sample[ch][1 - gr][0];
-
-            for (k = 0; k < 18 / 2; k++) {
-                window_subband(wk, samp);
-                window_subband(wk + 32, samp + 32);
-                samp += 64;
-                wk += 64;
-                /*
-                 * Compensate for inversion in the analysis filter
-                 */
-                for (band = 1; band < 32; band += 2) {
-                    samp[band - 32] *= -1;
+            unsigned int x8_bands = 0;
+
+            /* BEND: long blocks 8 bands at a time, skipping groups the
+             * lowpass has taken out entirely */
+            if (gfc->mdct_long_x8 && gi->block_type != SHORT_TYPE) {
+                for (band = 0; band < 32; band += 8) {
+                    for (k = 0; k < 8 && amp_filter[gr][band + k] < 1e-12; k++);
+                    if (k < 8) {
+                        gfc->mdct_long_x8(gi->xr + 18 * band, esv->sb_sample[ch][gr][0],
+                                          esv->sb_sample[ch][1 - gr][0], band, gi->block_type,
+                                          amp_filter[gr]);
+                        x8_bands |= 0xffu << band;
+                    }
                 }
             }
 
@@ -977,17 +1704,24 @@ mdct_sub48(lame_internal_flags * gfc, const sample_t * w0, const sample_t * w1)
              */
             for (band = 0; band < 32; band++, mdct_enc += 18) {
                 int     type = gi->block_type;
-                FLOAT const *const band0 = esv->sb_sample[ch][gr][0] + order[band];
-                FLOAT  *const band1 = esv->sb_sample[ch][1 - gr][0] + order[band];
+                int const column = gfc->window_subband_x8 ? band : order[band];
+                FLOAT const *const band0 = esv->sb_sample[ch][gr][0] + column;
+                FLOAT  *const band1 = esv->sb_sample[ch][1 - gr][0] + column;
                 if (gi->mixed_block_flag && band < 2)
                     type = 0;
-                if (esv->amp_filter[band] < 1e-12) {
+                if ((x8_bands >> band) & 1) {
+                    /* BEND: done by mdct_long_x8 above */
+                }
+                else if (amp_filter[gr][band] < 1e-12) {
                     memset(mdct_enc, 0, 18 * sizeof(FLOAT));
+                    /* BEND: the band may be faded back in next granule */
+                    for (k = 0; k < 18; k++)
+                        band1[k * 32] = 0;
                 }
                 else {
-                    if (esv->amp_filter[band] < 1.0) {
+                    if (amp_filter[gr][band] < 1.0) {
                         for (k = 0; k < 18; k++)
-                            band1[k * 32] *= esv->amp_filter[band];
+                            band1[k * 32] *= amp_filter[gr][band];
                     }
                     if (type == SHORT_TYPE) {
                         for (k = -NS / 4; k < 0; k++) {
@@ -1019,7 +1753,7 @@ mdct_sub48(lame_internal_flags * gfc, const sample_t * w0, const sample_t * w1)
                 /*
                  * Perform aliasing reduction butterfly
                  */
-                if (type != SHORT_TYPE && band != 0) {
+                if (type != SHORT_TYPE && band != 0 && !gfc->mdct_alias_x8) {
                     for (k = 7; k >= 0; --k) {
                         FLOAT   bu, bd;
                         bu = mdct_enc[k] * ca[k] + mdct_enc[-1 - k] * cs[k];
@@ -1030,9 +1764,15 @@ mdct_sub48(lame_internal_flags * gfc, const sample_t * w0, const sample_t * w1)
                     }
                 }
             }
+            if (gfc->mdct_alias_x8) {
+                /* BEND: the same butterflies, after the last band */
+                int const bands = gi->block_type != SHORT_TYPE ? 32 : gi->mixed_block_flag ? 2 : 0;
+                gfc->mdct_alias_x8(gi->xr, bands);
+            }
         }
-        wk = w1 + 286;
-        if (cfg->mode_gr == 1) {
+    }
+    if (cfg->mode_gr == 1) {
+        for (ch = 0; ch < cfg->channels_out; ch++) {
             memcpy(esv->sb_sample[ch][0], esv->sb_sample[ch][1], 576 * sizeof(FLOAT));
         }
     }
@@ -64,6 +64,7 @@ max_int(int a, int b)
 
 
 
+#ifndef FISH_MINIMAL /* BEND: the Fish profile keeps only the ABR/CBR presets */
 typedef struct {
     int     vbr_q;
     int     quant_comp;
@@ -211,6 +212,7 @@ apply_vbr_preset(lame_global_flags * gfp, int a, int enforce)
         gfp->internal_flags->cfg.ATHfixpoint = set->ath_fixpoint - y;
     }
 }
+#endif
 
 static int
 apply_abr_preset(lame_global_flags * gfp, int preset, int enforce)
@@ -319,6 +321,7 @@ apply_abr_preset(lame_global_flags * gfp, int preset, int enforce)
 int
 apply_preset(lame_global_flags * gfp, int preset, int enforce)
 {
+#ifndef FISH_MINIMAL
     /*translate legacy presets */
     switch (preset) {
     case R3MIX:
@@ -357,8 +360,10 @@ apply_preset(lame_global_flags * gfp, int preset, int enforce)
             return preset;
         }
     }
+#endif
 
     gfp->preset = preset;
+#ifndef FISH_MINIMAL
     {
         switch (preset) {
         case V9:
@@ -395,6 +400,7 @@ apply_preset(lame_global_flags * gfp, int preset, int enforce)
             break;
         }
     }
+#endif
     if (8 <= preset && preset <= 320) {
         return apply_abr_preset(gfp, preset, enforce);
     }
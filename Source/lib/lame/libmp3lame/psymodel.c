@@ -154,10 +154,12 @@ blocktype_d[2]        block type to use for previous granule
 #include "lame_global_flags.h"
 #include "fft.h"
 #include "lame-analysis.h"
+#include "vector/lame_intrin.h"
+#ifdef FISH_TEST_HOOKS
+#include "fish_test_hooks.h"
+#endif
 
 
-#define NSFIRLEN 21
-
 #ifdef M_LN10
 #define  LN_TO_LOG10  (M_LN10/10)
 #else
@@ -213,7 +215,7 @@ future:  Data indicates that the shape of the equal loudness curve varies
          However, the potential gain may not be enough to justify an effort.
 */
 static  FLOAT
-psycho_loudness_approx(FLOAT const *energy, FLOAT const *eql_w)
+loudness_core_c(FLOAT const *energy, FLOAT const *eql_w)
 {
     int     i;
     FLOAT   loudness_power;
@@ -222,6 +224,15 @@ psycho_loudness_approx(FLOAT const *energy, FLOAT const *eql_w)
     /* apply weights to power in freq. bands */
     for (i = 0; i < BLKSIZE / 2; ++i)
         loudness_power += energy[i] * eql_w[i];
+    return loudness_power;
+}
+
+static  FLOAT
+psycho_loudness_approx(lame_internal_flags const *gfc, FLOAT const *energy)
+{
+    FLOAT   loudness_power;
+
+    loudness_power = gfc->loudness_core(energy, gfc->ATH->eql_w); /* BEND */
     loudness_power *= VO_SCALE;
 
     return loudness_power;
@@ -300,17 +311,24 @@ init_mask_add_max_values(void)
 
 
 
+static const FLOAT table2[] = {
+    1.33352 * 1.33352, 1.35879 * 1.35879, 1.38454 * 1.38454, 1.39497 * 1.39497,
+    1.40548 * 1.40548, 1.3537 * 1.3537, 1.30382 * 1.30382, 1.22321 * 1.22321,
+    1.14758 * 1.14758,
+    1
+};
+
+/* BEND: the table2 index for a ratio below ma_max_i1 */
+inline static int
+mask_add_index(FLOAT ratio)
+{
+    return (int) (FAST_LOG10_X(ratio, 16.0f));
+}
+
 /* addition of simultaneous masking   Naoki Shibata 2000/7 */
 inline static FLOAT
 vbrpsy_mask_add(FLOAT m1, FLOAT m2, int b, int delta)
 {
-    static const FLOAT table2[] = {
-        1.33352 * 1.33352, 1.35879 * 1.35879, 1.38454 * 1.38454, 1.39497 * 1.39497,
-        1.40548 * 1.40548, 1.3537 * 1.3537, 1.30382 * 1.30382, 1.22321 * 1.22321,
-        1.14758 * 1.14758,
-        1
-    };
-
     FLOAT   ratio;
 
     if (m1 < 0) {
@@ -337,7 +355,7 @@ vbrpsy_mask_add(FLOAT m1, FLOAT m2, int b, int delta)
             return m1 + m2;
         }
         else {
-            int     i = (int) (FAST_LOG10_X(ratio, 16.0f));
+            int     i = mask_add_index(ratio);
             return (m1 + m2) * table2[i];
         }
     }
@@ -358,8 +376,8 @@ vbrpsy_mask_add(FLOAT m1, FLOAT m2, int b, int delta)
     between them
 */
 static void
-convert_partition2scalefac(PsyConst_CB2SB_t const *const gd, FLOAT const *eb, FLOAT const *thr,
-                           FLOAT enn_out[], FLOAT thm_out[])
+p2s_core_c(PsyConst_CB2SB_t const *const gd, FLOAT const *eb, FLOAT const *thr,
+           FLOAT enn_out[], FLOAT thm_out[])
 {
     FLOAT   enn, thmm;
     int     sb, b, n = gd->n_sb;
@@ -402,15 +420,23 @@ convert_partition2scalefac(PsyConst_CB2SB_t const *const gd, FLOAT const *eb, FL
     }
 }
 
+/* BEND: enn_out and thm_out take PSY_LANES_PAD(gd->n_sb) values */
+static void
+convert_partition2scalefac(lame_internal_flags const *gfc, PsyConst_CB2SB_t const *const gd,
+                           FLOAT const *eb, FLOAT const *thr, FLOAT enn_out[], FLOAT thm_out[])
+{
+    gfc->p2s_core(gd, eb, thr, enn_out, thm_out);
+}
+
 static void
 convert_partition2scalefac_s(lame_internal_flags * gfc, FLOAT const *eb, FLOAT const *thr, int chn,
                              int sblock)
 {
     PsyStateVar_t *const psv = &gfc->sv_psy;
     PsyConst_CB2SB_t const *const gds = &gfc->cd_psy->s;
-    FLOAT   enn[SBMAX_s], thm[SBMAX_s];
+    FLOAT   enn[PSY_LANES_PAD(SBMAX_s)], thm[PSY_LANES_PAD(SBMAX_s)];
     int     sb;
-    convert_partition2scalefac(gds, eb, thr, enn, thm);
+    convert_partition2scalefac(gfc, gds, eb, thr, enn, thm);
     for (sb = 0; sb < SBMAX_s; ++sb) {
         psv->en[chn].s[sb][sblock] = enn[sb];
         psv->thm[chn].s[sb][sblock] = thm[sb];
@@ -423,9 +449,10 @@ convert_partition2scalefac_l(lame_internal_flags * gfc, FLOAT const *eb, FLOAT c
 {
     PsyStateVar_t *const psv = &gfc->sv_psy;
     PsyConst_CB2SB_t const *const gdl = &gfc->cd_psy->l;
-    FLOAT  *enn = &psv->en[chn].l[0];
-    FLOAT  *thm = &psv->thm[chn].l[0];
-    convert_partition2scalefac(gdl, eb, thr, enn, thm);
+    FLOAT   enn[PSY_LANES_PAD(SBMAX_l)], thm[PSY_LANES_PAD(SBMAX_l)];
+    convert_partition2scalefac(gfc, gdl, eb, thr, enn, thm);
+    memcpy(psv->en[chn].l, enn, sizeof(psv->en[chn].l));
+    memcpy(psv->thm[chn].l, thm, sizeof(psv->thm[chn].l));
 }
 
 static void
@@ -434,9 +461,9 @@ convert_partition2scalefac_l_to_s(lame_internal_flags * gfc, FLOAT const *eb, FL
 {
     PsyStateVar_t *const psv = &gfc->sv_psy;
     PsyConst_CB2SB_t const *const gds = &gfc->cd_psy->l_to_s;
-    FLOAT   enn[SBMAX_s], thm[SBMAX_s];
+    FLOAT   enn[PSY_LANES_PAD(SBMAX_s)], thm[PSY_LANES_PAD(SBMAX_s)];
     int     sb, sblock;
-    convert_partition2scalefac(gds, eb, thr, enn, thm);
+    convert_partition2scalefac(gfc, gds, eb, thr, enn, thm);
     for (sb = 0; sb < SBMAX_s; ++sb) {
         FLOAT const scale = 1. / 64.f;
         FLOAT const tmp_enn = enn[sb];
@@ -465,8 +492,47 @@ NS_INTERP(FLOAT x, FLOAT y, FLOAT r)
 
 
 
+/* BEND: the log2 of en / (thm * masking_lower) for each band of a PE sum,
+ * PE_SATURATED where that is over 1e10 and 0 where the band adds nothing */
+static void
+pe_core_c(const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n, FLOAT * lg)
+{
+    int     i;
+
+    for (i = 0; i < n; i++) {
+        lg[i] = 0;
+        if (thm[i] > 0.0f) {
+            FLOAT const x = thm[i] * masking_lower;
+            if (en[i] > x) {
+                if (en[i] > x * 1e10f) {
+                    lg[i] = PE_SATURATED;
+                }
+                else {
+                    assert(x > 0);
+#ifdef USE_FAST_LOG
+                    lg[i] = fast_log2(en[i] / x);
+#else
+                    lg[i] = log(en[i] / x) / LOG2;
+#endif
+                }
+            }
+        }
+    }
+}
+
+/* BEND: gfc->pe_core on whole vectors, the rest here */
+static void
+pe_log2(lame_internal_flags const *gfc, const FLOAT * en, const FLOAT * thm, FLOAT masking_lower,
+        int n, FLOAT * lg)
+{
+    int const n_simd = n / PSY_LANES * PSY_LANES;
+
+    gfc->pe_core(en, thm, masking_lower, n_simd, lg);
+    pe_core_c(en + n_simd, thm + n_simd, masking_lower, n - n_simd, lg + n_simd);
+}
+
 static  FLOAT
-pecalc_s(III_psy_ratio const *mr, FLOAT masking_lower)
+pecalc_s(lame_internal_flags const *gfc, III_psy_ratio const *mr, FLOAT masking_lower)
 {
     FLOAT   pe_s;
     static const FLOAT regcoef_s[] = {
@@ -484,26 +550,19 @@ pecalc_s(III_psy_ratio const *mr, FLOAT masking_lower)
         130,
 /*      255.8 */
     };
-    unsigned int sb, sblock;
+    FLOAT   lg[3 * (SBMAX_s - 1)];
+    unsigned int i;
 
+    /* BEND: en.s and thm.s are [sb][sblock], so band i is sb = i / 3 */
+    pe_log2(gfc, &mr->en.s[0][0], &mr->thm.s[0][0], masking_lower, 3 * (SBMAX_s - 1), lg);
     pe_s = 1236.28f / 4;
-    for (sb = 0; sb < SBMAX_s - 1; sb++) {
-        for (sblock = 0; sblock < 3; sblock++) {
-            FLOAT const thm = mr->thm.s[sb][sblock];
-            assert(sb < dimension_of(regcoef_s));
-            if (thm > 0.0f) {
-                FLOAT const x = thm * masking_lower;
-                FLOAT const en = mr->en.s[sb][sblock];
-                if (en > x) {
-                    if (en > x * 1e10f) {
-                        pe_s += regcoef_s[sb] * (10.0f * LOG10);
-                    }
-                    else {
-                        assert(x > 0);
-                        pe_s += regcoef_s[sb] * FAST_LOG10(en / x);
-                    }
-                }
-            }
+    for (i = 0; i < 3 * (SBMAX_s - 1); i++) {
+        assert(i / 3 < dimension_of(regcoef_s));
+        if (lg[i] == PE_SATURATED) {
+            pe_s += regcoef_s[i / 3] * (10.0f * LOG10);
+        }
+        else {
+            pe_s += regcoef_s[i / 3] * (lg[i] * (LOG2 / LOG10));
         }
     }
 
@@ -511,7 +570,7 @@ pecalc_s(III_psy_ratio const *mr, FLOAT masking_lower)
 }
 
 static  FLOAT
-pecalc_l(III_psy_ratio const *mr, FLOAT masking_lower)
+pecalc_l(lame_internal_flags const *gfc, III_psy_ratio const *mr, FLOAT masking_lower)
 {
     FLOAT   pe_l;
     static const FLOAT regcoef_l[] = {
@@ -538,24 +597,18 @@ pecalc_l(III_psy_ratio const *mr, FLOAT masking_lower)
         126.1,
 /*      241.3 */
     };
+    FLOAT   lg[SBMAX_l - 1];
     unsigned int sb;
 
+    pe_log2(gfc, mr->en.l, mr->thm.l, masking_lower, SBMAX_l - 1, lg);
     pe_l = 1124.23f / 4;
     for (sb = 0; sb < SBMAX_l - 1; sb++) {
-        FLOAT const thm = mr->thm.l[sb];
         assert(sb < dimension_of(regcoef_l));
-        if (thm > 0.0f) {
-            FLOAT const x = thm * masking_lower;
-            FLOAT const en = mr->en.l[sb];
-            if (en > x) {
-                if (en > x * 1e10f) {
-                    pe_l += regcoef_l[sb] * (10.0f * LOG10);
-                }
-                else {
-                    assert(x > 0);
-                    pe_l += regcoef_l[sb] * FAST_LOG10(en / x);
-                }
-            }
+        if (lg[sb] == PE_SATURATED) {
+            pe_l += regcoef_l[sb] * (10.0f * LOG10);
+        }
+        else {
+            pe_l += regcoef_l[sb] * (lg[sb] * (LOG2 / LOG10));
         }
     }
 
@@ -564,7 +617,8 @@ pecalc_l(III_psy_ratio const *mr, FLOAT masking_lower)
 
 
 static void
-calc_energy(PsyConst_CB2SB_t const *l, FLOAT const *fftenergy, FLOAT * eb, FLOAT * max, FLOAT * avg)
+energy_core_c(PsyConst_CB2SB_t const *l, FLOAT const *fftenergy, FLOAT * eb, FLOAT * max,
+              FLOAT * avg)
 {
     int     b, j;
 
@@ -666,9 +720,10 @@ static void
 vbrpsy_compute_fft_l(lame_internal_flags * gfc, const sample_t * const buffer[2], int chn,
                      int gr_out, FLOAT fftenergy[HBLKSIZE], FLOAT(*wsamp_l)[BLKSIZE])
 {
-    SessionConfig_t const *const cfg = &gfc->cfg;
     PsyStateVar_t *psv = &gfc->sv_psy;
-    plotting_data *plt = cfg->analysis ? gfc->pinfo : 0;
+#ifndef NOANALYSIS
+    plotting_data *plt = gfc->cfg.analysis ? gfc->pinfo : 0;
+#endif
     int     j;
 
     if (chn < 2) {
@@ -705,12 +760,16 @@ vbrpsy_compute_fft_l(lame_internal_flags * gfc, const sample_t * const buffer[2]
         psv->tot_ener[chn] = totalenergy;
     }
 
+#ifndef NOANALYSIS
     if (plt) {
         for (j = 0; j < HBLKSIZE; j++) {
             plt->energy[gr_out][chn][j] = plt->energy_save[chn][j];
             plt->energy_save[chn][j] = fftenergy[j];
         }
     }
+#else
+    (void) gr_out;
+#endif
 }
 
 
@@ -757,10 +816,184 @@ vbrpsy_compute_loudness_approximation_l(lame_internal_flags * gfc, int gr_out, i
     PsyStateVar_t *psv = &gfc->sv_psy;
     if (chn < 2) {      /*no loudness for mid/side ch */
         gfc->ov_psy.loudness_sq[gr_out][chn] = psv->loudness_sq_save[chn];
-        psv->loudness_sq_save[chn] = psycho_loudness_approx(fftenergy, gfc->ATH->eql_w);
+        psv->loudness_sq_save[chn] = psycho_loudness_approx(gfc, fftenergy);
+    }
+}
+
+
+/* high pass filter of fs/4 for the attack detection: the outer taps of a
+ * symmetric NSFIRLEN tap FIR, the centre tap is 1 */
+static const FLOAT fircoef[] = {
+    -8.65163e-18 * 2, -0.00851586 * 2, -6.74764e-18 * 2, 0.0209036 * 2,
+    -3.36639e-17 * 2, -0.0438162 * 2, -1.54175e-17 * 2, 0.0931738 * 2,
+    -5.52212e-17 * 2, -0.313819 * 2
+};
+
+/* BEND: the largest |x| of each of the 9 sub short blocks of x, at least 1 */
+static void
+attack_peaks(const FLOAT * x, FLOAT peak[9])
+{
+    int     i, k;
+    for (i = 0; i < 9; i++) {
+        FLOAT   p = 1.;
+        for (k = 0; k < 576 / 9; k++, x++)
+            if (p < fabs(*x))
+                p = fabs(*x);
+        peak[i] = p;
+    }
+}
+
+/* BEND: the kernels behind gfc->attack_hpf_core and attack_ms_core, see
+ * vector/psy_simd.c for the SIMD ones */
+void
+attack_hpf_core_c(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak)
+{
+    int     i, j;
+    /* unroll the loop 2 times */
+    for (i = 0; i < 576; i++) {
+        FLOAT   sum1, sum2;
+        sum1 = firbuf[i + 10];
+        sum2 = 0.0;
+        for (j = 0; j < ((NSFIRLEN - 1) / 2) - 1; j += 2) {
+            sum1 += coef[j] * (firbuf[i + j] + firbuf[i + NSFIRLEN - j]);
+            sum2 += coef[j + 1] * (firbuf[i + j + 1] + firbuf[i + NSFIRLEN - j - 1]);
+        }
+        hp[i] = sum1 + sum2;
+    }
+    attack_peaks(hp, peak);
+}
+
+void
+attack_ms_core_c(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s)
+{
+    int     i, k;
+    for (i = 0; i < 9; i++) {
+        FLOAT   pm = 1., ps = 1.;
+        for (k = 0; k < 576 / 9; k++, l++, r++) {
+            FLOAT const m = *l + *r;
+            FLOAT const s = *l - *r;
+            if (pm < fabs(m))
+                pm = fabs(m);
+            if (ps < fabs(s))
+                ps = fabs(s);
+        }
+        peak_m[i] = pm;
+        peak_s[i] = ps;
     }
 }
 
+/* BEND: the kernel behind gfc->spread_core, see vector/psy_simd.c for
+ * the SIMD ones */
+static void
+spread_core_c(PsyConst_t const *cd, PsyConst_CB2SB_t const *gd, const FLOAT * eb,
+              const FLOAT * wt, const int *delta, int b_lim, FLOAT * ecb)
+{
+    int     b, j = 0;
+    (void) cd;
+    for (b = 0; b < b_lim; b++) {
+        int     kk = gd->s3ind[b][0];
+        int const last = gd->s3ind[b][1];
+        FLOAT   e = gd->s3[j] * eb[kk] * wt[kk];
+        for (++j, ++kk; kk <= last; ++j, ++kk)
+            e = vbrpsy_mask_add(e, gd->s3[j] * eb[kk] * wt[kk], kk - b, delta[b]);
+        ecb[b] = e;
+    }
+}
+
+static void
+psymodel_core_init(lame_internal_flags * gfc)
+{
+    gfc->attack_hpf_core = attack_hpf_core_c;
+    gfc->attack_ms_core = attack_ms_core_c;
+    gfc->spread_core = spread_core_c;
+    gfc->energy_core = energy_core_c;
+    gfc->p2s_core = p2s_core_c;
+    gfc->pe_core = pe_core_c;
+    gfc->loudness_core = loudness_core_c;
+#ifdef LAME_INTRIN_SSE
+    if (gfc->CPU_features.SSE2) {
+        gfc->attack_hpf_core = attack_hpf_core_SSE2;
+        gfc->attack_ms_core = attack_ms_core_SSE2;
+        gfc->energy_core = energy_core_SSE2;
+        gfc->p2s_core = p2s_core_SSE2;
+#ifdef USE_FAST_LOG
+        gfc->pe_core = pe_core_SSE2;
+#endif
+        gfc->loudness_core = loudness_core_SSE2;
+        /* spreading stays scalar: four lanes don't pay for the divide
+         * and the selects over the early outs of vbrpsy_mask_add */
+    }
+#endif
+#ifdef LAME_INTRIN_AVX
+    if (gfc->CPU_features.AVX2) {
+        gfc->attack_hpf_core = attack_hpf_core_AVX2;
+        gfc->attack_ms_core = attack_ms_core_AVX2;
+        gfc->spread_core = spread_core_AVX2;
+        gfc->energy_core = energy_core_AVX2;
+        gfc->p2s_core = p2s_core_AVX2;
+#ifdef USE_FAST_LOG
+        gfc->pe_core = pe_core_AVX2;
+#endif
+        gfc->loudness_core = loudness_core_AVX2;
+    }
+#endif
+#ifdef LAME_INTRIN_NEON
+    if (gfc->CPU_features.NEON) {
+        gfc->attack_hpf_core = attack_hpf_core_NEON;
+        gfc->attack_ms_core = attack_ms_core_NEON;
+        gfc->energy_core = energy_core_NEON;
+        gfc->p2s_core = p2s_core_NEON;
+#ifdef USE_FAST_LOG
+        gfc->pe_core = pe_core_NEON;
+#endif
+        gfc->loudness_core = loudness_core_NEON;
+#if defined(__aarch64__) || defined(_M_ARM64)
+        gfc->spread_core = spread_core_NEON; /* needs vdivq_f32 */
+#endif
+    }
+#endif
+}
+
+#ifdef FISH_TEST_HOOKS
+/* BEND: the kernels gfc picked, on the long (0), short (1) or long to
+ * short (2) partitions of gfc->cd_psy; for Tests/LameKernels.cpp */
+static PsyConst_CB2SB_t const *
+psymodel_partitions(lame_internal_flags const *gfc, int which)
+{
+    if (which == 1)
+        return &gfc->cd_psy->s;
+    if (which == 2)
+        return &gfc->cd_psy->l_to_s;
+    return &gfc->cd_psy->l;
+}
+
+void
+psymodel_energy_lines(lame_internal_flags const *gfc, int which, const FLOAT * fftenergy,
+                      FLOAT * eb, FLOAT * max, FLOAT * avg)
+{
+    gfc->energy_core(psymodel_partitions(gfc, which), fftenergy, eb, max, avg);
+}
+
+void
+psymodel_p2s_lines(lame_internal_flags const *gfc, int which, const FLOAT * eb,
+                   const FLOAT * thr, FLOAT * enn, FLOAT * thm)
+{
+    gfc->p2s_core(psymodel_partitions(gfc, which), eb, thr, enn, thm);
+}
+
+void
+psymodel_pe_lines(lame_internal_flags const *gfc, const FLOAT * en, const FLOAT * thm,
+                  FLOAT masking_lower, int n, FLOAT * lg)
+{
+    pe_log2(gfc, en, thm, masking_lower, n, lg);
+}
+
+FLOAT
+psymodel_loudness_lines(lame_internal_flags const *gfc, const FLOAT * energy)
+{
+    return gfc->loudness_core(energy, gfc->ATH->eql_w);
+}
+#endif /* FISH_TEST_HOOKS */
 
     /**********************************************************************
     *  Apply HPF of fs/4 to the input signal.
@@ -773,36 +1006,24 @@ vbrpsy_attack_detection(lame_internal_flags * gfc, const sample_t * const buffer
                         int uselongblock[2])
 {
     FLOAT   ns_hpfsmpl[2][576];
+    FLOAT   ns_peak[4][9];
     SessionConfig_t const *const cfg = &gfc->cfg;
     PsyStateVar_t *const psv = &gfc->sv_psy;
+#ifndef NOANALYSIS
     plotting_data *plt = cfg->analysis ? gfc->pinfo : 0;
+#endif
     int const n_chn_out = cfg->channels_out;
     /* chn=2 and 3 = Mid and Side channels */
     int const n_chn_psy = (cfg->mode == JOINT_STEREO) ? 4 : n_chn_out;
-    int     chn, i, j;
+    int     chn, i;
 
-    memset(&ns_hpfsmpl[0][0], 0, sizeof(ns_hpfsmpl));
     /* Don't copy the input buffer into a temporary buffer */
-    /* unroll the loop 2 times */
     for (chn = 0; chn < n_chn_out; chn++) {
-        static const FLOAT fircoef[] = {
-            -8.65163e-18 * 2, -0.00851586 * 2, -6.74764e-18 * 2, 0.0209036 * 2,
-            -3.36639e-17 * 2, -0.0438162 * 2, -1.54175e-17 * 2, 0.0931738 * 2,
-            -5.52212e-17 * 2, -0.313819 * 2
-        };
         /* apply high pass filter of fs/4 */
         const sample_t *const firbuf = &buffer[chn][576 - 350 - NSFIRLEN + 192];
         assert(dimension_of(fircoef) == ((NSFIRLEN - 1) / 2));
-        for (i = 0; i < 576; i++) {
-            FLOAT   sum1, sum2;
-            sum1 = firbuf[i + 10];
-            sum2 = 0.0;
-            for (j = 0; j < ((NSFIRLEN - 1) / 2) - 1; j += 2) {
-                sum1 += fircoef[j] * (firbuf[i + j] + firbuf[i + NSFIRLEN - j]);
-                sum2 += fircoef[j + 1] * (firbuf[i + j + 1] + firbuf[i + NSFIRLEN - j - 1]);
-            }
-            ns_hpfsmpl[chn][i] = sum1 + sum2;
-        }
+        /* BEND: with the sub short block peaks in the same pass */
+        gfc->attack_hpf_core(firbuf, fircoef, ns_hpfsmpl[chn], ns_peak[chn]);
         masking_ratio[gr_out][chn].en = psv->en[chn];
         masking_ratio[gr_out][chn].thm = psv->thm[chn];
         if (n_chn_psy > 2) {
@@ -812,21 +1033,14 @@ vbrpsy_attack_detection(lame_internal_flags * gfc, const sample_t * const buffer
             masking_MS_ratio[gr_out][chn].thm = psv->thm[chn + 2];
         }
     }
+    if (n_chn_psy > 2)
+        gfc->attack_ms_core(ns_hpfsmpl[0], ns_hpfsmpl[1], ns_peak[2], ns_peak[3]);
     for (chn = 0; chn < n_chn_psy; chn++) {
         FLOAT   attack_intensity[12];
         FLOAT   en_subshort[12];
         FLOAT   en_short[4] = { 0, 0, 0, 0 };
-        FLOAT const *pf = ns_hpfsmpl[chn & 1];
         int     ns_uselongblock = 1;
 
-        if (chn == 2) {
-            for (i = 0, j = 576; j > 0; ++i, --j) {
-                FLOAT const l = ns_hpfsmpl[0][i];
-                FLOAT const r = ns_hpfsmpl[1][i];
-                ns_hpfsmpl[0][i] = l + r;
-                ns_hpfsmpl[1][i] = l - r;
-            }
-        }
         /*************************************************************** 
         * determine the block type (window type)
         ***************************************************************/
@@ -839,11 +1053,7 @@ vbrpsy_attack_detection(lame_internal_flags * gfc, const sample_t * const buffer
         }
 
         for (i = 0; i < 9; i++) {
-            FLOAT const *const pfe = pf + 576 / 9;
-            FLOAT   p = 1.;
-            for (; pf < pfe; pf++)
-                if (p < fabs(*pf))
-                    p = fabs(*pf);
+            FLOAT   p = ns_peak[chn][i];
             psv->last_en_subshort[chn][i] = en_subshort[i + 3] = p;
             en_short[1 + i / 3] += p;
             if (p > en_subshort[i + 3 - 2]) {
@@ -874,6 +1084,7 @@ vbrpsy_attack_detection(lame_internal_flags * gfc, const sample_t * const buffer
             sub_short_factor[chn][i] = factor;
         }
 
+#ifndef NOANALYSIS
         if (plt) {
             FLOAT   x = attack_intensity[0];
             for (i = 1; i < 12; i++) {
@@ -884,6 +1095,7 @@ vbrpsy_attack_detection(lame_internal_flags * gfc, const sample_t * const buffer
             plt->ers[gr_out][chn] = plt->ers_save[chn];
             plt->ers_save[chn] = x;
         }
+#endif
 
         /* compare energies between sub-shortblocks */
         {
@@ -1038,57 +1250,103 @@ vbrpsy_calc_mask_index_s(lame_internal_flags const *gfc, FLOAT const *max,
 }
 
 
+/* BEND: the partitions that feed scalefactor bands below bw_sfb, see
+ * calc_bandwidth_limits */
+static int
+vbrpsy_partition_limit(PsyConst_CB2SB_t const *gd, int bw_sfb)
+{
+    if (bw_sfb >= gd->n_sb)
+        return gd->npart;
+    if (bw_sfb <= 0)
+        return 0;
+    return Min(gd->bo[bw_sfb - 1] + 1, gd->npart);
+}
+
+/* BEND: convolve the partitioned energy eb with the spreading function
+ * for the partitions b < b_lim, into ecb.  Each term is weighted by the
+ * masking table entry of its masker and mask_add'ed to the ones before. */
+static void
+vbrpsy_spread(lame_internal_flags const *gfc, PsyConst_CB2SB_t const *gd, FLOAT const *eb,
+              unsigned char const *mask_idx, int b_lim, FLOAT * ecb)
+{
+    /* eb and the weights, with zeros either side for the SIMD kernels */
+    FLOAT   ebp[3 * CBANDS], wtp[3 * CBANDS];
+    int     delta[CBANDS];
+    int const n = gd->npart;
+    int     b;
+
+    for (b = gd->s3_lo; b < 0; b++)
+        ebp[CBANDS + b] = wtp[CBANDS + b] = 0;
+    for (b = 0; b < n; b++) {
+        ebp[CBANDS + b] = eb[b];
+        wtp[CBANDS + b] = tab[mask_idx[b]];
+        delta[b] = mask_add_delta(mask_idx[b]);
+    }
+    for (; b < CBANDS; b++)
+        delta[b] = 0;
+    for (b = n; b < CBANDS + gd->s3_hi; b++)
+        ebp[CBANDS + b] = wtp[CBANDS + b] = 0;
+    gfc->spread_core(gfc->cd_psy, gd, ebp + CBANDS, wtp + CBANDS, delta, b_lim, ecb);
+}
+
+#ifdef FISH_TEST_HOOKS
+/* BEND: vbrpsy_spread over all the long (0) or short (1) partitions,
+ * returning how many there are; for Tests/LameKernels.cpp */
+int
+psymodel_spread_lines(lame_internal_flags const *gfc, int which, const FLOAT * eb,
+                      const unsigned char *mask_idx, FLOAT * ecb)
+{
+    PsyConst_CB2SB_t const *const gd = psymodel_partitions(gfc, which);
+    assert(which == 0 || which == 1);
+    vbrpsy_spread(gfc, gd, eb, mask_idx, gd->npart, ecb);
+    return gd->npart;
+}
+
+/* BEND: mask_add_index of n ratios in [1, ma_max_i1), and how many of the
+ * first 9 cd_psy->mask_add_ratio thresholds each one reaches */
+void
+psymodel_mask_add_index_lines(lame_internal_flags const *gfc, const FLOAT * ratio, int n,
+                              int *index, int *reached)
+{
+    FLOAT const *const th = gfc->cd_psy->mask_add_ratio;
+    int     k, i;
+    for (k = 0; k < n; k++) {
+        assert(ratio[k] >= 1 && ratio[k] < ma_max_i1);
+        index[k] = mask_add_index(ratio[k]);
+        reached[k] = 0;
+        for (i = 0; i < 9; i++)
+            reached[k] += ratio[k] >= th[i];
+    }
+}
+#endif /* FISH_TEST_HOOKS */
+
 static void
 vbrpsy_compute_masking_s(lame_internal_flags * gfc, const FLOAT(*fftenergy_s)[HBLKSIZE_s],
                          FLOAT * eb, FLOAT * thr, int chn, int sblock)
 {
     PsyStateVar_t *const psv = &gfc->sv_psy;
     PsyConst_CB2SB_t const *const gds = &gfc->cd_psy->s;
-    FLOAT   max[CBANDS], avg[CBANDS];
-    int     i, j, b;
+    FLOAT   max[CBANDS], avg[CBANDS], spread[CBANDS];
+    int     b, b_lim;
     unsigned char mask_idx_s[CBANDS];
 
     memset(max, 0, sizeof(max));
     memset(avg, 0, sizeof(avg));
 
-    for (b = j = 0; b < gds->npart; ++b) {
-        FLOAT   ebb = 0, m = 0;
-        int const n = gds->numlines[b];
-        for (i = 0; i < n; ++i, ++j) {
-            FLOAT const el = fftenergy_s[sblock][j];
-            ebb += el;
-            if (m < el)
-                m = el;
-        }
-        eb[b] = ebb;
-        assert(ebb >= 0);
-        max[b] = m;
-        assert(n > 0);
-        avg[b] = ebb * gds->rnumlines[b];
-        assert(avg[b] >= 0);
-    }
-    assert(b == gds->npart);
-    assert(j == 129);
+    gfc->energy_core(gds, fftenergy_s[sblock], eb, max, avg); /* BEND */
     vbrpsy_calc_mask_index_s(gfc, max, avg, mask_idx_s);
-    for (j = b = 0; b < gds->npart; b++) {
+    b_lim = vbrpsy_partition_limit(gds, gfc->sv_qnt.bw_sfb_s);
+    vbrpsy_spread(gfc, gds, eb, mask_idx_s, b_lim, spread);
+    for (b = 0; b < b_lim; b++) {
         int     kk = gds->s3ind[b][0];
         int const last = gds->s3ind[b][1];
-        int const delta = mask_add_delta(mask_idx_s[b]);
         int     dd, dd_n;
         FLOAT   x, ecb, avg_mask;
         FLOAT const masking_lower = gds->masking_lower[b] * gfc->sv_qnt.masking_lower;
 
-        dd = mask_idx_s[kk];
-        dd_n = 1;
-        ecb = gds->s3[j] * eb[kk] * tab[mask_idx_s[kk]];
-        ++j, ++kk;
-        while (kk <= last) {
+        for (dd = 0, dd_n = 0; kk <= last; ++kk, ++dd_n)
             dd += mask_idx_s[kk];
-            dd_n += 1;
-            x = gds->s3[j] * eb[kk] * tab[mask_idx_s[kk]];
-            ecb = vbrpsy_mask_add(ecb, x, kk - b, delta);
-            ++j, ++kk;
-        }
+        ecb = spread[b];
         dd = (1 + 2 * dd) / (2 * dd_n);
         avg_mask = tab[dd] * 0.5f;
         ecb *= avg_mask;
@@ -1134,6 +1392,11 @@ vbrpsy_compute_masking_s(lame_internal_flags * gfc, const FLOAT(*fftenergy_s)[HB
 
         assert(thr[b] >= 0);
     }
+    /* BEND: above the lowpass nothing gets quantized, nor counted in pe */
+    for (; b < gds->npart; b++) {
+        thr[b] = 0;
+        psv->nb_s1[chn][b] = psv->nb_s2[chn][b] = 0;
+    }
     for (; b < CBANDS; ++b) {
         eb[b] = 0;
         thr[b] = 0;
@@ -1147,49 +1410,34 @@ vbrpsy_compute_masking_l(lame_internal_flags * gfc, const FLOAT fftenergy[HBLKSI
 {
     PsyStateVar_t *const psv = &gfc->sv_psy;
     PsyConst_CB2SB_t const *const gdl = &gfc->cd_psy->l;
-    FLOAT   max[CBANDS], avg[CBANDS];
+    FLOAT   max[CBANDS], avg[CBANDS], spread[CBANDS];
     unsigned char mask_idx_l[CBANDS + 2];
-    int     k, b;
+    int     b, b_lim;
 
  /*********************************************************************
     *    Calculate the energy and the tonality of each partition.
  *********************************************************************/
-    calc_energy(gdl, fftenergy, eb_l, max, avg);
+    gfc->energy_core(gdl, fftenergy, eb_l, max, avg); /* BEND */
     calc_mask_index_l(gfc, max, avg, mask_idx_l);
 
  /*********************************************************************
     *      convolve the partitioned energy and unpredictability
     *      with the spreading function, s3_l[b][k]
  ********************************************************************/
-    k = 0;
-    for (b = 0; b < gdl->npart; b++) {
-        FLOAT   x, ecb, avg_mask, t;
+    b_lim = Max(vbrpsy_partition_limit(gdl, gfc->sv_qnt.bw_sfb_l),
+                vbrpsy_partition_limit(&gfc->cd_psy->l_to_s, gfc->sv_qnt.bw_sfb_s));
+    vbrpsy_spread(gfc, gdl, eb_l, mask_idx_l, b_lim, spread);
+    for (b = 0; b < b_lim; b++) {
+        FLOAT   x, ecb, avg_mask;
         FLOAT const masking_lower = gdl->masking_lower[b] * gfc->sv_qnt.masking_lower;
         /* convolve the partitioned energy with the spreading function */
         int     kk = gdl->s3ind[b][0];
         int const last = gdl->s3ind[b][1];
-        int const delta = mask_add_delta(mask_idx_l[b]);
-        int     dd = 0, dd_n = 0;
-
-        dd = mask_idx_l[kk];
-        dd_n += 1;
-        ecb = gdl->s3[k] * eb_l[kk] * tab[mask_idx_l[kk]];
-        ++k, ++kk;
-        while (kk <= last) {
+        int     dd, dd_n;
+
+        for (dd = 0, dd_n = 0; kk <= last; ++kk, ++dd_n)
             dd += mask_idx_l[kk];
-            dd_n += 1;
-            x = gdl->s3[k] * eb_l[kk] * tab[mask_idx_l[kk]];
-            t = vbrpsy_mask_add(ecb, x, kk - b, delta);
-#if 0
-            ecb += eb_l[kk];
-            if (ecb > t) {
-                ecb = t;
-            }
-#else
-            ecb = t;
-#endif
-            ++k, ++kk;
-        }
+        ecb = spread[b];
         dd = (1 + 2 * dd) / (2 * dd_n);
         avg_mask = tab[dd] * 0.5f;
         ecb *= avg_mask;
@@ -1265,6 +1513,11 @@ vbrpsy_compute_masking_l(lame_internal_flags * gfc, const FLOAT fftenergy[HBLKSI
         }
         assert(thr[b] >= 0);
     }
+    /* BEND: above the lowpass nothing gets quantized, nor counted in pe */
+    for (; b < gdl->npart; b++) {
+        thr[b] = 0;
+        psv->nb_l1[chn][b] = psv->nb_l2[chn][b] = 0;
+    }
     for (; b < CBANDS; ++b) {
         eb_l[b] = 0;
         thr[b] = 0;
@@ -1329,6 +1582,50 @@ vbrpsy_apply_block_type(PsyStateVar_t * psv, int nch, int const *uselongblock, i
 }
 
 
+static void
+vbrpsy_compute_pe(lame_internal_flags * gfc, int gr_out, int n_chn_psy,
+                  III_psy_ratio const masking_ratio[2][2],
+                  III_psy_ratio const masking_MS_ratio[2][2], int const blocktype_d[2],
+                  FLOAT percep_entropy[2], FLOAT percep_MS_entropy[2])
+{
+#ifndef NOANALYSIS
+    plotting_data *plt = gfc->cfg.analysis ? gfc->pinfo : 0;
+#endif
+    int     chn;
+
+    for (chn = 0; chn < n_chn_psy; chn++) {
+        FLOAT  *ppe;
+        int     type;
+        III_psy_ratio const *mr;
+
+        if (chn > 1) {
+            ppe = percep_MS_entropy - 2;
+            type = NORM_TYPE;
+            if (blocktype_d[0] == SHORT_TYPE || blocktype_d[1] == SHORT_TYPE)
+                type = SHORT_TYPE;
+            mr = &masking_MS_ratio[gr_out][chn - 2];
+        }
+        else {
+            ppe = percep_entropy;
+            type = blocktype_d[chn];
+            mr = &masking_ratio[gr_out][chn];
+        }
+        if (type == SHORT_TYPE) {
+            ppe[chn] = pecalc_s(gfc, mr, gfc->sv_qnt.masking_lower);
+        }
+        else {
+            ppe[chn] = pecalc_l(gfc, mr, gfc->sv_qnt.masking_lower);
+        }
+
+#ifndef NOANALYSIS
+        if (plt) {
+            plt->pe[gr_out][chn] = ppe[chn];
+        }
+#endif
+    }
+}
+
+
 /*************************************************************** 
  * compute M/S thresholds from Johnston & Ferreira 1992 ICASSP paper
  ***************************************************************/
@@ -1416,7 +1713,6 @@ L3psycho_anal_vbr(lame_internal_flags * gfc,
     PsyStateVar_t *const psv = &gfc->sv_psy;
     PsyConst_CB2SB_t const *const gdl = &gfc->cd_psy->l;
     PsyConst_CB2SB_t const *const gds = &gfc->cd_psy->s;
-    plotting_data *plt = cfg->analysis ? gfc->pinfo : 0;
 
     III_psy_xmin last_thm[4];
 
@@ -1575,34 +1871,357 @@ L3psycho_anal_vbr(lame_internal_flags * gfc,
     /*********************************************************************
     * compute the value of PE to return ... no delay and advance
     *********************************************************************/
+    vbrpsy_compute_pe(gfc, gr_out, n_chn_psy, masking_ratio, masking_MS_ratio,
+                      blocktype_d, percep_entropy, percep_MS_entropy);
+    return 0;
+}
+
+
+// BEND
+/*
+ * Cheap psychoacoustic model for Fish.
+ *
+ * Fish clamps the bit budget of each channel far below anything the full
+ * model asks for, so most of what L3psycho_anal_vbr computes gets overruled
+ * in CBR_iteration_loop anyway.  This model does no FFTs and no spreading
+ * function convolution:
+ *  - band energies follow a first order (spectral tilt) fit of the granule,
+ *  - thresholds sit a fixed distance below the band energy, spread to the
+ *    neighbouring bands with a cheap recursive slope,
+ *  - block switching only looks at the peaks of the first difference signal.
+ * Output keeps the one granule delay of L3psycho_anal_vbr.
+ */
+
+/* same 576 samples the attack detection of L3psycho_anal_vbr looks at */
+#define FISH_PSY_OFFSET (576 - 350 - NSFIRLEN + 192 + (NSFIRLEN - 1) / 2)
+
+#define FISH_PSY_SMR         0.0630957f /* threshold 12 dB below band energy */
+#define FISH_PSY_SPREAD_UP   0.0316228f /* -15 dB per band towards high bands */
+#define FISH_PSY_SPREAD_DOWN 0.0019953f /* -27 dB per band towards low bands */
+#define FISH_PSY_MAX_TILT    0.98f
+#define FISH_PSY_ATTACK_MIN  200.f      /* ignore attacks below about -44 dB */
+
+/* loudness^2 approximation, ~3 for full scale binary noise like psycho_loudness_approx */
+#define FISH_PSY_VO_SCALE    (3. / (576. * 32767. * 32767.))
+
+static void
+fish_psy_spread_thm(FLOAT * thm, int n)
+{
+    int     sb;
+    for (sb = 1; sb < n; ++sb) {
+        FLOAT const t = thm[sb - 1] * FISH_PSY_SPREAD_UP;
+        if (thm[sb] < t)
+            thm[sb] = t;
+    }
+    for (sb = n - 2; sb >= 0; --sb) {
+        FLOAT const t = thm[sb + 1] * FISH_PSY_SPREAD_DOWN;
+        if (thm[sb] < t)
+            thm[sb] = t;
+    }
+}
+
+static void
+fish_psy_spread(FLOAT const *cos_w, FLOAT const *width, int n, FLOAT rho, FLOAT energy,
+                FLOAT * enn, FLOAT * thm)
+{
+    /* normalized power spectrum of a first order AR process */
+    FLOAT const num = 1.f - rho * rho;
+    FLOAT const den = 1.f + rho * rho;
+    int     sb;
+
+    for (sb = 0; sb < n; ++sb) {
+        FLOAT const shape = num / (den - 2.f * rho * cos_w[sb]);
+        enn[sb] = energy * shape * width[sb];
+        thm[sb] = enn[sb] * FISH_PSY_SMR;
+    }
+    fish_psy_spread_thm(thm, n);
+}
+
+/* time domain pass shared by the cheap models: sub-shortblock energies,
+ * spectral tilt, loudness and attack detection.  returns 1 on attack */
+static int
+fish_psy_time_analysis(lame_internal_flags * gfc, const sample_t * const buffer[2], int gr_out,
+                       int chn, FLOAT en_short[3], FLOAT * tilt)
+{
+    PsyStateVar_t *const psv = &gfc->sv_psy;
+    FLOAT const attack_threshold = gfc->cd_psy->attack_threshold[chn];
+    FLOAT   x[576 + 1];
+    FLOAT   peak[2 + 9];
+    FLOAT   e0, r1 = 0, rho = 0;
+    int     attack = 0;
+    int     i, j;
+
+    if (chn < 2) {
+        sample_t const *const p = buffer[chn] + FISH_PSY_OFFSET - 1;
+        for (i = 0; i <= 576; i++)
+            x[i] = p[i];
+    }
+    else {
+        FLOAT const sqrt2_half = SQRT2 * 0.5f;
+        FLOAT const sign = (chn == 2) ? 1.f : -1.f;
+        sample_t const *const l = buffer[0] + FISH_PSY_OFFSET - 1;
+        sample_t const *const r = buffer[1] + FISH_PSY_OFFSET - 1;
+        for (i = 0; i <= 576; i++)
+            x[i] = (l[i] + sign * r[i]) * sqrt2_half;
+    }
+
+    /* energies, lag one correlation and sub-shortblock peaks in one pass */
+    en_short[0] = en_short[1] = en_short[2] = 0;
+    peak[0] = psv->last_en_subshort[chn][7];
+    peak[1] = psv->last_en_subshort[chn][8];
+    for (i = 0; i < 9; i++) {
+        FLOAT   p = 1.f, e = 0;
+        for (j = i * 64 + 1; j <= i * 64 + 64; j++) {
+            FLOAT const d = fabs(x[j] - x[j - 1]);
+            if (p < d)
+                p = d;
+            e += x[j] * x[j];
+            r1 += x[j] * x[j - 1];
+        }
+        en_short[i / 3] += e;
+        peak[i + 2] = p;
+        psv->last_en_subshort[chn][i] = p;
+        if (p > FISH_PSY_ATTACK_MIN && p > attack_threshold * peak[i])
+            attack |= (i < 6) ? 1 : 2;
+    }
+    if (psv->last_attacks[chn] == 3)
+        attack |= 1;
+    psv->last_attacks[chn] = (attack & 2) ? 3 : 0;
+
+    e0 = en_short[0] + en_short[1] + en_short[2];
+    if (e0 > 1e-12f) {
+        rho = r1 / e0;
+        if (rho > FISH_PSY_MAX_TILT)
+            rho = FISH_PSY_MAX_TILT;
+        if (rho < -FISH_PSY_MAX_TILT)
+            rho = -FISH_PSY_MAX_TILT;
+    }
+    *tilt = rho;
+
+    if (chn < 2) {
+        gfc->ov_psy.loudness_sq[gr_out][chn] = psv->loudness_sq_save[chn];
+        psv->loudness_sq_save[chn] = e0 * FISH_PSY_VO_SCALE;
+    }
+    return attack != 0;
+}
+
+static void
+fish_psy_use_attack(int chn, int attack, int uselongblock[2])
+{
+    if (chn < 2) {
+        uselongblock[chn] = !attack;
+    }
+    else if (attack) {
+        uselongblock[0] = uselongblock[1] = 0;
+    }
+}
+
+int
+L3psycho_anal_fish(lame_internal_flags * gfc,
+                   const sample_t * const buffer[2], int gr_out,
+                   III_psy_ratio masking_ratio[2][2],
+                   III_psy_ratio masking_MS_ratio[2][2],
+                   FLOAT percep_entropy[2], FLOAT percep_MS_entropy[2],
+                   FLOAT energy[4], int blocktype_d[2])
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    PsyStateVar_t *const psv = &gfc->sv_psy;
+    PsyConst_t const *const gd = gfc->cd_psy;
+    int const n_chn_out = cfg->channels_out;
+    /* chn=2 and 3 = Mid and Side channels */
+    int const n_chn_psy = (cfg->mode == JOINT_STEREO) ? 4 : n_chn_out;
+    int     uselongblock[2] = { 1, 1 };
+    int     chn, sb, sblock;
+
+    /* there is a one granule delay.  Copy maskings computed last call
+     * into masking_ratio to return to calling program.
+     */
+    for (chn = 0; chn < n_chn_out; chn++) {
+        masking_ratio[gr_out][chn].en = psv->en[chn];
+        masking_ratio[gr_out][chn].thm = psv->thm[chn];
+        if (n_chn_psy > 2) {
+            masking_MS_ratio[gr_out][chn].en = psv->en[chn + 2];
+            masking_MS_ratio[gr_out][chn].thm = psv->thm[chn + 2];
+        }
+    }
+
     for (chn = 0; chn < n_chn_psy; chn++) {
-        FLOAT  *ppe;
-        int     type;
-        III_psy_ratio const *mr;
+        FLOAT   en_short[3], enn[SBMAX_s], thm[SBMAX_s];
+        FLOAT   rho, e0;
+        int const attack = fish_psy_time_analysis(gfc, buffer, gr_out, chn, en_short, &rho);
 
-        if (chn > 1) {
-            ppe = percep_MS_entropy - 2;
-            type = NORM_TYPE;
-            if (blocktype_d[0] == SHORT_TYPE || blocktype_d[1] == SHORT_TYPE)
-                type = SHORT_TYPE;
-            mr = &masking_MS_ratio[gr_out][chn - 2];
+        e0 = en_short[0] + en_short[1] + en_short[2];
+        energy[chn] = psv->tot_ener[chn];
+        psv->tot_ener[chn] = e0;
+
+        fish_psy_spread(gd->fish_cos_l, gd->fish_width_l, SBMAX_l, rho, e0,
+                        psv->en[chn].l, psv->thm[chn].l);
+        for (sblock = 0; sblock < 3; sblock++) {
+            fish_psy_spread(gd->fish_cos_s, gd->fish_width_s, SBMAX_s, rho, en_short[sblock],
+                            enn, thm);
+            for (sb = 0; sb < SBMAX_s; sb++) {
+                psv->en[chn].s[sb][sblock] = enn[sb];
+                psv->thm[chn].s[sb][sblock] = thm[sb];
+            }
         }
-        else {
-            ppe = percep_entropy;
-            type = blocktype_d[chn];
-            mr = &masking_ratio[gr_out][chn];
+        fish_psy_use_attack(chn, attack, uselongblock);
+    }
+
+    vbrpsy_compute_block_type(cfg, uselongblock);
+    vbrpsy_apply_block_type(psv, n_chn_out, uselongblock, blocktype_d);
+    vbrpsy_compute_pe(gfc, gr_out, n_chn_psy, masking_ratio, masking_MS_ratio,
+                      blocktype_d, percep_entropy, percep_MS_entropy);
+    return 0;
+}
+
+
+// BEND
+/*
+ * MDCT domain psychoacoustic model.
+ *
+ * Runs in two steps around mdct_sub48, so there are no psymodel FFTs at all:
+ *  - L3psycho_anal_mdct_blocktype, before the MDCT, only decides the block
+ *    types from the time signal (same pass as the cheap model),
+ *  - L3psycho_anal_mdct, after the MDCT, derives band energies and
+ *    thresholds from the very spectrum that gets quantized.  A cheap MDST
+ *    estimate from the neighbouring lines smooths out the phase dependency
+ *    of the MDCT power, and the peak to mean ratio of each band picks the
+ *    masking offset between noise like (6 dB) and tonal (18 dB).
+ * As the spectrum is the current granule's, there is no granule delay.
+ */
+
+#define MDCT_PSY_NOISE_OFFSET 0.2511886f /* -6 dB */
+#define MDCT_PSY_TONE_OFFSET  0.0158489f /* -18 dB */
+
+int
+L3psycho_anal_mdct_blocktype(lame_internal_flags * gfc,
+                             const sample_t * const buffer[2], int gr_out, int blocktype_d[2])
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    int const n_chn_out = cfg->channels_out;
+    int const n_chn_psy = (cfg->mode == JOINT_STEREO) ? 4 : n_chn_out;
+    int     uselongblock[2] = { 1, 1 };
+    int     chn;
+
+    for (chn = 0; chn < n_chn_psy; chn++) {
+        FLOAT   en_short[3], rho;
+        int const attack = fish_psy_time_analysis(gfc, buffer, gr_out, chn, en_short, &rho);
+        fish_psy_use_attack(chn, attack, uselongblock);
+    }
+    vbrpsy_compute_block_type(cfg, uselongblock);
+    vbrpsy_apply_block_type(&gfc->sv_psy, n_chn_out, uselongblock, blocktype_d);
+    return 0;
+}
+
+/* energy and threshold of lines [start,end) taken every step'th line */
+static void
+mdct_psy_band(FLOAT const *xr, int start, int end, int step, FLOAT * enn, FLOAT * thm)
+{
+    FLOAT   sum = 0, peak = 0;
+    int const n = end - start;
+    int     k;
+
+    for (k = start; k < end; ++k) {
+        FLOAT const x = xr[k * step];
+        FLOAT const prev = (k > 0) ? xr[(k - 1) * step] : 0;
+        FLOAT const next = (k < 575 / step) ? xr[(k + 1) * step] : 0;
+        FLOAT const mdst = 0.5f * (next - prev);
+        FLOAT const p = x * x + mdst * mdst;
+        sum += p;
+        if (peak < p)
+            peak = p;
+    }
+    *enn = sum;
+    if (n > 1 && sum > 0) {
+        /* 0 for a flat band, 1 for a single line */
+        FLOAT   tonality = (peak * n / sum - 1.f) / (n - 1);
+        if (tonality > 1.f)
+            tonality = 1.f;
+        *thm = sum * (MDCT_PSY_NOISE_OFFSET
+                      + tonality * (MDCT_PSY_TONE_OFFSET - MDCT_PSY_NOISE_OFFSET));
+    }
+    else {
+        *thm = sum * MDCT_PSY_NOISE_OFFSET;
+    }
+}
+
+static void
+mdct_psy_ratio(lame_internal_flags const *gfc, FLOAT const *xr, int block_type,
+               III_psy_ratio * mr)
+{
+    int     sb, sblock;
+
+    memset(mr, 0, sizeof(*mr));
+    /* BEND: the lines above the lowpass are zeros, so are their en and thm */
+    if (block_type != SHORT_TYPE) {
+        for (sb = 0; sb < gfc->sv_qnt.bw_sfb_l; sb++) {
+            mdct_psy_band(xr, gfc->scalefac_band.l[sb], gfc->scalefac_band.l[sb + 1], 1,
+                          &mr->en.l[sb], &mr->thm.l[sb]);
         }
-        if (type == SHORT_TYPE) {
-            ppe[chn] = pecalc_s(mr, gfc->sv_qnt.masking_lower);
+        fish_psy_spread_thm(mr->thm.l, SBMAX_l);
+    }
+    else {
+        /* short block lines are interleaved, line k of window w is xr[3*k+w] */
+        for (sblock = 0; sblock < 3; sblock++) {
+            FLOAT   thm[SBMAX_s] = { 0 };
+            for (sb = 0; sb < gfc->sv_qnt.bw_sfb_s; sb++) {
+                mdct_psy_band(xr + sblock, gfc->scalefac_band.s[sb], gfc->scalefac_band.s[sb + 1],
+                              3, &mr->en.s[sb][sblock], &thm[sb]);
+            }
+            fish_psy_spread_thm(thm, SBMAX_s);
+            for (sb = 0; sb < SBMAX_s; sb++)
+                mr->thm.s[sb][sblock] = thm[sb];
         }
-        else {
-            ppe[chn] = pecalc_l(mr, gfc->sv_qnt.masking_lower);
+    }
+}
+
+int
+L3psycho_anal_mdct(lame_internal_flags * gfc, int gr_out,
+                   III_psy_ratio masking_ratio[2][2],
+                   III_psy_ratio masking_MS_ratio[2][2],
+                   FLOAT percep_entropy[2], FLOAT percep_MS_entropy[2], FLOAT energy[4])
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    III_side_info_t const *const l3_side = &gfc->l3_side;
+    int const n_chn_out = cfg->channels_out;
+    int const n_chn_psy = (cfg->mode == JOINT_STEREO) ? 4 : n_chn_out;
+    int     blocktype[2];
+    int     chn, i;
+
+    for (chn = 0; chn < n_chn_out; chn++)
+        blocktype[chn] = l3_side->tt[gr_out][chn].block_type;
+
+    for (chn = 0; chn < n_chn_psy; chn++) {
+        FLOAT   ms[576];
+        FLOAT const *xr;
+        FLOAT   e = 0;
+
+        if (chn < 2) {
+            xr = l3_side->tt[gr_out][chn].xr;
         }
+        else {
+            FLOAT const sqrt2_half = SQRT2 * 0.5f;
+            FLOAT const sign = (chn == 2) ? 1.f : -1.f;
+            FLOAT const *const l = l3_side->tt[gr_out][0].xr;
+            FLOAT const *const r = l3_side->tt[gr_out][1].xr;
+            for (i = 0; i < 576; i++)
+                ms[i] = (l[i] + sign * r[i]) * sqrt2_half;
+            xr = ms;
+        }
+        for (i = 0; i < 576; i++)
+            e += xr[i] * xr[i];
+        energy[chn] = e;
 
-        if (plt) {
-            plt->pe[gr_out][chn] = ppe[chn];
+        if (chn < 2) {
+            mdct_psy_ratio(gfc, xr, blocktype[chn], &masking_ratio[gr_out][chn]);
+        }
+        else {
+            mdct_psy_ratio(gfc, xr, blocktype[0], &masking_MS_ratio[gr_out][chn - 2]);
         }
     }
+
+    vbrpsy_compute_pe(gfc, gr_out, n_chn_psy, masking_ratio, masking_MS_ratio,
+                      blocktype, percep_entropy, percep_MS_entropy);
     return 0;
 }
 
@@ -1874,6 +2493,132 @@ init_s3_values(FLOAT ** p, int (*s3ind)[2], int npart,
     return 0;
 }
 
+/* BEND: gd->s3 again, by diagonal (see s3_band in util.h) */
+static int
+init_s3_band(PsyConst_CB2SB_t * gd)
+{
+    int     b, k, j = 0, lo = 0, hi = 0;
+
+    for (b = 0; b < gd->npart; b++) {
+        lo = Min(lo, gd->s3ind[b][0] - b);
+        hi = Max(hi, gd->s3ind[b][1] - b);
+    }
+    gd->s3_band = lame_calloc(FLOAT, (hi - lo + 1) * CBANDS);
+    if (!gd->s3_band)
+        return -1;
+    gd->s3_lo = lo;
+    gd->s3_hi = hi;
+    for (b = 0; b < gd->npart; b++)
+        for (k = gd->s3ind[b][0]; k <= gd->s3ind[b][1]; k++)
+            gd->s3_band[(k - b - lo) * CBANDS + b] = gd->s3[j++];
+    return 0;
+}
+
+/* BEND: the constants of vbrpsy_mask_add for the SIMD spreading.
+ * mask_add_index never goes down as the ratio goes up, so the smallest
+ * ratio that gets an index of i + 1 can be found by bisecting floats. */
+static void
+init_mask_add_ratio(PsyConst_t * gd)
+{
+    int     i;
+
+    assert(sizeof(FLOAT) == sizeof(uint32_t));
+    for (i = 0; i < 9; i++) {
+        union {
+            FLOAT   f;
+            uint32_t u;
+        } lo, hi, mid;
+        lo.f = 1;
+        hi.f = 16;
+        assert(mask_add_index(lo.f) < i + 1 && mask_add_index(hi.f) >= i + 1);
+        while (hi.u - lo.u > 1) {
+            mid.u = lo.u + (hi.u - lo.u) / 2;
+            if (mask_add_index(mid.f) >= i + 1)
+                hi = mid;
+            else
+                lo = mid;
+        }
+        gd->mask_add_ratio[i] = hi.f;
+    }
+    gd->mask_add_ratio[9] = ma_max_i1;
+    gd->mask_add_ratio[10] = ma_max_i2;
+    for (i = 0; i < 10; i++)
+        gd->mask_add_factor[i] = table2[i];
+}
+
+/* BEND: lay out n_out sums as a PsyGather_t, the terms of output k being
+ * idx[first[k] + r] times w[first[k] + r] for r < cnt[k] */
+static int
+init_psy_gather(PsyGather_t * t, int n_out, int const *first, int const *cnt, int const *idx,
+                FLOAT const *w)
+{
+    int     g, k, r, o, size = 0;
+
+    t->blocks = (n_out + PSY_LANES - 1) / PSY_LANES;
+    for (g = 0; g < t->blocks; g++) {
+        t->rows[g] = 0;
+        for (k = g * PSY_LANES; k < n_out && k < (g + 1) * PSY_LANES; k++)
+            t->rows[g] = Max(t->rows[g], cnt[k]);
+        size += t->rows[g] * PSY_LANES;
+    }
+    t->idx = lame_calloc(int, size);
+    t->w = lame_calloc(FLOAT, size);
+    if (!t->idx || !t->w)
+        return -1;
+    for (o = g = 0; g < t->blocks; o += t->rows[g++] * PSY_LANES)
+        for (k = g * PSY_LANES; k < n_out && k < (g + 1) * PSY_LANES; k++)
+            for (r = 0; r < cnt[k]; r++) {
+                t->idx[o + r * PSY_LANES + k % PSY_LANES] = idx[first[k] + r];
+                t->w[o + r * PSY_LANES + k % PSY_LANES] = w[first[k] + r];
+            }
+    return 0;
+}
+
+/* BEND: energy_core_c's sums, the fft lines of each partition */
+static int
+init_energy_gather(PsyConst_CB2SB_t * gd)
+{
+    int     first[CBANDS], idx[HBLKSIZE];
+    FLOAT   w[HBLKSIZE];
+    int     b, j;
+
+    for (b = j = 0; b < gd->npart; j += gd->numlines[b++])
+        first[b] = j;
+    assert(j <= HBLKSIZE);
+    for (j = 0; j < HBLKSIZE; j++) {
+        idx[j] = j;
+        w[j] = 1;
+    }
+    return init_psy_gather(&gd->energy, gd->npart, first, gd->numlines, idx, w);
+}
+
+/* BEND: p2s_core_c's sums, following its loop: the partitions of each
+ * scalefactor band, with the one at the transition to the next band split
+ * between the two by bo_weight */
+static int
+init_p2s_gather(PsyConst_CB2SB_t * gd)
+{
+    int     first[SBMAX_l], cnt[SBMAX_l] = { 0 }, idx[CBANDS + 2 * SBMAX_l];
+    FLOAT   w[CBANDS + 2 * SBMAX_l];
+    int     sb, b, j = 0, n = gd->n_sb;
+
+#define P2S_TERM(band, part, weight) (idx[j] = (part), w[j++] = (weight), cnt[band]++)
+    for (sb = b = 0; sb < n; ++b, ++sb) {
+        int const b_lim = Min(gd->bo[sb], gd->npart);
+        for (; b < b_lim; b++)
+            P2S_TERM(sb, b, 1.0f);
+        if (b >= gd->npart)
+            break;
+        P2S_TERM(sb, b, gd->bo_weight[sb]);
+        if (sb + 1 < n)
+            P2S_TERM(sb + 1, b, 1.0f - gd->bo_weight[sb]);
+    }
+#undef P2S_TERM
+    for (sb = j = 0; sb < n; j += cnt[sb++])
+        first[sb] = j;
+    return init_psy_gather(&gd->p2s, n, first, cnt, idx, w);
+}
+
 int
 psymodel_init(lame_global_flags const *gfp)
 {
@@ -1953,6 +2698,8 @@ psymodel_init(lame_global_flags const *gfp)
     i = init_s3_values(&gd->l.s3, gd->l.s3ind, gd->l.npart, bval, bval_width, norm);
     if (i)
         return i;
+    if (init_s3_band(&gd->l) || init_energy_gather(&gd->l) || init_p2s_gather(&gd->l)) /* BEND */
+        return -1;
 
     /* compute long block specific values, ATH and MINVAL */
     j = 0;
@@ -2052,10 +2799,14 @@ psymodel_init(lame_global_flags const *gfp)
     i = init_s3_values(&gd->s.s3, gd->s.s3ind, gd->s.npart, bval, bval_width, norm);
     if (i)
         return i;
+    if (init_s3_band(&gd->s) || init_energy_gather(&gd->s) || init_p2s_gather(&gd->s)) /* BEND */
+        return -1;
 
 
     init_mask_add_max_values();
+    init_mask_add_ratio(gd); /* BEND */
     init_fft(gfc);
+    psymodel_core_init(gfc); /* BEND */
 
     /* setup temporal masking */
     gd->decay = exp(-1.0 * LOG10 / (temporalmask_sustain_sec * sfreq / 192.0));
@@ -2163,5 +2914,21 @@ psymodel_init(lame_global_flags const *gfp)
     }
     memcpy(&gd->l_to_s, &gd->l, sizeof(gd->l_to_s));
     init_numline(&gd->l_to_s, sfreq, BLKSIZE, 192, SBMAX_s, gfc->scalefac_band.s);
+    if (init_p2s_gather(&gd->l_to_s)) /* BEND: shares the rest with l */
+        return -1;
+
+    /* BEND: band centres and widths for L3psycho_anal_fish */
+    for (sb = 0; sb < SBMAX_l; sb++) {
+        int const start = gfc->scalefac_band.l[sb];
+        int const end = gfc->scalefac_band.l[sb + 1];
+        gd->fish_cos_l[sb] = cos(PI * 0.5 * (start + end) / 576.0);
+        gd->fish_width_l[sb] = (end - start) / 576.0;
+    }
+    for (sb = 0; sb < SBMAX_s; sb++) {
+        int const start = gfc->scalefac_band.s[sb];
+        int const end = gfc->scalefac_band.s[sb + 1];
+        gd->fish_cos_s[sb] = cos(PI * 0.5 * (start + end) / 192.0);
+        gd->fish_width_s[sb] = (end - start) / 192.0;
+    }
     return 0;
 }
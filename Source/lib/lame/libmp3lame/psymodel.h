@@ -35,9 +35,30 @@ int     L3psycho_anal_vbr(lame_internal_flags * gfc,
                           III_psy_ratio MS_ratio[2][2],
                           FLOAT pe[2], FLOAT pe_MS[2], FLOAT ener[2], int blocktype_d[2]);
 
+// BEND
+int     L3psycho_anal_fish(lame_internal_flags * gfc,
+                           const sample_t *const buffer[2], int gr,
+                           III_psy_ratio ratio[2][2],
+                           III_psy_ratio MS_ratio[2][2],
+                           FLOAT pe[2], FLOAT pe_MS[2], FLOAT ener[4], int blocktype_d[2]);
+
+// BEND
+int     L3psycho_anal_mdct_blocktype(lame_internal_flags * gfc,
+                                     const sample_t *const buffer[2], int gr,
+                                     int blocktype_d[2]);
+
+int     L3psycho_anal_mdct(lame_internal_flags * gfc, int gr,
+                           III_psy_ratio ratio[2][2],
+                           III_psy_ratio MS_ratio[2][2],
+                           FLOAT pe[2], FLOAT pe_MS[2], FLOAT ener[4]);
+
 
 int     psymodel_init(lame_global_flags const* gfp);
 
+/* BEND: the scalar kernels */
+void    attack_hpf_core_c(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak);
+void    attack_ms_core_c(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s);
+
 
 #define rpelev 2
 #define rpelev2 16
@@ -51,6 +72,9 @@ int     psymodel_init(lame_global_flags const* gfp);
 /* tuned for output level (sensitive to energy scale) */
 #define VO_SCALE (1./( 14752*14752 )/(BLKSIZE/2))
 
+/* BEND: the log2 pe_core gives a band over 1e10 above its threshold */
+#define PE_SATURATED 1000.f
+
 #define temporalmask_sustain_sec 0.01
 
 #define NS_PREECHO_ATT0 0.8
@@ -58,6 +82,7 @@ int     psymodel_init(lame_global_flags const* gfp);
 #define NS_PREECHO_ATT2 0.3
 
 #define NS_MSFIX 3.5
+#define NSFIRLEN 21
 #define NSATTACKTHRE 4.4
 #define NSATTACKTHRE_S 25
 
@@ -37,9 +37,7 @@
 #include "bitstream.h"
 #include "vbrquantize.h"
 #include "quantize.h"
-#ifdef HAVE_XMMINTRIN_H
 #include "vector/lame_intrin.h"
-#endif
 
 
 
@@ -94,15 +92,10 @@ init_xrpow_core_init(lame_internal_flags * const gfc)
 {
     gfc->init_xrpow_core = init_xrpow_core_c;
 
-#if defined(HAVE_XMMINTRIN_H)
+#if defined(LAME_INTRIN_SSE)
     if (gfc->CPU_features.SSE)
         gfc->init_xrpow_core = init_xrpow_core_sse;
 #endif
-#ifndef HAVE_NASM
-#ifdef MIN_ARCH_SSE
-    gfc->init_xrpow_core = init_xrpow_core_sse;
-#endif
-#endif
 }
 
 
@@ -327,6 +320,19 @@ init_outer_loop(lame_internal_flags const *gfc, gr_info * const cod_info)
         }
     }
 
+    /* BEND: the bands from psybw up are silent below the lowpass */
+    if (gfc->sv_qnt.bw_unlimited) {
+        cod_info->psybw = cod_info->psymax;
+    }
+    else if (cod_info->block_type != SHORT_TYPE) {
+        cod_info->psybw = Min(cod_info->psymax, gfc->sv_qnt.bw_sfb_l);
+    }
+    else {
+        cod_info->psybw = Min(cod_info->psymax, cod_info->sfb_lmax
+                              + 3 * (Max(gfc->sv_qnt.bw_sfb_s, cod_info->sfb_smin)
+                                     - cod_info->sfb_smin));
+    }
+
     cod_info->count1bits = 0;
     cod_info->sfb_partition_table = nr_of_sfb_block[0][0];
     cod_info->slen[0] = 0;
@@ -440,15 +446,69 @@ bin_search_StepSize(lame_internal_flags * const gfc, gr_info * const cod_info,
  *  trancate smaller nubmers into 0 as long as the noise threshold is allowed.
  *
  ************************************************************************/
-static int
-floatcompare(const void *v1, const void *v2)
+/* BEND: the band used to be qsort()ed.  A min-heap gives the lines in
+ * the same ascending order, and only as many as the loop walks through. */
+static void
+heap_sift_down(FLOAT * const h, int n, int i)
 {
-    const FLOAT *const a = v1, *const b = v2;
-    if (*a > *b)
-        return 1;
-    if (*a < *b)
-        return -1;
-    return 0;
+    FLOAT const x = h[i];
+
+    for (;;) {
+        int     c = 2 * i + 1;
+        if (c >= n)
+            break;
+        if (c + 1 < n && h[c + 1] < h[c])
+            c++;
+        if (!(h[c] < x))
+            break;
+        h[i] = h[c];
+        i = c;
+    }
+    h[i] = x;
+}
+
+static FLOAT
+heap_pop(FLOAT * const h, int n)
+{
+    FLOAT const top = h[0];
+
+    h[0] = h[n - 1];
+    heap_sift_down(h, n - 1, 0);
+    return top;
+}
+
+/* BEND: the largest of the magnitudes in band that can go to zero with
+ * the noise added staying within allowedNoise, or 0.  Reorders band.
+ * Not static, for Tests/LameKernels.cpp. */
+FLOAT
+trancate_threshold(FLOAT * const band, int width, FLOAT allowedNoise)
+{
+    FLOAT   below = 0.0;
+    int     n, k;
+
+    /* the zero lines would come first and add no noise */
+    for (n = k = 0; k < width; k++)
+        if (band[k] != 0)
+            band[n++] = band[k];
+
+    for (k = n / 2 - 1; k >= 0; k--)
+        heap_sift_down(band, n, k);
+
+    while (n > 0) {
+        FLOAT   noise, top;
+        FLOAT const x = heap_pop(band, n--);
+        int     nsame = 1;
+
+        for (top = x; n > 0 && EQ(x, band[0]); nsame++)
+            top = heap_pop(band, n--);
+
+        noise = x * x * nsame;
+        if (allowedNoise < noise)
+            return below;
+        allowedNoise -= noise;
+        below = top;
+    }
+    return 0.0;
 }
 
 static void
@@ -462,7 +522,7 @@ trancate_smallspectrums(lame_internal_flags const *gfc,
     if ((!(gfc->sv_qnt.substep_shaping & 4) && gi->block_type == SHORT_TYPE)
         || gfc->sv_qnt.substep_shaping & 0x80)
         return;
-    (void) calc_noise(gi, l3_xmin, distort, &dummy, 0);
+    (void) calc_noise(gfc, gi, l3_xmin, distort, &dummy, 0);
     for (j = 0; j < 576; j++) {
         FLOAT   xr = 0.0;
         if (gi->l3_enc[j] != 0)
@@ -475,36 +535,15 @@ trancate_smallspectrums(lame_internal_flags const *gfc,
     if (gi->block_type == SHORT_TYPE)
         sfb = 6;
     do {
-        FLOAT   allowedNoise, trancateThreshold;
-        int     nsame, start;
+        FLOAT   trancateThreshold;
 
         width = gi->width[sfb];
         j += width;
         if (distort[sfb] >= 1.0)
             continue;
 
-        qsort(&work[j - width], width, sizeof(FLOAT), floatcompare);
-        if (EQ(work[j - 1], 0.0))
-            continue;   /* all zero sfb */
-
-        allowedNoise = (1.0 - distort[sfb]) * l3_xmin[sfb];
-        trancateThreshold = 0.0;
-        start = 0;
-        do {
-            FLOAT   noise;
-            for (nsame = 1; start + nsame < width; nsame++)
-                if (NEQ(work[start + j - width], work[start + j + nsame - width]))
-                    break;
-
-            noise = work[start + j - width] * work[start + j - width] * nsame;
-            if (allowedNoise < noise) {
-                if (start != 0)
-                    trancateThreshold = work[start + j - width - 1];
-                break;
-            }
-            allowedNoise -= noise;
-            start += nsame;
-        } while (start < width);
+        trancateThreshold =
+            trancate_threshold(&work[j - width], width, (1.0 - distort[sfb]) * l3_xmin[sfb]);
         if (EQ(trancateThreshold, 0.0))
             continue;
 
@@ -1037,7 +1076,7 @@ outer_loop(lame_internal_flags * gfc, gr_info * const cod_info, const FLOAT * co
 
     /* compute the distortion in this quantization */
     /* coefficients and thresholds both l/r (or both mid/side) */
-    (void) calc_noise(cod_info, l3_xmin, distort, &best_noise_info, &prev_noise);
+    (void) calc_noise(gfc, cod_info, l3_xmin, distort, &best_noise_info, &prev_noise);
     best_noise_info.bits = cod_info->part2_3_length;
 
     cod_info_w = *cod_info;
@@ -1120,7 +1159,7 @@ outer_loop(lame_internal_flags * gfc, gr_info * const cod_info, const FLOAT * co
             }
 
             /* compute the distortion in this quantization */
-            (void) calc_noise(&cod_info_w, l3_xmin, distort, &noise_info, &prev_noise);
+            (void) calc_noise(gfc, &cod_info_w, l3_xmin, distort, &noise_info, &prev_noise);
             noise_info.bits = cod_info_w.part2_3_length;
 
             /* check if this quantization is better
@@ -1138,7 +1177,7 @@ outer_loop(lame_internal_flags * gfc, gr_info * const cod_info, const FLOAT * co
             if (better) {
                 best_part2_3_length = cod_info->part2_3_length;
                 best_noise_info = noise_info;
-                *cod_info = cod_info_w;
+                memcpy(cod_info, &cod_info_w, GR_INFO_STATE_SIZE); /* BEND */
                 age = 0;
                 /* save data so we can restore this quantization later */
                 /*if (cfg->vbr == vbr_rh || cfg->vbr == vbr_mtrh) */  {
@@ -1164,7 +1203,7 @@ outer_loop(lame_internal_flags * gfc, gr_info * const cod_info, const FLOAT * co
         if (cfg->noise_shaping_amp == 3) {
             if (!bRefine) {
                 /* refine search */
-                cod_info_w = *cod_info;
+                memcpy(&cod_info_w, cod_info, GR_INFO_STATE_SIZE); /* BEND */
                 memcpy(xrpow, save_xrpow, sizeof(FLOAT) * 576);
                 age = 0;
                 best_ggain_pass1 = cod_info_w.global_gain;
@@ -1283,7 +1322,7 @@ VBR_encode_granule(lame_internal_flags * gfc, gr_info * const cod_info, const FL
 
             /*  store best quantization so far
              */
-            bst_cod_info = *cod_info;
+            memcpy(&bst_cod_info, cod_info, GR_INFO_STATE_SIZE); /* BEND */
             memcpy(bst_xrpow, xrpow, sizeof(FLOAT) * 576);
 
             /*  try with fewer bits
@@ -1303,7 +1342,7 @@ VBR_encode_granule(lame_internal_flags * gfc, gr_info * const cod_info, const FL
                 found = 2;
                 /*  start again with best quantization so far
                  */
-                *cod_info = bst_cod_info;
+                memcpy(cod_info, &bst_cod_info, GR_INFO_STATE_SIZE); /* BEND */
                 memcpy(xrpow, bst_xrpow, sizeof(FLOAT) * 576);
             }
         }
@@ -1975,6 +2014,217 @@ ABR_iteration_loop(lame_internal_flags * gfc, const FLOAT pe[2][2],
 
 
 
+// BEND
+/************************************************************************
+ *
+ *      direct_StepSize()
+ *
+ *  quantizer for Fish's tiny CBR targets.  Instead of outer_loop's
+ *  noise shaping search, predict the global gain straight from the
+ *  spectrum and the bit target, then refine it with at most
+ *  DIRECT_MAX_COUNT_BITS calls of count_bits.
+ *
+ *  The prediction assumes a line quantized to q > 1 costs about
+ *  1 + 2*log2(q) bits.  Line k reaches q = 1 at global gain
+ *  gk = 210 + 16/3*log2(xrpow[k]), so with a histogram over gk the
+ *  estimate for every gain is a running sum.
+ *
+ ************************************************************************/
+
+#define DIRECT_MAX_COUNT_BITS 6
+#define DIRECT_BITS_PER_STEP 0.375f /* 2 bits per octave, 3/16 octave per step */
+
+static int
+direct_predict_gain(gr_info const *const cod_info, FLOAT const xrpow[576], int desired_rate)
+{
+    int     hist[256];
+    int     k, g, cnt = 0;
+    FLOAT   sum = 0;
+    int const upper = cod_info->max_nonzero_coeff;
+
+    memset(hist, 0, sizeof(hist));
+    for (k = 0; k <= upper; k++) {
+        if (xrpow[k] > 1e-20f) {
+            int const gk = 210 + (int) (FAST_LOG10_X(xrpow[k], 16.0 / 3.0 * LOG10 / LOG2));
+            if (gk > 0)
+                hist[gk < 255 ? gk : 255]++;
+        }
+    }
+    /* lowest gain whose estimate fits, estimates grow as the gain drops */
+    for (g = 254; g >= 0; g--) {
+        FLOAT   est;
+        cnt += hist[g + 1];
+        sum += (FLOAT) (g + 1) * hist[g + 1];
+        est = cnt + DIRECT_BITS_PER_STEP * (sum - (FLOAT) g * cnt);
+        if (est > desired_rate)
+            return g + 1;
+    }
+    return 0;
+}
+
+static int
+direct_StepSize(lame_internal_flags * const gfc, gr_info * const cod_info,
+                int desired_rate, const int ch, const FLOAT xrpow[576])
+{
+    int     lo = -1, hi = 256;   /* lo: known too big, hi: known to fit */
+    int     hi_bits = 0;
+    int     calls = 0;
+    int     g, step, nBits;
+
+    desired_rate -= cod_info->part2_length;
+    g = direct_predict_gain(cod_info, xrpow, desired_rate);
+
+    /* bracket the prediction */
+    cod_info->global_gain = g;
+    nBits = count_bits(gfc, xrpow, cod_info, 0);
+    calls++;
+    if (nBits > desired_rate)
+        lo = g;
+    else {
+        hi = g;
+        hi_bits = nBits;
+    }
+    for (step = 2; calls < DIRECT_MAX_COUNT_BITS && (lo < 0 || hi > 255); step *= 2) {
+        g = (hi > 255) ? lo + step : hi - step;
+        if (g > 255)
+            g = 255;
+        if (g < 0)
+            g = 0;
+        if (g == lo || g == hi)
+            break;
+        cod_info->global_gain = g;
+        nBits = count_bits(gfc, xrpow, cod_info, 0);
+        calls++;
+        if (nBits > desired_rate)
+            lo = g;
+        else {
+            hi = g;
+            hi_bits = nBits;
+        }
+    }
+    /* bisect what is left of the budget */
+    while (calls < DIRECT_MAX_COUNT_BITS && hi <= 255 && hi - lo > 1) {
+        g = (lo + hi) / 2;
+        cod_info->global_gain = g;
+        nBits = count_bits(gfc, xrpow, cod_info, 0);
+        calls++;
+        if (nBits > desired_rate)
+            lo = g;
+        else {
+            hi = g;
+            hi_bits = nBits;
+        }
+    }
+
+    if (hi > 255) {
+        /* nothing fitted within the budget, fall back to the coarsest step */
+        hi = 255;
+        cod_info->global_gain = hi;
+        hi_bits = count_bits(gfc, xrpow, cod_info, 0);
+    }
+    else if (cod_info->global_gain != hi) {
+        /* l3_enc has to match the gain we keep */
+        cod_info->global_gain = hi;
+        hi_bits = count_bits(gfc, xrpow, cod_info, 0);
+    }
+
+    gfc->sv_qnt.CurrentStep[ch] = 4;
+    gfc->sv_qnt.OldValue[ch] = cod_info->global_gain;
+    cod_info->part2_3_length = hi_bits;
+    return hi_bits;
+}
+
+
+
+/************************************************************************
+ *
+ *      fish_limit_targ_bits()
+ *
+ *  Fish's per channel bit caps, set by lame_change_bitrate_midstream
+ *
+ ************************************************************************/
+
+static void
+fish_limit_targ_bits(lame_internal_flags const *gfc, int targ_bits[2])
+{
+    if (gfc->ch1br < targ_bits[0]) {
+        targ_bits[0] = gfc->ch1br;
+    }
+    /* tested against ch1br, as Fish's CBR loop always has */
+    if (gfc->ch1br < targ_bits[1]) {
+        targ_bits[1] = gfc->ch2br;
+    }
+}
+
+
+
+/************************************************************************
+ *
+ *      VBR_new_fish_iteration_loop()
+ *
+ *  CBR frames through the vbr-new quantizer.  The targets are worked
+ *  out as in CBR_iteration_loop, Fish's caps included, and handed to
+ *  VBR_encode_frame as hard per channel limits.  The bitrate index
+ *  stays put and nothing is drawn from the reservoir.
+ *
+ ************************************************************************/
+
+static void
+VBR_new_fish_iteration_loop(lame_internal_flags * gfc, const FLOAT pe[2][2],
+                            const FLOAT ms_ener_ratio[2], const III_psy_ratio ratio[2][2])
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    FLOAT   l3_xmin[2][2][SFBMAX];
+    FLOAT   xrpow[2][2][576];
+    int     targ_bits[2][2];
+    int     mean_bits, max_bits;
+    int     gr, ch;
+    III_side_info_t *const l3_side = &gfc->l3_side;
+
+    const FLOAT (*const_l3_xmin)[2][SFBMAX] = (const FLOAT (*)[2][SFBMAX])l3_xmin;
+    const FLOAT (*const_xrpow)[2][576] = (const FLOAT (*)[2][576])xrpow;
+    const int (*const_targ_bits)[2] = (const int (*)[2])targ_bits;
+
+    memset(xrpow, 0, sizeof(xrpow));
+    (void) ResvFrameBegin(gfc, &mean_bits);
+
+    for (gr = 0; gr < cfg->mode_gr; gr++) {
+        max_bits = on_pe(gfc, pe, targ_bits[gr], mean_bits, gr, gr);
+
+        if (gfc->ov_enc.mode_ext == MPG_MD_MS_LR) {
+            ms_convert(&gfc->l3_side, gr);
+            reduce_side(targ_bits[gr], ms_ener_ratio[gr], mean_bits, max_bits);
+        }
+        fish_limit_targ_bits(gfc, targ_bits[gr]);
+
+        for (ch = 0; ch < cfg->channels_out; ch++) {
+            gr_info *const cod_info = &l3_side->tt[gr][ch];
+            FLOAT const masking_lower_db = (cod_info->block_type != SHORT_TYPE)
+                ? gfc->sv_qnt.mask_adjust : gfc->sv_qnt.mask_adjust_short;
+            gfc->sv_qnt.masking_lower = pow(10.0, masking_lower_db * 0.1);
+
+            init_outer_loop(gfc, cod_info);
+            if (0 == init_xrpow(gfc, cod_info, xrpow[gr][ch])) {
+                targ_bits[gr][ch] = 0; /* silent granule needs no bits */
+            }
+            else {
+                (void) calc_xmin(gfc, &ratio[gr][ch], cod_info, l3_xmin[gr][ch]);
+            }
+        }               /* for ch */
+    }                   /* for gr */
+
+    (void) VBR_encode_frame(gfc, const_xrpow, const_l3_xmin, const_targ_bits);
+
+    for (gr = 0; gr < cfg->mode_gr; gr++) {
+        for (ch = 0; ch < cfg->channels_out; ch++) {
+            ResvAdjust(gfc, &l3_side->tt[gr][ch]);
+        }
+    }
+    ResvFrameEnd(gfc, mean_bits);
+}
+
+
+
 /************************************************************************
  *
  *      CBR_iteration_loop()
@@ -1998,6 +2248,11 @@ CBR_iteration_loop(lame_internal_flags * gfc, const FLOAT pe[2][2],
     III_side_info_t *const l3_side = &gfc->l3_side;
     gr_info *cod_info;
 
+    if (cfg->fish_quantizer == FISH_QUANT_VBR_NEW) { // BEND
+        VBR_new_fish_iteration_loop(gfc, pe, ms_ener_ratio, ratio);
+        return;
+    }
+
     (void) ResvFrameBegin(gfc, &mean_bits);
 
     /* quantize! */
@@ -2013,13 +2268,7 @@ CBR_iteration_loop(lame_internal_flags * gfc, const FLOAT pe[2][2],
         }
 
         // BIG BEND
-        if (gfc->ch1br < targ_bits[0]) {
-            targ_bits[0] = gfc->ch1br;
-        }
-        if (gfc->ch1br < targ_bits[1]) {
-            targ_bits[1] = gfc->ch2br;
-        }
-
+        fish_limit_targ_bits(gfc, targ_bits);
 
         for (ch = 0; ch < cfg->channels_out; ch++) {
             FLOAT   adjust, masking_lower_db;
@@ -2041,12 +2290,20 @@ CBR_iteration_loop(lame_internal_flags * gfc, const FLOAT pe[2][2],
              */
             init_outer_loop(gfc, cod_info);
             if (init_xrpow(gfc, cod_info, xrpow)) {
-                /*  xr contains energy we will have to encode
-                 *  calculate the masking abilities
-                 *  find some good quantization in outer_loop
-                 */
-                (void) calc_xmin(gfc, &ratio[gr][ch], cod_info, l3_xmin);
-                (void) outer_loop(gfc, cod_info, l3_xmin, xrpow, ch, targ_bits[ch]);
+                if (cfg->fish_quantizer == FISH_QUANT_DIRECT) { // BEND
+                    /*  no noise shaping, so no masking needed either
+                     */
+                    calc_max_nonzero_coeff(gfc, cod_info);
+                    (void) direct_StepSize(gfc, cod_info, targ_bits[ch], ch, xrpow);
+                }
+                else {
+                    /*  xr contains energy we will have to encode
+                     *  calculate the masking abilities
+                     *  find some good quantization in outer_loop
+                     */
+                    (void) calc_xmin(gfc, &ratio[gr][ch], cod_info, l3_xmin);
+                    (void) outer_loop(gfc, cod_info, l3_xmin, xrpow, ch, targ_bits[ch]);
+                }
             }
 
             iteration_finish_one(gfc, gr, ch);
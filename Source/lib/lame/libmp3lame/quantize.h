@@ -34,5 +34,8 @@ void    VBR_new_iteration_loop(lame_internal_flags * gfc, const FLOAT pe[2][2],
 void    ABR_iteration_loop(lame_internal_flags * gfc, const FLOAT pe[2][2],
                            const FLOAT ms_ratio[2], const III_psy_ratio ratio[2][2]);
 
+/* BEND: for the tests */
+FLOAT   trancate_threshold(FLOAT * band, int width, FLOAT allowedNoise);
+
 
 #endif /* LAME_QUANTIZE_H */
@@ -35,6 +35,7 @@
 #include "quantize_pvt.h"
 #include "reservoir.h"
 #include "lame-analysis.h"
+#include "vector/lame_intrin.h"
 #include <float.h>
 
 
@@ -368,6 +369,7 @@ iteration_init(lame_internal_flags * gfc)
 
         huffman_init(gfc);
         init_xrpow_core_init(gfc);
+        calc_noise_core_init(gfc); /* BEND */
 
         sel = 1;/* RH: all modes like vbr-new (cfg->vbr == vbr_mt || cfg->vbr == vbr_mtrh) ? 1 : 0;*/
 
@@ -414,6 +416,7 @@ iteration_init(lame_internal_flags * gfc)
         for (; i < SBMAX_s; ++i) {
             gfc->sv_qnt.shortfact[i] = adjust;
         }
+        calc_ath_xmin(gfc); /* BEND */
     }
 }
 
@@ -575,9 +578,127 @@ athAdjust(FLOAT a, FLOAT x, FLOAT athFloor, float ATHfixpoint)
 
 
 
-/*************************************************************************/
-/*            calc_xmin                                                  */
-/*************************************************************************/
+/*  determine the highest non-zero coeff
+ */
+void
+calc_max_nonzero_coeff(lame_internal_flags const *gfc, gr_info * const cod_info)
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    const FLOAT *const xr = cod_info->xr;
+    int     max_nonzero, k;
+
+    /* BEND: the lines above the lowpass are exact zeros */
+    if (gfc->sv_qnt.bw_unlimited) {
+        k = 576;
+    }
+    else if (cod_info->block_type != SHORT_TYPE) {
+        k = gfc->scalefac_band.l[gfc->sv_qnt.bw_sfb_l];
+    }
+    else {
+        k = Max(3 * gfc->scalefac_band.s[gfc->sv_qnt.bw_sfb_s],
+                gfc->scalefac_band.l[cod_info->sfb_lmax]);
+    }
+    max_nonzero = 0;
+    for (k = Min(k, 576) - 1; k > 0; --k) {
+        if (fabs(xr[k]) > 1e-12f) {
+            max_nonzero = k;
+            break;
+        }
+    }
+    if (cod_info->block_type != SHORT_TYPE) { /* NORM, START or STOP type, but not SHORT */
+        max_nonzero |= 1; /* only odd numbers */
+    }
+    else {
+        max_nonzero /= 6; /* 3 short blocks */
+        max_nonzero *= 6;
+        max_nonzero += 5;
+    }
+
+    if (gfc->sv_qnt.sfb21_extra == 0 && cfg->samplerate_out < 44000) {
+      int const sfb_l = (cfg->samplerate_out <= 8000) ? 17 : 21;
+      int const sfb_s = (cfg->samplerate_out <= 8000) ?  9 : 12;
+      int   limit = 575;
+      if (cod_info->block_type != SHORT_TYPE) { /* NORM, START or STOP type, but not SHORT */
+          limit = gfc->scalefac_band.l[sfb_l]-1;
+      }
+      else {
+          limit = 3*gfc->scalefac_band.s[sfb_s]-1;
+      }
+      if (max_nonzero > limit) {
+          max_nonzero = limit;
+      }
+    }
+    cod_info->max_nonzero_coeff = max_nonzero;
+}
+
+
+/* BEND: the scalefactor bands the polyphase lowpass leaves anything in.
+ * Subband b makes long block lines 18b .. 18b+17, plus the first 8 lines of
+ * band b+1 through the alias butterflies, and short block lines 6b .. 6b+5
+ * of each window.  While a retuned filter glides over, both ends count.
+ * lame_encode_mp3_frame works them out before the psymodel, which reads
+ * them as well.
+ */
+void
+calc_bandwidth_limits(lame_internal_flags * gfc)
+{
+    EncStateVar_t const *const esv = &gfc->sv_enc;
+    int     band, top = 0, line_l, line_s, sfb;
+
+    for (band = 0; band < SBLIMIT; band++) {
+        if (esv->amp_filter[band] >= 1e-12
+            || (esv->amp_filter_steps > 0 && esv->amp_filter_target[band] >= 1e-12))
+            top = band + 1;
+    }
+    line_l = Min(576, 18 * top + 8);
+    line_s = 6 * top;
+    for (sfb = 0; sfb < SBMAX_l && gfc->scalefac_band.l[sfb] < line_l; sfb++);
+    gfc->sv_qnt.bw_sfb_l = sfb;
+    for (sfb = 0; sfb < SBMAX_s && gfc->scalefac_band.s[sfb] < line_s; sfb++);
+    gfc->sv_qnt.bw_sfb_s = sfb;
+}
+
+
+/* BEND: calc_xmin's ATH per sfb only changes with ATH->adjust_factor, so
+ * it is worked out by iteration_init and adjust_ATH, whenever that is set,
+ * rather than for every granule and channel.
+ */
+void
+calc_ath_xmin(lame_internal_flags * gfc)
+{
+    SessionConfig_t const *const cfg = &gfc->cfg;
+    ATH_t  *const ATH = gfc->ATH;
+    int     sfb;
+
+    for (sfb = 0; sfb < SBMAX_l; sfb++) {
+        ATH->xmin_l[sfb] = athAdjust(ATH->adjust_factor, ATH->l[sfb], ATH->floor, cfg->ATHfixpoint);
+        ATH->xmin_l[sfb] *= gfc->sv_qnt.longfact[sfb];
+    }
+    for (sfb = 0; sfb < SBMAX_s; sfb++) {
+        ATH->xmin_s[sfb] = athAdjust(ATH->adjust_factor, ATH->s[sfb], ATH->floor, cfg->ATHfixpoint);
+        ATH->xmin_s[sfb] *= gfc->sv_qnt.shortfact[sfb];
+    }
+    ATH->xmin_adjust = ATH->adjust_factor;
+}
+
+
+/* energy of one band, and the energy with each line capped at rh1 */
+FLOAT
+calc_xmin_core_c(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2)
+{
+    FLOAT   en0 = 0.0, rh = *rh2;
+    int     l;
+
+    for (l = 0; l < width; ++l) {
+        FLOAT const xa = xr[l];
+        FLOAT const x2 = xa * xa;
+        en0 += x2;
+        rh += (x2 < rh1) ? x2 : rh1;
+    }
+    *rh2 = rh;
+    return en0;
+}
+
 
 /*
   Calculate the allowed distortion for each scalefactor band,
@@ -592,18 +713,24 @@ calc_xmin(lame_internal_flags const *gfc,
           III_psy_ratio const *const ratio, gr_info * const cod_info, FLOAT * pxmin)
 {
     SessionConfig_t const *const cfg = &gfc->cfg;
-    int     sfb, gsfb, j = 0, ath_over = 0, k;
+    int     sfb, gsfb, j = 0, ath_over = 0;
     ATH_t const *const ATH = gfc->ATH;
     const FLOAT *const xr = cod_info->xr;
-    int     max_nonzero;
 
+    assert(ATH->xmin_adjust == ATH->adjust_factor);
     for (gsfb = 0; gsfb < cod_info->psy_lmax; gsfb++) {
         FLOAT   en0, xmin;
         FLOAT   rh1, rh2, rh3;
-        int     width, l;
-
-        xmin = athAdjust(ATH->adjust_factor, ATH->l[gsfb], ATH->floor, cfg->ATHfixpoint);
-        xmin *= gfc->sv_qnt.longfact[gsfb];
+        int     width;
+
+        if (gsfb >= cod_info->psybw) {
+            /* BEND: silent, what the loop below makes of zeros */
+            j += cod_info->width[gsfb];
+            cod_info->energy_above_cutoff[gsfb] = 0;
+            *pxmin++ = DBL_EPSILON;
+            continue;
+        }
+        xmin = ATH->xmin_l[gsfb];
 
         width = cod_info->width[gsfb];
         rh1 = xmin / width;
@@ -612,13 +739,8 @@ calc_xmin(lame_internal_flags const *gfc,
 #else
         rh2 = 2.2204460492503131e-016;
 #endif
-        en0 = 0.0;
-        for (l = 0; l < width; ++l) {
-            FLOAT const xa = xr[j++];
-            FLOAT const x2 = xa * xa;
-            en0 += x2;
-            rh2 += (x2 < rh1) ? x2 : rh1;
-        }
+        en0 = gfc->calc_xmin_core(xr + j, width, rh1, &rh2);
+        j += width;
         if (en0 > xmin)
             ath_over++;
 
@@ -651,50 +773,28 @@ calc_xmin(lame_internal_flags const *gfc,
 
 
     /*use this function to determine the highest non-zero coeff */
-    max_nonzero = 0;
-    for (k = 575; k > 0; --k) {
-        if (fabs(xr[k]) > 1e-12f) {
-            max_nonzero = k;
-            break;
-        }
-    }
-    if (cod_info->block_type != SHORT_TYPE) { /* NORM, START or STOP type, but not SHORT */
-        max_nonzero |= 1; /* only odd numbers */
-    }
-    else {
-        max_nonzero /= 6; /* 3 short blocks */
-        max_nonzero *= 6;
-        max_nonzero += 5;
-    }
-
-    if (gfc->sv_qnt.sfb21_extra == 0 && cfg->samplerate_out < 44000) {
-      int const sfb_l = (cfg->samplerate_out <= 8000) ? 17 : 21;
-      int const sfb_s = (cfg->samplerate_out <= 8000) ?  9 : 12;
-      int   limit = 575;
-      if (cod_info->block_type != SHORT_TYPE) { /* NORM, START or STOP type, but not SHORT */
-          limit = gfc->scalefac_band.l[sfb_l]-1;
-      }
-      else {
-          limit = 3*gfc->scalefac_band.s[sfb_s]-1;
-      }
-      if (max_nonzero > limit) {
-          max_nonzero = limit;
-      }
-    }
-    cod_info->max_nonzero_coeff = max_nonzero;
+    calc_max_nonzero_coeff(gfc, cod_info);
 
 
 
     for (sfb = cod_info->sfb_smin; gsfb < cod_info->psymax; sfb++, gsfb += 3) {
-        int     width, b, l;
+        int     width, b;
         FLOAT   tmpATH;
 
-        tmpATH = athAdjust(ATH->adjust_factor, ATH->s[sfb], ATH->floor, cfg->ATHfixpoint);
-        tmpATH *= gfc->sv_qnt.shortfact[sfb];
+        if (gsfb >= cod_info->psybw) {
+            /* BEND: silent, as above */
+            for (b = 0; b < 3; b++) {
+                j += cod_info->width[gsfb];
+                cod_info->energy_above_cutoff[gsfb + b] = 0;
+                *pxmin++ = DBL_EPSILON;
+            }
+            continue;
+        }
+        tmpATH = ATH->xmin_s[sfb];
         
         width = cod_info->width[gsfb];
         for (b = 0; b < 3; b++) {
-            FLOAT   en0 = 0.0, xmin = tmpATH;
+            FLOAT   en0, xmin = tmpATH;
             FLOAT   rh1, rh2, rh3;
 
             rh1 = tmpATH / width;
@@ -703,12 +803,8 @@ calc_xmin(lame_internal_flags const *gfc,
 #else
             rh2 = 2.2204460492503131e-016;
 #endif
-            for (l = 0; l < width; ++l) {
-                FLOAT const xa = xr[j++];
-                FLOAT const x2 = xa * xa;
-                en0 += x2;
-                rh2 += (x2 < rh1) ? x2 : rh1;
-            }
+            en0 = gfc->calc_xmin_core(xr + j, width, rh1, &rh2);
+            j += width;
             if (en0 > tmpATH)
                 ath_over++;
             
@@ -797,6 +893,32 @@ calc_noise_core_c(const gr_info * const cod_info, int *startline, int l, FLOAT s
 }
 
 
+void
+calc_noise_core_init(lame_internal_flags * const gfc)
+{
+    gfc->calc_noise_core = calc_noise_core_c;
+    gfc->calc_xmin_core = calc_xmin_core_c;
+#ifdef LAME_INTRIN_SSE
+    if (gfc->CPU_features.SSE2) {
+        gfc->calc_noise_core = calc_noise_core_SSE2;
+        gfc->calc_xmin_core = calc_xmin_core_SSE2;
+    }
+#endif
+#ifdef LAME_INTRIN_AVX
+    if (gfc->CPU_features.AVX2) {
+        gfc->calc_noise_core = calc_noise_core_AVX2;
+        gfc->calc_xmin_core = calc_xmin_core_AVX2;
+    }
+#endif
+#ifdef LAME_INTRIN_NEON
+    if (gfc->CPU_features.NEON) {
+        gfc->calc_noise_core = calc_noise_core_NEON;
+        gfc->calc_xmin_core = calc_xmin_core_NEON;
+    }
+#endif
+}
+
+
 /*************************************************************************/
 /*            calc_noise                                                 */
 /*************************************************************************/
@@ -814,7 +936,7 @@ calc_noise_core_c(const gr_info * const cod_info, int *startline, int l, FLOAT s
 /* +10 dB  =>  +6.45 */
 
 int
-calc_noise(gr_info const *const cod_info,
+calc_noise(lame_internal_flags const *gfc, gr_info const *const cod_info,
            FLOAT const *l3_xmin,
            FLOAT * distort, calc_noise_result * const res, calc_noise_data * prev_noise)
 {
@@ -837,7 +959,12 @@ calc_noise(gr_info const *const cod_info,
         FLOAT   distort_ = 0.0f;
         FLOAT   noise = 0.0f;
 
-        if (prev_noise && (prev_noise->step[sfb] == s)) {
+        if (sfb >= cod_info->psybw) {
+            /* BEND: silent, so the noise is nil */
+            j += cod_info->width[sfb];
+            noise = FAST_LOG10(1E-20f);
+        }
+        else if (prev_noise && (prev_noise->step[sfb] == s)) {
 
             /* use previously computed values */
             j += cod_info->width[sfb];
@@ -860,7 +987,7 @@ calc_noise(gr_info const *const cod_info,
                     l = 0;
             }
 
-            noise = calc_noise_core_c(cod_info, &j, l, step);
+            noise = gfc->calc_noise_core(cod_info, &j, l, step);
 
 
             if (prev_noise) {
@@ -920,6 +1047,7 @@ calc_noise(gr_info const *const cod_info,
 
 
 
+#ifndef NOANALYSIS
 /************************************************************************
  *
  *  set_pinfo()
@@ -947,7 +1075,7 @@ set_pinfo(lame_internal_flags const *gfc,
     calc_noise_result noise;
 
     (void) calc_xmin(gfc, ratio, cod_info, l3_xmin);
-    (void) calc_noise(cod_info, l3_xmin, xfsf, &noise, 0);
+    (void) calc_noise(gfc, cod_info, l3_xmin, xfsf, &noise, 0);
 
     j = 0;
     sfb2 = cod_info->sfb_lmax;
@@ -1072,3 +1200,4 @@ set_frame_pinfo(lame_internal_flags * gfc, const III_psy_ratio ratio[2][2])
         }               /* for ch */
     }                   /* for gr */
 }
+#endif
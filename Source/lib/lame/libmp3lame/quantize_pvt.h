@@ -90,20 +90,36 @@ void    reduce_side(int targ_bits[2], FLOAT ms_ener_ratio, int mean_bits, int ma
 void    iteration_init(lame_internal_flags * gfc);
 
 
+void    calc_max_nonzero_coeff(lame_internal_flags const *gfc, gr_info * const cod_info);
+void    calc_bandwidth_limits(lame_internal_flags * gfc);
+void    calc_ath_xmin(lame_internal_flags * gfc);
+
 int     calc_xmin(lame_internal_flags const *gfc,
                   III_psy_ratio const *const ratio, gr_info * const cod_info, FLOAT * l3_xmin);
 
-int     calc_noise(const gr_info * const cod_info,
+int     calc_noise(lame_internal_flags const *gfc, const gr_info * const cod_info,
                    const FLOAT * l3_xmin,
                    FLOAT * distort, calc_noise_result * const res, calc_noise_data * prev_noise);
 
+void    calc_noise_core_init(lame_internal_flags * const gfc);
+
+/* BEND: the scalar kernel */
+FLOAT   calc_xmin_core_c(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2);
+
+#ifndef NOANALYSIS
 void    set_frame_pinfo(lame_internal_flags * gfc, const III_psy_ratio ratio[2][2]);
+#endif
 
 
 
 
 /* takehiro.c */
 
+/* BEND: the scalar kernels, see vector/quantize_simd.c */
+void    quantize_lines_xrpow(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi);
+void    quantize_lines_xrpow_01(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix);
+int     choose_table_nonMMX(const int *ix, const int *const end, int *const s);
+
 int     count_bits(lame_internal_flags const *const gfc, const FLOAT * const xr,
                    gr_info * const cod_info, calc_noise_data * prev_noise);
 int     noquant_count_bits(lame_internal_flags const *const gfc,
@@ -156,10 +156,12 @@ ResvFrameBegin(lame_internal_flags * gfc, int *mean_bits)
 
     l3_side->resvDrain_pre = 0;
 
+#ifndef NOANALYSIS
     if (gfc->pinfo != NULL) {
         gfc->pinfo->mean_bits = meanBits / 2; /* expected bits per channel per granule [is this also right for mono/stereo, MPEG-1/2 ?] */
         gfc->pinfo->resvsize = esv->ResvSize;
     }
+#endif
     *mean_bits = meanBits;
     return fullFrameBits;
 }
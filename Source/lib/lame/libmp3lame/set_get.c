@@ -234,6 +234,10 @@ lame_set_analysis(lame_global_flags * gfp, int analysis)
            of the possible meanings of the value */
         if (0 > analysis || 1 < analysis)
             return -1;
+#ifdef NOANALYSIS
+        if (analysis)
+            return -1;  /* BEND: built without the analyzer hooks */
+#endif
         gfp->analysis = analysis;
         return 0;
     }
@@ -263,6 +267,10 @@ lame_set_bWriteVbrTag(lame_global_flags * gfp, int bWriteVbrTag)
            of the possible meanings of the value */
         if (0 > bWriteVbrTag || 1 < bWriteVbrTag)
             return -1;
+#ifdef FISH_MINIMAL
+        if (bWriteVbrTag)
+            return -1;  /* BEND: built without VbrTag.c */
+#endif
         gfp->write_lame_tag = bWriteVbrTag;
         return 0;
     }
@@ -511,6 +519,10 @@ lame_set_findReplayGain(lame_global_flags * gfp, int findReplayGain)
            of the possible meanings of the value */
         if (0 > findReplayGain || 1 < findReplayGain)
             return -1;
+#ifdef FISH_MINIMAL
+        if (findReplayGain)
+            return -1;  /* BEND: built without gain_analysis.c */
+#endif
         gfp->findReplayGain = findReplayGain;
         return 0;
     }
@@ -535,6 +547,7 @@ lame_set_decode_on_the_fly(lame_global_flags * gfp, int decode_on_the_fly)
 {
     if (is_lame_global_flags_valid(gfp)) {
 #ifndef DECODE_ON_THE_FLY
+        (void) decode_on_the_fly;
         return -1;
 #else
         /* default = 0 (disabled) */
@@ -2344,3 +2357,132 @@ lame_get_maximum_number_of_samples(lame_t gfp, size_t buffer_size)
     }
     return LAME_GENERICERROR;
 }
+
+
+// BEND
+/* psychoacoustic model, FISH_PSY_VBR (default), FISH_PSY_CHEAP or FISH_PSY_MDCT */
+int
+lame_set_fish_psymodel(lame_global_flags * gfp, fish_psymodel psymodel)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        int const model = psymodel;
+        if (model < 0 || FISH_PSY_MAX_INDICATOR <= model)
+            return -1;  /* Unknown psymodel! */
+        gfp->fish_psymodel = psymodel;
+        return 0;
+    }
+    return -1;
+}
+
+fish_psymodel
+lame_get_fish_psymodel(const lame_global_flags * gfp)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        assert(gfp->fish_psymodel < FISH_PSY_MAX_INDICATOR);
+        return (fish_psymodel) gfp->fish_psymodel;
+    }
+    return FISH_PSY_VBR;
+}
+
+
+// BEND
+/* CBR quantizer, FISH_QUANT_ITERATIVE (default) or FISH_QUANT_DIRECT */
+int
+lame_set_fish_quantizer(lame_global_flags * gfp, fish_quantizer quantizer)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        int const q = quantizer;
+        if (q < 0 || FISH_QUANT_MAX_INDICATOR <= q)
+            return -1;  /* Unknown quantizer! */
+        gfp->fish_quantizer = quantizer;
+        return 0;
+    }
+    return -1;
+}
+
+fish_quantizer
+lame_get_fish_quantizer(const lame_global_flags * gfp)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        assert(gfp->fish_quantizer < FISH_QUANT_MAX_INDICATOR);
+        return (fish_quantizer) gfp->fish_quantizer;
+    }
+    return FISH_QUANT_ITERATIVE;
+}
+
+
+// BEND
+/* FISH_SESSION_FILE (default) or FISH_SESSION_STREAM, see lame.h */
+int
+lame_set_fish_session(lame_global_flags * gfp, fish_session session)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        int const s = session;
+        if (s < 0 || FISH_SESSION_MAX_INDICATOR <= s)
+            return -1;  /* Unknown session profile! */
+        gfp->fish_session = session;
+        return 0;
+    }
+    return -1;
+}
+
+fish_session
+lame_get_fish_session(const lame_global_flags * gfp)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        assert(gfp->fish_session < FISH_SESSION_MAX_INDICATOR);
+        return (fish_session) gfp->fish_session;
+    }
+    return FISH_SESSION_FILE;
+}
+
+
+// BEND
+/* 0 (default) or 1, see lame.h */
+int
+lame_set_fish_arena(lame_global_flags * gfp, int arena)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        if (0 > arena || 1 < arena)
+            return -1;
+        gfp->fish_arena = arena;
+        return 0;
+    }
+    return -1;
+}
+
+int
+lame_get_fish_arena(const lame_global_flags * gfp)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        assert(0 <= gfp->fish_arena && 1 >= gfp->fish_arena);
+        return gfp->fish_arena;
+    }
+    return 0;
+}
+
+// BEND
+int
+lame_get_fish_session_bytes(const lame_global_flags * gfp)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        lame_internal_flags const *const gfc = gfp->internal_flags;
+        if (gfc != 0)
+            return (int) lame_session_bytes(gfc);
+    }
+    return -1;
+}
+
+// BEND
+/* 0 (default) or 1, see set_get.h */
+int
+lame_set_bandwidth_unlimited(lame_global_flags * gfp, int unlimited)
+{
+    if (is_lame_global_flags_valid(gfp)) {
+        if (0 > unlimited || 1 < unlimited)
+            return -1;
+        gfp->bandwidth_unlimited = unlimited;
+        return 0;
+    }
+    return -1;
+}
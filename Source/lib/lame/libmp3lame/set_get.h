@@ -69,6 +69,10 @@ extern  "C" {
     void CDECL lame_set_tune(lame_t, float); /* FOR INTERNAL USE ONLY */
     void CDECL lame_set_msfix(lame_t gfp, double msfix);
 
+/* BEND: 1 has the quantizer work through the bands above the lowpass
+ * rather than skip them, for the tests */
+    int CDECL lame_set_bandwidth_unlimited(lame_global_flags *, int);
+
 
 #if defined(__cplusplus)
 }
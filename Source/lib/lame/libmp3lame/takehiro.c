@@ -33,6 +33,7 @@
 #include "util.h"
 #include "quantize_pvt.h"
 #include "tables.h"
+#include "vector/lame_intrin.h"
 
 
 static const struct {
@@ -110,7 +111,7 @@ static const struct {
 
 
 
-static void
+void
 quantize_lines_xrpow_01(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix)
 {
     const FLOAT compareval0 = (1.0f - 0.4054f) / istep;
@@ -141,7 +142,7 @@ typedef union {
 #define MAGIC_INT 0x4b000000
 
 
-static void
+void
 quantize_lines_xrpow(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi)
 {
     fi_union *fi;
@@ -219,7 +220,7 @@ quantize_lines_xrpow(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi)
 #define ROUNDFAC 0.4054
 
 
-static void
+void
 quantize_lines_xrpow(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix)
 {
     unsigned int remaining;
@@ -279,8 +280,8 @@ quantize_lines_xrpow(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix)
  *********************************************************************/
 
 static void
-quantize_xrpow(const FLOAT * xp, int *pi, FLOAT istep, gr_info const *const cod_info,
-               calc_noise_data const *prev_noise)
+quantize_xrpow(lame_internal_flags const *const gfc, const FLOAT * xp, int *pi, FLOAT istep,
+               gr_info const *const cod_info, calc_noise_data const *prev_noise)
 {
     /* quantize on xr^(3/4) instead of xr */
     int     sfb;
@@ -324,11 +325,11 @@ quantize_xrpow(const FLOAT * xp, int *pi, FLOAT istep, gr_info const *const cod_
             /* do not recompute this part,
                but compute accumulated lines */
             if (accumulate) {
-                quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
+                gfc->quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
                 accumulate = 0;
             }
             if (accumulate01) {
-                quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
+                gfc->quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
                 accumulate01 = 0;
             }
         }
@@ -363,7 +364,7 @@ quantize_xrpow(const FLOAT * xp, int *pi, FLOAT istep, gr_info const *const cod_
                 prev_noise->step[sfb] > 0 && step >= prev_noise->step[sfb]) {
 
                 if (accumulate) {
-                    quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
+                    gfc->quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
                     accumulate = 0;
                     acc_iData = iData;
                     acc_xp = xp;
@@ -372,7 +373,7 @@ quantize_xrpow(const FLOAT * xp, int *pi, FLOAT istep, gr_info const *const cod_
             }
             else {
                 if (accumulate01) {
-                    quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
+                    gfc->quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
                     accumulate01 = 0;
                     acc_iData = iData;
                     acc_xp = xp;
@@ -385,11 +386,11 @@ quantize_xrpow(const FLOAT * xp, int *pi, FLOAT istep, gr_info const *const cod_
                  *  may happen due to "prev_data_use" optimization 
                  */
                 if (accumulate01) {
-                    quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
+                    gfc->quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
                     accumulate01 = 0;
                 }
                 if (accumulate) {
-                    quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
+                    gfc->quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
                     accumulate = 0;
                 }
 
@@ -403,11 +404,11 @@ quantize_xrpow(const FLOAT * xp, int *pi, FLOAT istep, gr_info const *const cod_
         }
     }
     if (accumulate) {   /*last data part */
-        quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
+        gfc->quantize_lines_xrpow(accumulate, istep, acc_xp, acc_iData);
         accumulate = 0;
     }
     if (accumulate01) { /*last data part */
-        quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
+        gfc->quantize_lines_xrpow_01(accumulate01, istep, acc_xp, acc_iData);
         accumulate01 = 0;
     }
 
@@ -615,7 +616,7 @@ static const count_fnc count_fncs[] =
 , &count_bit_noESC_from3
 };
 
-static int
+int
 choose_table_nonMMX(const int *ix, const int *const end, int *const _s)
 {
     unsigned int* s = (unsigned int*)_s;
@@ -776,7 +777,7 @@ count_bits(lame_internal_flags const *const gfc,
     if (gi->xrpow_max > w)
         return LARGE_BITS;
 
-    quantize_xrpow(xr, ix, IPOW20(gi->global_gain), gi, prev_noise);
+    quantize_xrpow(gfc, xr, ix, IPOW20(gi->global_gain), gi, prev_noise);
 
     if (gfc->sv_qnt.substep_shaping & 2) {
         int     sfb, j = 0;
@@ -806,34 +807,216 @@ count_bits(lame_internal_flags const *const gfc,
  **********************************************************************/
 
 
-inline static void
-recalc_divide_init(const lame_internal_flags * const gfc,
-                   gr_info const *cod_info,
-                   int const *const ix, int r01_bits[], int r01_div[], int r0_tbl[], int r1_tbl[])
+/* BEND: best_huffman_divide used to run choose_table over every
+ * region0/region1/region2 split it tried.  Now the bits of each
+ * scalefactor band are counted once, for every table choose_table could
+ * pick for a region holding that band, and the bits of a region are a
+ * difference of prefix sums.  The tables picked are choose_table's. */
+
+#define HUFF_ESC16 16           /* the codes of tables 16..23, without linbits */
+#define HUFF_ESC24 17           /* the codes of tables 24..31, without linbits */
+#define HUFF_NESC  18           /* number of escaped values */
+#define HUFF_NBITS 19
+
+typedef struct {
+    int     top;                /* last table group any region can need */
+    int     nband;              /* bands below big_values, the last one cut there */
+    unsigned int max[SBMAX_l];  /* largest ix of each band */
+    unsigned int sum[SBMAX_l + 1][HUFF_NBITS]; /* bits of all bands below */
+} huff_divide_bits;
+
+
+/* the first table of the group choose_table picks from for a region
+   whose largest ix is max: 1, 2, 5, 7, 10, 13, or HUFF_ESC16 */
+static int
+huff_group(unsigned int max)
+{
+    if (max <= 1)
+        return 1;
+    if (max <= 15)
+        return huf_tbl_noESC[max - 1];
+    return HUFF_ESC16;
+}
+
+
+/* adds the bits of ix[] for the tables of groups t..top to bits[] */
+static void
+huff_count_band(const int *const ix, const int *const end, int t, int top, unsigned int *bits)
+{
+    while (t <= top) {
+        const int *p = ix;
+        if (t == 1) {
+            const uint8_t *const hlen1 = ht[1].hlen;
+            do {
+                unsigned int const x0 = *p++;
+                unsigned int const x1 = *p++;
+                bits[1] += hlen1[x0 + x0 + x1];
+            } while (p < end);
+            t = 2;
+        }
+        else if (t == 2 || t == 5) {
+            unsigned int const xlen = ht[t].xlen;
+            uint32_t const *const table = (t == 2) ? &table23[0] : &table56[0];
+            unsigned int sum = 0;
+            do {
+                unsigned int const x0 = *p++;
+                unsigned int const x1 = *p++;
+                sum += table[x0 * xlen + x1];
+            } while (p < end);
+            bits[t] += sum >> 16u;
+            bits[t + 1] += sum & 0xffffu;
+            t = (t == 2) ? 5 : 7;
+        }
+        else if (t < HUFF_ESC16) {
+            unsigned int const xlen = ht[t].xlen;
+            const uint8_t *const hlen1 = ht[t].hlen;
+            const uint8_t *const hlen2 = ht[t + 1].hlen;
+            const uint8_t *const hlen3 = ht[t + 2].hlen;
+            unsigned int sum1 = 0, sum2 = 0, sum3 = 0;
+            do {
+                unsigned int const x0 = *p++;
+                unsigned int const x1 = *p++;
+                unsigned int const x = x0 * xlen + x1;
+                sum1 += hlen1[x];
+                sum2 += hlen2[x];
+                sum3 += hlen3[x];
+            } while (p < end);
+            bits[t] += sum1;
+            bits[t + 1] += sum2;
+            bits[t + 2] += sum3;
+            t += 3;
+        }
+        else {
+            unsigned int sum = 0, nesc = 0;
+            do {
+                unsigned int x = *p++;
+                unsigned int y = *p++;
+                if (x >= 15u) {
+                    x = 15u;
+                    nesc++;
+                }
+                if (y >= 15u) {
+                    y = 15u;
+                    nesc++;
+                }
+                sum += largetbl[x * 16u + y];
+            } while (p < end);
+            bits[HUFF_ESC16] += sum >> 16u;
+            bits[HUFF_ESC24] += sum & 0xffffu;
+            bits[HUFF_NESC] += nesc;
+            t = HUFF_NBITS;
+        }
+    }
+}
+
+
+/* counts the bands from band up to big_values */
+static void
+recalc_divide_count(const lame_internal_flags * const gfc, const int *const ix, int bigv,
+                    int band, huff_divide_bits * hb)
 {
-    int     r0, r1, bigv, r0t, r1t, bits;
+    int const *const sfb_l = gfc->scalefac_band.l;
 
-    bigv = cod_info->big_values;
+    for (; sfb_l[band] < bigv; band++) {
+        int const end = Min(sfb_l[band + 1], bigv);
+        unsigned int *const bits = hb->sum[band + 1];
+        unsigned int const max = ix_max(ix + sfb_l[band], ix + end);
+
+        memcpy(bits, hb->sum[band], sizeof(hb->sum[band]));
+        hb->max[band] = max;
+        huff_count_band(ix + sfb_l[band], ix + end, huff_group(max), hb->top, bits);
+    }
+    hb->nband = band;
+}
+
+
+/* choose_table for the bands b0..b1-1, whose largest ix is max */
+static int
+recalc_divide_table(const huff_divide_bits * hb, int b0, int b1, unsigned int max, int *s)
+{
+    unsigned int const *const sum0 = hb->sum[b0];
+    unsigned int const *const sum1 = hb->sum[b1];
+    unsigned int bits, bits2;
+    int     t, t1;
+
+    if (max == 0)
+        return 0;
+
+    if (max <= 15) {
+        t = t1 = huf_tbl_noESC[max - 1];
+        bits = sum1[t1] - sum0[t1];
+        if (t1 != 1) {
+            bits2 = sum1[t1 + 1] - sum0[t1 + 1];
+            if (bits > bits2) {
+                bits = bits2;
+                t++;
+            }
+        }
+        if (t1 >= 7) {
+            bits2 = sum1[t1 + 2] - sum0[t1 + 2];
+            if (bits > bits2) {
+                bits = bits2;
+                t = t1 + 2;
+            }
+        }
+    }
+    else {
+        unsigned int const nesc = sum1[HUFF_NESC] - sum0[HUFF_NESC];
+        int     choice2;
+
+        max -= 15u;
+        for (choice2 = 24; choice2 < 32; choice2++) {
+            if (ht[choice2].linmax >= max) {
+                break;
+            }
+        }
+        for (t = choice2 - 8; t < 24; t++) {
+            if (ht[t].linmax >= max) {
+                break;
+            }
+        }
+        bits = sum1[HUFF_ESC16] - sum0[HUFF_ESC16] + nesc * ht[t].xlen;
+        bits2 = sum1[HUFF_ESC24] - sum0[HUFF_ESC24] + nesc * ht[choice2].xlen;
+        if (bits > bits2) {
+            bits = bits2;
+            t = choice2;
+        }
+    }
+    *s += bits;
+    return t;
+}
+
+
+inline static void
+recalc_divide_init(const huff_divide_bits * hb,
+                   int r01_bits[], int r01_div[], int r0_tbl[], int r1_tbl[])
+{
+    int     r0, r1, r0t, r1t, bits;
+    unsigned int max0 = 0;
 
     for (r0 = 0; r0 <= 7 + 15; r0++) {
         r01_bits[r0] = LARGE_BITS;
     }
 
+    /* region0 is bands 0..r0, region1 bands r0+1..r0+r1+1 */
     for (r0 = 0; r0 < 16; r0++) {
-        int const a1 = gfc->scalefac_band.l[r0 + 1];
+        unsigned int max1 = 0;
         int     r0bits;
-        if (a1 >= bigv)
+        if (r0 + 1 >= hb->nband)
             break;
+        if (max0 < hb->max[r0])
+            max0 = hb->max[r0];
         r0bits = 0;
-        r0t = gfc->choose_table(ix, ix + a1, &r0bits);
+        r0t = recalc_divide_table(hb, 0, r0 + 1, max0, &r0bits);
 
         for (r1 = 0; r1 < 8; r1++) {
-            int const a2 = gfc->scalefac_band.l[r0 + r1 + 2];
-            if (a2 >= bigv)
+            if (r0 + r1 + 2 >= hb->nband)
                 break;
+            if (max1 < hb->max[r0 + r1 + 1])
+                max1 = hb->max[r0 + r1 + 1];
 
             bits = r0bits;
-            r1t = gfc->choose_table(ix + a1, ix + a2, &bits);
+            r1t = recalc_divide_table(hb, r0 + 1, r0 + r1 + 2, max1, &bits);
             if (r01_bits[r0 + r1] > bits) {
                 r01_bits[r0 + r1] = bits;
                 r01_div[r0 + r1] = r0;
@@ -845,30 +1028,33 @@ recalc_divide_init(const lame_internal_flags * const gfc,
 }
 
 inline static void
-recalc_divide_sub(const lame_internal_flags * const gfc,
+recalc_divide_sub(const huff_divide_bits * hb,
                   const gr_info * cod_info2,
                   gr_info * const gi,
-                  const int *const ix,
                   const int r01_bits[], const int r01_div[], const int r0_tbl[], const int r1_tbl[])
 {
-    int     bits, r2, a2, bigv, r2t;
+    int     bits, r2, r2t;
+    unsigned int max2[SBMAX_l + 1];
 
-    bigv = cod_info2->big_values;
+    /* region2 is bands r2 up to big_values */
+    max2[hb->nband] = 0;
+    for (r2 = hb->nband - 1; r2 >= 0; r2--) {
+        max2[r2] = Max(max2[r2 + 1], hb->max[r2]);
+    }
 
     for (r2 = 2; r2 < SBMAX_l + 1; r2++) {
-        a2 = gfc->scalefac_band.l[r2];
-        if (a2 >= bigv)
+        if (r2 >= hb->nband)
             break;
 
         bits = r01_bits[r2 - 2] + cod_info2->count1bits;
         if (gi->part2_3_length <= bits)
             break;
 
-        r2t = gfc->choose_table(ix + a2, ix + bigv, &bits);
+        r2t = recalc_divide_table(hb, r2, hb->nband, max2[r2], &bits);
         if (gi->part2_3_length <= bits)
             continue;
 
-        memcpy(gi, cod_info2, sizeof(gr_info));
+        memcpy(gi, cod_info2, GR_INFO_SIDE_SIZE); /* BEND */
         gi->part2_3_length = bits;
         gi->region0_count = r01_div[r2 - 2];
         gi->region1_count = r2 - 2 - r01_div[r2 - 2];
@@ -893,6 +1079,7 @@ best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
     int     r01_div[7 + 15 + 1];
     int     r0_tbl[7 + 15 + 1];
     int     r1_tbl[7 + 15 + 1];
+    huff_divide_bits hb;
 
 
     /* SHORT BLOCK stuff fails for MPEG2 */
@@ -900,10 +1087,16 @@ best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
         return;
 
 
-    memcpy(&cod_info2, gi, sizeof(gr_info));
+    memcpy(&cod_info2, gi, GR_INFO_SIDE_SIZE); /* BEND: l3_enc stays gi's */
     if (gi->block_type == NORM_TYPE) {
-        recalc_divide_init(gfc, gi, ix, r01_bits, r01_div, r0_tbl, r1_tbl);
-        recalc_divide_sub(gfc, &cod_info2, gi, ix, r01_bits, r01_div, r0_tbl, r1_tbl);
+        /* BEND: too large for any table, count_bits said LARGE_BITS already */
+        unsigned int const max = gi->big_values > 0 ? ix_max(ix, ix + gi->big_values) : 0;
+        if (max > IXMAX_VAL)
+            return;
+        hb.top = huff_group(max);
+        recalc_divide_count(gfc, ix, gi->big_values, 0, &hb);
+        recalc_divide_init(&hb, r01_bits, r01_div, r0_tbl, r1_tbl);
+        recalc_divide_sub(&hb, &cod_info2, gi, r01_bits, r01_div, r0_tbl, r1_tbl);
     }
 
     i = cod_info2.big_values;
@@ -915,7 +1108,7 @@ best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
         return;
 
     /* Determines the number of bits to encode the quadruples. */
-    memcpy(&cod_info2, gi, sizeof(gr_info));
+    memcpy(&cod_info2, gi, GR_INFO_SIDE_SIZE); /* BEND: l3_enc stays gi's */
     cod_info2.count1 = i;
     a1 = a2 = 0;
 
@@ -936,8 +1129,14 @@ best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
 
     cod_info2.count1bits = a1;
 
-    if (cod_info2.block_type == NORM_TYPE)
-        recalc_divide_sub(gfc, &cod_info2, gi, ix, r01_bits, r01_div, r0_tbl, r1_tbl);
+    if (cod_info2.block_type == NORM_TYPE) {
+        /* recount the bands big_values has moved into */
+        int     band = 0;
+        while (gfc->scalefac_band.l[band + 1] <= i)
+            band++;
+        recalc_divide_count(gfc, ix, i, band, &hb);
+        recalc_divide_sub(&hb, &cod_info2, gi, r01_bits, r01_div, r0_tbl, r1_tbl);
+    }
     else {
         /* Count the number of bits necessary to code the bigvalues region. */
         cod_info2.part2_3_length = a1;
@@ -952,10 +1151,11 @@ best_huffman_divide(const lame_internal_flags * const gfc, gr_info * const gi)
             cod_info2.table_select[1] =
                 gfc->choose_table(ix + a1, ix + i, (int *) &cod_info2.part2_3_length);
         if (gi->part2_3_length > cod_info2.part2_3_length)
-            memcpy(gi, &cod_info2, sizeof(gr_info));
+            memcpy(gi, &cod_info2, GR_INFO_SIDE_SIZE); /* BEND */
     }
 }
 
+
 static const int slen1_n[16] = { 1, 1, 1, 1, 8, 2, 2, 2, 4, 4, 4, 8, 8, 8, 16, 16 };
 static const int slen2_n[16] = { 1, 2, 4, 8, 1, 2, 4, 8, 2, 4, 8, 2, 4, 8, 4, 8 };
 const int slen1_tab[16] = { 0, 0, 0, 0, 3, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4 };
@@ -1344,6 +1544,30 @@ huffman_init(lame_internal_flags * const gfc)
     }
 #endif
 
+    /* BEND */
+    gfc->quantize_lines_xrpow = quantize_lines_xrpow;
+    gfc->quantize_lines_xrpow_01 = quantize_lines_xrpow_01;
+#ifdef LAME_INTRIN_SSE
+    if (gfc->CPU_features.SSE2) {
+        gfc->quantize_lines_xrpow = quantize_lines_xrpow_SSE2;
+        gfc->quantize_lines_xrpow_01 = quantize_lines_xrpow_01_SSE2;
+    }
+#endif
+#ifdef LAME_INTRIN_AVX
+    if (gfc->CPU_features.AVX2) {
+        assert(choose_table_check_AVX2());
+        gfc->choose_table = choose_table_AVX2;
+        gfc->quantize_lines_xrpow = quantize_lines_xrpow_AVX2;
+        gfc->quantize_lines_xrpow_01 = quantize_lines_xrpow_01_AVX2;
+    }
+#endif
+#ifdef LAME_INTRIN_NEON
+    if (gfc->CPU_features.NEON) {
+        gfc->quantize_lines_xrpow = quantize_lines_xrpow_NEON;
+        gfc->quantize_lines_xrpow_01 = quantize_lines_xrpow_01_NEON;
+    }
+#endif
+
     for (i = 2; i <= 576; i += 2) {
         int     scfb_anz = 0, bv_index;
         while (gfc->scalefac_band.l[++scfb_anz] < i);
@@ -32,6 +32,9 @@
 #include "encoder.h"
 #include "util.h"
 #include "tables.h"
+#ifndef FISH_MINIMAL
+#include "gain_analysis.h" /* BEND: replaygain_t for the session arena */
+#endif
 
 #define PRECOMPUTE
 #if defined(__FreeBSD__) && !defined(__alpha__)
@@ -46,6 +49,7 @@
 ***********************************************************************/
 /*empty and close mallocs in gfc */
 
+#ifndef FISH_MINIMAL
 void
 free_id3tag(lame_internal_flags * const gfc)
 {
@@ -88,21 +92,37 @@ free_id3tag(lame_internal_flags * const gfc)
         gfc->tag_spec.v2_tail = 0;
     }
 }
+#endif
 
 
+/* BEND */
+static void
+free_psy_gather(lame_internal_flags const *gfc, PsyGather_t * t)
+{
+    lame_session_free(gfc, t->idx);
+    lame_session_free(gfc, t->w);
+}
+
 static void
 free_global_data(lame_internal_flags * gfc)
 {
     if (gfc && gfc->cd_psy) {
         if (gfc->cd_psy->l.s3) {
             /* XXX allocated in psymodel_init() */
-            free(gfc->cd_psy->l.s3);
+            lame_session_free(gfc, gfc->cd_psy->l.s3);
         }
         if (gfc->cd_psy->s.s3) {
             /* XXX allocated in psymodel_init() */
-            free(gfc->cd_psy->s.s3);
+            lame_session_free(gfc, gfc->cd_psy->s.s3);
         }
-        free(gfc->cd_psy);
+        lame_session_free(gfc, gfc->cd_psy->l.s3_band); /* BEND */
+        lame_session_free(gfc, gfc->cd_psy->s.s3_band);
+        free_psy_gather(gfc, &gfc->cd_psy->l.energy);
+        free_psy_gather(gfc, &gfc->cd_psy->s.energy);
+        free_psy_gather(gfc, &gfc->cd_psy->l.p2s);
+        free_psy_gather(gfc, &gfc->cd_psy->s.p2s);
+        free_psy_gather(gfc, &gfc->cd_psy->l_to_s.p2s);
+        lame_session_free(gfc, gfc->cd_psy);
         gfc->cd_psy = 0;
     }
 }
@@ -111,47 +131,54 @@ free_global_data(lame_internal_flags * gfc)
 void
 freegfc(lame_internal_flags * const gfc)
 {                       /* bit stream structure */
+    void   *arena;
     int     i;
 
     if (gfc == 0) return;
 
     for (i = 0; i <= 2 * BPC; i++)
         if (gfc->sv_enc.blackfilt[i] != NULL) {
-            free(gfc->sv_enc.blackfilt[i]);
+            lame_session_free(gfc, gfc->sv_enc.blackfilt[i]);
             gfc->sv_enc.blackfilt[i] = NULL;
         }
     if (gfc->sv_enc.inbuf_old[0]) {
-        free(gfc->sv_enc.inbuf_old[0]);
+        lame_session_free(gfc, gfc->sv_enc.inbuf_old[0]);
         gfc->sv_enc.inbuf_old[0] = NULL;
     }
     if (gfc->sv_enc.inbuf_old[1]) {
-        free(gfc->sv_enc.inbuf_old[1]);
+        lame_session_free(gfc, gfc->sv_enc.inbuf_old[1]);
         gfc->sv_enc.inbuf_old[1] = NULL;
     }
 
     if (gfc->bs.buf != NULL) {
-        free(gfc->bs.buf);
+        lame_session_free(gfc, gfc->bs.buf);
         gfc->bs.buf = NULL;
     }
 
+#ifndef FISH_MINIMAL
     if (gfc->VBR_seek_table.bag) {
-        free(gfc->VBR_seek_table.bag);
+        lame_session_free(gfc, gfc->VBR_seek_table.bag);
         gfc->VBR_seek_table.bag = NULL;
         gfc->VBR_seek_table.size = 0;
     }
+#endif
     if (gfc->ATH) {
-        free(gfc->ATH);
+        lame_session_free(gfc, gfc->ATH);
     }
+#ifndef FISH_MINIMAL
     if (gfc->sv_rpg.rgdata) {
-        free(gfc->sv_rpg.rgdata);
+        lame_session_free(gfc, gfc->sv_rpg.rgdata);
     }
+#endif
     if (gfc->sv_enc.in_buffer_0) {
-        free(gfc->sv_enc.in_buffer_0);
+        lame_session_free(gfc, gfc->sv_enc.in_buffer_0);
     }
     if (gfc->sv_enc.in_buffer_1) {
-        free(gfc->sv_enc.in_buffer_1);
+        lame_session_free(gfc, gfc->sv_enc.in_buffer_1);
     }
+#ifndef FISH_MINIMAL
     free_id3tag(gfc);
+#endif
 
 #ifdef DECODE_ON_THE_FLY
     if (gfc->hip) {
@@ -162,7 +189,224 @@ freegfc(lame_internal_flags * const gfc)
 
     free_global_data(gfc);
 
-    free(gfc);
+    arena = gfc->arena.pointer; /* BEND: gfc is in it */
+    free(arena ? arena : gfc);
+}
+
+/* BEND: the session arena, see lame_set_fish_arena.  lame_pack_session
+ * copies gfc and the blocks it points to into one allocation, in the
+ * order session_slots lists them, and frees the originals.  Blocks
+ * allocated later stay on the heap; lame_session_free tells them apart. */
+
+#define ARENA_ALIGN 64
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+#define SESSION_SLOTS_MAX 32
+
+typedef struct {
+    void   *slot;        /* where the pointer to the block is kept */
+    size_t  size;        /* 0 for a pointer into another block */
+} session_slot_t;
+
+static void *
+slot_get(void const *slot)
+{
+    void   *p;
+    memcpy(&p, slot, sizeof(p));
+    return p;
+}
+
+static size_t
+psy_gather_lanes(PsyGather_t const *t)
+{
+    size_t  n = 0;
+    int     g;
+    for (g = 0; g < t->blocks; g++)
+        n += t->rows[g];
+    return n * PSY_LANES;
+}
+
+static size_t
+s3_values(PsyConst_CB2SB_t const *gd)
+{
+    size_t  n = 0;
+    int     b;
+    for (b = 0; b < gd->npart; b++)
+        n += gd->s3ind[b][1] - gd->s3ind[b][0] + 1;
+    return n;
+}
+
+#define ARENA_PAGE 4096
+
+static int
+all_zero(unsigned char const *p, size_t n)
+{
+    while (n > 0 && p[n - 1] == 0)
+        n--;
+    return n == 0;
+}
+
+/* copies into the zeroed arena a page at a time, leaving out pages that
+ * are still zero (most of bs.buf), so they are never touched */
+static void
+arena_copy(unsigned char *dst, unsigned char const *src, size_t n)
+{
+    while (n > 0) {
+        size_t const k = Min(n, ARENA_PAGE - (size_t) dst % ARENA_PAGE);
+        if (!all_zero(src, k))
+            memcpy(dst, src, k);
+        dst += k;
+        src += k;
+        n -= k;
+    }
+}
+
+/* the blocks of a session, what every frame reads first */
+static int
+session_slots(lame_internal_flags ** pgfc, session_slot_t * s)
+{
+    lame_internal_flags *const gfc = *pgfc;
+    PsyConst_t *const gd = gfc->cd_psy;
+    EncStateVar_t *const esv = &gfc->sv_enc;
+#ifndef FISH_MINIMAL
+    replaygain_t *const rg = gfc->sv_rpg.rgdata;
+#endif
+    int     n = 0;
+
+#define SLOT(p, bytes) \
+    if ((p) != NULL) { s[n].slot = &(p); s[n].size = (bytes); n++; }
+#define SLOT_GATHER(t) \
+    SLOT((t).idx, psy_gather_lanes(&(t)) * sizeof(int)) \
+    SLOT((t).w, psy_gather_lanes(&(t)) * sizeof(FLOAT))
+
+    SLOT(*pgfc, sizeof(lame_internal_flags))
+    SLOT(gfc->cd_psy, sizeof(PsyConst_t))
+    if (gd) {
+        SLOT_GATHER(gd->l.energy)
+        SLOT(gd->l.s3_band, (gd->l.s3_hi - gd->l.s3_lo + 1) * CBANDS * sizeof(FLOAT))
+        SLOT_GATHER(gd->l.p2s)
+        SLOT_GATHER(gd->l_to_s.p2s)
+        SLOT_GATHER(gd->s.energy)
+        SLOT(gd->s.s3_band, (gd->s.s3_hi - gd->s.s3_lo + 1) * CBANDS * sizeof(FLOAT))
+        SLOT_GATHER(gd->s.p2s)
+        SLOT(gd->l.s3, s3_values(&gd->l) * sizeof(FLOAT))
+        SLOT(gd->s.s3, s3_values(&gd->s) * sizeof(FLOAT))
+        /* l_to_s shares these with l */
+        SLOT(gd->l_to_s.energy.idx, 0)
+        SLOT(gd->l_to_s.energy.w, 0)
+        SLOT(gd->l_to_s.s3_band, 0)
+        SLOT(gd->l_to_s.s3, 0)
+    }
+    SLOT(gfc->ATH, sizeof(ATH_t))
+    SLOT(gfc->bs.buf, gfc->bs.buf_size)
+    SLOT(esv->in_buffer_0, esv->in_buffer_nsamples * sizeof(sample_t))
+    SLOT(esv->in_buffer_1, esv->in_buffer_nsamples * sizeof(sample_t))
+#ifndef FISH_MINIMAL
+    SLOT(gfc->VBR_seek_table.bag, gfc->VBR_seek_table.size * sizeof(int))
+    SLOT(gfc->sv_rpg.rgdata, sizeof(replaygain_t))
+    if (rg) {
+        SLOT(rg->linpre, 0)
+        SLOT(rg->rinpre, 0)
+        SLOT(rg->lstep, 0)
+        SLOT(rg->rstep, 0)
+        SLOT(rg->lout, 0)
+        SLOT(rg->rout, 0)
+    }
+#endif
+#undef SLOT_GATHER
+#undef SLOT
+    assert(n <= SESSION_SLOTS_MAX);
+    return n;
+}
+
+/* where p went, for p in one of the blocks that moved */
+static void *
+arena_relocate(void const *p, session_slot_t const *s, void *const *old, size_t const *off,
+               int n, unsigned char *base)
+{
+    int     i;
+    for (i = 0; i < n; i++) {
+        size_t const d = (size_t) p - (size_t) old[i];
+        if (s[i].size > 0 && (size_t) p >= (size_t) old[i] && d < s[i].size)
+            return base + off[i] + d;
+    }
+    return (void *) p;
+}
+
+int
+lame_pack_session(lame_global_flags * gfp)
+{
+    lame_internal_flags *gfc = gfp->internal_flags;
+    session_slot_t s[SESSION_SLOTS_MAX];
+    void   *old[SESSION_SLOTS_MAX];
+    size_t  off[SESSION_SLOTS_MAX], size = 0;
+    unsigned char *base;
+    void   *pointer;
+    int     i, n;
+
+    if (gfc->arena.pointer != 0)
+        return 0;
+#ifndef FISH_MINIMAL
+    if (!gfc->cfg.findReplayGain && gfc->sv_rpg.rgdata) {
+        /* nothing reads it then */
+        free(gfc->sv_rpg.rgdata);
+        gfc->sv_rpg.rgdata = 0;
+    }
+#endif
+    n = session_slots(&gfp->internal_flags, s);
+    for (i = 0; i < n; i++) {
+        old[i] = slot_get(s[i].slot);
+        off[i] = size;
+        size += ARENA_ROUND(s[i].size);
+    }
+    pointer = calloc(1, size + ARENA_ALIGN - 1);
+    if (pointer == 0)
+        return -1;      /* stays on the heap */
+    base = (unsigned char *) ((((size_t) pointer + ARENA_ALIGN - 1) / ARENA_ALIGN) * ARENA_ALIGN);
+    for (i = 0; i < n; i++)
+        if (s[i].size > 0)
+            arena_copy(base + off[i], old[i], s[i].size);
+    /* every pointer, at its new place, to where its block went */
+    for (i = 0; i < n; i++) {
+        void   *const p = arena_relocate(old[i], s, old, off, n, base);
+        memcpy(arena_relocate(s[i].slot, s, old, off, n, base), &p, sizeof(p));
+    }
+    for (i = 0; i < n; i++)
+        if (s[i].size > 0)
+            free(old[i]);
+
+    gfc = gfp->internal_flags;
+    gfc->arena.pointer = pointer;
+    gfc->arena.aligned = base;
+    gfc->arena_size = size;
+    return 0;
+}
+
+static int
+in_arena(lame_internal_flags const *gfc, void const *p)
+{
+    return gfc->arena.pointer != 0 && (size_t) p >= (size_t) gfc->arena.aligned
+        && (size_t) p - (size_t) gfc->arena.aligned < gfc->arena_size;
+}
+
+void
+lame_session_free(lame_internal_flags const *gfc, void *p)
+{
+    if (!in_arena(gfc, p))
+        free(p);
+}
+
+size_t
+lame_session_bytes(lame_internal_flags const *gfc)
+{
+    lame_internal_flags *pgfc = (lame_internal_flags *) gfc;
+    session_slot_t s[SESSION_SLOTS_MAX];
+    size_t  bytes = gfc->arena_size;
+    int     i, n = session_slots(&pgfc, s);
+
+    for (i = 0; i < n; i++)
+        if (!in_arena(gfc, slot_get(s[i].slot)))
+            bytes += ARENA_ROUND(s[i].size);
+    return bytes;
 }
 
 void
@@ -782,6 +1026,86 @@ extern int has_SSE_nasm(void);
 extern int has_SSE2_nasm(void);
 #endif
 
+/* BEND: cpuid based detection for the intrinsics kernels.  The CPU is
+ * only asked once per process, every encoder after that reuses the answer.
+ */
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+# define CPUID_X86
+# if defined(_MSC_VER)
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#endif
+
+#define CPUID_SSE    (1u << 0)
+#define CPUID_SSE2   (1u << 1)
+#define CPUID_AVX2   (1u << 2)
+#define CPUID_DONE   (1u << 31)
+
+#ifdef CPUID_X86
+static void
+cpuid_count(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+    int     r[4];
+    __cpuidex(r, (int) leaf, (int) subleaf);
+    regs[0] = r[0];
+    regs[1] = r[1];
+    regs[2] = r[2];
+    regs[3] = r[3];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* which register states the OS saves on a context switch */
+static unsigned int
+xgetbv0(void)
+{
+#if defined(_MSC_VER)
+    return (unsigned int) _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return eax;
+#endif
+}
+#endif
+
+static unsigned int
+cpuid_features(void)
+{
+    static unsigned int features = 0;
+
+    if (features == 0) {
+        unsigned int found = CPUID_DONE;
+#ifdef CPUID_X86
+        unsigned int regs[4];
+        unsigned int max_leaf;
+
+        cpuid_count(0, 0, regs);
+        max_leaf = regs[0];
+        if (max_leaf >= 1) {
+            cpuid_count(1, 0, regs);
+            if (regs[3] & (1u << 25))
+                found |= CPUID_SSE;
+            if (regs[3] & (1u << 26))
+                found |= CPUID_SSE2;
+            /* OSXSAVE and AVX, then ask the OS about YMM state */
+            if ((regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) && max_leaf >= 7) {
+                unsigned int const xcr0 = xgetbv0();
+                cpuid_count(7, 0, regs);
+                if ((xcr0 & 0x06) == 0x06 && (regs[1] & (1u << 5)))
+                    found |= CPUID_AVX2;
+            }
+        }
+#endif
+        features = found; /* racing threads all store the same value */
+    }
+    return features;
+}
+
 int
 has_MMX(void)
 {
@@ -811,7 +1135,7 @@ has_SSE(void)
 #if defined( _M_X64 ) || defined( MIN_ARCH_SSE )
     return 1;
 #else
-    return 0;           /* don't know, assume not */
+    return (cpuid_features() & CPUID_SSE) != 0;
 #endif
 #endif
 }
@@ -825,11 +1149,65 @@ has_SSE2(void)
 #if defined( _M_X64 ) || defined( MIN_ARCH_SSE )
     return 1;
 #else
-    return 0;           /* don't know, assume not */
+    return (cpuid_features() & CPUID_SSE2) != 0;
 #endif
 #endif
 }
 
+int
+has_AVX2(void)
+{
+    return (cpuid_features() & CPUID_AVX2) != 0;
+}
+
+int
+has_NEON(void)
+{
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+    return 1;           /* part of the baseline there */
+#else
+    return 0;
+#endif
+}
+
+
+/* BEND: LAME_SIMD=c|sse2|avx2|neon caps which kernels an encoder
+ * may pick, so that all of them can be tried out on one machine.
+ */
+void
+limit_CPU_features(lame_internal_flags * gfc)
+{
+    char const *const level = getenv("LAME_SIMD");
+
+    if (level == NULL || level[0] == '\0')
+        return;
+    if (strcmp(level, "avx2") == 0) {
+        gfc->CPU_features.NEON = 0;
+    }
+    else if (strcmp(level, "sse2") == 0) {
+        gfc->CPU_features.AVX2 = 0;
+        gfc->CPU_features.NEON = 0;
+    }
+    else if (strcmp(level, "neon") == 0) {
+        gfc->CPU_features.MMX = 0;
+        gfc->CPU_features.AMD_3DNow = 0;
+        gfc->CPU_features.SSE = 0;
+        gfc->CPU_features.SSE2 = 0;
+        gfc->CPU_features.AVX2 = 0;
+    }
+    else if (strcmp(level, "c") == 0) {
+        gfc->CPU_features.MMX = 0;
+        gfc->CPU_features.AMD_3DNow = 0;
+        gfc->CPU_features.SSE = 0;
+        gfc->CPU_features.SSE2 = 0;
+        gfc->CPU_features.AVX2 = 0;
+        gfc->CPU_features.NEON = 0;
+    }
+    else {
+        MSGF(gfc, "Warning: LAME_SIMD=%s not understood, ignored\n", level);
+    }
+}
+
 void
 disable_FPE(void)
 {
@@ -955,9 +1333,6 @@ disable_FPE(void)
  ***********************************************************************/
 
 
-#define LOG2_SIZE       (512)
-#define LOG2_SIZE_L2    (9)
-
 static ieee754_float32_t log_table[LOG2_SIZE + 1];
 
 
@@ -1004,6 +1379,13 @@ fast_log2(ieee754_float32_t x)
     return log2val;
 }
 
+/* BEND: log_table, LOG2_SIZE + 1 entries */
+ieee754_float32_t const *
+fast_log2_table(void)
+{
+    return log_table;
+}
+
 #else /* Don't use FAST_LOG */
 
 
@@ -138,7 +138,8 @@ extern  "C" {
         int     buf_size;    /* size of buffer (in number of bytes) */
         int     totbit;      /* bit counter of bit stream */
         int     buf_byte_idx; /* pointer to top byte in buffer */
-        int     buf_bit_idx; /* pointer to top bit of top byte in buffer */
+        uint64_t acc;        /* BEND: bits not in buf yet, the low acc_bits of acc */
+        int     acc_bits;
 
         /* format of file in rd mode (BINARY/ASCII) */
     } Bit_stream_struc;
@@ -179,12 +180,29 @@ extern  "C" {
         FLOAT   cb_l[CBANDS]; /* ATH for long block convolution bands */
         FLOAT   cb_s[CBANDS]; /* ATH for short block convolution bands */
         FLOAT   eql_w[BLKSIZE / 2]; /* equal loudness weights (based on ATH) */
+        /* BEND: what calc_xmin makes of l and s, for adjust_factor = xmin_adjust */
+        FLOAT   xmin_adjust;
+        FLOAT   xmin_l[SBMAX_l];
+        FLOAT   xmin_s[SBMAX_s];
     } ATH_t;
 
     /**
      *  PSY Model related stuff
      */
 
+    /* BEND: a gather table for the band sums of psymodel.c, output k sums
+     * w * in[idx] over its terms in the order the scalar loops add them.
+     * The outputs go in blocks of PSY_LANES, block g has rows[g] rows of
+     * one term per output, and the padding terms have w = 0. */
+#define PSY_LANES 8
+#define PSY_LANES_PAD(n) (((n) + PSY_LANES - 1) / PSY_LANES * PSY_LANES)
+    typedef struct {
+        int    *idx;
+        FLOAT  *w;
+        int     rows[CBANDS / PSY_LANES];
+        int     blocks;
+    } PsyGather_t;
+
     typedef struct {
         FLOAT   masking_lower[CBANDS];
         FLOAT   minval[CBANDS];
@@ -200,20 +218,40 @@ extern  "C" {
         int     npart;
         int     n_sb; /* SBMAX_l or SBMAX_s */
         FLOAT  *s3;
+        /* BEND: s3 by diagonal for the SIMD spreading, s3 of maskee b and
+         * masker b + d at s3_band[(d - s3_lo) * CBANDS + b], 0 outside s3ind */
+        FLOAT  *s3_band;
+        int     s3_lo, s3_hi;
+        PsyGather_t energy; /* BEND: fft lines to partitions */
+        PsyGather_t p2s; /* BEND: partitions to scalefactor bands */
     } PsyConst_CB2SB_t;
 
 
+    /* BEND: per fht stage (kx = 2, 8, 32, 128) c1, s1, c2, s2 for
+     * i = 0 .. kx + 7, the padding is for the SIMD FFTs' last vector */
+#define FHT_TWIDDLE_SIZE (4 * (2 + 8 + 32 + 128 + 4 * 8))
+
     /**
      *  global data constants
      */
     typedef struct {
         FLOAT window[BLKSIZE], window_s[BLKSIZE_s / 2];
+        FLOAT   window_sf[BLKSIZE_s]; // BEND: window_s over the whole short block
+        FLOAT   fht_twiddle[FHT_TWIDDLE_SIZE]; // BEND: for the SIMD FFTs
         PsyConst_CB2SB_t l;
         PsyConst_CB2SB_t s;
         PsyConst_CB2SB_t l_to_s;
         FLOAT   attack_threshold[4];
         FLOAT   decay;
         int     force_short_block_calc;
+        FLOAT   fish_cos_l[SBMAX_l]; // BEND: cos() of the long sfb centres
+        FLOAT   fish_width_l[SBMAX_l]; // BEND: long sfb widths / 576
+        FLOAT   fish_cos_s[SBMAX_s]; // BEND: cos() of the short sfb centres
+        FLOAT   fish_width_s[SBMAX_s]; // BEND: short sfb widths / 192
+        /* BEND: vbrpsy_mask_add's table2 index is how many of the first 9
+         * ratios its ratio reaches; then ma_max_i1 and ma_max_i2 */
+        FLOAT   mask_add_ratio[11];
+        FLOAT   mask_add_factor[10]; // BEND: its table2
     } PsyConst_t;
 
 
@@ -248,6 +286,8 @@ extern  "C" {
         /* variables for newmdct.c */
         FLOAT   sb_sample[2][2][18][SBLIMIT];
         FLOAT   amp_filter[32];
+        FLOAT   amp_filter_target[32]; /* BEND: amp_filter glides here, */
+        int     amp_filter_steps;      /* one step per granule */
 
         /* variables used by util.c */
         /* BPC = maximum number of filter convolution windows to precompute */
@@ -293,10 +333,16 @@ extern  "C" {
 #ifndef  MFSIZE
 # define MFSIZE  ( 3*1152 + ENCDELAY - MDCTDELAY )
 #endif
-        sample_t mfbuf[2][MFSIZE];
+/* BEND: the MFSIZE window slides over MFSLACK more samples before its
+ * contents have to be moved back to the start of mfbuf */
+#ifndef  MFSLACK
+# define MFSLACK ( 4*1152 )
+#endif
+        sample_t mfbuf[2][MFSIZE + MFSLACK];
 
         int     mf_samples_to_encode;
         int     mf_size;
+        int     mf_start;    /* BEND: where the window begins in mfbuf */
 
     } EncStateVar_t;
 
@@ -327,6 +373,11 @@ extern  "C" {
         int     CurrentStep[2];
         int     pseudohalf[SFBMAX];
         int     sfb21_extra; /* will be set in lame_init_params */
+        /* BEND: the polyphase lowpass leaves nothing from these scalefactor
+         * bands up, see calc_bandwidth_limits */
+        int     bw_sfb_l;
+        int     bw_sfb_s;
+        int     bw_unlimited; /* BEND: 1 turns the quantizer's shortcuts off */
         int     substep_shaping; /* 0 = no substep
                                     1 = use substep shaping at last step(VBR only)
                                     (not implemented yet)
@@ -457,6 +508,10 @@ extern  "C" {
         FLOAT   pcm_transform[2][2];
 
         FLOAT   minval;
+
+        int     fish_psymodel; // BEND: see fish_psymodel in lame.h
+        int     fish_quantizer; // BEND: see fish_quantizer in lame.h
+        int     fish_session; // BEND: see fish_session in lame.h
     } SessionConfig_t;
 
 
@@ -506,12 +561,16 @@ extern  "C" {
         EncResult_t ov_enc;
         QntStateVar_t sv_qnt; /* DATA FROM QUANTIZE.C */
 
+#ifndef FISH_MINIMAL /* BEND: the Fish profile has no ReplayGain or tags */
         RpgStateVar_t sv_rpg;
+#endif
         RpgResult_t ov_rpg;
 
+#ifndef FISH_MINIMAL
         /* optional ID3 tags, used in id3tag.c  */
         struct id3tag_spec tag_spec;
         uint16_t nMusicCRC;
+#endif
 
         uint16_t _unused;
 
@@ -522,25 +581,75 @@ extern  "C" {
             unsigned int AMD_3DNow:1; /* K6-2, K6-III, Athlon      */
             unsigned int SSE:1; /* Pentium III, Pentium 4    */
             unsigned int SSE2:1; /* Pentium 4, K8             */
-            unsigned int _unused:28;
+            unsigned int AVX2:1; /* BEND: Haswell, Zen        */
+            unsigned int NEON:1; /* BEND: ARMv7 with NEON, ARMv8 */
+            unsigned int _unused:26;
         } CPU_features;
 
 
+#ifndef FISH_MINIMAL
         VBR_seek_info_t VBR_seek_table; /* used for Xing VBR header */
+#endif
 
         ATH_t  *ATH;         /* all ATH related stuff */
 
         PsyConst_t *cd_psy;
 
+        /* BEND: the block gfc and its tables live in after lame_pack_session,
+         * gfc itself first; arena.pointer is 0 when they are on the heap */
+        aligned_pointer_t arena;
+        size_t  arena_size;
+
+#ifndef NOANALYSIS
         /* used by the frame analyzer */
         plotting_data *pinfo;
+#endif
         hip_t hip;
 
         /* functions to replace with CPU feature optimized versions in takehiro.c */
         int     (*choose_table) (const int *ix, const int *const end, int *const s);
+        /* BEND */
+        void    (*quantize_lines_xrpow) (unsigned int l, FLOAT istep, const FLOAT * xp,
+                                         int *pi);
+        void    (*quantize_lines_xrpow_01) (unsigned int l, FLOAT istep, const FLOAT * xr,
+                                            int *ix);
         void    (*fft_fht) (FLOAT *, int);
+        /* BEND: whole of fft_long / one fft_short block, 0 to use fft_fht */
+        void    (*fft_window_fht) (FLOAT * x, const sample_t * in, const FLOAT * window,
+                                   const FLOAT * twiddle, int n);
         void    (*init_xrpow_core) (gr_info * const cod_info, FLOAT xrpow[576], int upper,
                                     FLOAT * sum);
+        /* BEND: the line loops of calc_noise and calc_xmin */
+        FLOAT   (*calc_noise_core) (const gr_info * const cod_info, int *startline, int l,
+                                    FLOAT step);
+        FLOAT   (*calc_xmin_core) (const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2);
+        /* BEND: newmdct.c's kernels, 0 for the scalar code.  With
+         * window_subband_x8, sb_sample is kept in band order. */
+        void    (*window_subband_x8) (const sample_t * x0, FLOAT * a0,
+                                      const sample_t * x1, FLOAT * a1);
+        void    (*mdct_alias_x8) (FLOAT * xr, int bands);
+        void    (*mdct_long_x8) (FLOAT * out, const FLOAT * sb0, FLOAT * sb1, int band,
+                                 int type, const FLOAT * amp);
+        /* BEND: the fs/4 high pass of the attack detection with the peaks
+         * of its 9 sub short blocks, and those peaks for mid and side */
+        void    (*attack_hpf_core) (const sample_t * firbuf, const FLOAT * fircoef,
+                                    FLOAT * hp, FLOAT * peak);
+        void    (*attack_ms_core) (const FLOAT * l, const FLOAT * r, FLOAT * peak_m,
+                                   FLOAT * peak_s);
+        /* BEND: the spreading of vbrpsy_compute_masking_l/s, ecb[b] for b < b_lim */
+        void    (*spread_core) (PsyConst_t const *cd, PsyConst_CB2SB_t const *gd,
+                                const FLOAT * eb, const FLOAT * wt, const int *delta,
+                                int b_lim, FLOAT * ecb);
+        /* BEND: the band reductions of psymodel.c: calc_energy,
+         * convert_partition2scalefac, the log2 ratios of pecalc_l/s and the
+         * weighted sum of psycho_loudness_approx */
+        void    (*energy_core) (PsyConst_CB2SB_t const *gd, const FLOAT * fftenergy,
+                                FLOAT * eb, FLOAT * max, FLOAT * avg);
+        void    (*p2s_core) (PsyConst_CB2SB_t const *gd, const FLOAT * eb, const FLOAT * thr,
+                             FLOAT * enn, FLOAT * thm);
+        void    (*pe_core) (const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n,
+                            FLOAT * lg);
+        FLOAT   (*loudness_core) (const FLOAT * energy, const FLOAT * eql_w);
 
         lame_report_function report_msg;
         lame_report_function report_dbg;
@@ -559,7 +668,12 @@ extern  "C" {
 *
 ***********************************************************************/
     void    freegfc(lame_internal_flags * const gfc);
+    int     lame_pack_session(lame_global_flags * gfp); /* BEND */
+    size_t  lame_session_bytes(lame_internal_flags const *gfc); /* BEND */
+    void    lame_session_free(lame_internal_flags const *gfc, void *p); /* BEND */
+#ifndef FISH_MINIMAL
     void    free_id3tag(lame_internal_flags * const gfc);
+#endif
     extern int BitrateIndex(int, int, int);
     extern int FindNearestBitrate(int, int, int);
     extern int map2MP3Frequency(int freq);
@@ -572,6 +686,11 @@ extern  "C" {
 /* log/log10 approximations */
     extern void init_log_table(void);
     extern ieee754_float32_t fast_log2(ieee754_float32_t x);
+#ifdef USE_FAST_LOG
+#define LOG2_SIZE       (512)
+#define LOG2_SIZE_L2    (9)
+    extern ieee754_float32_t const *fast_log2_table(void); /* BEND: for the SIMD kernels */
+#endif
 
     int     isResamplingNecessary(SessionConfig_t const* cfg);
 
@@ -592,6 +711,9 @@ extern  "C" {
     extern int has_3DNow(void);
     extern int has_SSE(void);
     extern int has_SSE2(void);
+    extern int has_AVX2(void); /* BEND */
+    extern int has_NEON(void); /* BEND */
+    extern void limit_CPU_features(lame_internal_flags * gfc); /* BEND */
 
 
 
@@ -612,7 +734,9 @@ extern  "C" {
 
     int     is_lame_internal_flags_valid(const lame_internal_flags * gfp);
     
+#ifndef NOANALYSIS
     extern void hip_set_pinfo(hip_t hip, plotting_data* pinfo);
+#endif
 
 #ifdef __cplusplus
 }
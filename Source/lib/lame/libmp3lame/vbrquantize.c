@@ -1359,6 +1359,10 @@ VBR_encode_frame(lame_internal_flags * gfc, const FLOAT xr34orig[2][2][576],
                      */
                     ok = 0;
                 }
+                if (cfg->fish_quantizer == FISH_QUANT_VBR_NEW && use_nbits_ch[gr][ch] > max_bits[gr][ch]) {
+                    /* BEND: Fish's channel caps are hard limits */
+                    ok = 0;
+                }
             }
         }
         if (ok) {
@@ -1369,7 +1373,15 @@ VBR_encode_frame(lame_internal_flags * gfc, const FLOAT xr34orig[2][2][576],
     /* OK, we are in trouble and have to define how many bits are
      * to be used for each granule
      */
-    {
+    if (cfg->fish_quantizer == FISH_QUANT_VBR_NEW) {
+        /* BEND: no moving bits between channels or granules */
+        for (gr = 0; gr < ngr; ++gr) {
+            for (ch = 0; ch < nch; ++ch) {
+                max_nbits_ch[gr][ch] = max_bits[gr][ch];
+            }
+        }
+    }
+    else {
         ok = 1;
         sum_fr = 0;
 
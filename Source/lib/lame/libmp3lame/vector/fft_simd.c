@@ -0,0 +1,545 @@
+/*
+ * FFT for the psychoacoustic model, AVX2 and NEON intrinsics
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* BEND: each fft_window_fht_* does all of fft_long (n = BLKSIZE) or one
+ * block of fft_short (n = BLKSIZE_s) from fft.c.
+ *
+ * The window multiply and the bit reversed load are fused into the first
+ * two radix 4 stages (the one in fft_long/fft_short and the k1 = 4 stage
+ * of fht).  Those run with one block of 16 outputs per lane.  The later
+ * stages of fht run across the twiddle index i.  The gi side of each
+ * butterfly is loaded and stored back to front.  Twiddles come from
+ * cd_psy->fht_twiddle (see init_fft), so they round the same way as in
+ * fht. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "lame.h"
+#include "machine.h"
+#include "encoder.h"
+#include "util.h"
+#include "psymodel.h"
+#include "lame_intrin.h"
+
+
+#if defined(LAME_INTRIN_AVX) || defined(LAME_INTRIN_NEON)
+
+static const unsigned char rv_tbl[] = {
+    0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
+    0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0,
+    0x08, 0x88, 0x48, 0xc8, 0x28, 0xa8, 0x68, 0xe8,
+    0x18, 0x98, 0x58, 0xd8, 0x38, 0xb8, 0x78, 0xf8,
+    0x04, 0x84, 0x44, 0xc4, 0x24, 0xa4, 0x64, 0xe4,
+    0x14, 0x94, 0x54, 0xd4, 0x34, 0xb4, 0x74, 0xf4,
+    0x0c, 0x8c, 0x4c, 0xcc, 0x2c, 0xac, 0x6c, 0xec,
+    0x1c, 0x9c, 0x5c, 0xdc, 0x3c, 0xbc, 0x7c, 0xfc,
+    0x02, 0x82, 0x42, 0xc2, 0x22, 0xa2, 0x62, 0xe2,
+    0x12, 0x92, 0x52, 0xd2, 0x32, 0xb2, 0x72, 0xf2,
+    0x0a, 0x8a, 0x4a, 0xca, 0x2a, 0xaa, 0x6a, 0xea,
+    0x1a, 0x9a, 0x5a, 0xda, 0x3a, 0xba, 0x7a, 0xfa,
+    0x06, 0x86, 0x46, 0xc6, 0x26, 0xa6, 0x66, 0xe6,
+    0x16, 0x96, 0x56, 0xd6, 0x36, 0xb6, 0x76, 0xf6,
+    0x0e, 0x8e, 0x4e, 0xce, 0x2e, 0xae, 0x6e, 0xee,
+    0x1e, 0x9e, 0x5e, 0xde, 0x3e, 0xbe, 0x7e, 0xfe
+};
+
+/* where lane l of a group starting at block g reads from (before the
+ * +n/4, +n/2, +3n/4 offsets), for row r of those blocks */
+static void
+head_index(int ix[], int lanes, int g, int r, int n)
+{
+    int const half = n >> 5; /* blocks of 16 per half */
+    int const h = g >= half;
+    int const step = BLKSIZE / n;
+    int     l;
+
+    g -= h * half;
+    for (l = 0; l < lanes; l++) {
+        ix[l] = rv_tbl[(4 * (g + l) + r) * step] + h;
+    }
+}
+
+/* the two butterflies of a fht stage that need no twiddle, one block */
+static void
+fht_block_plain(FLOAT * fz, int k1)
+{
+    int const kx = k1 >> 1, k2 = k1 << 1, k3 = k2 + k1;
+    FLOAT  *const fi = fz;
+    FLOAT  *const gi = fz + kx;
+    FLOAT   f0, f1, f2, f3;
+
+    f1 = fi[0] - fi[k1];
+    f0 = fi[0] + fi[k1];
+    f3 = fi[k2] - fi[k3];
+    f2 = fi[k2] + fi[k3];
+    fi[k2] = f0 - f2;
+    fi[0] = f0 + f2;
+    fi[k3] = f1 - f3;
+    fi[k1] = f1 + f3;
+    f1 = gi[0] - gi[k1];
+    f0 = gi[0] + gi[k1];
+    f3 = SQRT2 * gi[k3];
+    f2 = SQRT2 * gi[k2];
+    gi[k2] = f0 - f2;
+    gi[0] = f0 + f2;
+    gi[k3] = f1 - f3;
+    gi[k1] = f1 + f3;
+}
+
+#endif
+
+
+#ifdef LAME_INTRIN_AVX
+
+#include <immintrin.h>
+
+/* v[0..7] lane l goes to dst[16 * l + 0..7] */
+LAME_TARGET("avx2") static void
+store_transposed_AVX2(__m256 const v[8], FLOAT * dst)
+{
+    __m256  t0, t1, t2, t3, t4, t5, t6, t7;
+    __m256  u0, u1, u2, u3, u4, u5, u6, u7;
+
+    t0 = _mm256_unpacklo_ps(v[0], v[1]);
+    t1 = _mm256_unpackhi_ps(v[0], v[1]);
+    t2 = _mm256_unpacklo_ps(v[2], v[3]);
+    t3 = _mm256_unpackhi_ps(v[2], v[3]);
+    t4 = _mm256_unpacklo_ps(v[4], v[5]);
+    t5 = _mm256_unpackhi_ps(v[4], v[5]);
+    t6 = _mm256_unpacklo_ps(v[6], v[7]);
+    t7 = _mm256_unpackhi_ps(v[6], v[7]);
+    u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    _mm256_storeu_ps(dst + 0 * 16, _mm256_permute2f128_ps(u0, u4, 0x20));
+    _mm256_storeu_ps(dst + 1 * 16, _mm256_permute2f128_ps(u1, u5, 0x20));
+    _mm256_storeu_ps(dst + 2 * 16, _mm256_permute2f128_ps(u2, u6, 0x20));
+    _mm256_storeu_ps(dst + 3 * 16, _mm256_permute2f128_ps(u3, u7, 0x20));
+    _mm256_storeu_ps(dst + 4 * 16, _mm256_permute2f128_ps(u0, u4, 0x31));
+    _mm256_storeu_ps(dst + 5 * 16, _mm256_permute2f128_ps(u1, u5, 0x31));
+    _mm256_storeu_ps(dst + 6 * 16, _mm256_permute2f128_ps(u2, u6, 0x31));
+    _mm256_storeu_ps(dst + 7 * 16, _mm256_permute2f128_ps(u3, u7, 0x31));
+}
+
+/* windowed, bit reversed load plus the first two radix 4 stages, for
+ * 8 blocks of 16 at a time */
+LAME_TARGET("avx2") static void
+fht_head_AVX2(FLOAT * x, const sample_t * in, const FLOAT * window, const FLOAT * tw, int n)
+{
+    __m256 const c1 = _mm256_set1_ps(tw[1]);
+    __m256 const s1 = _mm256_set1_ps(tw[10 + 1]);
+    __m256 const c2 = _mm256_set1_ps(tw[20 + 1]);
+    __m256 const s2 = _mm256_set1_ps(tw[30 + 1]);
+    __m256 const sqrt2 = _mm256_set1_ps(SQRT2);
+    __m256i const q1 = _mm256_set1_epi32(n >> 2);
+    __m256i const q2 = _mm256_set1_epi32(n >> 1);
+    __m256i const q3 = _mm256_set1_epi32(3 * (n >> 2));
+    int     g, r;
+
+    for (g = 0; g < n >> 4; g += 8) {
+        __m256  m[4][4], y[16];
+        __m256  a, b, f0, f1, f2, f3, g0, g1, g2, g3;
+
+        for (r = 0; r < 4; r++) {
+            int     ix[8];
+            __m256i i0, i1, i2, i3;
+            head_index(ix, 8, g, r, n);
+            i0 = _mm256_loadu_si256((__m256i const *) ix);
+            i1 = _mm256_add_epi32(i0, q2);
+            i2 = _mm256_add_epi32(i0, q1);
+            i3 = _mm256_add_epi32(i0, q3);
+            f0 = _mm256_mul_ps(_mm256_i32gather_ps(window, i0, 4), _mm256_i32gather_ps(in, i0, 4));
+            a = _mm256_mul_ps(_mm256_i32gather_ps(window, i1, 4), _mm256_i32gather_ps(in, i1, 4));
+            f1 = _mm256_sub_ps(f0, a);
+            f0 = _mm256_add_ps(f0, a);
+            f2 = _mm256_mul_ps(_mm256_i32gather_ps(window, i2, 4), _mm256_i32gather_ps(in, i2, 4));
+            a = _mm256_mul_ps(_mm256_i32gather_ps(window, i3, 4), _mm256_i32gather_ps(in, i3, 4));
+            f3 = _mm256_sub_ps(f2, a);
+            f2 = _mm256_add_ps(f2, a);
+            m[r][0] = _mm256_add_ps(f0, f2);
+            m[r][2] = _mm256_sub_ps(f0, f2);
+            m[r][1] = _mm256_add_ps(f1, f3);
+            m[r][3] = _mm256_sub_ps(f1, f3);
+        }
+
+        /* k1 = 4: column 0 and 2 without twiddle, 1 and 3 with i = 1 */
+        f1 = _mm256_sub_ps(m[0][0], m[1][0]);
+        f0 = _mm256_add_ps(m[0][0], m[1][0]);
+        f3 = _mm256_sub_ps(m[2][0], m[3][0]);
+        f2 = _mm256_add_ps(m[2][0], m[3][0]);
+        y[8] = _mm256_sub_ps(f0, f2);
+        y[0] = _mm256_add_ps(f0, f2);
+        y[12] = _mm256_sub_ps(f1, f3);
+        y[4] = _mm256_add_ps(f1, f3);
+
+        f1 = _mm256_sub_ps(m[0][2], m[1][2]);
+        f0 = _mm256_add_ps(m[0][2], m[1][2]);
+        f3 = _mm256_mul_ps(sqrt2, m[3][2]);
+        f2 = _mm256_mul_ps(sqrt2, m[2][2]);
+        y[10] = _mm256_sub_ps(f0, f2);
+        y[2] = _mm256_add_ps(f0, f2);
+        y[14] = _mm256_sub_ps(f1, f3);
+        y[6] = _mm256_add_ps(f1, f3);
+
+        b = _mm256_sub_ps(_mm256_mul_ps(s2, m[1][1]), _mm256_mul_ps(c2, m[1][3]));
+        a = _mm256_add_ps(_mm256_mul_ps(c2, m[1][1]), _mm256_mul_ps(s2, m[1][3]));
+        f1 = _mm256_sub_ps(m[0][1], a);
+        f0 = _mm256_add_ps(m[0][1], a);
+        g1 = _mm256_sub_ps(m[0][3], b);
+        g0 = _mm256_add_ps(m[0][3], b);
+        b = _mm256_sub_ps(_mm256_mul_ps(s2, m[3][1]), _mm256_mul_ps(c2, m[3][3]));
+        a = _mm256_add_ps(_mm256_mul_ps(c2, m[3][1]), _mm256_mul_ps(s2, m[3][3]));
+        f3 = _mm256_sub_ps(m[2][1], a);
+        f2 = _mm256_add_ps(m[2][1], a);
+        g3 = _mm256_sub_ps(m[2][3], b);
+        g2 = _mm256_add_ps(m[2][3], b);
+        b = _mm256_sub_ps(_mm256_mul_ps(s1, f2), _mm256_mul_ps(c1, g3));
+        a = _mm256_add_ps(_mm256_mul_ps(c1, f2), _mm256_mul_ps(s1, g3));
+        y[9] = _mm256_sub_ps(f0, a);
+        y[1] = _mm256_add_ps(f0, a);
+        y[15] = _mm256_sub_ps(g1, b);
+        y[7] = _mm256_add_ps(g1, b);
+        b = _mm256_sub_ps(_mm256_mul_ps(c1, g2), _mm256_mul_ps(s1, f3));
+        a = _mm256_add_ps(_mm256_mul_ps(s1, g2), _mm256_mul_ps(c1, f3));
+        y[11] = _mm256_sub_ps(g0, a);
+        y[3] = _mm256_add_ps(g0, a);
+        y[13] = _mm256_sub_ps(f1, b);
+        y[5] = _mm256_add_ps(f1, b);
+
+        store_transposed_AVX2(y, x + 16 * g);
+        store_transposed_AVX2(y + 8, x + 16 * g + 8);
+    }
+}
+
+/* the remaining fht stages, k1 = 16 and up */
+LAME_TARGET("avx2") static void
+fht_tail_AVX2(FLOAT * fz, const FLOAT * tw, int n)
+{
+    __m256i const rev = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    __m256i const lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    int     k1;
+
+    tw += 4 * (2 + 8); /* k1 = 4 was done by fht_head_AVX2 */
+    for (k1 = 16; k1 < n; k1 <<= 2) {
+        int const kx = k1 >> 1, k2 = k1 << 1, k3 = k2 + k1, k4 = k2 << 1, len = kx + 8;
+        FLOAT  *fb;
+        for (fb = fz; fb < fz + n; fb += k4) {
+            int     i;
+            fht_block_plain(fb, k1);
+            for (i = 1; i < kx; i += 8) {
+                __m256i const mf = _mm256_cmpgt_epi32(_mm256_set1_epi32(kx - i), lane);
+                __m256i const mg = _mm256_permutevar8x32_epi32(mf, rev);
+                __m256 const c1 = _mm256_loadu_ps(tw + i);
+                __m256 const s1 = _mm256_loadu_ps(tw + len + i);
+                __m256 const c2 = _mm256_loadu_ps(tw + 2 * len + i);
+                __m256 const s2 = _mm256_loadu_ps(tw + 3 * len + i);
+                FLOAT  *const fi = fb + i;
+                FLOAT  *const gi = fb + k1 - i - 7; /* gi[7 - l] is lane l */
+                __m256  fi0, fi1, fi2, fi3, gi0, gi1, gi2, gi3;
+                __m256  a, b, f0, f1, f2, f3, g0, g1, g2, g3;
+
+                fi0 = _mm256_maskload_ps(fi, mf);
+                fi1 = _mm256_maskload_ps(fi + k1, mf);
+                fi2 = _mm256_maskload_ps(fi + k2, mf);
+                fi3 = _mm256_maskload_ps(fi + k3, mf);
+                gi0 = _mm256_permutevar8x32_ps(_mm256_maskload_ps(gi, mg), rev);
+                gi1 = _mm256_permutevar8x32_ps(_mm256_maskload_ps(gi + k1, mg), rev);
+                gi2 = _mm256_permutevar8x32_ps(_mm256_maskload_ps(gi + k2, mg), rev);
+                gi3 = _mm256_permutevar8x32_ps(_mm256_maskload_ps(gi + k3, mg), rev);
+
+                b = _mm256_sub_ps(_mm256_mul_ps(s2, fi1), _mm256_mul_ps(c2, gi1));
+                a = _mm256_add_ps(_mm256_mul_ps(c2, fi1), _mm256_mul_ps(s2, gi1));
+                f1 = _mm256_sub_ps(fi0, a);
+                f0 = _mm256_add_ps(fi0, a);
+                g1 = _mm256_sub_ps(gi0, b);
+                g0 = _mm256_add_ps(gi0, b);
+                b = _mm256_sub_ps(_mm256_mul_ps(s2, fi3), _mm256_mul_ps(c2, gi3));
+                a = _mm256_add_ps(_mm256_mul_ps(c2, fi3), _mm256_mul_ps(s2, gi3));
+                f3 = _mm256_sub_ps(fi2, a);
+                f2 = _mm256_add_ps(fi2, a);
+                g3 = _mm256_sub_ps(gi2, b);
+                g2 = _mm256_add_ps(gi2, b);
+                b = _mm256_sub_ps(_mm256_mul_ps(s1, f2), _mm256_mul_ps(c1, g3));
+                a = _mm256_add_ps(_mm256_mul_ps(c1, f2), _mm256_mul_ps(s1, g3));
+                fi2 = _mm256_sub_ps(f0, a);
+                fi0 = _mm256_add_ps(f0, a);
+                gi3 = _mm256_sub_ps(g1, b);
+                gi1 = _mm256_add_ps(g1, b);
+                b = _mm256_sub_ps(_mm256_mul_ps(c1, g2), _mm256_mul_ps(s1, f3));
+                a = _mm256_add_ps(_mm256_mul_ps(s1, g2), _mm256_mul_ps(c1, f3));
+                gi2 = _mm256_sub_ps(g0, a);
+                gi0 = _mm256_add_ps(g0, a);
+                fi3 = _mm256_sub_ps(f1, b);
+                fi1 = _mm256_add_ps(f1, b);
+
+                _mm256_maskstore_ps(fi, mf, fi0);
+                _mm256_maskstore_ps(fi + k1, mf, fi1);
+                _mm256_maskstore_ps(fi + k2, mf, fi2);
+                _mm256_maskstore_ps(fi + k3, mf, fi3);
+                _mm256_maskstore_ps(gi, mg, _mm256_permutevar8x32_ps(gi0, rev));
+                _mm256_maskstore_ps(gi + k1, mg, _mm256_permutevar8x32_ps(gi1, rev));
+                _mm256_maskstore_ps(gi + k2, mg, _mm256_permutevar8x32_ps(gi2, rev));
+                _mm256_maskstore_ps(gi + k3, mg, _mm256_permutevar8x32_ps(gi3, rev));
+            }
+        }
+        tw += 4 * len;
+    }
+}
+
+LAME_TARGET("avx2") void
+fft_window_fht_AVX2(FLOAT * x, const sample_t * in, const FLOAT * window,
+                    const FLOAT * twiddle, int n)
+{
+    fht_head_AVX2(x, in, window, twiddle, n);
+    fht_tail_AVX2(x, twiddle, n);
+}
+
+#endif /* LAME_INTRIN_AVX */
+
+
+#ifdef LAME_INTRIN_NEON
+
+#include <arm_neon.h>
+
+static float32x4_t
+gather4_NEON(const FLOAT * p, int const ix[4], int offset)
+{
+    FLOAT   v[4];
+    v[0] = p[ix[0] + offset];
+    v[1] = p[ix[1] + offset];
+    v[2] = p[ix[2] + offset];
+    v[3] = p[ix[3] + offset];
+    return vld1q_f32(v);
+}
+
+static float32x4_t
+reverse4_NEON(float32x4_t v)
+{
+    v = vrev64q_f32(v);
+    return vextq_f32(v, v, 2);
+}
+
+/* windowed, bit reversed load plus the first two radix 4 stages, for
+ * 4 blocks of 16 at a time */
+static void
+fht_head_NEON(FLOAT * x, const sample_t * in, const FLOAT * window, const FLOAT * tw, int n)
+{
+    float32x4_t const c1 = vdupq_n_f32(tw[1]);
+    float32x4_t const s1 = vdupq_n_f32(tw[10 + 1]);
+    float32x4_t const c2 = vdupq_n_f32(tw[20 + 1]);
+    float32x4_t const s2 = vdupq_n_f32(tw[30 + 1]);
+    float32x4_t const sqrt2 = vdupq_n_f32(SQRT2);
+    int const q1 = n >> 2, q2 = n >> 1, q3 = 3 * (n >> 2);
+    int     g, r;
+
+    for (g = 0; g < n >> 4; g += 4) {
+        float32x4_t m[4][4];
+        float32x4x4_t y[4];
+        float32x4_t a, b, f0, f1, f2, f3, g0, g1, g2, g3;
+
+        for (r = 0; r < 4; r++) {
+            int     ix[4];
+            head_index(ix, 4, g, r, n);
+            f0 = vmulq_f32(gather4_NEON(window, ix, 0), gather4_NEON(in, ix, 0));
+            a = vmulq_f32(gather4_NEON(window, ix, q2), gather4_NEON(in, ix, q2));
+            f1 = vsubq_f32(f0, a);
+            f0 = vaddq_f32(f0, a);
+            f2 = vmulq_f32(gather4_NEON(window, ix, q1), gather4_NEON(in, ix, q1));
+            a = vmulq_f32(gather4_NEON(window, ix, q3), gather4_NEON(in, ix, q3));
+            f3 = vsubq_f32(f2, a);
+            f2 = vaddq_f32(f2, a);
+            m[r][0] = vaddq_f32(f0, f2);
+            m[r][2] = vsubq_f32(f0, f2);
+            m[r][1] = vaddq_f32(f1, f3);
+            m[r][3] = vsubq_f32(f1, f3);
+        }
+
+        /* k1 = 4: column 0 and 2 without twiddle, 1 and 3 with i = 1;
+         * y[r].val[c] ends up at x[16 * block + 4 * r + c] */
+        f1 = vsubq_f32(m[0][0], m[1][0]);
+        f0 = vaddq_f32(m[0][0], m[1][0]);
+        f3 = vsubq_f32(m[2][0], m[3][0]);
+        f2 = vaddq_f32(m[2][0], m[3][0]);
+        y[2].val[0] = vsubq_f32(f0, f2);
+        y[0].val[0] = vaddq_f32(f0, f2);
+        y[3].val[0] = vsubq_f32(f1, f3);
+        y[1].val[0] = vaddq_f32(f1, f3);
+
+        f1 = vsubq_f32(m[0][2], m[1][2]);
+        f0 = vaddq_f32(m[0][2], m[1][2]);
+        f3 = vmulq_f32(sqrt2, m[3][2]);
+        f2 = vmulq_f32(sqrt2, m[2][2]);
+        y[2].val[2] = vsubq_f32(f0, f2);
+        y[0].val[2] = vaddq_f32(f0, f2);
+        y[3].val[2] = vsubq_f32(f1, f3);
+        y[1].val[2] = vaddq_f32(f1, f3);
+
+        b = vsubq_f32(vmulq_f32(s2, m[1][1]), vmulq_f32(c2, m[1][3]));
+        a = vaddq_f32(vmulq_f32(c2, m[1][1]), vmulq_f32(s2, m[1][3]));
+        f1 = vsubq_f32(m[0][1], a);
+        f0 = vaddq_f32(m[0][1], a);
+        g1 = vsubq_f32(m[0][3], b);
+        g0 = vaddq_f32(m[0][3], b);
+        b = vsubq_f32(vmulq_f32(s2, m[3][1]), vmulq_f32(c2, m[3][3]));
+        a = vaddq_f32(vmulq_f32(c2, m[3][1]), vmulq_f32(s2, m[3][3]));
+        f3 = vsubq_f32(m[2][1], a);
+        f2 = vaddq_f32(m[2][1], a);
+        g3 = vsubq_f32(m[2][3], b);
+        g2 = vaddq_f32(m[2][3], b);
+        b = vsubq_f32(vmulq_f32(s1, f2), vmulq_f32(c1, g3));
+        a = vaddq_f32(vmulq_f32(c1, f2), vmulq_f32(s1, g3));
+        y[2].val[1] = vsubq_f32(f0, a);
+        y[0].val[1] = vaddq_f32(f0, a);
+        y[3].val[3] = vsubq_f32(g1, b);
+        y[1].val[3] = vaddq_f32(g1, b);
+        b = vsubq_f32(vmulq_f32(c1, g2), vmulq_f32(s1, f3));
+        a = vaddq_f32(vmulq_f32(s1, g2), vmulq_f32(c1, f3));
+        y[2].val[3] = vsubq_f32(g0, a);
+        y[0].val[3] = vaddq_f32(g0, a);
+        y[3].val[1] = vsubq_f32(f1, b);
+        y[1].val[1] = vaddq_f32(f1, b);
+
+        for (r = 0; r < 4; r++) {
+            FLOAT  *const dst = x + 16 * g + 4 * r;
+            vst4q_lane_f32(dst + 0 * 16, y[r], 0);
+            vst4q_lane_f32(dst + 1 * 16, y[r], 1);
+            vst4q_lane_f32(dst + 2 * 16, y[r], 2);
+            vst4q_lane_f32(dst + 3 * 16, y[r], 3);
+        }
+    }
+}
+
+/* the remaining fht stages, k1 = 16 and up */
+static void
+fht_tail_NEON(FLOAT * fz, const FLOAT * tw, int n)
+{
+    int     k1;
+
+    tw += 4 * (2 + 8); /* k1 = 4 was done by fht_head_NEON */
+    for (k1 = 16; k1 < n; k1 <<= 2) {
+        int const kx = k1 >> 1, k2 = k1 << 1, k3 = k2 + k1, k4 = k2 << 1, len = kx + 8;
+        FLOAT  *fb;
+        for (fb = fz; fb < fz + n; fb += k4) {
+            int     i;
+            fht_block_plain(fb, k1);
+            for (i = 1; i + 4 <= kx; i += 4) {
+                float32x4_t const c1 = vld1q_f32(tw + i);
+                float32x4_t const s1 = vld1q_f32(tw + len + i);
+                float32x4_t const c2 = vld1q_f32(tw + 2 * len + i);
+                float32x4_t const s2 = vld1q_f32(tw + 3 * len + i);
+                FLOAT  *const fi = fb + i;
+                FLOAT  *const gi = fb + k1 - i - 3; /* gi[3 - l] is lane l */
+                float32x4_t fi0, fi1, fi2, fi3, gi0, gi1, gi2, gi3;
+                float32x4_t a, b, f0, f1, f2, f3, g0, g1, g2, g3;
+
+                fi0 = vld1q_f32(fi);
+                fi1 = vld1q_f32(fi + k1);
+                fi2 = vld1q_f32(fi + k2);
+                fi3 = vld1q_f32(fi + k3);
+                gi0 = reverse4_NEON(vld1q_f32(gi));
+                gi1 = reverse4_NEON(vld1q_f32(gi + k1));
+                gi2 = reverse4_NEON(vld1q_f32(gi + k2));
+                gi3 = reverse4_NEON(vld1q_f32(gi + k3));
+
+                b = vsubq_f32(vmulq_f32(s2, fi1), vmulq_f32(c2, gi1));
+                a = vaddq_f32(vmulq_f32(c2, fi1), vmulq_f32(s2, gi1));
+                f1 = vsubq_f32(fi0, a);
+                f0 = vaddq_f32(fi0, a);
+                g1 = vsubq_f32(gi0, b);
+                g0 = vaddq_f32(gi0, b);
+                b = vsubq_f32(vmulq_f32(s2, fi3), vmulq_f32(c2, gi3));
+                a = vaddq_f32(vmulq_f32(c2, fi3), vmulq_f32(s2, gi3));
+                f3 = vsubq_f32(fi2, a);
+                f2 = vaddq_f32(fi2, a);
+                g3 = vsubq_f32(gi2, b);
+                g2 = vaddq_f32(gi2, b);
+                b = vsubq_f32(vmulq_f32(s1, f2), vmulq_f32(c1, g3));
+                a = vaddq_f32(vmulq_f32(c1, f2), vmulq_f32(s1, g3));
+                fi2 = vsubq_f32(f0, a);
+                fi0 = vaddq_f32(f0, a);
+                gi3 = vsubq_f32(g1, b);
+                gi1 = vaddq_f32(g1, b);
+                b = vsubq_f32(vmulq_f32(c1, g2), vmulq_f32(s1, f3));
+                a = vaddq_f32(vmulq_f32(s1, g2), vmulq_f32(c1, f3));
+                gi2 = vsubq_f32(g0, a);
+                gi0 = vaddq_f32(g0, a);
+                fi3 = vsubq_f32(f1, b);
+                fi1 = vaddq_f32(f1, b);
+
+                vst1q_f32(fi, fi0);
+                vst1q_f32(fi + k1, fi1);
+                vst1q_f32(fi + k2, fi2);
+                vst1q_f32(fi + k3, fi3);
+                vst1q_f32(gi, reverse4_NEON(gi0));
+                vst1q_f32(gi + k1, reverse4_NEON(gi1));
+                vst1q_f32(gi + k2, reverse4_NEON(gi2));
+                vst1q_f32(gi + k3, reverse4_NEON(gi3));
+            }
+            for (; i < kx; i++) {
+                FLOAT const c1 = tw[i], s1 = tw[len + i];
+                FLOAT const c2 = tw[2 * len + i], s2 = tw[3 * len + i];
+                FLOAT  *const fi = fb + i;
+                FLOAT  *const gi = fb + k1 - i;
+                FLOAT   a, b, g0, f0, f1, g1, f2, g2, f3, g3;
+                b = s2 * fi[k1] - c2 * gi[k1];
+                a = c2 * fi[k1] + s2 * gi[k1];
+                f1 = fi[0] - a;
+                f0 = fi[0] + a;
+                g1 = gi[0] - b;
+                g0 = gi[0] + b;
+                b = s2 * fi[k3] - c2 * gi[k3];
+                a = c2 * fi[k3] + s2 * gi[k3];
+                f3 = fi[k2] - a;
+                f2 = fi[k2] + a;
+                g3 = gi[k2] - b;
+                g2 = gi[k2] + b;
+                b = s1 * f2 - c1 * g3;
+                a = c1 * f2 + s1 * g3;
+                fi[k2] = f0 - a;
+                fi[0] = f0 + a;
+                gi[k3] = g1 - b;
+                gi[k1] = g1 + b;
+                b = c1 * g2 - s1 * f3;
+                a = s1 * g2 + c1 * f3;
+                gi[k2] = g0 - a;
+                gi[0] = g0 + a;
+                fi[k3] = f1 - b;
+                fi[k1] = f1 + b;
+            }
+        }
+        tw += 4 * len;
+    }
+}
+
+void
+fft_window_fht_NEON(FLOAT * x, const sample_t * in, const FLOAT * window,
+                    const FLOAT * twiddle, int n)
+{
+    fht_head_NEON(x, in, window, twiddle, n);
+    fht_tail_NEON(x, twiddle, n);
+}
+
+#endif /* LAME_INTRIN_NEON */
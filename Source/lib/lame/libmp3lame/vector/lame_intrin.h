@@ -23,11 +23,171 @@
 #ifndef LAME_INTRIN_H
 #define LAME_INTRIN_H
 
+/* BEND: which kernels are compiled in.  This goes by the target the
+ * compiler is building for rather than by configure, so that each slice
+ * of a universal binary gets its own kernels.  Whether a kernel is used
+ * is decided at run time from gfc->CPU_features. */
+#if defined(HAVE_XMMINTRIN_H) || defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define LAME_INTRIN_SSE
+#endif
+#if defined(LAME_INTRIN_SSE) && (defined(__GNUC__) || defined(_MSC_VER))
+# define LAME_INTRIN_AVX    /* via target attributes, no global -mavx2 */
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+# define LAME_INTRIN_NEON
+#endif
+
+#if defined(__GNUC__) && !defined(_MSC_VER)
+# define LAME_TARGET(x) __attribute__((target(x)))
+#else
+# define LAME_TARGET(x)
+#endif
 
+/* BEND: GCC/Clang vector extensions.  Kernels written with these compile
+ * to the baseline vectors (SSE2, NEON), or to AVX2 under LAME_TARGET.
+ * They need __builtin_shufflevector, which GCC has had since 12. */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 12 && !defined(_MSC_VER))
+# define LAME_VECTOR_EXT
+#endif
+
+
+#ifdef LAME_INTRIN_SSE
 void
 init_xrpow_core_sse(gr_info * const cod_info, FLOAT xrpow[576], int upper, FLOAT * sum);
 
 void
 fht_SSE2(FLOAT* , int);
 
+void
+quantize_lines_xrpow_SSE2(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi);
+
+void
+quantize_lines_xrpow_01_SSE2(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix);
+
+FLOAT
+calc_noise_core_SSE2(const gr_info * const cod_info, int *startline, int l, FLOAT step);
+
+FLOAT
+calc_xmin_core_SSE2(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2);
+
+void
+attack_hpf_core_SSE2(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak);
+
+void
+attack_ms_core_SSE2(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s);
+
+void
+energy_core_SSE2(PsyConst_CB2SB_t const *gd, const FLOAT * fftenergy, FLOAT * eb, FLOAT * max,
+                 FLOAT * avg);
+
+void
+p2s_core_SSE2(PsyConst_CB2SB_t const *gd, const FLOAT * eb, const FLOAT * thr, FLOAT * enn,
+              FLOAT * thm);
+
+#ifdef USE_FAST_LOG
+void
+pe_core_SSE2(const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n, FLOAT * lg);
+#endif
+
+FLOAT
+loudness_core_SSE2(const FLOAT * energy, const FLOAT * eql_w);
+#endif
+
+#ifdef LAME_INTRIN_AVX
+void
+fft_window_fht_AVX2(FLOAT * x, const sample_t * in, const FLOAT * window,
+                    const FLOAT * twiddle, int n);
+
+void
+quantize_lines_xrpow_AVX2(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi);
+
+void
+quantize_lines_xrpow_01_AVX2(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix);
+
+int
+choose_table_check_AVX2(void);
+
+int
+choose_table_AVX2(const int *ix, const int *const end, int *const s);
+
+FLOAT
+calc_noise_core_AVX2(const gr_info * const cod_info, int *startline, int l, FLOAT step);
+
+FLOAT
+calc_xmin_core_AVX2(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2);
+
+void
+attack_hpf_core_AVX2(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak);
+
+void
+attack_ms_core_AVX2(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s);
+
+void
+spread_core_AVX2(PsyConst_t const *cd, PsyConst_CB2SB_t const *gd, const FLOAT * eb,
+                 const FLOAT * wt, const int *delta, int b_lim, FLOAT * ecb);
+
+void
+energy_core_AVX2(PsyConst_CB2SB_t const *gd, const FLOAT * fftenergy, FLOAT * eb, FLOAT * max,
+                 FLOAT * avg);
+
+void
+p2s_core_AVX2(PsyConst_CB2SB_t const *gd, const FLOAT * eb, const FLOAT * thr, FLOAT * enn,
+              FLOAT * thm);
+
+#ifdef USE_FAST_LOG
+void
+pe_core_AVX2(const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n, FLOAT * lg);
+#endif
+
+FLOAT
+loudness_core_AVX2(const FLOAT * energy, const FLOAT * eql_w);
+#endif
+
+#ifdef LAME_INTRIN_NEON
+void
+fft_window_fht_NEON(FLOAT * x, const sample_t * in, const FLOAT * window,
+                    const FLOAT * twiddle, int n);
+
+void
+quantize_lines_xrpow_NEON(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi);
+
+void
+quantize_lines_xrpow_01_NEON(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix);
+
+FLOAT
+calc_noise_core_NEON(const gr_info * const cod_info, int *startline, int l, FLOAT step);
+
+FLOAT
+calc_xmin_core_NEON(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2);
+
+void
+attack_hpf_core_NEON(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak);
+
+void
+attack_ms_core_NEON(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s);
+
+void
+energy_core_NEON(PsyConst_CB2SB_t const *gd, const FLOAT * fftenergy, FLOAT * eb, FLOAT * max,
+                 FLOAT * avg);
+
+void
+p2s_core_NEON(PsyConst_CB2SB_t const *gd, const FLOAT * eb, const FLOAT * thr, FLOAT * enn,
+              FLOAT * thm);
+
+#ifdef USE_FAST_LOG
+void
+pe_core_NEON(const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n, FLOAT * lg);
+#endif
+
+FLOAT
+loudness_core_NEON(const FLOAT * energy, const FLOAT * eql_w);
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+void
+spread_core_NEON(PsyConst_t const *cd, PsyConst_CB2SB_t const *gd, const FLOAT * eb,
+                 const FLOAT * wt, const int *delta, int b_lim, FLOAT * ecb);
+#endif
+#endif
+
 #endif
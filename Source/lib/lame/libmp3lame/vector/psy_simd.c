@@ -0,0 +1,751 @@
+/*
+ * Attack detection, spreading and band reductions of the psychoacoustic
+ * model (attack_hpf_core_c, attack_ms_core_c, spread_core_c,
+ * energy_core_c, p2s_core_c, pe_core_c and loudness_core_c of
+ * psymodel.c), SSE2, AVX2 and NEON intrinsics
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* BEND: attack_hpf_core_* run the fs/4 high pass of vbrpsy_attack_detection
+ * a vector of outputs at a time, with the taps added in the order of
+ * attack_hpf_core_c, so the filtered samples are the same bit for bit.
+ * Each sub short block's peak comes out of the same pass; attack_ms_core_*
+ * take the mid and side peaks the same way.
+ *
+ * spread_core_* run vbrpsy_spread with one partition b per lane,
+ * walking the diagonals d of s3_band in the order spread_core_c walks
+ * the masker b + d.  Outside s3ind the s3 entry is 0, which mask_add
+ * passes over, so the lanes need no bounds.  The thresholds in
+ * cd->mask_add_ratio match mask_add_index, and as they are nested
+ * mask_add_* build table2's factor by adding the steps between its bit
+ * patterns, so ecb is the same bit for bit too.  The loop over b is the
+ * inner one: one lane's fold is a long dependency chain.
+ *
+ * energy_core_* and p2s_core_* run one partition or scalefactor
+ * band per lane through a PsyGather_t (see init_psy_gather), one row of
+ * terms at a time.  Each lane adds its terms in the order of the scalar
+ * loop and the padding adds +0, so eb, max, avg and the band sums are the
+ * same bit for bit.
+ *
+ * pe_core_* take log_table lookups lane by lane with the arithmetic of
+ * fast_log2, so they give pe_core_c's log2s; pecalc_l/s add them up.
+ *
+ * loudness_core_* sum in vector lanes, so the loudness may differ from
+ * loudness_core_c in the last bits. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "lame.h"
+#include "machine.h"
+#include "encoder.h"
+#include "util.h"
+#include "psymodel.h"
+#include "lame_intrin.h"
+
+
+#ifdef LAME_INTRIN_SSE
+
+#include <emmintrin.h>
+
+LAME_TARGET("sse2") static __m128
+gather4_SSE2(const FLOAT * p, const int *ix)
+{
+    return _mm_setr_ps(p[ix[0]], p[ix[1]], p[ix[2]], p[ix[3]]);
+}
+
+LAME_TARGET("sse2") void
+energy_core_SSE2(PsyConst_CB2SB_t const *gd, const FLOAT * fftenergy, FLOAT * eb, FLOAT * max,
+                 FLOAT * avg)
+{
+    PsyGather_t const *const t = &gd->energy;
+    const int *idx = t->idx;
+    const FLOAT *w = t->w;
+    int     g, r;
+
+    for (g = 0; g < t->blocks; g++) {
+        int const b = g * PSY_LANES;
+        __m128  s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+        __m128  m0 = _mm_setzero_ps(), m1 = _mm_setzero_ps();
+        for (r = 0; r < t->rows[g]; r++, idx += PSY_LANES, w += PSY_LANES) {
+            __m128 const x0 = _mm_mul_ps(_mm_loadu_ps(w), gather4_SSE2(fftenergy, idx));
+            __m128 const x1 = _mm_mul_ps(_mm_loadu_ps(w + 4), gather4_SSE2(fftenergy, idx + 4));
+            s0 = _mm_add_ps(s0, x0);
+            s1 = _mm_add_ps(s1, x1);
+            m0 = _mm_max_ps(m0, x0);
+            m1 = _mm_max_ps(m1, x1);
+        }
+        _mm_storeu_ps(eb + b, s0);
+        _mm_storeu_ps(eb + b + 4, s1);
+        _mm_storeu_ps(max + b, m0);
+        _mm_storeu_ps(max + b + 4, m1);
+        _mm_storeu_ps(avg + b, _mm_mul_ps(s0, _mm_loadu_ps(gd->rnumlines + b)));
+        _mm_storeu_ps(avg + b + 4, _mm_mul_ps(s1, _mm_loadu_ps(gd->rnumlines + b + 4)));
+    }
+}
+
+LAME_TARGET("sse2") void
+p2s_core_SSE2(PsyConst_CB2SB_t const *gd, const FLOAT * eb, const FLOAT * thr, FLOAT * enn,
+              FLOAT * thm)
+{
+    PsyGather_t const *const t = &gd->p2s;
+    const int *idx = t->idx;
+    const FLOAT *w = t->w;
+    int     g, r;
+
+    for (g = 0; g < t->blocks; g++) {
+        int const sb = g * PSY_LANES;
+        __m128  e0 = _mm_setzero_ps(), e1 = _mm_setzero_ps();
+        __m128  t0 = _mm_setzero_ps(), t1 = _mm_setzero_ps();
+        for (r = 0; r < t->rows[g]; r++, idx += PSY_LANES, w += PSY_LANES) {
+            __m128 const w0 = _mm_loadu_ps(w), w1 = _mm_loadu_ps(w + 4);
+            e0 = _mm_add_ps(e0, _mm_mul_ps(w0, gather4_SSE2(eb, idx)));
+            e1 = _mm_add_ps(e1, _mm_mul_ps(w1, gather4_SSE2(eb, idx + 4)));
+            t0 = _mm_add_ps(t0, _mm_mul_ps(w0, gather4_SSE2(thr, idx)));
+            t1 = _mm_add_ps(t1, _mm_mul_ps(w1, gather4_SSE2(thr, idx + 4)));
+        }
+        _mm_storeu_ps(enn + sb, e0);
+        _mm_storeu_ps(enn + sb + 4, e1);
+        _mm_storeu_ps(thm + sb, t0);
+        _mm_storeu_ps(thm + sb + 4, t1);
+    }
+}
+
+#ifdef USE_FAST_LOG
+/* fast_log2 lane by lane */
+LAME_TARGET("sse2") static __m128
+fast_log2_SSE2(__m128 x, ieee754_float32_t const *tab)
+{
+    __m128i const bits = _mm_castps_si128(x);
+    __m128i const mant = _mm_and_si128(bits, _mm_set1_epi32(0x7fffff));
+    __m128 const e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23),
+                                                                 _mm_set1_epi32(0xff)),
+                                                   _mm_set1_epi32(0x7f)));
+    __m128 const partial =
+        _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(mant,
+                                                 _mm_set1_epi32((1 << (23 - LOG2_SIZE_L2)) - 1))),
+                   _mm_set1_ps(1.0f / ((1 << (23 - LOG2_SIZE_L2)))));
+    int     k[4];
+    __m128  t0, t1;
+
+    _mm_storeu_si128((__m128i *) k, _mm_srli_epi32(mant, 23 - LOG2_SIZE_L2));
+    t0 = _mm_setr_ps(tab[k[0]], tab[k[1]], tab[k[2]], tab[k[3]]);
+    t1 = _mm_setr_ps(tab[k[0] + 1], tab[k[1] + 1], tab[k[2] + 1], tab[k[3] + 1]);
+    return _mm_add_ps(e, _mm_add_ps(_mm_mul_ps(t0, _mm_sub_ps(_mm_set1_ps(1.0f), partial)),
+                                    _mm_mul_ps(t1, partial)));
+}
+
+LAME_TARGET("sse2") void
+pe_core_SSE2(const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n, FLOAT * lg)
+{
+    ieee754_float32_t const *const tab = fast_log2_table();
+    __m128 const ml = _mm_set1_ps(masking_lower);
+    __m128 const zero = _mm_setzero_ps();
+    int     i;
+
+    for (i = 0; i < n; i += 4) {
+        __m128 const t = _mm_loadu_ps(thm + i);
+        __m128 const e = _mm_loadu_ps(en + i);
+        __m128 const x = _mm_mul_ps(t, ml);
+        __m128 const on = _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmpgt_ps(e, x));
+        __m128 const sat = _mm_cmpgt_ps(e, _mm_mul_ps(x, _mm_set1_ps(1e10f)));
+        __m128 const l = fast_log2_SSE2(_mm_div_ps(e, x), tab);
+        __m128 const v = _mm_or_ps(_mm_and_ps(sat, _mm_set1_ps(PE_SATURATED)),
+                                   _mm_andnot_ps(sat, l));
+        _mm_storeu_ps(lg + i, _mm_and_ps(on, v));
+    }
+}
+#endif
+
+LAME_TARGET("sse2") FLOAT
+loudness_core_SSE2(const FLOAT * energy, const FLOAT * eql_w)
+{
+    __m128  s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    int     i;
+
+    for (i = 0; i < BLKSIZE / 2; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(energy + i), _mm_loadu_ps(eql_w + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(energy + i + 4),
+                                       _mm_loadu_ps(eql_w + i + 4)));
+    }
+    s0 = _mm_add_ps(s0, s1);
+    s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+    s0 = _mm_add_ss(s0, _mm_shuffle_ps(s0, s0, 1));
+    return _mm_cvtss_f32(s0);
+}
+
+LAME_TARGET("sse2") static FLOAT
+hmax_SSE2(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+LAME_TARGET("sse2") void
+attack_hpf_core_SSE2(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak)
+{
+    __m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128  c[(NSFIRLEN - 1) / 2];
+    int     b, i, j;
+
+    for (j = 0; j < (NSFIRLEN - 1) / 2; j++)
+        c[j] = _mm_set1_ps(coef[j]);
+    for (b = 0, i = 0; b < 9; b++) {
+        __m128  p = _mm_set1_ps(1.f);
+        for (; i < 576 / 9 * (b + 1); i += 4) {
+            __m128  sum1 = _mm_loadu_ps(firbuf + i + 10);
+            __m128  sum2 = _mm_setzero_ps();
+            __m128  h;
+            for (j = 0; j < ((NSFIRLEN - 1) / 2) - 1; j += 2) {
+                __m128 const x1 = _mm_add_ps(_mm_loadu_ps(firbuf + i + j),
+                                             _mm_loadu_ps(firbuf + i + NSFIRLEN - j));
+                __m128 const x2 = _mm_add_ps(_mm_loadu_ps(firbuf + i + j + 1),
+                                             _mm_loadu_ps(firbuf + i + NSFIRLEN - j - 1));
+                sum1 = _mm_add_ps(sum1, _mm_mul_ps(c[j], x1));
+                sum2 = _mm_add_ps(sum2, _mm_mul_ps(c[j + 1], x2));
+            }
+            h = _mm_add_ps(sum1, sum2);
+            _mm_storeu_ps(hp + i, h);
+            p = _mm_max_ps(_mm_and_ps(h, abs_mask), p);
+        }
+        peak[b] = hmax_SSE2(p);
+    }
+}
+
+LAME_TARGET("sse2") void
+attack_ms_core_SSE2(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s)
+{
+    __m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    int     b, i;
+
+    for (b = 0, i = 0; b < 9; b++) {
+        __m128  pm = _mm_set1_ps(1.f), ps = pm;
+        for (; i < 576 / 9 * (b + 1); i += 4) {
+            __m128 const vl = _mm_loadu_ps(l + i);
+            __m128 const vr = _mm_loadu_ps(r + i);
+            pm = _mm_max_ps(_mm_and_ps(_mm_add_ps(vl, vr), abs_mask), pm);
+            ps = _mm_max_ps(_mm_and_ps(_mm_sub_ps(vl, vr), abs_mask), ps);
+        }
+        peak_m[b] = hmax_SSE2(pm);
+        peak_s[b] = hmax_SSE2(ps);
+    }
+}
+
+#endif /* LAME_INTRIN_SSE */
+
+#ifdef LAME_INTRIN_AVX
+
+#include <immintrin.h>
+
+LAME_TARGET("avx2") static __m256
+gather8_AVX2(const FLOAT * p, const int *ix)
+{
+    return _mm256_setr_ps(p[ix[0]], p[ix[1]], p[ix[2]], p[ix[3]],
+                          p[ix[4]], p[ix[5]], p[ix[6]], p[ix[7]]);
+}
+
+LAME_TARGET("avx2") void
+energy_core_AVX2(PsyConst_CB2SB_t const *gd, const FLOAT * fftenergy, FLOAT * eb, FLOAT * max,
+                 FLOAT * avg)
+{
+    PsyGather_t const *const t = &gd->energy;
+    const int *idx = t->idx;
+    const FLOAT *w = t->w;
+    int     g, r;
+
+    for (g = 0; g < t->blocks; g++) {
+        int const b = g * PSY_LANES;
+        __m256  s = _mm256_setzero_ps(), m = _mm256_setzero_ps();
+        for (r = 0; r < t->rows[g]; r++, idx += PSY_LANES, w += PSY_LANES) {
+            __m256 const x =
+                _mm256_mul_ps(_mm256_loadu_ps(w),
+                              gather8_AVX2(fftenergy, idx));
+            s = _mm256_add_ps(s, x);
+            m = _mm256_max_ps(m, x);
+        }
+        _mm256_storeu_ps(eb + b, s);
+        _mm256_storeu_ps(max + b, m);
+        _mm256_storeu_ps(avg + b, _mm256_mul_ps(s, _mm256_loadu_ps(gd->rnumlines + b)));
+    }
+}
+
+LAME_TARGET("avx2") void
+p2s_core_AVX2(PsyConst_CB2SB_t const *gd, const FLOAT * eb, const FLOAT * thr, FLOAT * enn,
+              FLOAT * thm)
+{
+    PsyGather_t const *const t = &gd->p2s;
+    const int *idx = t->idx;
+    const FLOAT *w = t->w;
+    int     g, r;
+
+    for (g = 0; g < t->blocks; g++) {
+        int const sb = g * PSY_LANES;
+        __m256  e = _mm256_setzero_ps(), h = _mm256_setzero_ps();
+        for (r = 0; r < t->rows[g]; r++, idx += PSY_LANES, w += PSY_LANES) {
+            __m256 const wr = _mm256_loadu_ps(w);
+            e = _mm256_add_ps(e, _mm256_mul_ps(wr, gather8_AVX2(eb, idx)));
+            h = _mm256_add_ps(h, _mm256_mul_ps(wr, gather8_AVX2(thr, idx)));
+        }
+        _mm256_storeu_ps(enn + sb, e);
+        _mm256_storeu_ps(thm + sb, h);
+    }
+}
+
+#ifdef USE_FAST_LOG
+/* fast_log2 lane by lane */
+LAME_TARGET("avx2") static __m256
+fast_log2_AVX2(__m256 x, ieee754_float32_t const *tab)
+{
+    __m256i const bits = _mm256_castps_si256(x);
+    __m256i const mant = _mm256_and_si256(bits, _mm256_set1_epi32(0x7fffff));
+    __m256i const k = _mm256_srli_epi32(mant, 23 - LOG2_SIZE_L2);
+    __m256 const e =
+        _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23),
+                                                             _mm256_set1_epi32(0xff)),
+                                            _mm256_set1_epi32(0x7f)));
+    __m256 const partial =
+        _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(mant,
+                                                          _mm256_set1_epi32((1 << (23 -
+                                                                                   LOG2_SIZE_L2))
+                                                                            - 1))),
+                      _mm256_set1_ps(1.0f / ((1 << (23 - LOG2_SIZE_L2)))));
+    __m256 const t0 = _mm256_i32gather_ps(tab, k, 4);
+    __m256 const t1 = _mm256_i32gather_ps(tab + 1, k, 4);
+
+    return _mm256_add_ps(e, _mm256_add_ps(_mm256_mul_ps(t0, _mm256_sub_ps(_mm256_set1_ps(1.0f),
+                                                                          partial)),
+                                          _mm256_mul_ps(t1, partial)));
+}
+
+LAME_TARGET("avx2") void
+pe_core_AVX2(const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n, FLOAT * lg)
+{
+    ieee754_float32_t const *const tab = fast_log2_table();
+    __m256 const ml = _mm256_set1_ps(masking_lower);
+    __m256 const zero = _mm256_setzero_ps();
+    int     i;
+
+    for (i = 0; i < n; i += 8) {
+        __m256 const t = _mm256_loadu_ps(thm + i);
+        __m256 const e = _mm256_loadu_ps(en + i);
+        __m256 const x = _mm256_mul_ps(t, ml);
+        __m256 const on = _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ),
+                                        _mm256_cmp_ps(e, x, _CMP_GT_OQ));
+        __m256 const sat = _mm256_cmp_ps(e, _mm256_mul_ps(x, _mm256_set1_ps(1e10f)), _CMP_GT_OQ);
+        __m256 const l = fast_log2_AVX2(_mm256_div_ps(e, x), tab);
+        _mm256_storeu_ps(lg + i, _mm256_and_ps(on, _mm256_blendv_ps(l, _mm256_set1_ps(PE_SATURATED),
+                                                                   sat)));
+    }
+}
+#endif
+
+LAME_TARGET("avx2") FLOAT
+loudness_core_AVX2(const FLOAT * energy, const FLOAT * eql_w)
+{
+    __m256  s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m128  s;
+    int     i;
+
+    for (i = 0; i < BLKSIZE / 2; i += 16) {
+        s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(energy + i),
+                                             _mm256_loadu_ps(eql_w + i)));
+        s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(energy + i + 8),
+                                             _mm256_loadu_ps(eql_w + i + 8)));
+    }
+    s0 = _mm256_add_ps(s0, s1);
+    s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+LAME_TARGET("avx2") static FLOAT
+hmax_AVX2(__m256 v)
+{
+    __m128  h = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_max_ss(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(h);
+}
+
+LAME_TARGET("avx2") void
+attack_hpf_core_AVX2(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak)
+{
+    __m256 const abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256  c[(NSFIRLEN - 1) / 2];
+    int     b, i, j;
+
+    for (j = 0; j < (NSFIRLEN - 1) / 2; j++)
+        c[j] = _mm256_set1_ps(coef[j]);
+    for (b = 0, i = 0; b < 9; b++) {
+        __m256  p = _mm256_set1_ps(1.f);
+        for (; i < 576 / 9 * (b + 1); i += 8) {
+            __m256  sum1 = _mm256_loadu_ps(firbuf + i + 10);
+            __m256  sum2 = _mm256_setzero_ps();
+            __m256  h;
+            for (j = 0; j < ((NSFIRLEN - 1) / 2) - 1; j += 2) {
+                __m256 const x1 = _mm256_add_ps(_mm256_loadu_ps(firbuf + i + j),
+                                                _mm256_loadu_ps(firbuf + i + NSFIRLEN - j));
+                __m256 const x2 = _mm256_add_ps(_mm256_loadu_ps(firbuf + i + j + 1),
+                                                _mm256_loadu_ps(firbuf + i + NSFIRLEN - j - 1));
+                sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(c[j], x1));
+                sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(c[j + 1], x2));
+            }
+            h = _mm256_add_ps(sum1, sum2);
+            _mm256_storeu_ps(hp + i, h);
+            p = _mm256_max_ps(_mm256_and_ps(h, abs_mask), p);
+        }
+        peak[b] = hmax_AVX2(p);
+    }
+}
+
+LAME_TARGET("avx2") void
+attack_ms_core_AVX2(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s)
+{
+    __m256 const abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    int     b, i;
+
+    for (b = 0, i = 0; b < 9; b++) {
+        __m256  pm = _mm256_set1_ps(1.f), ps = pm;
+        for (; i < 576 / 9 * (b + 1); i += 8) {
+            __m256 const vl = _mm256_loadu_ps(l + i);
+            __m256 const vr = _mm256_loadu_ps(r + i);
+            pm = _mm256_max_ps(_mm256_and_ps(_mm256_add_ps(vl, vr), abs_mask), pm);
+            ps = _mm256_max_ps(_mm256_and_ps(_mm256_sub_ps(vl, vr), abs_mask), ps);
+        }
+        peak_m[b] = hmax_AVX2(pm);
+        peak_s[b] = hmax_AVX2(ps);
+    }
+}
+
+/* vbrpsy_mask_add lane by lane, for m1 >= 0; near: |b| <= delta.
+ * th holds cd->mask_add_ratio, fs table2[0] then its steps, broadcast. */
+LAME_TARGET("avx2") static __m256
+mask_add_AVX2(__m256 m1, __m256 m2, __m256 near, const __m256 * th, const __m256i * fs)
+{
+    __m256 const zero = _mm256_setzero_ps();
+    __m256i fi = fs[0];
+    __m256  hi, ratio, sum, f, r;
+    int     i;
+
+    m2 = _mm256_max_ps(m2, zero);
+    hi = _mm256_max_ps(m1, m2);
+    ratio = _mm256_div_ps(hi, _mm256_min_ps(m1, m2));
+    sum = _mm256_add_ps(m1, m2);
+    for (i = 0; i < 9; i++)
+        fi = _mm256_add_epi32(fi, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(ratio, th[i],
+                                                                                     _CMP_GE_OQ)),
+                                                   fs[i + 1]));
+    f = _mm256_castsi256_ps(fi);
+    f = _mm256_blendv_ps(_mm256_mul_ps(sum, f), sum, _mm256_cmp_ps(ratio, th[9], _CMP_GE_OQ));
+    r = _mm256_blendv_ps(sum, hi, _mm256_cmp_ps(ratio, th[10], _CMP_GE_OQ));
+    r = _mm256_blendv_ps(r, f, near);
+    r = _mm256_blendv_ps(r, m1, _mm256_cmp_ps(m2, zero, _CMP_LE_OQ));
+    return _mm256_blendv_ps(r, m2, _mm256_cmp_ps(m1, zero, _CMP_LE_OQ));
+}
+
+LAME_TARGET("avx2") void
+spread_core_AVX2(PsyConst_t const *cd, PsyConst_CB2SB_t const *gd, const FLOAT * eb,
+                 const FLOAT * wt, const int *delta, int b_lim, FLOAT * ecb)
+{
+    const FLOAT *s3 = gd->s3_band;
+    __m256  th[11];
+    __m256i fs[10];
+    int     b, d, i;
+
+    for (i = 0; i < 11; i++)
+        th[i] = _mm256_set1_ps(cd->mask_add_ratio[i]);
+    fs[0] = _mm256_castps_si256(_mm256_set1_ps(cd->mask_add_factor[0]));
+    for (i = 1; i < 10; i++)
+        fs[i] = _mm256_sub_epi32(_mm256_castps_si256(_mm256_set1_ps(cd->mask_add_factor[i])),
+                                 _mm256_castps_si256(_mm256_set1_ps(cd->mask_add_factor[i - 1])));
+    for (b = 0; b < b_lim; b += 8)
+        _mm256_storeu_ps(ecb + b, _mm256_setzero_ps());
+    for (d = gd->s3_lo; d <= gd->s3_hi; d++, s3 += CBANDS) {
+        __m256 const ad = _mm256_set1_ps((FLOAT) (d < 0 ? -d : d));
+        for (b = 0; b < b_lim; b += 8) {
+            __m256 const x = _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(s3 + b),
+                                                         _mm256_loadu_ps(eb + b + d)),
+                                           _mm256_loadu_ps(wt + b + d));
+            __m256 const near =
+                _mm256_cmp_ps(ad, _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)
+                                                                        (delta + b))),
+                              _CMP_LE_OQ);
+            _mm256_storeu_ps(ecb + b, mask_add_AVX2(_mm256_loadu_ps(ecb + b), x, near, th, fs));
+        }
+    }
+}
+
+#endif /* LAME_INTRIN_AVX */
+
+#ifdef LAME_INTRIN_NEON
+
+#include <arm_neon.h>
+
+static float32x4_t
+gather4_NEON(const FLOAT * p, const int *ix)
+{
+    float32x4_t v = vdupq_n_f32(0.f);
+    v = vld1q_lane_f32(p + ix[0], v, 0);
+    v = vld1q_lane_f32(p + ix[1], v, 1);
+    v = vld1q_lane_f32(p + ix[2], v, 2);
+    return vld1q_lane_f32(p + ix[3], v, 3);
+}
+
+void
+energy_core_NEON(PsyConst_CB2SB_t const *gd, const FLOAT * fftenergy, FLOAT * eb, FLOAT * max,
+                 FLOAT * avg)
+{
+    PsyGather_t const *const t = &gd->energy;
+    const int *idx = t->idx;
+    const FLOAT *w = t->w;
+    int     g, r;
+
+    for (g = 0; g < t->blocks; g++) {
+        int const b = g * PSY_LANES;
+        float32x4_t s0 = vdupq_n_f32(0.f), s1 = vdupq_n_f32(0.f);
+        float32x4_t m0 = vdupq_n_f32(0.f), m1 = vdupq_n_f32(0.f);
+        for (r = 0; r < t->rows[g]; r++, idx += PSY_LANES, w += PSY_LANES) {
+            float32x4_t const x0 = vmulq_f32(vld1q_f32(w), gather4_NEON(fftenergy, idx));
+            float32x4_t const x1 = vmulq_f32(vld1q_f32(w + 4), gather4_NEON(fftenergy, idx + 4));
+            s0 = vaddq_f32(s0, x0);
+            s1 = vaddq_f32(s1, x1);
+            m0 = vmaxq_f32(m0, x0);
+            m1 = vmaxq_f32(m1, x1);
+        }
+        vst1q_f32(eb + b, s0);
+        vst1q_f32(eb + b + 4, s1);
+        vst1q_f32(max + b, m0);
+        vst1q_f32(max + b + 4, m1);
+        vst1q_f32(avg + b, vmulq_f32(s0, vld1q_f32(gd->rnumlines + b)));
+        vst1q_f32(avg + b + 4, vmulq_f32(s1, vld1q_f32(gd->rnumlines + b + 4)));
+    }
+}
+
+void
+p2s_core_NEON(PsyConst_CB2SB_t const *gd, const FLOAT * eb, const FLOAT * thr, FLOAT * enn,
+              FLOAT * thm)
+{
+    PsyGather_t const *const t = &gd->p2s;
+    const int *idx = t->idx;
+    const FLOAT *w = t->w;
+    int     g, r;
+
+    for (g = 0; g < t->blocks; g++) {
+        int const sb = g * PSY_LANES;
+        float32x4_t e0 = vdupq_n_f32(0.f), e1 = vdupq_n_f32(0.f);
+        float32x4_t t0 = vdupq_n_f32(0.f), t1 = vdupq_n_f32(0.f);
+        for (r = 0; r < t->rows[g]; r++, idx += PSY_LANES, w += PSY_LANES) {
+            float32x4_t const w0 = vld1q_f32(w), w1 = vld1q_f32(w + 4);
+            e0 = vaddq_f32(e0, vmulq_f32(w0, gather4_NEON(eb, idx)));
+            e1 = vaddq_f32(e1, vmulq_f32(w1, gather4_NEON(eb, idx + 4)));
+            t0 = vaddq_f32(t0, vmulq_f32(w0, gather4_NEON(thr, idx)));
+            t1 = vaddq_f32(t1, vmulq_f32(w1, gather4_NEON(thr, idx + 4)));
+        }
+        vst1q_f32(enn + sb, e0);
+        vst1q_f32(enn + sb + 4, e1);
+        vst1q_f32(thm + sb, t0);
+        vst1q_f32(thm + sb + 4, t1);
+    }
+}
+
+#ifdef USE_FAST_LOG
+/* fast_log2 lane by lane */
+static float32x4_t
+fast_log2_NEON(float32x4_t x, ieee754_float32_t const *tab)
+{
+    int32x4_t const bits = vreinterpretq_s32_f32(x);
+    int32x4_t const mant = vandq_s32(bits, vdupq_n_s32(0x7fffff));
+    float32x4_t const e =
+        vcvtq_f32_s32(vsubq_s32(vandq_s32(vshrq_n_s32(bits, 23), vdupq_n_s32(0xff)),
+                                vdupq_n_s32(0x7f)));
+    float32x4_t const partial =
+        vmulq_f32(vcvtq_f32_s32(vandq_s32(mant, vdupq_n_s32((1 << (23 - LOG2_SIZE_L2)) - 1))),
+                  vdupq_n_f32(1.0f / ((1 << (23 - LOG2_SIZE_L2)))));
+    int     k[4];
+    float32x4_t t0, t1;
+
+    vst1q_s32(k, vshrq_n_s32(mant, 23 - LOG2_SIZE_L2));
+    t0 = gather4_NEON(tab, k);
+    t1 = gather4_NEON(tab + 1, k);
+    return vaddq_f32(e, vaddq_f32(vmulq_f32(t0, vsubq_f32(vdupq_n_f32(1.0f), partial)),
+                                  vmulq_f32(t1, partial)));
+}
+
+void
+pe_core_NEON(const FLOAT * en, const FLOAT * thm, FLOAT masking_lower, int n, FLOAT * lg)
+{
+    ieee754_float32_t const *const tab = fast_log2_table();
+    float32x4_t const ml = vdupq_n_f32(masking_lower);
+    float32x4_t const zero = vdupq_n_f32(0.f);
+    int     i;
+
+    for (i = 0; i < n; i += 4) {
+        float32x4_t const t = vld1q_f32(thm + i);
+        float32x4_t const e = vld1q_f32(en + i);
+        float32x4_t const x = vmulq_f32(t, ml);
+        uint32x4_t const on = vandq_u32(vcgtq_f32(t, zero), vcgtq_f32(e, x));
+        uint32x4_t const sat = vcgtq_f32(e, vmulq_f32(x, vdupq_n_f32(1e10f)));
+        float32x4_t l;
+#if defined(__aarch64__) || defined(_M_ARM64)
+        l = fast_log2_NEON(vdivq_f32(e, x), tab);
+#else
+        /* no vdivq_f32 on 32 bit ARM, and a reciprocal would not round like en / x */
+        float   r[4];
+        int     j;
+        for (j = 0; j < 4; j++)
+            r[j] = en[i + j] / (thm[i + j] * masking_lower);
+        l = fast_log2_NEON(vld1q_f32(r), tab);
+#endif
+        l = vbslq_f32(sat, vdupq_n_f32(PE_SATURATED), l);
+        vst1q_f32(lg + i, vreinterpretq_f32_u32(vandq_u32(on, vreinterpretq_u32_f32(l))));
+    }
+}
+#endif
+
+FLOAT
+loudness_core_NEON(const FLOAT * energy, const FLOAT * eql_w)
+{
+    float32x4_t s0 = vdupq_n_f32(0.f), s1 = vdupq_n_f32(0.f);
+    float32x2_t s;
+    int     i;
+
+    for (i = 0; i < BLKSIZE / 2; i += 8) {
+        s0 = vaddq_f32(s0, vmulq_f32(vld1q_f32(energy + i), vld1q_f32(eql_w + i)));
+        s1 = vaddq_f32(s1, vmulq_f32(vld1q_f32(energy + i + 4), vld1q_f32(eql_w + i + 4)));
+    }
+    s0 = vaddq_f32(s0, s1);
+    s = vadd_f32(vget_low_f32(s0), vget_high_f32(s0));
+    s = vpadd_f32(s, s);
+    return vget_lane_f32(s, 0);
+}
+
+static FLOAT
+hmax_NEON(float32x4_t v)
+{
+    float32x2_t h = vmax_f32(vget_low_f32(v), vget_high_f32(v));
+    h = vpmax_f32(h, h);
+    return vget_lane_f32(h, 0);
+}
+
+void
+attack_hpf_core_NEON(const sample_t * firbuf, const FLOAT * coef, FLOAT * hp, FLOAT * peak)
+{
+    float32x4_t c[(NSFIRLEN - 1) / 2];
+    int     b, i, j;
+
+    for (j = 0; j < (NSFIRLEN - 1) / 2; j++)
+        c[j] = vdupq_n_f32(coef[j]);
+    for (b = 0, i = 0; b < 9; b++) {
+        float32x4_t p = vdupq_n_f32(1.f);
+        for (; i < 576 / 9 * (b + 1); i += 4) {
+            float32x4_t sum1 = vld1q_f32(firbuf + i + 10);
+            float32x4_t sum2 = vdupq_n_f32(0.f);
+            float32x4_t h;
+            /* vmulq then vaddq, no fused vmlaq, to round like the C code */
+            for (j = 0; j < ((NSFIRLEN - 1) / 2) - 1; j += 2) {
+                float32x4_t const x1 = vaddq_f32(vld1q_f32(firbuf + i + j),
+                                                 vld1q_f32(firbuf + i + NSFIRLEN - j));
+                float32x4_t const x2 = vaddq_f32(vld1q_f32(firbuf + i + j + 1),
+                                                 vld1q_f32(firbuf + i + NSFIRLEN - j - 1));
+                sum1 = vaddq_f32(sum1, vmulq_f32(c[j], x1));
+                sum2 = vaddq_f32(sum2, vmulq_f32(c[j + 1], x2));
+            }
+            h = vaddq_f32(sum1, sum2);
+            vst1q_f32(hp + i, h);
+            p = vmaxq_f32(vabsq_f32(h), p);
+        }
+        peak[b] = hmax_NEON(p);
+    }
+}
+
+void
+attack_ms_core_NEON(const FLOAT * l, const FLOAT * r, FLOAT * peak_m, FLOAT * peak_s)
+{
+    int     b, i;
+
+    for (b = 0, i = 0; b < 9; b++) {
+        float32x4_t pm = vdupq_n_f32(1.f), ps = pm;
+        for (; i < 576 / 9 * (b + 1); i += 4) {
+            float32x4_t const vl = vld1q_f32(l + i);
+            float32x4_t const vr = vld1q_f32(r + i);
+            pm = vmaxq_f32(vabsq_f32(vaddq_f32(vl, vr)), pm);
+            ps = vmaxq_f32(vabsq_f32(vsubq_f32(vl, vr)), ps);
+        }
+        peak_m[b] = hmax_NEON(pm);
+        peak_s[b] = hmax_NEON(ps);
+    }
+}
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+/* vbrpsy_mask_add lane by lane, for m1 >= 0; near: |b| <= delta.
+ * th holds cd->mask_add_ratio, fs table2[0] then its steps, broadcast. */
+static float32x4_t
+mask_add_NEON(float32x4_t m1, float32x4_t m2, uint32x4_t near, const float32x4_t * th,
+              const uint32x4_t * fs)
+{
+    float32x4_t const zero = vdupq_n_f32(0.f);
+    uint32x4_t fi = fs[0];
+    float32x4_t hi, ratio, sum, f, r;
+    int     i;
+
+    m2 = vmaxq_f32(m2, zero);
+    hi = vmaxq_f32(m1, m2);
+    ratio = vdivq_f32(hi, vminq_f32(m1, m2));
+    sum = vaddq_f32(m1, m2);
+    for (i = 0; i < 9; i++)
+        fi = vaddq_u32(fi, vandq_u32(vcgeq_f32(ratio, th[i]), fs[i + 1]));
+    f = vreinterpretq_f32_u32(fi);
+    f = vbslq_f32(vcgeq_f32(ratio, th[9]), sum, vmulq_f32(sum, f));
+    r = vbslq_f32(vcgeq_f32(ratio, th[10]), hi, sum);
+    r = vbslq_f32(near, f, r);
+    r = vbslq_f32(vcleq_f32(m2, zero), m1, r);
+    return vbslq_f32(vcleq_f32(m1, zero), m2, r);
+}
+
+void
+spread_core_NEON(PsyConst_t const *cd, PsyConst_CB2SB_t const *gd, const FLOAT * eb,
+                 const FLOAT * wt, const int *delta, int b_lim, FLOAT * ecb)
+{
+    const FLOAT *s3 = gd->s3_band;
+    float32x4_t th[11];
+    uint32x4_t fs[10];
+    int     b, d, i;
+
+    for (i = 0; i < 11; i++)
+        th[i] = vdupq_n_f32(cd->mask_add_ratio[i]);
+    fs[0] = vreinterpretq_u32_f32(vdupq_n_f32(cd->mask_add_factor[0]));
+    for (i = 1; i < 10; i++)
+        fs[i] = vsubq_u32(vreinterpretq_u32_f32(vdupq_n_f32(cd->mask_add_factor[i])),
+                          vreinterpretq_u32_f32(vdupq_n_f32(cd->mask_add_factor[i - 1])));
+    for (b = 0; b < b_lim; b += 4)
+        vst1q_f32(ecb + b, vdupq_n_f32(0.f));
+    for (d = gd->s3_lo; d <= gd->s3_hi; d++, s3 += CBANDS) {
+        float32x4_t const ad = vdupq_n_f32((FLOAT) (d < 0 ? -d : d));
+        for (b = 0; b < b_lim; b += 4) {
+            float32x4_t const x = vmulq_f32(vmulq_f32(vld1q_f32(s3 + b), vld1q_f32(eb + b + d)),
+                                            vld1q_f32(wt + b + d));
+            uint32x4_t const near = vcleq_f32(ad, vcvtq_f32_s32(vld1q_s32(delta + b)));
+            vst1q_f32(ecb + b, mask_add_NEON(vld1q_f32(ecb + b), x, near, th, fs));
+        }
+    }
+}
+#endif
+
+#endif /* LAME_INTRIN_NEON */
@@ -0,0 +1,833 @@
+/*
+ * quantize_lines_xrpow and choose_table from takehiro.c, calc_noise_core
+ * and calc_xmin_core from quantize_pvt.c, SSE2, AVX2 and NEON intrinsics
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.     See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* BEND: these give the same ix as the scalar code in takehiro.c, bit for
+ * bit, so that choosing them never changes a bitstream.
+ *
+ * With TAKEHIRO_IEEE754_HACK the scalar code rounds x + 2^23 to float to
+ * find the table index, then rounds x + 2^23 + adj43asm[] once more; x
+ * and the sums are doubles there, so they are doubles here too.  Without
+ * it, x is a float and both conversions truncate (adj43[]).
+ *
+ * Like the scalar code, only whole pairs of lines are quantized. */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "lame.h"
+#include "machine.h"
+#include "encoder.h"
+#include "util.h"
+#include "quantize_pvt.h"
+#include "tables.h"
+#include "lame_intrin.h"
+
+
+#if defined(LAME_INTRIN_SSE) || defined(LAME_INTRIN_NEON)
+
+#ifdef TAKEHIRO_IEEE754_HACK
+
+typedef union {
+    float   f;
+    int     i;
+} fi_union;
+
+#define MAGIC_FLOAT (65536*(128))
+#define MAGIC_INT 0x4b000000
+
+#endif
+
+/* one line, as in takehiro.c */
+static int
+quantize_line(FLOAT istep, FLOAT xp)
+{
+#ifdef TAKEHIRO_IEEE754_HACK
+    double  x = istep * xp;
+    fi_union fi;
+
+    x += MAGIC_FLOAT;
+    fi.f = x;
+    fi.f = x + adj43asm[fi.i - MAGIC_INT];
+    return fi.i - MAGIC_INT;
+#else
+    FLOAT   x = xp * istep;
+    int const rx = (int) x;
+
+    x += adj43[rx];
+    return (int) x;
+#endif
+}
+
+/* the lines a kernel leaves over */
+static void
+quantize_lines_tail(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi)
+{
+    unsigned int i;
+
+    for (i = 0; i < (l & ~1u); i++) {
+        pi[i] = quantize_line(istep, xp[i]);
+    }
+}
+
+static void
+quantize_lines_01_tail(unsigned int l, FLOAT compareval0, const FLOAT * xr, int *ix)
+{
+    unsigned int i;
+
+    for (i = 0; i < l; i++) {
+        ix[i] = (compareval0 > xr[i]) ? 0 : 1;
+    }
+}
+
+
+/* BEND: the calc_noise_core and calc_xmin_core kernels sum in a different
+ * order than the C code, so their results may differ in the last bits.
+ * Which of calc_noise_core_c's three cases applies goes by where the run
+ * of lines starts, as there. */
+
+enum noise_region { above_count1, count1_region, big_values_region };
+
+static enum noise_region
+noise_region(const gr_info * const cod_info, int j)
+{
+    if (j > cod_info->count1)
+        return above_count1;
+    if (j > cod_info->big_values)
+        return count1_region;
+    return big_values_region;
+}
+
+/* lines i .. n-1 of a run, as in calc_noise_core_c */
+static FLOAT
+calc_noise_tail(const FLOAT * xr, const int *ix, int i, int n, FLOAT step,
+                enum noise_region region)
+{
+    FLOAT   noise = 0;
+
+    for (; i < n; i++) {
+        FLOAT   temp;
+        if (region == above_count1)
+            temp = xr[i];
+        else if (region == count1_region)
+            temp = fabs(xr[i]) - (ix[i] ? step : 0);
+        else
+            temp = fabs(xr[i]) - pow43[ix[i]] * step;
+        noise += temp * temp;
+    }
+    return noise;
+}
+
+static FLOAT
+calc_xmin_tail(const FLOAT * xr, int i, int width, FLOAT rh1, FLOAT * rh2)
+{
+    FLOAT   en0 = 0;
+
+    for (; i < width; i++) {
+        FLOAT const x2 = xr[i] * xr[i];
+        en0 += x2;
+        *rh2 += (x2 < rh1) ? x2 : rh1;
+    }
+    return en0;
+}
+
+#endif
+
+
+#ifdef LAME_INTRIN_SSE
+
+#include <emmintrin.h>
+
+/* 4 lines at a time.  SSE2 has no gather, so the table lookups go
+ * through memory */
+LAME_TARGET("sse2") void
+quantize_lines_xrpow_SSE2(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi)
+{
+    __m128 const vistep = _mm_set1_ps(istep);
+    unsigned int i;
+    int     rx[4];
+#ifdef TAKEHIRO_IEEE754_HACK
+    __m128d const magic = _mm_set1_pd(MAGIC_FLOAT);
+    __m128i const magic_int = _mm_set1_epi32(MAGIC_INT);
+
+    for (i = 0; i + 4 <= l; i += 4) {
+        __m128 const x = _mm_mul_ps(_mm_loadu_ps(xp + i), vistep);
+        __m128d lo = _mm_add_pd(_mm_cvtps_pd(x), magic);
+        __m128d hi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), magic);
+        __m128  f = _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+        __m128  adj;
+
+        _mm_storeu_si128((__m128i *) rx, _mm_sub_epi32(_mm_castps_si128(f), magic_int));
+        adj = _mm_setr_ps(adj43asm[rx[0]], adj43asm[rx[1]], adj43asm[rx[2]], adj43asm[rx[3]]);
+        lo = _mm_add_pd(lo, _mm_cvtps_pd(adj));
+        hi = _mm_add_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(adj, adj)));
+        f = _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+        _mm_storeu_si128((__m128i *) (pi + i),
+                         _mm_sub_epi32(_mm_castps_si128(f), magic_int));
+    }
+#else
+    for (i = 0; i + 4 <= l; i += 4) {
+        __m128  x = _mm_mul_ps(_mm_loadu_ps(xp + i), vistep);
+
+        _mm_storeu_si128((__m128i *) rx, _mm_cvttps_epi32(x));
+        x = _mm_add_ps(x, _mm_setr_ps(adj43[rx[0]], adj43[rx[1]], adj43[rx[2]], adj43[rx[3]]));
+        _mm_storeu_si128((__m128i *) (pi + i), _mm_cvttps_epi32(x));
+    }
+#endif
+    quantize_lines_tail(l - i, istep, xp + i, pi + i);
+}
+
+LAME_TARGET("sse2") void
+quantize_lines_xrpow_01_SSE2(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix)
+{
+    FLOAT const compareval0 = (1.0f - 0.4054f) / istep;
+    __m128 const cmp = _mm_set1_ps(compareval0);
+    __m128i const one = _mm_set1_epi32(1);
+    unsigned int i;
+
+    /* all ones (-1) where the line rounds to 0 */
+    for (i = 0; i + 4 <= l; i += 4) {
+        __m128 const zero = _mm_cmpgt_ps(cmp, _mm_loadu_ps(xr + i));
+        _mm_storeu_si128((__m128i *) (ix + i), _mm_add_epi32(_mm_castps_si128(zero), one));
+    }
+    quantize_lines_01_tail(l - i, compareval0, xr + i, ix + i);
+}
+
+LAME_TARGET("sse2") static FLOAT
+hsum_SSE2(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+LAME_TARGET("sse2") FLOAT
+calc_noise_core_SSE2(const gr_info * const cod_info, int *startline, int l, FLOAT step)
+{
+    int const j = *startline;
+    int const n = 2 * l;
+    FLOAT const *const xr = cod_info->xr + j;
+    int const *const ix = cod_info->l3_enc + j;
+    enum noise_region const region = noise_region(cod_info, j);
+    __m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 const vstep = _mm_set1_ps(step);
+    __m128  acc = _mm_setzero_ps();
+    int     i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128  t = _mm_loadu_ps(xr + i);
+        if (region == count1_region) {
+            __m128 const q = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (ix + i)));
+            t = _mm_sub_ps(_mm_and_ps(t, abs_mask), _mm_mul_ps(q, vstep));
+        }
+        else if (region == big_values_region) {
+            __m128 const q = _mm_setr_ps(pow43[ix[i]], pow43[ix[i + 1]],
+                                         pow43[ix[i + 2]], pow43[ix[i + 3]]);
+            t = _mm_sub_ps(_mm_and_ps(t, abs_mask), _mm_mul_ps(q, vstep));
+        }
+        acc = _mm_add_ps(acc, _mm_mul_ps(t, t));
+    }
+    *startline = j + n;
+    return hsum_SSE2(acc) + calc_noise_tail(xr, ix, i, n, step, region);
+}
+
+LAME_TARGET("sse2") FLOAT
+calc_xmin_core_SSE2(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2)
+{
+    __m128 const vrh1 = _mm_set1_ps(rh1);
+    __m128  en = _mm_setzero_ps(), rh = _mm_setzero_ps();
+    int     i;
+
+    for (i = 0; i + 4 <= width; i += 4) {
+        __m128 const x = _mm_loadu_ps(xr + i);
+        __m128 const x2 = _mm_mul_ps(x, x);
+        en = _mm_add_ps(en, x2);
+        rh = _mm_add_ps(rh, _mm_min_ps(x2, vrh1));
+    }
+    *rh2 += hsum_SSE2(rh);
+    return hsum_SSE2(en) + calc_xmin_tail(xr, i, width, rh1, rh2);
+}
+
+#endif /* LAME_INTRIN_SSE */
+
+
+#ifdef LAME_INTRIN_AVX
+
+#include <immintrin.h>
+
+/* 8 lines at a time, the table lookups as gathers */
+LAME_TARGET("avx2") void
+quantize_lines_xrpow_AVX2(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi)
+{
+    __m256 const vistep = _mm256_set1_ps(istep);
+    unsigned int i;
+#ifdef TAKEHIRO_IEEE754_HACK
+    __m256d const magic = _mm256_set1_pd(MAGIC_FLOAT);
+    __m256i const magic_int = _mm256_set1_epi32(MAGIC_INT);
+
+    for (i = 0; i + 8 <= l; i += 8) {
+        __m256 const x = _mm256_mul_ps(_mm256_loadu_ps(xp + i), vistep);
+        __m256d lo = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), magic);
+        __m256d hi = _mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), magic);
+        __m256  f = _mm256_set_m128(_mm256_cvtpd_ps(hi), _mm256_cvtpd_ps(lo));
+        __m256i const rx = _mm256_sub_epi32(_mm256_castps_si256(f), magic_int);
+        __m256 const adj = _mm256_i32gather_ps(adj43asm, rx, 4);
+
+        lo = _mm256_add_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(adj)));
+        hi = _mm256_add_pd(hi, _mm256_cvtps_pd(_mm256_extractf128_ps(adj, 1)));
+        f = _mm256_set_m128(_mm256_cvtpd_ps(hi), _mm256_cvtpd_ps(lo));
+        _mm256_storeu_si256((__m256i *) (pi + i),
+                            _mm256_sub_epi32(_mm256_castps_si256(f), magic_int));
+    }
+#else
+    for (i = 0; i + 8 <= l; i += 8) {
+        __m256  x = _mm256_mul_ps(_mm256_loadu_ps(xp + i), vistep);
+        __m256i const rx = _mm256_cvttps_epi32(x);
+
+        x = _mm256_add_ps(x, _mm256_i32gather_ps(adj43, rx, 4));
+        _mm256_storeu_si256((__m256i *) (pi + i), _mm256_cvttps_epi32(x));
+    }
+#endif
+    quantize_lines_tail(l - i, istep, xp + i, pi + i);
+}
+
+LAME_TARGET("avx2") void
+quantize_lines_xrpow_01_AVX2(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix)
+{
+    FLOAT const compareval0 = (1.0f - 0.4054f) / istep;
+    __m256 const cmp = _mm256_set1_ps(compareval0);
+    __m256i const one = _mm256_set1_epi32(1);
+    unsigned int i;
+
+    for (i = 0; i + 8 <= l; i += 8) {
+        __m256 const zero = _mm256_cmp_ps(cmp, _mm256_loadu_ps(xr + i), _CMP_GT_OQ);
+        _mm256_storeu_si256((__m256i *) (ix + i),
+                            _mm256_add_epi32(_mm256_castps_si256(zero), one));
+    }
+    quantize_lines_01_tail(l - i, compareval0, xr + i, ix + i);
+}
+
+
+
+/* BEND: choose_table_AVX2 gives the same table and bit count as
+ * choose_table_nonMMX.  For max <= 15 the lengths of the tables that
+ * choose_table_nonMMX weighs against each other sit side by side in one
+ * 64 bit entry, 21 bits apiece, so that one gather per pair of lines
+ * counts all of them.  The ESC tables already come packed (largetbl). */
+
+#define HLEN_BITS 21
+#define HLEN_MASK ((1u << HLEN_BITS) - 1)
+
+static const int huf_tbl_noESC[] = {
+    1, 2, 5, 7, 7, 10, 10, 13, 13, 13, 13, 13, 13, 13, 13
+};
+
+/* For each group of tables choose_table_nonMMX weighs against each other,
+ * the xlen * xlen entries of hlen, packed from ht[].hlen.  These are
+ * constants rather than built at init, so that encoders on other threads
+ * never see them half written; choose_table_check_AVX2 holds them against
+ * ht. */
+static const uint64_t hlen_packed[2 * 2 + 3 * 3 + 4 * 4 + 6 * 6 + 8 * 8 + 16 * 16] = {
+    /* max 1: tables 1, at 0 */
+    0x000000000001, 0x000000000004, 0x000000000003, 0x000000000005,
+    /* max 2: tables 2, 3, at 4 */
+    0x000000400001, 0x000000600004, 0x000000e00007, 0x000000800004,
+    0x000000800005, 0x000000e00007, 0x000000c00006, 0x000000e00007,
+    0x000001000008,
+    /* max 3: tables 5, 6, at 13 */
+    0x000000600001, 0x000000800004, 0x000000c00007, 0x000001000008,
+    0x000000800004, 0x000000800005, 0x000000c00008, 0x000000e00009,
+    0x000000a00007, 0x000000c00008, 0x000000e00009, 0x00000100000a,
+    0x000000e00008, 0x000000e00008, 0x000001000009, 0x00000120000a,
+    /* max 4: tables 7, 8, 9, at 29 */
+    0x0c0000400001, 0x100000800004, 0x180000e00007, 0x1c0001200009,
+    0x240001200009, 0x28000140000a, 0x100000800004, 0x140000800006,
+    0x180000c00008, 0x1c0001400009, 0x200001400009, 0x28000140000a,
+    0x140000e00007, 0x180000c00007, 0x1c0001000009, 0x20000140000a,
+    0x24000140000a, 0x28000160000b, 0x1c0001200008, 0x1c0001400009,
+    0x20000140000a, 0x24000160000b, 0x24000160000b, 0x28000180000b,
+    0x200001200008, 0x200001200009, 0x24000140000a, 0x24000160000b,
+    0x28000180000b, 0x2c000180000c, 0x240001400009, 0x24000140000a,
+    0x28000160000b, 0x28000160000c, 0x2c0001a0000c, 0x2c0001a0000c,
+    /* max 6: tables 10, 11, 12, at 65 */
+    0x100000400001, 0x100000800004, 0x180000c00007, 0x200001000009,
+    0x24000120000a, 0x28000140000a, 0x28000120000a, 0x28000140000b,
+    0x100000800004, 0x140000a00006, 0x180000c00008, 0x1c0001000009,
+    0x24000140000a, 0x24000140000b, 0x28000120000a, 0x28000140000a,
+    0x180000c00007, 0x180000e00008, 0x1c0001000009, 0x20000120000a,
+    0x24000140000b, 0x28000160000c, 0x24000140000b, 0x28000140000b,
+    0x1c0001000008, 0x1c0001000009, 0x20000120000a, 0x20000160000b,
+    0x24000140000c, 0x28000180000c, 0x28000140000b, 0x28000160000c,
+    0x200001200009, 0x20000140000a, 0x24000140000b, 0x24000160000c,
+    0x28000160000c, 0x28000180000c, 0x28000160000c, 0x2c000180000c,
+    0x24000120000a, 0x24000140000b, 0x28000160000c, 0x28000180000c,
+    0x28000180000d, 0x2c0001a0000d, 0x28000180000c, 0x2c0001a0000d,
+    0x240001200009, 0x24000120000a, 0x24000120000b, 0x28000140000c,
+    0x28000160000c, 0x2c000180000c, 0x2c000180000d, 0x30000180000d,
+    0x28000120000a, 0x28000120000a, 0x28000140000b, 0x2c000160000c,
+    0x2c000180000c, 0x2c000180000d, 0x2c000180000d, 0x30000180000d,
+    /* max 8: tables 13, 14, 15, at 129 */
+    0x0c0000200001, 0x140000a00005, 0x180000e00007, 0x200001200008,
+    0x200001400009, 0x24000140000a, 0x28000160000a, 0x28000160000b,
+    0x28000180000a, 0x2c000180000b, 0x2c000180000c, 0x300001a0000c,
+    0x300001a0000d, 0x300001a0000d, 0x340001c0000e, 0x38000160000e,
+    0x140000800004, 0x140000c00006, 0x1c0001000008, 0x200001200009,
+    0x24000140000a, 0x24000160000a, 0x28000160000b, 0x28000160000b,
+    0x28000180000b, 0x2c000180000b, 0x2c000180000c, 0x300001a0000c,
+    0x300001c0000d, 0x300001a0000e, 0x340001c0000e, 0x34000160000e,
+    0x180000e00007, 0x1c0001000008, 0x1c0001200009, 0x20000140000a,
+    0x24000160000b, 0x24000160000b, 0x28000180000c, 0x28000180000c,
+    0x280001a0000b, 0x2c000180000c, 0x2c0001a0000c, 0x300001a0000d,
+    0x300001a0000d, 0x340001c0000e, 0x340001c0000f, 0x34000180000f,
+    0x1c0001200008, 0x200001200009, 0x20000140000a, 0x24000160000b,
+    0x24000160000b, 0x28000180000c, 0x28000180000c, 0x2c000180000c,
+    0x2c0001a0000c, 0x2c0001a0000d, 0x300001c0000d, 0x300001c0000d,
+    0x300001c0000d, 0x340001e0000e, 0x340001e0000f, 0x340001a0000f,
+    0x200001400009, 0x200001400009, 0x24000160000b, 0x24000160000b,
+    0x28000180000c, 0x28000180000c, 0x2c0001a0000d, 0x2c0001a0000d,
+    0x2c0001a0000c, 0x2c0001c0000d, 0x300001c0000d, 0x300001c0000e,
+    0x300001e0000e, 0x340001e0000f, 0x340001e0000f, 0x340001800010,
+    0x24000140000a, 0x24000140000a, 0x24000160000b, 0x28000160000c,
+    0x28000180000c, 0x280001a0000c, 0x2c0001a0000d, 0x2c0001c0000d,
+    0x2c0001a0000d, 0x2c0001c0000d, 0x300001c0000e, 0x300001e0000d,
+    0x340001e0000f, 0x340001e0000f, 0x340002000010, 0x380001a00010,
+    0x28000160000a, 0x24000160000b, 0x28000160000c, 0x28000180000c,
+    0x280001a0000d, 0x2c0001a0000d, 0x2c0001a0000d, 0x2c0001a0000d,
+    0x2c0001c0000d, 0x300001c0000e, 0x300001c0000e, 0x300001c0000e,
+    0x340001e0000f, 0x340001e0000f, 0x380002000010, 0x380001a00010,
+    0x28000160000b, 0x28000160000b, 0x28000180000c, 0x2c000180000d,
+    0x2c0001a0000d, 0x2c0001a0000d, 0x2c0001a0000e, 0x300001c0000e,
+    0x300001c0000e, 0x300001e0000e, 0x300001e0000f, 0x300001e0000f,
+    0x340001e0000f, 0x340002200010, 0x340002200012, 0x380001a00012,
+    0x28000160000a, 0x28000180000a, 0x28000180000b, 0x2c0001a0000c,
+    0x2c0001a0000c, 0x2c0001a0000d, 0x2c0001c0000d, 0x300001c0000e,
+    0x300001e0000e, 0x300001e0000e, 0x300001e0000e, 0x340001e0000f,
+    0x34000200000f, 0x380002000010, 0x380002000011, 0x380001a00011,
+    0x28000180000b, 0x28000180000b, 0x2c000180000c, 0x2c0001a0000c,
+    0x2c0001a0000d, 0x2c0001c0000d, 0x300001c0000d, 0x300001e0000f,
+    0x300001e0000e, 0x340001e0000f, 0x340001e0000f, 0x340002000010,
+    0x340001e00010, 0x380002000010, 0x380001e00012, 0x380001c00011,
+    0x2c000180000b, 0x2c0001a0000c, 0x2c000180000c, 0x2c0001a0000d,
+    0x300001c0000d, 0x300001c0000e, 0x300001c0000e, 0x300001c0000f,
+    0x300001e0000e, 0x34000200000f, 0x340002000010, 0x34000200000f,
+    0x340002200010, 0x380002200011, 0x3c0002000012, 0x380001a00013,
+    0x2c0001a0000c, 0x2c0001a0000c, 0x2c0001a0000c, 0x2c0001a0000d,
+    0x300001c0000e, 0x300001c0000e, 0x300001e0000e, 0x30000200000e,
+    0x34000200000f, 0x34000200000f, 0x34000200000f, 0x340002000010,
+    0x380002000011, 0x380001e00011, 0x380002000011, 0x3c0001c00012,
+    0x300001a0000c, 0x300001c0000d, 0x2c0001c0000d, 0x300001c0000e,
+    0x300001c0000e, 0x300001e0000f, 0x340001e0000e, 0x340001e0000f,
+    0x340001e00010, 0x340002200010, 0x340002000011, 0x340002000011,
+    0x380002000011, 0x380002000012, 0x3c0002400012, 0x3c0001c00012,
+    0x300001e0000d, 0x300001c0000d, 0x300001c0000e, 0x300001c0000f,
+    0x300001e0000f, 0x340001e0000f, 0x340002000010, 0x340002000010,
+    0x340002000010, 0x380002400010, 0x380002200010, 0x380002200011,
+    0x380002200012, 0x380002600011, 0x3c0002200012, 0x3c0001c00012,
+    0x340001c0000e, 0x340001e0000e, 0x340001a0000e, 0x340001c0000f,
+    0x34000200000f, 0x34000200000f, 0x340001e00011, 0x340002000010,
+    0x380002000010, 0x380002200013, 0x380002400011, 0x380002200011,
+    0x3c0002600011, 0x3c0002200013, 0x380002000012, 0x3c0001c00012,
+    0x34000160000d, 0x34000160000e, 0x34000160000f, 0x340001800010,
+    0x340001800010, 0x340001a00010, 0x340001a00011, 0x380001a00010,
+    0x380001c00011, 0x380001c00011, 0x380001c00012, 0x380001c00012,
+    0x3c0001c00015, 0x3c0001c00014, 0x3c0001c00015, 0x3c0001800012,
+};
+
+static uint64_t const *const hlen_by_max[16] = {
+    0, hlen_packed + 0, hlen_packed + 4, hlen_packed + 13,
+    hlen_packed + 29, hlen_packed + 29, hlen_packed + 65, hlen_packed + 65,
+    hlen_packed + 129, hlen_packed + 129, hlen_packed + 129, hlen_packed + 129,
+    hlen_packed + 129, hlen_packed + 129, hlen_packed + 129, hlen_packed + 129
+};
+
+int
+choose_table_check_AVX2(void)
+{
+    int     max;
+
+    for (max = 1; max <= 15; max++) {
+        int const t1 = huf_tbl_noESC[max - 1];
+        int const tables = max == 1 ? 1 : max <= 3 ? 2 : 3;
+        unsigned int const xlen = ht[t1].xlen;
+        unsigned int x;
+        int     t;
+
+        for (x = 0; x < xlen * xlen; x++) {
+            uint64_t entry = 0;
+            for (t = 0; t < tables; t++) {
+                entry |= (uint64_t) ht[t1 + t].hlen[x] << (HLEN_BITS * t);
+            }
+            if (hlen_by_max[max][x] != entry)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+LAME_TARGET("avx2") static unsigned int
+ix_max_AVX2(const int *ix, int n)
+{
+    __m256i vmax = _mm256_setzero_si256();
+    __m128i m;
+    int     i, max;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        vmax = _mm256_max_epi32(vmax, _mm256_loadu_si256((const __m256i *) (ix + i)));
+    }
+    m = _mm_max_epi32(_mm256_castsi256_si128(vmax), _mm256_extracti128_si256(vmax, 1));
+    m = _mm_max_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    max = _mm_cvtsi128_si32(m);
+    for (; i < n; i++) {
+        if (max < ix[i])
+            max = ix[i];
+    }
+    return (unsigned int) max;
+}
+
+/* x0 * xlen + x1 for the 4 pairs of lines in v, one per 64 bit lane */
+LAME_TARGET("avx2") static __m256i
+pair_index_AVX2(__m256i v, __m256i xlen)
+{
+    return _mm256_add_epi64(_mm256_mul_epu32(v, xlen), _mm256_srli_epi64(v, 32));
+}
+
+LAME_TARGET("avx2") static uint64_t
+hsum_epi64_AVX2(__m256i v)
+{
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+    return (uint64_t) _mm_cvtsi128_si64(s);
+}
+
+LAME_TARGET("avx2") static int
+count_bit_noESC_AVX2(const int *ix, int n, unsigned int max, unsigned int *s)
+{
+    int const t1 = huf_tbl_noESC[max - 1];
+    unsigned int const xlen = ht[t1].xlen;
+    uint64_t const *const table = hlen_by_max[max];
+    __m256i const vxlen = _mm256_set1_epi64x(xlen);
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t sum;
+    unsigned int sum1, sum2, sum3;
+    int     i, t;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i const v = _mm256_loadu_si256((const __m256i *) (ix + i));
+        acc = _mm256_add_epi64(acc, _mm256_i64gather_epi64((const long long *) table,
+                                                           pair_index_AVX2(v, vxlen), 8));
+    }
+    sum = hsum_epi64_AVX2(acc);
+    for (; i < n; i += 2) {
+        sum += table[ix[i] * xlen + ix[i + 1]];
+    }
+
+    sum1 = (unsigned int) sum & HLEN_MASK;
+    sum2 = (unsigned int) (sum >> HLEN_BITS) & HLEN_MASK;
+    sum3 = (unsigned int) (sum >> (2 * HLEN_BITS)) & HLEN_MASK;
+
+    /* the same choice as count_bit_noESC_from2/3 */
+    t = t1;
+    if (max > 1) {
+        if (sum1 > sum2) {
+            sum1 = sum2;
+            t++;
+        }
+        if (max > 3 && sum1 > sum3) {
+            sum1 = sum3;
+            t = t1 + 2;
+        }
+    }
+    *s += sum1;
+    return t;
+}
+
+LAME_TARGET("avx2") static int
+count_bit_ESC_AVX2(const int *ix, int n, int t1, int const t2, unsigned int *const s)
+{
+    unsigned int const linbits = ht[t1].xlen * 65536u + ht[t2].xlen;
+    __m256i const fourteen = _mm256_set1_epi32(14);
+    __m256i const fifteen = _mm256_set1_epi32(15);
+    __m256i const sixteen = _mm256_set1_epi64x(16);
+    __m128i len = _mm_setzero_si128();
+    __m256i esc = _mm256_setzero_si256();
+    __m128i e;
+    unsigned int sum, sum2;
+    int     i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i const v = _mm256_loadu_si256((const __m256i *) (ix + i));
+        __m256i const x = _mm256_min_epi32(v, fifteen);
+
+        esc = _mm256_sub_epi32(esc, _mm256_cmpgt_epi32(v, fourteen));
+        len = _mm_add_epi32(len, _mm256_i64gather_epi32((const int *) largetbl,
+                                                        pair_index_AVX2(x, sixteen), 4));
+    }
+    /* sum wraps just as count_bit_ESC's does */
+    e = _mm_add_epi32(_mm256_castsi256_si128(esc), _mm256_extracti128_si256(esc, 1));
+    len = _mm_add_epi32(len, _mm_mullo_epi32(e, _mm_set1_epi32((int) linbits)));
+    len = _mm_add_epi32(len, _mm_unpackhi_epi64(len, len));
+    len = _mm_add_epi32(len, _mm_shuffle_epi32(len, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = (unsigned int) _mm_cvtsi128_si32(len);
+    for (; i < n; i += 2) {
+        unsigned int x = ix[i];
+        unsigned int y = ix[i + 1];
+
+        if (x >= 15u) {
+            x = 15u;
+            sum += linbits;
+        }
+        if (y >= 15u) {
+            y = 15u;
+            sum += linbits;
+        }
+        sum += largetbl[x * 16u + y];
+    }
+
+    sum2 = sum & 0xffffu;
+    sum >>= 16u;
+
+    if (sum > sum2) {
+        sum = sum2;
+        t1 = t2;
+    }
+
+    *s += sum;
+    return t1;
+}
+
+LAME_TARGET("avx2") int
+choose_table_AVX2(const int *ix, const int *const end, int *const _s)
+{
+    unsigned int *const s = (unsigned int *) _s;
+    int const n = (int) (end - ix);
+    unsigned int max;
+    int     choice, choice2;
+
+    max = ix_max_AVX2(ix, n);
+
+    if (max == 0) {
+        return 0;
+    }
+    if (max <= 15) {
+        return count_bit_noESC_AVX2(ix, n, max, s);
+    }
+    /* try tables with linbits */
+    if (max > IXMAX_VAL) {
+        *s = LARGE_BITS;
+        return -1;
+    }
+    max -= 15u;
+    for (choice2 = 24; choice2 < 32; choice2++) {
+        if (ht[choice2].linmax >= max) {
+            break;
+        }
+    }
+
+    for (choice = choice2 - 8; choice < 24; choice++) {
+        if (ht[choice].linmax >= max) {
+            break;
+        }
+    }
+    return count_bit_ESC_AVX2(ix, n, choice, choice2, s);
+}
+
+LAME_TARGET("avx2") static FLOAT
+hsum_AVX2(__m256 v)
+{
+    __m128  h = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(h);
+}
+
+LAME_TARGET("avx2") FLOAT
+calc_noise_core_AVX2(const gr_info * const cod_info, int *startline, int l, FLOAT step)
+{
+    int const j = *startline;
+    int const n = 2 * l;
+    FLOAT const *const xr = cod_info->xr + j;
+    int const *const ix = cod_info->l3_enc + j;
+    enum noise_region const region = noise_region(cod_info, j);
+    __m256 const abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 const vstep = _mm256_set1_ps(step);
+    __m256  acc = _mm256_setzero_ps();
+    FLOAT   noise;
+    int     i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256  t = _mm256_loadu_ps(xr + i);
+        if (region != above_count1) {
+            __m256i const q = _mm256_loadu_si256((const __m256i *) (ix + i));
+            __m256 const p = region == count1_region
+                ? _mm256_cvtepi32_ps(q) : _mm256_i32gather_ps(pow43, q, 4);
+            t = _mm256_sub_ps(_mm256_and_ps(t, abs_mask), _mm256_mul_ps(p, vstep));
+        }
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(t, t));
+    }
+    *startline = j + n;
+    noise = hsum_AVX2(acc);
+    _mm256_zeroupper(); /* GCC leaves it out here, and the tail is SSE code */
+    return noise + calc_noise_tail(xr, ix, i, n, step, region);
+}
+
+LAME_TARGET("avx2") FLOAT
+calc_xmin_core_AVX2(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2)
+{
+    __m256 const vrh1 = _mm256_set1_ps(rh1);
+    __m256  en = _mm256_setzero_ps(), rh = _mm256_setzero_ps();
+    int     i;
+
+    for (i = 0; i + 8 <= width; i += 8) {
+        __m256 const x = _mm256_loadu_ps(xr + i);
+        __m256 const x2 = _mm256_mul_ps(x, x);
+        en = _mm256_add_ps(en, x2);
+        rh = _mm256_add_ps(rh, _mm256_min_ps(x2, vrh1));
+    }
+    *rh2 += hsum_AVX2(rh);
+    return hsum_AVX2(en) + calc_xmin_tail(xr, i, width, rh1, rh2);
+}
+
+#endif /* LAME_INTRIN_AVX */
+
+
+#ifdef LAME_INTRIN_NEON
+
+#include <arm_neon.h>
+
+/* 4 lines at a time, the table lookups lane by lane.  Under
+ * TAKEHIRO_IEEE754_HACK this needs the AArch64 double vectors */
+void
+quantize_lines_xrpow_NEON(unsigned int l, FLOAT istep, const FLOAT * xp, int *pi)
+{
+    float32x4_t const vistep = vdupq_n_f32(istep);
+    unsigned int i = 0;
+    int     rx[4];
+#ifdef TAKEHIRO_IEEE754_HACK
+#if defined(__aarch64__) || defined(_M_ARM64)
+    float64x2_t const magic = vdupq_n_f64(MAGIC_FLOAT);
+    int32x4_t const magic_int = vdupq_n_s32(MAGIC_INT);
+
+    for (; i + 4 <= l; i += 4) {
+        float32x4_t const x = vmulq_f32(vld1q_f32(xp + i), vistep);
+        float64x2_t lo = vaddq_f64(vcvt_f64_f32(vget_low_f32(x)), magic);
+        float64x2_t hi = vaddq_f64(vcvt_high_f64_f32(x), magic);
+        float32x4_t f = vcvt_high_f32_f64(vcvt_f32_f64(lo), hi);
+        float32x4_t adj;
+
+        vst1q_s32(rx, vsubq_s32(vreinterpretq_s32_f32(f), magic_int));
+        adj = vld1q_lane_f32(&adj43asm[rx[0]], vdupq_n_f32(0), 0);
+        adj = vld1q_lane_f32(&adj43asm[rx[1]], adj, 1);
+        adj = vld1q_lane_f32(&adj43asm[rx[2]], adj, 2);
+        adj = vld1q_lane_f32(&adj43asm[rx[3]], adj, 3);
+        lo = vaddq_f64(lo, vcvt_f64_f32(vget_low_f32(adj)));
+        hi = vaddq_f64(hi, vcvt_high_f64_f32(adj));
+        f = vcvt_high_f32_f64(vcvt_f32_f64(lo), hi);
+        vst1q_s32(pi + i, vsubq_s32(vreinterpretq_s32_f32(f), magic_int));
+    }
+#endif
+#else
+    for (; i + 4 <= l; i += 4) {
+        float32x4_t x = vmulq_f32(vld1q_f32(xp + i), vistep);
+        float32x4_t adj;
+
+        vst1q_s32(rx, vcvtq_s32_f32(x));
+        adj = vld1q_lane_f32(&adj43[rx[0]], vdupq_n_f32(0), 0);
+        adj = vld1q_lane_f32(&adj43[rx[1]], adj, 1);
+        adj = vld1q_lane_f32(&adj43[rx[2]], adj, 2);
+        adj = vld1q_lane_f32(&adj43[rx[3]], adj, 3);
+        x = vaddq_f32(x, adj);
+        vst1q_s32(pi + i, vcvtq_s32_f32(x));
+    }
+#endif
+    quantize_lines_tail(l - i, istep, xp + i, pi + i);
+}
+
+void
+quantize_lines_xrpow_01_NEON(unsigned int l, FLOAT istep, const FLOAT * xr, int *ix)
+{
+    FLOAT const compareval0 = (1.0f - 0.4054f) / istep;
+    float32x4_t const cmp = vdupq_n_f32(compareval0);
+    int32x4_t const one = vdupq_n_s32(1);
+    unsigned int i;
+
+    for (i = 0; i + 4 <= l; i += 4) {
+        uint32x4_t const zero = vcgtq_f32(cmp, vld1q_f32(xr + i));
+        vst1q_s32(ix + i, vaddq_s32(vreinterpretq_s32_u32(zero), one));
+    }
+    quantize_lines_01_tail(l - i, compareval0, xr + i, ix + i);
+}
+
+static FLOAT
+hsum_NEON(float32x4_t v)
+{
+    float32x2_t h = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(h, h), 0);
+}
+
+FLOAT
+calc_noise_core_NEON(const gr_info * const cod_info, int *startline, int l, FLOAT step)
+{
+    int const j = *startline;
+    int const n = 2 * l;
+    FLOAT const *const xr = cod_info->xr + j;
+    int const *const ix = cod_info->l3_enc + j;
+    enum noise_region const region = noise_region(cod_info, j);
+    float32x4_t const vstep = vdupq_n_f32(step);
+    float32x4_t acc = vdupq_n_f32(0);
+    int     i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        float32x4_t t = vld1q_f32(xr + i);
+        if (region == count1_region) {
+            float32x4_t const q = vcvtq_f32_s32(vld1q_s32(ix + i));
+            t = vsubq_f32(vabsq_f32(t), vmulq_f32(q, vstep));
+        }
+        else if (region == big_values_region) {
+            float32x4_t q = vld1q_lane_f32(&pow43[ix[i]], vdupq_n_f32(0), 0);
+            q = vld1q_lane_f32(&pow43[ix[i + 1]], q, 1);
+            q = vld1q_lane_f32(&pow43[ix[i + 2]], q, 2);
+            q = vld1q_lane_f32(&pow43[ix[i + 3]], q, 3);
+            t = vsubq_f32(vabsq_f32(t), vmulq_f32(q, vstep));
+        }
+        acc = vaddq_f32(acc, vmulq_f32(t, t));
+    }
+    *startline = j + n;
+    return hsum_NEON(acc) + calc_noise_tail(xr, ix, i, n, step, region);
+}
+
+FLOAT
+calc_xmin_core_NEON(const FLOAT * xr, int width, FLOAT rh1, FLOAT * rh2)
+{
+    float32x4_t const vrh1 = vdupq_n_f32(rh1);
+    float32x4_t en = vdupq_n_f32(0), rh = vdupq_n_f32(0);
+    int     i;
+
+    for (i = 0; i + 4 <= width; i += 4) {
+        float32x4_t const x = vld1q_f32(xr + i);
+        float32x4_t const x2 = vmulq_f32(x, x);
+        en = vaddq_f32(en, x2);
+        rh = vaddq_f32(rh, vminq_f32(x2, vrh1));
+    }
+    *rh2 += hsum_NEON(rh);
+    return hsum_NEON(en) + calc_xmin_tail(xr, i, width, rh1, rh2);
+}
+
+#endif /* LAME_INTRIN_NEON */
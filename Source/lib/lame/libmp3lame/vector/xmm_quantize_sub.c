@@ -32,7 +32,7 @@
 
 
 
-#ifdef HAVE_XMMINTRIN_H
+#ifdef LAME_INTRIN_SSE
 
 #include <xmmintrin.h>
 
@@ -236,5 +236,5 @@ fht_SSE2(FLOAT * fz, int n)
     } while (k4 < n);
 }
 
-#endif	/* HAVE_XMMINTRIN_H */
+#endif	/* LAME_INTRIN_SSE */
 
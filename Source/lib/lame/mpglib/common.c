@@ -72,7 +72,9 @@ const long freqs[9] = { 44100, 48000, 32000,
     /* *INDENT-ON* */
 
 
+#ifndef FISH_MINIMAL /* BEND: Layer I/II only */
 real    muls[27][64];
+#endif
 
 #if 0
 static void
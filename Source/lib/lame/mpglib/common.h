@@ -29,7 +29,9 @@
 extern const int tabsel_123[2][3][16];
 extern const long freqs[9];
 
+#ifndef FISH_MINIMAL
 extern real muls[27][64];
+#endif
 
 
 int     head_check(unsigned long head, int check_layer);
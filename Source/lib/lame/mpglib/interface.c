@@ -52,8 +52,10 @@ extern void lame_report_def(const char* format, va_list args);
 int
 InitMP3(PMPSTR mp)
 {
+#ifndef FISH_MINIMAL /* BEND: the Fish profile decodes Layer III only */
     hip_init_tables_layer1();
     hip_init_tables_layer2();
+#endif
     hip_init_tables_layer3();
 
     if (mp) {
@@ -248,7 +250,9 @@ check_vbr_header(PMPSTR mp, int bytes)
 {
     int     i, pos;
     struct buf *buf = mp->tail;
+#ifndef FISH_MINIMAL
     unsigned char xing[XING_HEADER_SIZE];
+#endif
     VBRTAGDATA pTagData;
 
     pos = buf->pos;
@@ -262,6 +266,7 @@ check_vbr_header(PMPSTR mp, int bytes)
         }
         ++pos;
     }
+#ifndef FISH_MINIMAL
     /* now read header */
     for (i = 0; i < XING_HEADER_SIZE; ++i) {
         while (pos >= buf->size) {
@@ -276,6 +281,9 @@ check_vbr_header(PMPSTR mp, int bytes)
 
     /* check first bytes for Xing header */
     mp->vbr_header = GetVbrTag(&pTagData, xing);
+#else
+    mp->vbr_header = 0; /* BEND: built without VbrTag.c */
+#endif
     if (mp->vbr_header) {
         mp->num_frames = pTagData.frames;
         mp->enc_delay = pTagData.enc_delay;
@@ -603,6 +611,7 @@ decodeMP3_clipchoice(PMPSTR mp, unsigned char *in, int isize, char *out, int *do
 
         /*do_layer3(&mp->fr,(unsigned char *) out,done); */
         switch (mp->fr.lay) {
+#ifndef FISH_MINIMAL
         case 1:
             if (mp->fr.error_protection)
                 getbits(mp, 16);
@@ -617,6 +626,7 @@ decodeMP3_clipchoice(PMPSTR mp, unsigned char *in, int isize, char *out, int *do
 
             decode_layer2_frame(mp, (unsigned char *) out, done);
             break;
+#endif
 
         case 3:
             decode_layer3_frame(mp, (unsigned char *) out, done, synth_1to1_mono_ptr, synth_1to1_ptr);
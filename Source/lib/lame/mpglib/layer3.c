@@ -396,9 +396,11 @@ III_get_side_info_1(PMPSTR mp, int stereo,
             {
                 unsigned int qss = getbits_fast(mp, 8);
                 gr_infos->pow2gain = gainpow2 + 256 - qss + powdiff;
+#ifndef NOANALYSIS
                 if (mp->pinfo != NULL) {
                     mp->pinfo->qss[gr][ch] = qss;
                 }
+#endif
             }
             if (ms_stereo)
                 gr_infos->pow2gain += 2;
@@ -420,8 +422,10 @@ III_get_side_info_1(PMPSTR mp, int stereo,
                 for (i = 0; i < 3; i++) {
                     unsigned int sbg = (getbits_fast(mp, 3) << 3);
                     gr_infos->full_gain[i] = gr_infos->pow2gain + sbg;
+#ifndef NOANALYSIS
                     if (mp->pinfo != NULL)
                         mp->pinfo->sub_gain[gr][ch][i] = sbg / 8;
+#endif
                 }
 
                 if (gr_infos->block_type == 0) {
@@ -489,9 +493,11 @@ III_get_side_info_2(PMPSTR mp, int stereo, int ms_stereo, long sfreq, int single
         }
         qss = getbits_fast(mp, 8);
         gr_infos->pow2gain = gainpow2 + 256 - qss + powdiff;
+#ifndef NOANALYSIS
         if (mp->pinfo != NULL) {
             mp->pinfo->qss[0][ch] = qss;
         }
+#endif
 
 
         if (ms_stereo)
@@ -512,8 +518,10 @@ III_get_side_info_2(PMPSTR mp, int stereo, int ms_stereo, long sfreq, int single
             for (i = 0; i < 3; i++) {
                 unsigned int sbg = (getbits_fast(mp, 3) << 3);
                 gr_infos->full_gain[i] = gr_infos->pow2gain + sbg;
+#ifndef NOANALYSIS
                 if (mp->pinfo != NULL)
                     mp->pinfo->sub_gain[0][ch][i] = sbg / 8;
+#endif
 
             }
 
@@ -1806,12 +1814,14 @@ decode_layer3_frame(PMPSTR mp, unsigned char *pcm_sample, int *pcm_point,
             else {
                 part2bits = III_get_scale_factors_1(mp, scalefacs[0], gr_infos);
             }
+#ifndef NOANALYSIS
             if (mp->pinfo != NULL) {
                 int     i;
                 mp->pinfo->sfbits[gr][0] = part2bits;
                 for (i = 0; i < 39; i++)
                     mp->pinfo->sfb_s[gr][0][i] = scalefacs[0][i];
             }
+#endif
 
             /* lame_report_fnc(mp->report_err, "calling III dequantize sample 1 gr_infos->part2_3_length %d\n", gr_infos->part2_3_length); */
             if (III_dequantize_sample(mp, hybridIn[0], scalefacs[0], gr_infos, sfreq, part2bits))
@@ -1825,12 +1835,14 @@ decode_layer3_frame(PMPSTR mp, unsigned char *pcm_sample, int *pcm_point,
             else {
                 part2bits = III_get_scale_factors_1(mp, scalefacs[1], gr_infos);
             }
+#ifndef NOANALYSIS
             if (mp->pinfo != NULL) {
                 int     i;
                 mp->pinfo->sfbits[gr][1] = part2bits;
                 for (i = 0; i < 39; i++)
                     mp->pinfo->sfb_s[gr][1][i] = scalefacs[1][i];
             }
+#endif
 
             /* lame_report_fnc(mp->report_err, "calling III dequantize sample 2  gr_infos->part2_3_length %d\n", gr_infos->part2_3_length); */
             if (III_dequantize_sample(mp, hybridIn[1], scalefacs[1], gr_infos, sfreq, part2bits))
@@ -1877,6 +1889,7 @@ decode_layer3_frame(PMPSTR mp, unsigned char *pcm_sample, int *pcm_point,
             }
         }
 
+#ifndef NOANALYSIS
         if (mp->pinfo != NULL) {
             int     i, sb;
             float   ifqstep;
@@ -1945,6 +1958,7 @@ decode_layer3_frame(PMPSTR mp, unsigned char *pcm_sample, int *pcm_point,
                         mp->pinfo->mpg123xr[gr][ch][j] = hybridIn[ch][sb][ss];
             }
         }
+#endif
 
 
         for (ch = 0; ch < stereo1; ch++) {
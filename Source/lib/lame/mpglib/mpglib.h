@@ -79,7 +79,9 @@ typedef struct mpstr_tag {
 
     int     bitindex;
     unsigned char *wordpointer;
+#ifndef NOANALYSIS
     plotting_data *pinfo;
+#endif
 
     lame_report_function report_msg;
     lame_report_function report_dbg;
@@ -3,6 +3,7 @@
 #endif
 #include "catch2/benchmark/catch_benchmark_all.hpp"
 #include "catch2/catch_test_macros.hpp"
+#include "LameLoopback.h"
 
 TEST_CASE ("Boot performance")
 {
@@ -42,3 +43,56 @@ TEST_CASE ("Boot performance")
     };
 #endif
 }
+
+TEST_CASE ("LAME loopback performance")
+{
+    // one second of audio through encode -> decode, as MP3Processor runs it
+    const auto input = lametest::makeTestSignal (44100, 44100);
+
+    BENCHMARK ("Loopback, full psymodel")
+    {
+        return lametest::loopback (input, 44100, 0.5f).size();
+    };
+
+    BENCHMARK ("Loopback, file session bookkeeping")
+    {
+        return lametest::loopback (input, 44100, 0.5f, [] (lame_global_flags* gfp) {
+            lame_set_fish_session (gfp, FISH_SESSION_FILE);
+        }).size();
+    };
+
+    BENCHMARK ("Loopback, encoder state on the heap")
+    {
+        return lametest::loopback (input, 44100, 0.5f, [] (lame_global_flags* gfp) {
+            lame_set_fish_arena (gfp, 0);
+        }).size();
+    };
+
+    BENCHMARK ("Loopback, cheap psymodel")
+    {
+        return lametest::loopback (input, 44100, 0.5f, [] (lame_global_flags* gfp) {
+            lame_set_fish_psymodel (gfp, FISH_PSY_CHEAP);
+        }).size();
+    };
+
+    BENCHMARK ("Loopback, direct quantizer")
+    {
+        return lametest::loopback (input, 44100, 0.5f, [] (lame_global_flags* gfp) {
+            lame_set_fish_quantizer (gfp, FISH_QUANT_DIRECT);
+        }).size();
+    };
+
+    BENCHMARK ("Loopback, vbr-new quantizer")
+    {
+        return lametest::loopback (input, 44100, 0.5f, [] (lame_global_flags* gfp) {
+            lame_set_fish_quantizer (gfp, FISH_QUANT_VBR_NEW);
+        }).size();
+    };
+
+    BENCHMARK ("Loopback, MDCT domain psymodel")
+    {
+        return lametest::loopback (input, 44100, 0.5f, [] (lame_global_flags* gfp) {
+            lame_set_fish_psymodel (gfp, FISH_PSY_MDCT);
+        }).size();
+    };
+}
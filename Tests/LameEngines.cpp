@@ -0,0 +1,298 @@
+// A/B checks for the alternate encoder paths added to our LAME fork. Each
+// alternate path is run through the same loopback as MP3Processor and
+// compared against LAME's stock path on the same material, so that a
+// cheaper path can't quietly change the character of the effect.
+
+#include "LameLoopback.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace lametest;
+
+extern "C" int lame_set_bandwidth_unlimited(lame_global_flags*, int);
+
+namespace
+{
+constexpr int sampleRate = 44100;
+
+void compareAgainstStock(const Signal& input, float fish, const Configure& alternate,
+                         double maxSnrLossDb)
+{
+    const auto stock = loopback(input, sampleRate, fish);
+    const auto other = loopback(input, sampleRate, fish, alternate);
+    REQUIRE(stock.size() > input.size() / 2);
+    REQUIRE(other.size() == stock.size());
+
+    for (int ch = 0; ch < 2; ++ch) {
+        const auto& in = ch ? input.right : input.left;
+        const auto& a = ch ? stock.right : stock.left;
+        const auto& b = ch ? other.right : other.left;
+        const double snrStock = alignedSnrDb(in, a);
+        const double snrOther = alignedSnrDb(in, b);
+        CAPTURE(fish, ch, snrStock, snrOther);
+        CHECK(snrOther > 6.0);
+        CHECK(snrOther > snrStock - maxSnrLossDb);
+        CHECK(std::abs(rmsDb(a, 4096) - rmsDb(b, 4096)) < 1.0);
+    }
+}
+} // namespace
+
+TEST_CASE("Cheap psymodel stays close to the full psymodel", "[lame][psymodel]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 3);
+    const Configure cheap = [](lame_global_flags* gfp) {
+        REQUIRE(lame_set_fish_psymodel(gfp, FISH_PSY_CHEAP) == 0);
+    };
+    for (float fish : { 0.f, 0.5f, 0.9f }) {
+        compareAgainstStock(input, fish, cheap, 4.5);
+    }
+}
+
+TEST_CASE("MDCT domain psymodel stays close to the full psymodel", "[lame][psymodel]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 3);
+    const Configure mdct = [](lame_global_flags* gfp) {
+        REQUIRE(lame_set_fish_psymodel(gfp, FISH_PSY_MDCT) == 0);
+    };
+    for (float fish : { 0.f, 0.5f, 0.9f }) {
+        compareAgainstStock(input, fish, mdct, 4.5);
+    }
+}
+
+TEST_CASE("Direct quantizer stays close to the iterative quantizer", "[lame][quantizer]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 3);
+    const Configure direct = [](lame_global_flags* gfp) {
+        REQUIRE(lame_set_fish_quantizer(gfp, FISH_QUANT_DIRECT) == 0);
+    };
+    for (float fish : { 0.f, 0.5f, 0.9f }) {
+        compareAgainstStock(input, fish, direct, 3.0);
+    }
+}
+
+TEST_CASE("vbr-new quantizer stays close to the iterative quantizer", "[lame][quantizer]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 3);
+    const Configure vbrNew = [](lame_global_flags* gfp) {
+        REQUIRE(lame_set_fish_quantizer(gfp, FISH_QUANT_VBR_NEW) == 0);
+    };
+    for (float fish : { 0.f, 0.5f, 0.9f }) {
+        compareAgainstStock(input, fish, vbrNew, 3.0);
+    }
+}
+
+TEST_CASE("Midstream lowpass retunes the polyphase filter", "[lame][filter]")
+{
+    Signal input;
+    for (int i = 0; i < sampleRate * 2; ++i) {
+        const double t = (double) i / sampleRate;
+        const float x = 0.2f * (float) std::sin(6.283185307179586 * 440.0 * t)
+                      + 0.2f * (float) std::sin(6.283185307179586 * 6000.0 * t);
+        input.left.push_back(x);
+        input.right.push_back(x);
+    }
+
+    const auto open = loopback(input, sampleRate, 0.f);
+    const auto closed = loopback(input, sampleRate, 0.f, {}, 512, 3000);
+    REQUIRE(closed.size() == open.size());
+
+    const size_t settled = 8192;
+    CAPTURE(toneDb(open.left, 6000.0, sampleRate, settled),
+            toneDb(closed.left, 6000.0, sampleRate, settled));
+    CHECK(toneDb(open.left, 6000.0, sampleRate, settled) > -24.0);
+    CHECK(toneDb(closed.left, 6000.0, sampleRate, settled) < -50.0);
+    CHECK(std::abs(toneDb(open.left, 440.0, sampleRate, settled)
+                   - toneDb(closed.left, 440.0, sampleRate, settled)) < 1.0);
+
+    lame_global_flags* gfp = lame_init();
+    REQUIRE(gfp != nullptr);
+    CHECK(lame_change_filter_midstream(gfp, 3000, 0) == -1); // not initialised yet
+    lame_close(gfp);
+}
+
+TEST_CASE("Lowpass shortcuts leave band-limited output as it was", "[lame][filter]")
+{
+    // Above the lowpass the quantizer skips the bands the filter empties.
+    // That must not move a single bit, whichever psymodel is in use. (The
+    // psymodel's own bound is left on: it keeps what the filter takes out
+    // from the PE, which is meant to change the output.)
+    Signal input;
+    for (int i = 0; i < sampleRate * 2; ++i) {
+        const double t = (double) i / sampleRate;
+        const double swell = 0.5 + 0.5 * std::sin(6.283185307179586 * 1.5 * t);
+        input.left.push_back(0.3f * (float) std::sin(6.283185307179586 * 180.0 * t)
+                             + (float) (0.2 * swell) * (float) std::sin(6.283185307179586 * 700.0 * t));
+        input.right.push_back(0.3f * (float) std::sin(6.283185307179586 * 330.0 * t + 0.3)
+                              + (float) (0.2 * swell) * (float) std::sin(6.283185307179586 * 520.0 * t));
+    }
+
+    for (fish_psymodel psymodel : { FISH_PSY_VBR, FISH_PSY_CHEAP, FISH_PSY_MDCT }) {
+        for (int lowpass : { 1500, 2500, 4000 }) {
+            const auto limited = loopback(input, sampleRate, 0.5f, [psymodel](lame_global_flags* gfp) {
+                REQUIRE(lame_set_fish_psymodel(gfp, psymodel) == 0);
+            }, 512, lowpass);
+            const auto unlimited = loopback(input, sampleRate, 0.5f, [psymodel](lame_global_flags* gfp) {
+                REQUIRE(lame_set_fish_psymodel(gfp, psymodel) == 0);
+                REQUIRE(lame_set_bandwidth_unlimited(gfp, 1) == 0);
+            }, 512, lowpass);
+            CAPTURE(psymodel, lowpass);
+            REQUIRE(limited.size() > input.size() / 2);
+            CHECK(limited.left == unlimited.left);
+            CHECK(limited.right == unlimited.right);
+        }
+    }
+}
+
+TEST_CASE("Window ingest encodes like lame_encode_buffer_ieee_float", "[lame][ingest]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 2);
+    for (int blockSize : { 512, 333, 4096 }) {
+        const auto copied = loopback(input, sampleRate, 0.5f, {}, blockSize);
+        const auto direct = loopback(input, sampleRate, 0.5f, {}, blockSize, 0, true);
+        CAPTURE(blockSize);
+        REQUIRE(copied.size() > input.size() / 2);
+        CHECK(direct.left == copied.left);
+        CHECK(direct.right == copied.right);
+    }
+
+    lame_global_flags* gfp = lame_init();
+    REQUIRE(gfp != nullptr);
+    float* l = nullptr;
+    float* r = nullptr;
+    unsigned char mp3[8192];
+    CHECK(lame_encode_acquire_ieee_float(gfp, &l, &r) == -3); // not initialised yet
+    lame_set_in_samplerate(gfp, sampleRate);
+    REQUIRE(lame_init_params(gfp) == 0);
+    const int room = lame_encode_acquire_ieee_float(gfp, &l, &r);
+    REQUIRE(room > 0);
+    CHECK(lame_encode_commit_ieee_float(gfp, room + 1, mp3, sizeof(mp3)) == -3);
+    lame_close(gfp);
+}
+
+TEST_CASE("Stream session decodes like a file session, a frame sooner", "[lame][session]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 2);
+    const auto stream = loopback(input, sampleRate, 0.5f);
+    const auto file = loopback(input, sampleRate, 0.5f, [](lame_global_flags* gfp) {
+        REQUIRE(lame_set_fish_session(gfp, FISH_SESSION_FILE) == 0);
+    });
+    // the file session starts with the LAME tag frame, which decodes to silence
+    const size_t tagFrame = lameHasTags() ? 1152 : 0;
+    REQUIRE(stream.size() > input.size() / 2);
+    REQUIRE(file.size() == stream.size() + tagFrame);
+
+    float worst = 0.f;
+    for (size_t i = 0; i < stream.size(); ++i) {
+        worst = std::max(worst, std::abs(stream.left[i] - file.left[i + tagFrame]));
+        worst = std::max(worst, std::abs(stream.right[i] - file.right[i + tagFrame]));
+    }
+    CHECK(worst <= 1.5f / 32767.f); // the decoder's synthesis rounding
+}
+
+TEST_CASE("Arena session encodes like a heap session", "[lame][session]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 2);
+    const auto arena = loopback(input, sampleRate, 0.5f);
+    const auto heap = loopback(input, sampleRate, 0.5f, [](lame_global_flags* gfp) {
+        REQUIRE(lame_set_fish_arena(gfp, 0) == 0);
+    });
+    REQUIRE(arena.size() > input.size() / 2);
+    REQUIRE(arena.size() == heap.size());
+    CHECK(arena.left == heap.left);
+    CHECK(arena.right == heap.right);
+
+    int bytes[2];
+    for (int a = 0; a < 2; ++a) {
+        lame_global_flags* gfp = lame_init();
+        REQUIRE(gfp != nullptr);
+        lame_set_in_samplerate(gfp, sampleRate);
+        lame_set_fish_session(gfp, FISH_SESSION_STREAM);
+        lame_set_fish_arena(gfp, a);
+        REQUIRE(lame_init_params(gfp) == 0);
+        bytes[a] = lame_get_fish_session_bytes(gfp);
+        lame_close(gfp);
+    }
+    CHECK(bytes[0] > 0);
+    CHECK(bytes[1] > 0);
+    if (lameHasTags())
+        CHECK(bytes[1] < bytes[0]); // no ReplayGain state without ReplayGain
+    else
+        CHECK(bytes[1] == bytes[0]); // nothing to leave out
+}
+
+TEST_CASE("Arena session is no more resident than a heap session", "[lame][session]")
+{
+    // Pages of the session that are still zero, most of the bitstream
+    // buffer, have to stay untouched in the arena as they do on the heap.
+    if (residentBytes() == 0)
+        SKIP("no resident set size on this platform");
+    const auto input = makeTestSignal(sampleRate, sampleRate / 2);
+    std::vector<unsigned char> mp3(input.size() * 5 / 4 + 7200);
+    std::vector<lame_global_flags*> sessions;
+    size_t grown[2];
+    for (int a : { 0, 1 }) {
+        freshHeap();
+        const size_t before = residentBytes();
+        for (int k = 0; k < 32; ++k) {
+            lame_global_flags* gfp = lame_init();
+            REQUIRE(gfp != nullptr);
+            sessions.push_back(gfp);
+            lame_set_in_samplerate(gfp, sampleRate);
+            lame_set_out_samplerate(gfp, sampleRate);
+            lame_set_brate(gfp, 96);
+            lame_set_disable_reservoir(gfp, 1);
+            lame_set_fish_session(gfp, FISH_SESSION_STREAM);
+            lame_set_fish_arena(gfp, a);
+            REQUIRE(lame_init_params(gfp) == 0);
+            REQUIRE(lame_encode_buffer_ieee_float(gfp, input.left.data(), input.right.data(),
+                                                  (int) input.size(), mp3.data(), (int) mp3.size())
+                    > 0);
+        }
+        grown[a] = residentBytes() - before;
+    }
+    for (auto* gfp : sessions)
+        lame_close(gfp);
+    CAPTURE(grown[0], grown[1]);
+    CHECK(grown[1] <= grown[0]);
+}
+
+TEST_CASE("Tag and ReplayGain setters follow the build", "[lame]")
+{
+    lame_global_flags* gfp = lame_init();
+    REQUIRE(gfp != nullptr);
+    const int built = lameHasTags() ? 0 : -1;
+    CHECK(lame_set_findReplayGain(gfp, 1) == built);
+    CHECK(lame_set_bWriteVbrTag(gfp, 1) == built);
+    CHECK(lame_set_findReplayGain(gfp, 0) == 0);
+    CHECK(lame_set_bWriteVbrTag(gfp, 0) == 0);
+    lame_close(gfp);
+}
+
+TEST_CASE("Engine selection is validated", "[lame]")
+{
+    lame_global_flags* gfp = lame_init();
+    REQUIRE(gfp != nullptr);
+    CHECK(lame_get_fish_psymodel(gfp) == FISH_PSY_VBR);
+    CHECK(lame_set_fish_psymodel(gfp, FISH_PSY_MAX_INDICATOR) == -1);
+    CHECK(lame_set_fish_psymodel(gfp, FISH_PSY_CHEAP) == 0);
+    CHECK(lame_get_fish_psymodel(gfp) == FISH_PSY_CHEAP);
+
+    CHECK(lame_get_fish_quantizer(gfp) == FISH_QUANT_ITERATIVE);
+    CHECK(lame_set_fish_quantizer(gfp, FISH_QUANT_MAX_INDICATOR) == -1);
+    CHECK(lame_set_fish_quantizer(gfp, FISH_QUANT_DIRECT) == 0);
+    CHECK(lame_get_fish_quantizer(gfp) == FISH_QUANT_DIRECT);
+
+    CHECK(lame_get_fish_session(gfp) == FISH_SESSION_FILE);
+    CHECK(lame_set_fish_session(gfp, FISH_SESSION_MAX_INDICATOR) == -1);
+    CHECK(lame_set_fish_session(gfp, FISH_SESSION_STREAM) == 0);
+    CHECK(lame_get_fish_session(gfp) == FISH_SESSION_STREAM);
+
+    CHECK(lame_get_fish_arena(gfp) == 0);
+    CHECK(lame_set_fish_arena(gfp, 2) == -1);
+    CHECK(lame_set_fish_arena(gfp, 1) == 0);
+    CHECK(lame_get_fish_arena(gfp) == 1);
+    lame_close(gfp);
+}
@@ -0,0 +1,847 @@
+// Checks for the SIMD kernels in our LAME fork. LAME picks its kernels from
+// the CPU features at lame_init_params; LAME_SIMD caps that choice so every
+// level this machine supports can be held against the plain C code. The
+// rewritten searches are held against the stock code they replaced.
+
+#include "LameLoopback.h"
+#include "fish_test_hooks.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace lametest;
+
+// fish_test_hooks.h declares what these checks call inside the library. The
+// tables the kernels read are filled in by lame_init_params.
+typedef void (*QuantizeLines)(unsigned int l, float istep, const float* xp, int* pi);
+typedef float (*CalcXminCore)(const float* xr, int width, float rh1, float* rh2);
+typedef void (*AttackHpfCore)(const float* firbuf, const float* coef, float* hp, float* peak);
+typedef void (*AttackMsCore)(const float* l, const float* r, float* peakM, float* peakS);
+
+namespace
+{
+constexpr int sampleRate = 44100;
+constexpr int ixMax = 8206; // IXMAX_VAL, the largest ix count_bits lets through
+
+struct QuantizeKernels
+{
+    const char* name;
+    QuantizeLines lines;
+    QuantizeLines lines01;
+    CalcXminCore xmin;
+};
+
+std::vector<QuantizeKernels> quantizeKernels()
+{
+    std::vector<QuantizeKernels> kernels;
+#if defined(__x86_64__) || defined(_M_X64)
+    if (has_SSE2())
+        kernels.push_back({ "sse2", quantize_lines_xrpow_SSE2, quantize_lines_xrpow_01_SSE2,
+                            calc_xmin_core_SSE2 });
+    if (has_AVX2())
+        kernels.push_back({ "avx2", quantize_lines_xrpow_AVX2, quantize_lines_xrpow_01_AVX2,
+                            calc_xmin_core_AVX2 });
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    kernels.push_back({ "neon", quantize_lines_xrpow_NEON, quantize_lines_xrpow_01_NEON,
+                        calc_xmin_core_NEON });
+#endif
+    return kernels;
+}
+
+struct PsyKernels
+{
+    const char* name;
+    AttackHpfCore attackHpf;
+    AttackMsCore attackMs;
+};
+
+std::vector<PsyKernels> psyKernels()
+{
+    std::vector<PsyKernels> kernels;
+#if defined(__x86_64__) || defined(_M_X64)
+    if (has_SSE2())
+        kernels.push_back({ "sse2", attack_hpf_core_SSE2, attack_ms_core_SSE2 });
+    if (has_AVX2())
+        kernels.push_back({ "avx2", attack_hpf_core_AVX2, attack_ms_core_AVX2 });
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    kernels.push_back({ "neon", attack_hpf_core_NEON, attack_ms_core_NEON });
+#endif
+    return kernels;
+}
+
+// An encoder set up under LAME_SIMD=level, whose kernels are called
+// directly; the "c" one gives the reference.
+class Session
+{
+public:
+    explicit Session(const char* level, const Configure& configure = {})
+    {
+        ScopedSimdLevel scoped(level);
+        gfp = lame_init();
+        lame_set_in_samplerate(gfp, sampleRate);
+        lame_set_out_samplerate(gfp, sampleRate);
+        if (configure)
+            configure(gfp);
+        if (lame_init_params(gfp) == 0)
+            gfc = lame_get_internal_flags(gfp);
+    }
+    ~Session() { lame_close(gfp); }
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    lame_global_flags* gfp = nullptr;
+    lame_internal_flags* gfc = nullptr;
+};
+
+// Largest difference between a and b, relative to the largest value of a.
+double relativeError(const float* a, const float* b, size_t n)
+{
+    double top = 0, diff = 0;
+    for (size_t i = 0; i < n; ++i) {
+        top = std::max(top, (double) std::abs(a[i]));
+        diff = std::max(diff, (double) std::abs(a[i] - b[i]));
+    }
+    return top > 0 ? diff / top : diff;
+}
+
+std::vector<float> noise(uint32_t seed, size_t n, float scale)
+{
+    std::vector<float> x(n);
+    for (auto& v : x) {
+        seed = seed * 1664525u + 1013904223u;
+        v = ((seed >> 8) / 8388608.f - 1.f) * scale;
+    }
+    return x;
+}
+} // namespace
+
+TEST_CASE("Every SIMD level encodes like the C kernels", "[lame][simd]")
+{
+    const auto input = makeTestSignal(sampleRate, sampleRate * 3);
+    Signal reference;
+    {
+        ScopedSimdLevel level("c");
+        reference = loopback(input, sampleRate, 0.5f);
+    }
+    REQUIRE(reference.size() > input.size() / 2);
+
+    for (const char* name : { "sse2", "avx2", "neon" }) {
+        ScopedSimdLevel level(name);
+        const auto other = loopback(input, sampleRate, 0.5f);
+        REQUIRE(other.size() == reference.size());
+        for (int ch = 0; ch < 2; ++ch) {
+            const auto& in = ch ? input.right : input.left;
+            const auto& a = ch ? reference.right : reference.left;
+            const auto& b = ch ? other.right : other.left;
+            const double snrC = alignedSnrDb(in, a);
+            const double snrSimd = alignedSnrDb(in, b);
+            CAPTURE(name, ch, snrC, snrSimd);
+            CHECK(std::abs(snrSimd - snrC) < 0.5);
+            CHECK(std::abs(rmsDb(a, 4096) - rmsDb(b, 4096)) < 0.25);
+        }
+    }
+}
+
+TEST_CASE("SIMD psymodel FFTs track the C FFT", "[lame][simd]")
+{
+    // The FFTs only feed the masking thresholds, so the output of each
+    // level is held against the C output itself rather than the input. Float
+    // rounding may move a few quantizer decisions, nothing more.
+    const auto input = makeTestSignal(sampleRate, sampleRate * 3);
+    for (float fish : { 0.f, 0.9f }) {
+        Signal reference;
+        {
+            ScopedSimdLevel level("c");
+            reference = loopback(input, sampleRate, fish);
+        }
+        REQUIRE(reference.size() > input.size() / 2);
+
+        for (const char* name : { "avx2", "neon" }) {
+            ScopedSimdLevel level(name);
+            const auto other = loopback(input, sampleRate, fish);
+            REQUIRE(other.size() == reference.size());
+            for (int ch = 0; ch < 2; ++ch) {
+                const auto& a = ch ? reference.right : reference.left;
+                const auto& b = ch ? other.right : other.left;
+                const double snr = alignedSnrDb(a, b, 0);
+                CAPTURE(name, fish, ch, snr);
+                CHECK(snr > 25.0);
+            }
+        }
+    }
+}
+
+TEST_CASE("SIMD psymodel FFTs give the C FFT's spectrum", "[lame][simd]")
+{
+    // Both channels, the long FFT and the three short ones, on noise with
+    // a tone on top. The stages add in another order than fht does, so
+    // the lines may differ in the last bits.
+    Session reference("c");
+    REQUIRE(reference.gfc != nullptr);
+    auto left = noise(7, 1024, 20000.f), right = noise(8, 1024, 300.f);
+    for (size_t i = 0; i < left.size(); ++i)
+        right[i] += 10000.f * (float) std::sin(0.37 * (double) i);
+    const float* data[2] = { left.data(), right.data() };
+
+    for (const char* name : { "avx2", "neon" }) {
+        Session other(name);
+        REQUIRE(other.gfc != nullptr);
+        for (int chn = 0; chn < 2; ++chn) {
+            std::vector<float> a(1024), b(1024);
+            fft_long(reference.gfc, a.data(), chn, data);
+            fft_long(other.gfc, b.data(), chn, data);
+            const double errorLong = relativeError(a.data(), b.data(), a.size());
+
+            float as[3][256], bs[3][256];
+            fft_short(reference.gfc, as, chn, data);
+            fft_short(other.gfc, bs, chn, data);
+            const double errorShort = relativeError(as[0], bs[0], 3 * 256);
+            CAPTURE(name, chn, errorLong, errorShort);
+            CHECK(errorLong < 1e-6);
+            CHECK(errorShort < 1e-6);
+        }
+    }
+}
+
+TEST_CASE("SIMD filterbank tracks the C filterbank", "[lame][simd]")
+{
+    // The polyphase filterbank runs L and R side by side in stereo and
+    // consecutive slots side by side in mono, so both layouts are held
+    // against the C output. The long block MDCT skips bands the lowpass
+    // has taken out, hence the 3 kHz runs.
+    const auto input = makeTestSignal(sampleRate, sampleRate * 3);
+    for (MPEG_mode mode : { JOINT_STEREO, MONO }) {
+        for (int lowpass : { 0, 3000 }) {
+            const Configure configure = [mode](lame_global_flags* gfp) {
+                lame_set_mode(gfp, mode);
+            };
+            Signal reference;
+            {
+                ScopedSimdLevel level("c");
+                reference = loopback(input, sampleRate, 0.5f, configure, 512, lowpass);
+            }
+            REQUIRE(reference.size() > input.size() / 2);
+
+            ScopedSimdLevel level("avx2");
+            const auto other = loopback(input, sampleRate, 0.5f, configure, 512, lowpass);
+            REQUIRE(other.size() == reference.size());
+            for (int ch = 0; ch < (mode == MONO ? 1 : 2); ++ch) {
+                const auto& a = ch ? reference.right : reference.left;
+                const auto& b = ch ? other.right : other.left;
+                const double snr = alignedSnrDb(a, b, 0);
+                CAPTURE(mode, lowpass, ch, snr);
+                CHECK(snr > 25.0);
+            }
+        }
+    }
+}
+
+TEST_CASE("SIMD filterbank gives the C filterbank's spectrum", "[lame][simd]")
+{
+    // Frame after frame, so the previous granule's subband samples carry
+    // over, through every block type; both channels in stereo, and the
+    // slots side by side in mono. The long block MDCT skips the bands a
+    // lowpass takes out and scales the ones it fades, so there are runs
+    // with a lowpass that moves halfway through, gliding to the new one.
+    const auto input = makeTestSignal(sampleRate, 1152 * 24 + 2048);
+    const int blockTypes[] = { 0, 1, 2, 2, 3, 0, 0, 1, 3 };
+    for (MPEG_mode mode : { JOINT_STEREO, MONO }) {
+        for (int lowpass : { 0, 3000 }) {
+            const Configure configure = [mode](lame_global_flags* gfp) {
+                lame_set_mode(gfp, mode);
+            };
+            Session reference("c", configure), other("avx2", configure);
+            REQUIRE(reference.gfc != nullptr);
+            REQUIRE(other.gfc != nullptr);
+            const int channels = mode == MONO ? 1 : 2;
+            double worst = 0;
+            for (int frame = 0; frame < 24; ++frame) {
+                if (lowpass > 0 && frame % 12 == 0) {
+                    lame_change_bitrate_midstream(reference.gfp, lowpass * (1 + frame / 12), 0.5f);
+                    lame_change_bitrate_midstream(other.gfp, lowpass * (1 + frame / 12), 0.5f);
+                }
+                const float* l = input.left.data() + 1152 * frame;
+                const float* r = input.right.data() + 1152 * frame;
+                const int type = blockTypes[frame % 9];
+                float a[2][2][576], b[2][2][576];
+                mdct_sub48_spectrum(reference.gfc, l, r, type, a);
+                mdct_sub48_spectrum(other.gfc, l, r, type, b);
+                for (int gr = 0; gr < 2; ++gr)
+                    for (int ch = 0; ch < channels; ++ch)
+                        worst = std::max(worst, relativeError(a[gr][ch], b[gr][ch], 576));
+            }
+            CAPTURE(mode, lowpass, worst);
+            CHECK(worst < 1e-6);
+        }
+    }
+}
+
+TEST_CASE("SIMD quantizers give the C quantizer's l3_enc", "[lame][simd]")
+{
+    // Unlike the transforms these have to match bit for bit: a single ix
+    // off changes the bitstream. Lines are spread over the whole table,
+    // and some sit right at a rounding boundary of the adj43 correction.
+    lame_global_flags* gfp = lame_init();
+    REQUIRE(lame_init_params(gfp) == 0);
+
+    uint32_t seed = 4321;
+    auto uniform = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0;
+    };
+    std::vector<float> xr(576);
+    std::vector<int> reference(576 + 8), other(576 + 8);
+    for (const auto& kernel : quantizeKernels()) {
+        int mismatches = 0;
+        for (int rep = 0; rep < 2000; ++rep) {
+            const auto istep = (float) std::pow(2.0, -0.1875 * (rep % 200));
+            const float top = ixMax / istep;
+            for (auto& x : xr) {
+                const double u = uniform();
+                x = (rep & 1) ? (float) (u * u * top)
+                              : (float) ((std::floor(u * 40) + 0.4054) / istep);
+                x = std::min(x, top);
+            }
+            const auto l = (unsigned int) (2 + 2 * (rep % 288));
+            for (int f = 0; f < 2; ++f) {
+                std::fill(reference.begin(), reference.end(), -1);
+                std::fill(other.begin(), other.end(), -1);
+                (f ? quantize_lines_xrpow_01 : quantize_lines_xrpow)(l, istep, xr.data(), reference.data());
+                (f ? kernel.lines01 : kernel.lines)(l, istep, xr.data(), other.data());
+                mismatches += reference != other;
+            }
+        }
+        CAPTURE(kernel.name);
+        CHECK(mismatches == 0);
+    }
+    lame_close(gfp);
+}
+
+TEST_CASE("SIMD xmin and noise sums track the C sums", "[lame][simd]")
+{
+    // Sums of squares over a band, added up in another order than the C
+    // loops, so they may drift a few float ulps apart. The noise goes through
+    // each region of a granule: zeros, ones and the pow43 lines.
+    uint32_t seed = 555;
+    auto uniform = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0;
+    };
+    std::vector<float> xr(576);
+
+    for (const auto& kernel : quantizeKernels()) {
+        double worst = 0;
+        for (int rep = 0; rep < 2000; ++rep) {
+            for (auto& x : xr)
+                x = (float) ((uniform() - 0.5) * std::pow(10.0, 4 * uniform()));
+            const int width = 2 + 2 * (int) (uniform() * 200);
+            const auto rh1 = (float) (uniform() * 1e4);
+            float rhC = (float) uniform(), rhSimd = rhC;
+            const float enC = calc_xmin_core_c(xr.data(), width, rh1, &rhC);
+            const float enSimd = kernel.xmin(xr.data(), width, rh1, &rhSimd);
+            worst = std::max(worst, (double) std::abs(enC - enSimd) / enC);
+            worst = std::max(worst, (double) std::abs(rhC - rhSimd) / rhC);
+        }
+        CAPTURE(kernel.name, worst);
+        CHECK(worst < 1e-5);
+    }
+
+    Session reference("c");
+    REQUIRE(reference.gfc != nullptr);
+    std::vector<int> ix(576);
+    for (const char* name : { "sse2", "avx2", "neon" }) {
+        Session other(name);
+        REQUIRE(other.gfc != nullptr);
+        double worst = 0;
+        for (int rep = 0; rep < 2000; ++rep) {
+            const auto step = (float) std::pow(2.0, 0.25 * (int) (uniform() * 40 - 20));
+            const int bigValues = 2 * (int) (uniform() * 200);
+            const int count1 = std::min(576, bigValues + 4 * (int) (uniform() * 60));
+            for (int i = 0; i < 576; ++i) {
+                const double q = i < bigValues ? uniform() * 40 : i < count1 ? uniform() * 1.4 : 0;
+                ix[i] = (int) q;
+                xr[i] = (float) ((uniform() < 0.5 ? -1 : 1) * std::pow(q, 4.0 / 3.0) * step);
+            }
+            // the kernels pick the region from startline > count1, startline > big_values
+            const int region = rep % 3;
+            const int from = region == 0 ? 0 : region == 1 ? bigValues + 2 : count1 + 2;
+            const int to = region == 0 ? bigValues : region == 1 ? count1 : 574;
+            if (to < from)
+                continue;
+            const int startline = from + 2 * (int) (uniform() * ((to - from) / 2 + 1));
+            const int pairs = 1 + (int) (uniform() * ((576 - startline) / 2));
+            const float a = calc_noise_lines(reference.gfc, xr.data(), ix.data(), bigValues, count1,
+                                             startline, pairs, step);
+            const float b = calc_noise_lines(other.gfc, xr.data(), ix.data(), bigValues, count1,
+                                             startline, pairs, step);
+            if (a > 0)
+                worst = std::max(worst, (double) std::abs(a - b) / a);
+        }
+        CAPTURE(name, worst);
+        CHECK(worst < 1e-5);
+    }
+}
+
+TEST_CASE("SIMD attack detection gives the C peaks", "[lame][simd]")
+{
+    // The high pass adds its taps in the C order, so the filtered samples
+    // and the sub block peaks are the same bit for bit.
+    constexpr int firLength = 21; // NSFIRLEN
+    for (const auto& kernel : psyKernels()) {
+        int mismatches = 0;
+        for (int rep = 0; rep < 200; ++rep) {
+            const float scale = (float) std::pow(10.0, rep % 6);
+            const auto firbuf = noise(1000 + rep, 576 + firLength + 8, 32767 * scale / 1e5f);
+            const auto coef = noise(2000 + rep, (firLength - 1) / 2, 1);
+            std::vector<float> hpC(576), hpSimd(576), peakC(9), peakSimd(9);
+            attack_hpf_core_c(firbuf.data(), coef.data(), hpC.data(), peakC.data());
+            kernel.attackHpf(firbuf.data(), coef.data(), hpSimd.data(), peakSimd.data());
+            mismatches += hpC != hpSimd || peakC != peakSimd;
+
+            const auto left = noise(3000 + rep, 576, 32767 * scale / 1e5f);
+            const auto right = noise(4000 + rep, 576, 32767 * scale / 1e5f);
+            std::vector<float> midC(9), sideC(9), midSimd(9), sideSimd(9);
+            attack_ms_core_c(left.data(), right.data(), midC.data(), sideC.data());
+            kernel.attackMs(left.data(), right.data(), midSimd.data(), sideSimd.data());
+            mismatches += midC != midSimd || sideC != sideSimd;
+        }
+        CAPTURE(kernel.name);
+        CHECK(mismatches == 0);
+    }
+}
+
+TEST_CASE("SIMD psymodel reductions track the C reductions", "[lame][simd]")
+{
+    // Partition sums and maxima on the long, short and long to short
+    // partitions, the PE logs, and the loudness sum. The kernels keep the C
+    // order except for the loudness sum, but a compiler may fuse the C
+    // multiply-adds.
+    uint32_t seed = 31337;
+    auto uniform = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0;
+    };
+    auto spread = [&uniform](std::vector<float>& x, double decades) {
+        for (auto& v : x)
+            v = uniform() < 0.1 ? 0.f : (float) std::pow(10.0, decades * uniform());
+    };
+    auto worstOf = [](const std::vector<float>& a, const std::vector<float>& b) {
+        double worst = 0;
+        for (size_t i = 0; i < a.size(); ++i)
+            worst = std::max(worst, (double) std::abs(a[i] - b[i]) / std::max(std::abs(a[i]), 1e-30f));
+        return worst;
+    };
+
+    Session reference("c");
+    REQUIRE(reference.gfc != nullptr);
+    std::vector<float> fft(513), eb(128), thr(128), en(64), thm(64);
+    for (const char* name : { "sse2", "avx2", "neon" }) {
+        Session other(name);
+        REQUIRE(other.gfc != nullptr);
+        double sums = 0, maxima = 0, scalefacs = 0, logs = 0, loudness = 0;
+        for (int rep = 0; rep < 500; ++rep) {
+            const int which = rep % 3;
+            spread(fft, 12);
+            std::vector<float> ebA(128), maxA(128), avgA(128), ebB(128), maxB(128), avgB(128);
+            psymodel_energy_lines(reference.gfc, which, fft.data(), ebA.data(), maxA.data(), avgA.data());
+            psymodel_energy_lines(other.gfc, which, fft.data(), ebB.data(), maxB.data(), avgB.data());
+            sums = std::max({ sums, worstOf(ebA, ebB), worstOf(avgA, avgB) });
+            maxima = std::max(maxima, worstOf(maxA, maxB));
+
+            spread(eb, 8);
+            spread(thr, 8);
+            std::vector<float> ennA(64), thmA(64), ennB(64), thmB(64);
+            psymodel_p2s_lines(reference.gfc, which, eb.data(), thr.data(), ennA.data(), thmA.data());
+            psymodel_p2s_lines(other.gfc, which, eb.data(), thr.data(), ennB.data(), thmB.data());
+            scalefacs = std::max({ scalefacs, worstOf(ennA, ennB), worstOf(thmA, thmB) });
+
+            spread(en, 14);
+            spread(thm, 8);
+            const int n = 1 + rep % 22;
+            const auto maskingLower = (float) std::pow(10.0, 2 * uniform() - 1);
+            std::vector<float> lgA(64), lgB(64);
+            psymodel_pe_lines(reference.gfc, en.data(), thm.data(), maskingLower, n, lgA.data());
+            psymodel_pe_lines(other.gfc, en.data(), thm.data(), maskingLower, n, lgB.data());
+            for (int i = 0; i < n; ++i)
+                logs = std::max(logs, (double) std::abs(lgA[i] - lgB[i]));
+
+            const float a = psymodel_loudness_lines(reference.gfc, fft.data());
+            const float b = psymodel_loudness_lines(other.gfc, fft.data());
+            loudness = std::max(loudness, (double) std::abs(a - b) / a);
+        }
+        CAPTURE(name, sums, maxima, scalefacs, logs, loudness);
+        CHECK(sums < 1e-6);
+        CHECK(maxima == 0);
+        CHECK(scalefacs < 1e-6);
+        CHECK(logs < 1e-5);
+        CHECK(loudness < 1e-5);
+    }
+}
+
+TEST_CASE("SIMD spreading gives the C masking", "[lame][simd]")
+{
+    // The kernels fold each partition's maskers in the C order and build
+    // table2's factor from cd_psy->mask_add_ratio, so ecb is the same bit
+    // for bit.
+    uint32_t seed = 4242;
+    auto uniform = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0;
+    };
+
+    Session reference("c");
+    REQUIRE(reference.gfc != nullptr);
+    for (const char* name : { "sse2", "avx2", "neon" }) {
+        Session other(name);
+        REQUIRE(other.gfc != nullptr);
+        int mismatches = 0;
+        for (int rep = 0; rep < 500; ++rep) {
+            const int which = rep % 2;
+            std::vector<float> eb(64);
+            std::vector<unsigned char> maskIdx(64);
+            for (int b = 0; b < 64; ++b) {
+                eb[b] = uniform() < 0.1 ? 0.f : (float) std::pow(10.0, 12 * uniform());
+                maskIdx[b] = (unsigned char) (9 * uniform());
+            }
+            std::vector<float> ecbA(64), ecbB(64);
+            const int n = psymodel_spread_lines(reference.gfc, which, eb.data(), maskIdx.data(),
+                                                ecbA.data());
+            REQUIRE(psymodel_spread_lines(other.gfc, which, eb.data(), maskIdx.data(), ecbB.data()) == n);
+            mismatches += !std::equal(ecbA.begin(), ecbA.begin() + n, ecbB.begin());
+        }
+        CAPTURE(name);
+        CHECK(mismatches == 0);
+    }
+}
+
+TEST_CASE("mask_add thresholds give the log table's index", "[lame][simd]")
+{
+    // Every float ratio from 1 up to ma_max_i1 = 10^(9/16), where
+    // vbrpsy_mask_add stops taking FAST_LOG10_X, reaches as many of the
+    // SIMD thresholds as the log gives.
+    Session session("c");
+    REQUIRE(session.gfc != nullptr);
+    const float top = 3.6517412725483771f;
+    constexpr int chunk = 1 << 16;
+    std::vector<float> ratio(chunk);
+    std::vector<int> index(chunk), reached(chunk);
+    int mismatches = 0, checked = 0;
+    for (float r = 1.f; r < top;) {
+        int n = 0;
+        for (; n < chunk && r < top; ++n, r = std::nextafter(r, top))
+            ratio[n] = r;
+        psymodel_mask_add_index_lines(session.gfc, ratio.data(), n, index.data(), reached.data());
+        for (int k = 0; k < n; ++k)
+            mismatches += index[k] != reached[k];
+        checked += n;
+    }
+    CAPTURE(checked);
+    CHECK(mismatches == 0);
+}
+
+// Stock best_huffman_divide, run on best_huffman_divide_lines' fields:
+// part2_3_length, big_values, count1, count1bits, count1table_select,
+// table_select[0..2], region0_count, region1_count.
+namespace stock
+{
+enum { part23, bigValues, count1, count1Bits, count1Table, table0, table1, table2, region0, region1 };
+
+// scalefac_band.l at 44.1 kHz
+constexpr int sfbL[23] = { 0,  4,  8,  12, 16,  20,  24,  30,  36,  44,  52, 62,
+                           74, 90, 110, 134, 162, 196, 238, 288, 342, 418, 576 };
+
+struct Divisions
+{
+    int bits[23], div[23], r0Table[23], r1Table[23];
+};
+
+void divideInit(const int* ix, const int* gi, Divisions& d)
+{
+    const int bigv = gi[bigValues];
+    for (int r0 = 0; r0 <= 7 + 15; r0++)
+        d.bits[r0] = 100000;
+    for (int r0 = 0; r0 < 16; r0++) {
+        const int a1 = sfbL[r0 + 1];
+        if (a1 >= bigv)
+            break;
+        int r0bits = 0;
+        const int r0t = choose_table_nonMMX(ix, ix + a1, &r0bits);
+        for (int r1 = 0; r1 < 8; r1++) {
+            const int a2 = sfbL[r0 + r1 + 2];
+            if (a2 >= bigv)
+                break;
+            int bits = r0bits;
+            const int r1t = choose_table_nonMMX(ix + a1, ix + a2, &bits);
+            if (d.bits[r0 + r1] > bits) {
+                d.bits[r0 + r1] = bits;
+                d.div[r0 + r1] = r0;
+                d.r0Table[r0 + r1] = r0t;
+                d.r1Table[r0 + r1] = r1t;
+            }
+        }
+    }
+}
+
+void divideSub(const int* ix, const int* gi2, int* gi, const Divisions& d)
+{
+    const int bigv = gi2[bigValues];
+    for (int r2 = 2; r2 < 22 + 1; r2++) {
+        const int a2 = sfbL[r2];
+        if (a2 >= bigv)
+            break;
+        int bits = d.bits[r2 - 2] + gi2[count1Bits];
+        if (gi[part23] <= bits)
+            break;
+        const int r2t = choose_table_nonMMX(ix + a2, ix + bigv, &bits);
+        if (gi[part23] <= bits)
+            continue;
+        std::copy(gi2, gi2 + 10, gi);
+        gi[part23] = bits;
+        gi[region0] = d.div[r2 - 2];
+        gi[region1] = r2 - 2 - d.div[r2 - 2];
+        gi[table0] = d.r0Table[r2 - 2];
+        gi[table1] = d.r1Table[r2 - 2];
+        gi[table2] = r2t;
+    }
+}
+
+void bestHuffmanDivide(const int* ix, int blockType, int* gi)
+{
+    Divisions d;
+    int gi2[10];
+    std::copy(gi, gi + 10, gi2);
+    if (blockType == 0) {
+        divideInit(ix, gi, d);
+        divideSub(ix, gi2, gi, d);
+    }
+
+    int i = gi2[bigValues];
+    if (i == 0 || (unsigned int) (ix[i - 2] | ix[i - 1]) > 1)
+        return;
+    i = gi[count1] + 2;
+    if (i > 576)
+        return;
+
+    std::copy(gi, gi + 10, gi2);
+    gi2[count1] = i;
+    int a1 = 0, a2 = 0;
+    for (; i > gi2[bigValues]; i -= 4) {
+        const int p = ((ix[i - 4] * 2 + ix[i - 3]) * 2 + ix[i - 2]) * 2 + ix[i - 1];
+        a1 += t32l[p];
+        a2 += t33l[p];
+    }
+    gi2[bigValues] = i;
+    gi2[count1Table] = 0;
+    if (a1 > a2) {
+        a1 = a2;
+        gi2[count1Table] = 1;
+    }
+    gi2[count1Bits] = a1;
+
+    if (blockType == 0)
+        divideSub(ix, gi2, gi, d);
+    else {
+        gi2[part23] = a1;
+        a1 = std::min(sfbL[7 + 1], i);
+        if (a1 > 0)
+            gi2[table0] = choose_table_nonMMX(ix, ix + a1, &gi2[part23]);
+        if (i > a1)
+            gi2[table1] = choose_table_nonMMX(ix + a1, ix + i, &gi2[part23]);
+        if (gi[part23] > gi2[part23])
+            std::copy(gi2, gi2 + 10, gi);
+    }
+}
+
+// machine.h's EQ
+bool eq(float a, float b)
+{
+    return std::abs(a) > std::abs(b) ? std::abs(a - b) <= std::abs(a) * 1e-6f
+                                     : std::abs(a - b) <= std::abs(b) * 1e-6f;
+}
+
+// trancate_smallspectrums' threshold for one band, through a qsort
+float trancateThreshold(std::vector<float> band, float allowedNoise)
+{
+    const int width = (int) band.size();
+    std::sort(band.begin(), band.end());
+    if (eq(band[width - 1], 0))
+        return 0;
+    float threshold = 0;
+    int start = 0;
+    do {
+        int nsame = 1;
+        for (; start + nsame < width; nsame++)
+            if (!eq(band[start], band[start + nsame]))
+                break;
+        const float noise = band[start] * band[start] * nsame;
+        if (allowedNoise < noise) {
+            if (start != 0)
+                threshold = band[start - 1];
+            break;
+        }
+        allowedNoise -= noise;
+        start += nsame;
+    } while (start < width);
+    return threshold;
+}
+} // namespace stock
+
+TEST_CASE("best_huffman_divide picks the stock division", "[lame][huffman]")
+{
+    // Spectra falling off with frequency into a tail of ones, with maxima
+    // for every table group, and on every block type.
+    Session session("c");
+    REQUIRE(session.gfc != nullptr);
+    uint32_t seed = 4242;
+    auto uniform = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0;
+    };
+    std::vector<int> ix(576);
+    int mismatches = 0;
+    for (int rep = 0; rep < 20000; ++rep) {
+        const int blockType = std::vector<int> { 0, 0, 1, 2, 3 }[rep % 5];
+        const double top = std::pow(10.0, 4 * uniform());
+        const double falloff = 20 + 500 * uniform();
+        const int ones = (int) (576 * uniform());
+        const int last = ones + (int) ((576 - ones) * uniform());
+        for (int i = 0; i < 576; ++i) {
+            const double x = i < ones ? top * std::exp(-i / falloff) * uniform() : uniform() * 1.5;
+            ix[i] = i < last ? std::min(ixMax, (int) x) : 0;
+        }
+        int counted[10], divided[10];
+        best_huffman_divide_lines(session.gfc, ix.data(), blockType, counted, divided);
+        stock::bestHuffmanDivide(ix.data(), blockType, counted);
+        mismatches += !std::equal(counted, counted + 10, divided);
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE("trancate_smallspectrums cuts where the stock sort did", "[lame][quantizer]")
+{
+    // Bands of every width with zeros, exact repeats and repeats within
+    // EQ's 1e-6, against allowances from none to the whole band.
+    uint32_t seed = 808;
+    auto uniform = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0;
+    };
+    int mismatches = 0, cuts = 0;
+    for (int rep = 0; rep < 50000; ++rep) {
+        std::vector<float> band(1 + (int) (uniform() * 192));
+        float energy = 0;
+        for (auto& x : band) {
+            const double u = uniform();
+            x = u < 0.2 ? 0.f : (float) (1 + std::floor(uniform() * 8)) * 0.37f;
+            if (u > 0.9)
+                x *= 1 + (float) (uniform() * 2e-6);
+            else if (u > 0.6)
+                x = (float) (uniform() * 4);
+            energy += x * x;
+        }
+        const auto allowed = (float) (energy * uniform() * uniform());
+        const float expected = stock::trancateThreshold(band, allowed);
+        auto scratch = band;
+        const float got = trancate_threshold(scratch.data(), (int) scratch.size(), allowed);
+        mismatches += got != expected;
+        cuts += expected != 0;
+    }
+    CAPTURE(cuts);
+    CHECK(cuts > 10000);
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE("Bitstream writer writes the stock writer's bytes", "[lame][bitstream]")
+{
+    // Granules made up from integers alone, so the bytes don't depend on
+    // the build: escapes, ones regions, every block type, scalefactors and
+    // a reservoir that fills and drains. The hash is of what the stock
+    // byte-at-a-time writer made of them; the frames must also decode.
+    constexpr int frames = 200, granules = frames * 4, sfbMax = 39;
+    uint32_t seed = 2024;
+    auto next = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    std::vector<int> blockTypes(granules), scalefacs(granules * sfbMax), lines(granules * 576);
+    for (int g = 0; g < granules; ++g) {
+        blockTypes[g] = next() % 3 ? 0 : (int) (next() % 4);
+        for (int sfb = 0; sfb < sfbMax; ++sfb)
+            scalefacs[g * sfbMax + sfb] = (int) (next() % 8);
+        const int top = (int) (next() % 2000), falloff = 8 + (int) (next() % 200);
+        const int big = (int) (next() % 577), ones = big + (int) (next() % (577 - big));
+        for (int i = 0; i < 576; ++i) {
+            int x = 0;
+            if (i < big)
+                x = (int) (next() % (top * falloff / (falloff + i) + 1));
+            else if (i < ones)
+                x = (int) (next() % 2);
+            lines[g * 576 + i] = next() % 2 ? -x : x;
+        }
+    }
+
+    Session session("c", [](lame_global_flags* gfp) {
+        lame_set_brate(gfp, 128);
+        lame_set_VBR(gfp, vbr_off);
+        lame_set_bWriteVbrTag(gfp, 0);
+    });
+    REQUIRE(session.gfc != nullptr);
+    std::vector<unsigned char> mp3(frames * 2000);
+    const int bytes = format_bitstream_lines(session.gfc, blockTypes.data(), scalefacs.data(),
+                                             lines.data(), frames, mp3.data(), (int) mp3.size());
+    REQUIRE(bytes > 0);
+
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < bytes; ++i)
+        hash = (hash ^ mp3[i]) * 1099511628211ull;
+    CAPTURE(bytes, hash);
+    CHECK(hash == 0x341cb6630e8806bdull);
+
+    hip_t hip = hip_decode_init();
+    std::vector<short> pcmL(1152 * 8), pcmR(1152 * 8);
+    int decoded = 0;
+    for (int pos = 0; pos < bytes; pos += 1024) {
+        const int n = hip_decode(hip, mp3.data() + pos, std::min(1024, bytes - pos), pcmL.data(),
+                                 pcmR.data());
+        REQUIRE(n >= 0);
+        decoded += n;
+    }
+    hip_decode_exit(hip);
+    CHECK(decoded == 1152 * frames);
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+TEST_CASE("SIMD Huffman counting gives the C counts", "[lame][simd]")
+{
+    // Regions of every length, with maxima that pick each of the noESC
+    // table groups and the ESC tables, up to the IXMAX_VAL cut off.
+    if (!has_AVX2())
+        SKIP("no AVX2");
+    lame_global_flags* gfp = lame_init();
+    REQUIRE(lame_init_params(gfp) == 0);
+
+    uint32_t seed = 97;
+    auto next = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    std::vector<int> ix(576);
+    int mismatches = 0;
+    for (int rep = 0; rep < 20000; ++rep) {
+        const int limit = std::vector<int> { 0, 1, 2, 3, 4, 5, 7, 8, 15, 16, 100, 8206, 9000 }[rep % 13];
+        const int n = 2 + 2 * (int) (next() % 288);
+        for (int i = 0; i < n; ++i)
+            ix[i] = (int) (next() % (next() % 4 ? limit / 4 + 1 : limit + 1));
+        int bitsC = (int) (next() % 100), bitsSimd = bitsC;
+        const int tableC = choose_table_nonMMX(ix.data(), ix.data() + n, &bitsC);
+        const int tableSimd = choose_table_AVX2(ix.data(), ix.data() + n, &bitsSimd);
+        mismatches += tableC != tableSimd || bitsC != bitsSimd;
+    }
+    CHECK(mismatches == 0);
+    lame_close(gfp);
+}
+#endif
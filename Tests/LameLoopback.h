@@ -0,0 +1,264 @@
+#pragma once
+
+// Helpers for driving the modified LAME the same way MP3Processor does:
+// CBR, no bit reservoir, encode -> hip_decode loopback.
+
+#include <lame.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#if defined(__linux__)
+#include <fstream>
+#include <malloc.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#endif
+
+namespace lametest
+{
+
+struct Signal
+{
+    std::vector<float> left;
+    std::vector<float> right;
+
+    size_t size() const { return left.size(); }
+};
+
+// Deterministic programme material: a low tone, a stereo offset tone, a
+// little noise and a few clicks so that short blocks get exercised too.
+inline Signal makeTestSignal(int sampleRate, int numSamples)
+{
+    Signal s;
+    s.left.resize(numSamples);
+    s.right.resize(numSamples);
+    uint32_t seed = 12345;
+    const double twoPi = 6.283185307179586;
+    for (int i = 0; i < numSamples; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = ((seed >> 9) / 8388608.f - 1.f) * 0.02f;
+        const double t = (double) i / sampleRate;
+        float l = 0.3f * (float) std::sin(twoPi * 220.0 * t)
+                + 0.1f * (float) std::sin(twoPi * 1330.0 * t) + noise;
+        float r = 0.3f * (float) std::sin(twoPi * 220.0 * t + 0.4)
+                + 0.1f * (float) std::sin(twoPi * 2470.0 * t) + noise;
+        if (i % 11025 < 32) {
+            const float click = (i % 2 ? 0.4f : -0.4f);
+            l += click;
+            r += click;
+        }
+        s.left[i] = l;
+        s.right[i] = r;
+    }
+    return s;
+}
+
+using Configure = std::function<void(lame_global_flags*)>;
+
+// False for a LAME configured with --enable-fish-minimal, which is built
+// without the LAME tag and ReplayGain.
+inline bool lameHasTags()
+{
+    lame_global_flags* gfp = lame_init();
+    const bool tags = lame_set_bWriteVbrTag(gfp, 1) == 0;
+    lame_close(gfp);
+    return tags;
+}
+
+// Resident set size of this process in bytes, or 0 where we can't ask.
+inline size_t residentBytes()
+{
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * (size_t) sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+#else
+    return 0;
+#endif
+}
+
+// Puts the heap back the way a fresh process has it, as far as
+// residentBytes() can tell: free pages go back to the system, and large
+// blocks come straight from it again (glibc raises its mmap threshold as
+// big blocks are freed, and then hands out used pages it has to clear).
+inline void freshHeap()
+{
+#if defined(__linux__) && defined(__GLIBC__)
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+    malloc_trim(0);
+#elif defined(__APPLE__)
+    malloc_zone_pressure_relief(nullptr, 0);
+#endif
+}
+
+// Caps the kernels LAME picks (LAME_SIMD) for encoders set up while this
+// is in scope.
+class ScopedSimdLevel
+{
+public:
+    explicit ScopedSimdLevel(const char* level) { set(level); }
+    ~ScopedSimdLevel() { set(""); }
+
+private:
+    static void set(const char* level)
+    {
+#ifdef _WIN32
+        _putenv_s("LAME_SIMD", level);
+#else
+        setenv("LAME_SIMD", level, 1);
+#endif
+    }
+};
+
+// Feeds n samples to the encoder through lame_encode_acquire/commit_ieee_float,
+// the way MP3Processor::addNextInput does. Returns the mp3 bytes, or < 0.
+inline int encodeThroughWindow(lame_global_flags* gfp, const float* left, const float* right,
+                               int n, unsigned char* mp3, int mp3Size)
+{
+    int bytes = 0;
+    for (int done = 0; done < n;) {
+        float* l = nullptr;
+        float* r = nullptr;
+        const int room = lame_encode_acquire_ieee_float(gfp, &l, &r);
+        if (room < 0) {
+            return room;
+        }
+        const int k = std::min(room, n - done);
+        std::copy(left + done, left + done + k, l);
+        std::copy(right + done, right + done + k, r);
+        const int ret = lame_encode_commit_ieee_float(gfp, k, mp3 + bytes, mp3Size - bytes);
+        if (ret < 0) {
+            return ret;
+        }
+        bytes += ret;
+        done += k;
+    }
+    return bytes;
+}
+
+// Runs input through LAME and back, with the same settings as
+// MP3Processor::init. configure is called just before lame_init_params,
+// lowpass (Hz, 0 leaves LAME's choice) goes in with the fish amount.
+// throughWindow feeds the encoder with encodeThroughWindow rather than
+// lame_encode_buffer_ieee_float.
+inline Signal loopback(const Signal& input, int sampleRate, float fish,
+                       const Configure& configure = {}, int blockSize = 512,
+                       int lowpass = 0, bool throughWindow = false)
+{
+    Signal out;
+    lame_global_flags* gfp = lame_init();
+    if (gfp == nullptr) {
+        return out;
+    }
+    lame_set_in_samplerate(gfp, sampleRate);
+    lame_set_out_samplerate(gfp, sampleRate);
+    lame_set_brate(gfp, 96);
+    lame_set_VBR(gfp, vbr_off);
+    lame_set_disable_reservoir(gfp, 1);
+    lame_set_fish_session(gfp, FISH_SESSION_STREAM);
+    lame_set_fish_arena(gfp, 1);
+    if (configure) {
+        configure(gfp);
+    }
+    if (lame_init_params(gfp) != 0) {
+        lame_close(gfp);
+        return out;
+    }
+    lame_change_bitrate_midstream(gfp, lowpass, fish);
+
+    hip_t hip = hip_decode_init();
+    std::vector<unsigned char> mp3(blockSize * 5 / 4 + 7200);
+    std::vector<short> pcmL(8192), pcmR(8192);
+
+    for (size_t pos = 0; pos < input.size(); pos += blockSize) {
+        const int n = (int) std::min<size_t>(blockSize, input.size() - pos);
+        const int bytes = throughWindow
+            ? encodeThroughWindow(gfp, input.left.data() + pos, input.right.data() + pos, n,
+                                  mp3.data(), (int) mp3.size())
+            : lame_encode_buffer_ieee_float(gfp, input.left.data() + pos,
+                                            input.right.data() + pos, n,
+                                            mp3.data(), (int) mp3.size());
+        if (bytes < 0) {
+            break;
+        }
+        const int decoded = hip_decode(hip, mp3.data(), bytes, pcmL.data(), pcmR.data());
+        for (int i = 0; i < decoded; ++i) {
+            out.left.push_back(pcmL[i] / 32767.f);
+            out.right.push_back(pcmR[i] / 32767.f);
+        }
+    }
+
+    hip_decode_exit(hip);
+    lame_close(gfp);
+    return out;
+}
+
+inline double rmsDb(const std::vector<float>& x, size_t from = 0)
+{
+    double sum = 0;
+    for (size_t i = from; i < x.size(); ++i) {
+        sum += (double) x[i] * x[i];
+    }
+    const double n = (double) std::max<size_t>(1, x.size() - std::min(from, x.size()));
+    return 10.0 * std::log10(sum / n + 1e-20);
+}
+
+// Level of a single frequency in x, in dB relative to a full scale sine.
+inline double toneDb(const std::vector<float>& x, double freq, int sampleRate, size_t from = 0)
+{
+    const double w = 6.283185307179586 * freq / sampleRate;
+    double re = 0, im = 0;
+    for (size_t i = from; i < x.size(); ++i) {
+        re += x[i] * std::cos(w * (double) i);
+        im -= x[i] * std::sin(w * (double) i);
+    }
+    const double n = (double) std::max<size_t>(1, x.size() - std::min(from, x.size()));
+    return 20.0 * std::log10(2.0 * std::sqrt(re * re + im * im) / n + 1e-20);
+}
+
+// SNR of test against ref in dB, after finding the codec delay by
+// searching lags up to maxLag.
+inline double alignedSnrDb(const std::vector<float>& ref, const std::vector<float>& test,
+                           int maxLag = 3000, size_t skip = 4096)
+{
+    if (test.size() <= skip + (size_t) maxLag || ref.size() <= skip) {
+        return -100.0;
+    }
+    const size_t n = std::min(ref.size(), test.size() - maxLag) - skip;
+    int bestLag = 0;
+    double best = -1e300;
+    for (int lag = 0; lag <= maxLag; ++lag) {
+        double c = 0;
+        for (size_t i = skip; i < skip + n; i += 4) {
+            c += (double) ref[i] * test[i + lag];
+        }
+        if (c > best) {
+            best = c;
+            bestLag = lag;
+        }
+    }
+    double sig = 0, err = 0;
+    for (size_t i = skip; i < skip + n; ++i) {
+        const double d = (double) test[i + bestLag] - ref[i];
+        sig += (double) ref[i] * ref[i];
+        err += d * d;
+    }
+    return 10.0 * std::log10((sig + 1e-20) / (err + 1e-20));
+}
+
+} // namespace lametest